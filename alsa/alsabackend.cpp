@@ -29,7 +29,6 @@
 #include <KPluginFactory>
 #include <KPluginLoader>
 #include <KStandardDirs>
-#include <KMessageBox>
 #include <KLocale>
 #include <QWidget>
 #include <sched.h>
@@ -57,6 +56,7 @@ namespace KMid {
         }
 
         bool m_initialized;
+        QString m_initializationError;
         QString m_backendString;
         ALSAMIDIObject *m_object;
         ALSAMIDIOutput *m_output;
@@ -75,20 +75,21 @@ namespace KMid {
             d->m_object->initialize(d->m_output);
             d->m_initialized = true;
         } catch (const SequencerError& ex) {
-            QString errorstr = i18nc("@info","Fatal error from the ALSA sequencer backend. "
+            d->m_initializationError = i18nc("@info","Fatal error from the ALSA sequencer backend. "
                 "This usually happens when the kernel does not have ALSA support, "
                 "the device node (/dev/snd/seq) does not exist, "
                 "or the kernel module (snd_seq) is not loaded. "
                 "Please check your ALSA/MIDI configuration. "
                 "Returned error was: %1", ex.qstrError());
-            KMessageBox::error(0, errorstr, i18nc("@title:window","ALSA Sequencer Backend Error"));
         } catch (...) {
-        	qDebug() << "Fatal error from the ALSA sequencer backend. "
-            "This usually happens when the kernel does not have ALSA support, "
-            "the device node (/dev/snd/seq) does not exist, "
-            "or the kernel module (snd_seq) is not loaded. "
-            "Please check your ALSA/MIDI configuration. ";
+            d->m_initializationError = i18nc("@info","Fatal error from the ALSA sequencer backend. "
+                "This usually happens when the kernel does not have ALSA support, "
+                "the device node (/dev/snd/seq) does not exist, "
+                "or the kernel module (snd_seq) is not loaded. "
+                "Please check your ALSA/MIDI configuration.");
         }
+        if (!d->m_initialized)
+            qDebug() << d->m_initializationError;
     }
 
     ALSABackend::~ALSABackend()
@@ -101,6 +102,11 @@ namespace KMid {
         return d->m_initialized;
     }
 
+    QString ALSABackend::initializationError()
+    {
+        return d->m_initializationError;
+    }
+
     QString ALSABackend::backendName()
     {
         return d->m_backendString;
@@ -36,6 +36,7 @@ namespace KMid {
             virtual MIDIObject *midiObject();
             virtual MIDIOutput *midiOutput();
             virtual bool initialized();
+            virtual QString initializationError();
 
             virtual bool hasSoftSynths();
             virtual void setupConfigurationWidget(QWidget* widget);
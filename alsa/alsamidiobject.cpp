@@ -21,18 +21,24 @@
 #include "alsamidioutput.h"
 #include "song.h"
 #include "player.h"
+#include "songloader.h"
+#include "songcache.h"
+#include "latencystats.h"
 
 #include <cmath>
-#include <qsmf.h>
 #include <alsaevent.h>
 #include <alsaqueue.h>
 
-#include <KIO/NetAccess>
+#include <KIO/Job>
+#include <KStandardDirs>
+#include <KUrl>
+#include <KDebug>
+#include <QHash>
 #include <QTextStream>
 #include <QTextCodec>
 #include <QTime>
-#include <QMutex>
-#include <QMutexLocker>
+#include <QTimer>
+#include <QElapsedTimer>
 
 using namespace drumstick;
 
@@ -44,34 +50,34 @@ namespace KMid {
             m_out(0),
             m_client(0),
             m_port(0),
+            m_outputPort(0),
             m_queue(0),
             m_player(0),
-            m_engine(0),
+            m_loader(0),
+            m_preloader(0),
+            m_cache(0),
+            m_gapTimer(0),
+            m_downloadJob(0),
             m_codec(0),
             m_state(BufferingState),
             m_portId(-1),
             m_queueId(-1),
             m_clientId(-1),
-            m_initialTempo(0),
             m_playlistIndex(-1),
+            m_songGap(0),
+            m_batchWindow(20),
+            m_lastGap(-1),
             m_tempoFactor(1.0),
             m_lastTempo(0),
-            m_tick(0),
-            m_duration(0),
-            m_lastBeat(0),
-            m_beatLength(0),
-            m_beatMax(0),
-            m_barCount(0),
-            m_beatCount(0),
-            m_lowestMidiNote(127),
-            m_highestMidiNote(0)
-        {
-            for(int i=0; i<MIDI_CHANNELS; ++i) {
-                m_channelUsed[i] = false;
-                m_channelEvents[i] = 0;
-                m_channelPatches[i] = -1;
-            }
-        }
+            m_directOutput(true),
+            m_monitorEvents(true),
+            m_queueStatus(0),
+            m_usecPerTick(0),
+            m_lastEchoTick(0),
+            m_lastEchoTime(-1),
+            m_anchorTick(0),
+            m_anchorClock(-1)
+        { }
 
         virtual ~ALSAMIDIObjectPrivate()
         {
@@ -81,7 +87,12 @@ namespace KMid {
                     m_port->detach();
                 m_client->close();
             }
+            delete m_loader;
+            delete m_preloader;
+            delete m_cache;
             delete m_player;
+            if (m_queueStatus != NULL)
+                snd_seq_queue_status_free(m_queueStatus);
         }
 
         void setQueueTempo() {
@@ -89,69 +100,110 @@ namespace KMid {
             m_queue->stop();
             QueueTempo firstTempo = m_queue->getTempo();
             firstTempo.setPPQ(m_song.getDivision());
-            firstTempo.setTempo(m_initialTempo);
+            firstTempo.setTempo(m_song.getInitialTempo());
             firstTempo.setTempoFactor(m_tempoFactor);
             m_queue->setTempo(firstTempo);
             m_client->drainOutput();
         }
 
+        /**
+         * Sends a song event received by the loopback port to the output,
+         * unless the player has already scheduled it to the output device.
+         */
+        void sendEvent(const snd_seq_event_t *ev)
+        {
+            if (m_player->output() == NULL) {
+                SequencerEvent event(const_cast<snd_seq_event_t*>(ev));
+                m_out->sendEvent(&event);
+            }
+        }
+
+        /**
+         * Records how late an event has been handled. The loopback port
+         * stamps the events with the queue position when they are delivered,
+         * which is compared with the queue position now. The queue status is
+         * only read for the echo events, which anchor the queue position to
+         * the monotonic clock; for the other events the position is the
+         * anchor plus the clock time elapsed since, so there is no system
+         * call per event. The intervals between echo events are compared
+         * with the queue real time too, measuring the jitter of the input
+         * thread. It uses a preallocated status record, so nothing is
+         * allocated.
+         */
+        void recordLateness(const snd_seq_event_t *ev)
+        {
+            if (m_usecPerTick <= 0)
+                return;
+            qint64 clock = m_clock.nsecsElapsed() / 1000;
+            if (ev->type == SND_SEQ_EVENT_ECHO) {
+                if (snd_seq_get_queue_status(m_client->getHandle(), m_queueId, m_queueStatus) < 0)
+                    return;
+                const snd_seq_real_time_t *rt = snd_seq_queue_status_get_real_time(m_queueStatus);
+                qint64 now = rt->tv_sec * Q_INT64_C(1000000) + rt->tv_nsec / 1000;
+                if (m_lastEchoTime >= 0 && ev->time.tick > m_lastEchoTick) {
+                    qint64 expected = qint64((ev->time.tick - m_lastEchoTick) * m_usecPerTick);
+                    m_stats.record(LatencyStats::Jitter, qAbs(now - m_lastEchoTime - expected));
+                }
+                m_lastEchoTick = ev->time.tick;
+                m_lastEchoTime = now;
+                m_anchorTick = snd_seq_queue_status_get_tick_time(m_queueStatus);
+                m_anchorClock = clock;
+            } else if (m_anchorClock < 0) {
+                return;
+            }
+            qint64 position = qint64(m_anchorTick * m_usecPerTick) + clock - m_anchorClock;
+            qint64 stamp = qint64(ev->time.tick * m_usecPerTick);
+            if (position >= stamp)
+                m_stats.recordEvent(ev->type, position - stamp);
+        }
+
         ALSAMIDIOutput *m_out;
         MidiClient *m_client;
         MidiPort *m_port;
+        MidiPort *m_outputPort;
         MidiQueue *m_queue;
         Player* m_player;
-        QSmf *m_engine;
+        SongLoader* m_loader;
+        SongLoader* m_preloader;
+        SongCache* m_cache;
+        QTimer* m_gapTimer;
+        KIO::StoredTransferJob* m_downloadJob;
         QTextCodec *m_codec;
 
         State m_state;
         int m_portId;
         int m_queueId;
         int m_clientId;
-        int m_initialTempo;
         int m_playlistIndex;
+        int m_songGap;
+        int m_batchWindow;
+        qint64 m_lastGap;
+        QElapsedTimer m_gapTime;
         qreal m_tempoFactor;
         qreal m_lastTempo;
-        qint64 m_tick;
         Song m_song;
         QStringList m_loadingMessages;
         QStringList m_playList;
         QString m_encoding;
-        qreal m_duration;
-        qint64 m_lastBeat;
-        qint64 m_beatLength;
-        int m_beatMax;
-        int m_barCount;
-        int m_beatCount;
-        int m_lowestMidiNote;
-        int m_highestMidiNote;
-        bool m_channelUsed[MIDI_CHANNELS];
-        QMutex m_openMutex;
-        int m_channelEvents[MIDI_CHANNELS];
-        QByteArray m_trackLabel;
-        QByteArray m_channelLabel[MIDI_CHANNELS];
-        int m_channelPatches[MIDI_CHANNELS];
+        QString m_loadingFile;
+        bool m_directOutput;
+        bool m_monitorEvents;
+        LatencyStats m_stats;
+        snd_seq_queue_status_t *m_queueStatus;
+        qreal m_usecPerTick;
+        snd_seq_tick_time_t m_lastEchoTick;
+        qint64 m_lastEchoTime;
+        snd_seq_tick_time_t m_anchorTick;
+        qint64 m_anchorClock;
+        QElapsedTimer m_clock;
     };
 
     ALSAMIDIObject::ALSAMIDIObject(QObject *parent) : MIDIObject(parent),
         d(new ALSAMIDIObjectPrivate)
     {
-        d->m_engine = new QSmf(this);
-        connect(d->m_engine, SIGNAL(signalSMFHeader(int,int,int)), SLOT(headerEvent(int,int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFNoteOn(int,int,int)), SLOT(noteOnEvent(int,int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFNoteOff(int,int,int)), SLOT(noteOffEvent(int,int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFKeyPress(int,int,int)), SLOT(keyPressEvent(int,int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFCtlChange(int,int,int)), SLOT(ctlChangeEvent(int,int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFPitchBend(int,int)), SLOT(pitchBendEvent(int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFProgram(int,int)), SLOT(programEvent(int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFChanPress(int,int)), SLOT(chanPressEvent(int,int)));
-        connect(d->m_engine, SIGNAL(signalSMFSysex(const QByteArray&)), SLOT(sysexEvent(const QByteArray&)));
-        connect(d->m_engine, SIGNAL(signalSMFMetaMisc(int,const QByteArray&)), SLOT(metaEvent(int,const QByteArray&)));
-        connect(d->m_engine, SIGNAL(signalSMFTempo(int)), SLOT(tempoEvent(int)));
-        connect(d->m_engine, SIGNAL(signalSMFTrackStart()), SLOT(slotTrackStart()));
-        connect(d->m_engine, SIGNAL(signalSMFTrackEnd()), SLOT(slotTrackEnd()));
-        connect(d->m_engine, SIGNAL(signalSMFendOfTrack()), SLOT(endOfTrackEvent()));
-        connect(d->m_engine, SIGNAL(signalSMFError(const QString&)), SLOT(errorHandler(const QString&)));
-        connect(d->m_engine, SIGNAL(signalSMFTimeSig(int,int,int,int)), SLOT(timeSigEvent(int,int,int,int)));
+        d->m_gapTimer = new QTimer(this);
+        d->m_gapTimer->setSingleShot(true);
+        connect( d->m_gapTimer, SIGNAL(timeout()), SLOT(nextSong()) );
     }
 
     ALSAMIDIObject::~ALSAMIDIObject()
@@ -178,97 +230,135 @@ namespace KMid {
         d->m_port->setTimestampReal(false);
         d->m_port->setTimestampQueue(d->m_queueId);
         d->m_port->subscribeFromAnnounce();
+        d->m_outputPort = d->m_client->createPort();
+        d->m_outputPort->setPortName("output");
+        d->m_outputPort->setCapability( SND_SEQ_PORT_CAP_READ |
+                                        SND_SEQ_PORT_CAP_NO_EXPORT );
+        d->m_outputPort->setPortType( SND_SEQ_PORT_TYPE_APPLICATION |
+                                      SND_SEQ_PORT_TYPE_MIDI_GENERIC );
+        connect( d->m_out, SIGNAL(outputDeviceChanged(const QString&)),
+                 SLOT(outputDeviceChanged(const QString&)) );
+        outputDeviceChanged(d->m_out->outputDeviceName());
+        connect( d->m_out, SIGNAL(transformChanged()), SLOT(rescheduleEvents()) );
         d->m_player = new Player(d->m_client, d->m_portId);
         connect( d->m_player, SIGNAL(finished()),
                  SLOT(songFinished()), Qt::QueuedConnection );
         connect( d->m_player, SIGNAL(stopped()),
                  d->m_out, SLOT(allNotesOff()), Qt::QueuedConnection );
-        d->m_client->setHandler(this);
+        d->m_cache = new SongCache(KStandardDirs::locateLocal("appdata", "songcache/", true));
+        d->m_loader = new SongLoader(d->m_clientId, d->m_portId, d->m_queueId);
+        d->m_loader->setCache(d->m_cache);
+        connect( d->m_loader, SIGNAL(progress(int)), SIGNAL(loadProgress(int)) );
+        connect( d->m_loader, SIGNAL(finished()), SLOT(loadFinished()) );
+        d->m_preloader = new SongLoader(d->m_clientId, d->m_portId, d->m_queueId);
+        d->m_preloader->setCache(d->m_cache);
+        connect( d->m_preloader, SIGNAL(finished()), SLOT(preloadFinished()) );
+        snd_seq_queue_status_malloc(&d->m_queueStatus);
+        d->m_client->setRawHandler(this);
         d->m_client->startSequencerInput();
     }
 
-    void ALSAMIDIObject::handleSequencerEvent(SequencerEvent* ev)
+    static inline MIDIEventRecord eventRecord(int type, int channel, int data1,
+                                              int data2 = 0, int value = 0)
     {
-        if ( !SequencerEvent::isConnectionChange(ev) &&
-             (d->m_state == PlayingState) )
-            switch(ev->getSequencerType()) {
-            case SND_SEQ_EVENT_ECHO: {
-                    emit tick(ev->getTick());
-                    qreal rtempo = currentTempo();
-                    if (rtempo != d->m_lastTempo) {
-                        emit tempoChanged(rtempo);
-                        d->m_lastTempo = rtempo;
-                    }
-                }
-                break;
-            case SND_SEQ_EVENT_USR8:
-                emit beat(ev->getRaw32(0), ev->getRaw8(4), ev->getRaw8(5));
-                break;
-            case SND_SEQ_EVENT_TIMESIGN:
-                emit timeSignatureChanged(ev->getRaw8(0), ::pow(2, ev->getRaw8(1)));
-                break;
-            case SND_SEQ_EVENT_USR_VAR0: {
-                    VariableEvent *ve = static_cast<VariableEvent*>(ev);
-                    if (ve != NULL && ve->getData() != NULL && ve->getLength() > 0) {
-                        QByteArray ba(ve->getData(), ve->getLength());
-                        QString s;
-                        if (d->m_codec == NULL)
-                            s = QString::fromAscii(ba);
-                        else
-                            s = d->m_codec->toUnicode(ba);
-                        s.remove(QRegExp("[/\\\\]+"));
-                        s.remove(QRegExp("[\r\n]+"));
-                        emit midiText(Song::Lyric, s);
-                    }
-                }
-                break;
-            case SND_SEQ_EVENT_NOTEOFF: {
-                    d->m_out->sendEvent(ev);
-                    const NoteOffEvent* n = static_cast<const NoteOffEvent*>(ev);
-                    emit midiNoteOff(n->getChannel(), n->getKey(), n->getVelocity());
-                }
-                break;
-            case SND_SEQ_EVENT_NOTEON: {
-                    d->m_out->sendEvent(ev);
-                    const NoteOnEvent* n = static_cast<const NoteOnEvent*>(ev);
-                    emit midiNoteOn(n->getChannel(), n->getKey(), n->getVelocity());
-                }
-                break;
-            case SND_SEQ_EVENT_KEYPRESS: {
-                    d->m_out->sendEvent(ev);
-                    const KeyPressEvent* n = static_cast<const KeyPressEvent*>(ev);
-                    emit midiKeyPressure(n->getChannel(), n->getKey(), n->getVelocity());
-                }
-                break;
-            case SND_SEQ_EVENT_CONTROLLER:
-            case SND_SEQ_EVENT_CONTROL14: {
-                    d->m_out->sendEvent(ev);
-                    const ControllerEvent* n = static_cast<const ControllerEvent*>(ev);
-                    emit midiController(n->getChannel(), n->getParam(), n->getValue());
-                }
-                break;
-            case SND_SEQ_EVENT_PGMCHANGE: {
-                    d->m_out->sendEvent(ev);
-                    const ProgramChangeEvent* p = static_cast<const ProgramChangeEvent*>(ev);
-                    emit midiProgram(p->getChannel(), p->getValue());
-                }
-                break;
-            case SND_SEQ_EVENT_CHANPRESS: {
-                    d->m_out->sendEvent(ev);
-                    const ChanPressEvent* n = static_cast<const ChanPressEvent*>(ev);
-                    emit midiChannelPressure(n->getChannel(), n->getValue());
-                }
-                break;
-            case SND_SEQ_EVENT_PITCHBEND: {
-                    d->m_out->sendEvent(ev);
-                    const PitchBendEvent* n = static_cast<const PitchBendEvent*>(ev);
-                    emit midiPitchBend(n->getChannel(), n->getValue());
+        MIDIEventRecord record;
+        record.type = type;
+        record.channel = channel;
+        record.data1 = data1;
+        record.data2 = data2;
+        record.value = value;
+        return record;
+    }
+
+    /**
+     * Handles the events received by the loopback port, in the input thread.
+     * Nothing is allocated here, except for the lyrics text.
+     */
+    void ALSAMIDIObject::handleRawEvent(const snd_seq_event_t* ev)
+    {
+        if (d->m_state != PlayingState)
+            return;
+        if (d->m_stats.isEnabled())
+            d->recordLateness(ev);
+        switch(ev->type) {
+        case SND_SEQ_EVENT_ECHO: {
+                emit tick(ev->time.tick);
+                qreal rtempo = currentTempo();
+                if (rtempo != d->m_lastTempo) {
+                    emit tempoChanged(rtempo);
+                    d->m_lastTempo = rtempo;
+                    if (rtempo > 0)
+                        d->m_usecPerTick = 6e7 / (rtempo * d->m_song.getDivision());
                 }
-                break;
-            default:
-                d->m_out->sendEvent(ev);
             }
-        delete ev;
+            break;
+        case SND_SEQ_EVENT_USR8:
+            emit beat(ev->data.raw32.d[0], ev->data.raw8.d[4], ev->data.raw8.d[5]);
+            break;
+        case SND_SEQ_EVENT_TIMESIGN:
+            emit timeSignatureChanged(ev->data.raw8.d[0], ::pow(2, ev->data.raw8.d[1]));
+            break;
+        case SND_SEQ_EVENT_USR_VAR0:
+            if (ev->data.ext.ptr != NULL && ev->data.ext.len > 0) {
+                QByteArray ba(static_cast<const char*>(ev->data.ext.ptr), ev->data.ext.len);
+                QString s;
+                if (d->m_codec == NULL)
+                    s = QString::fromAscii(ba);
+                else
+                    s = d->m_codec->toUnicode(ba);
+                static const QRegExp separators("[/\\\\\r\n]+");
+                s.remove(separators);
+                emit midiText(Song::Lyric, s, ev->time.tick);
+            }
+            break;
+        case SND_SEQ_EVENT_NOTEOFF:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::NoteOff, ev->data.note.channel,
+                                  ev->data.note.note, ev->data.note.velocity));
+            break;
+        case SND_SEQ_EVENT_NOTEON:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::NoteOn, ev->data.note.channel,
+                                  ev->data.note.note, ev->data.note.velocity));
+            break;
+        case SND_SEQ_EVENT_KEYPRESS:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::KeyPressure, ev->data.note.channel,
+                                  ev->data.note.note, ev->data.note.velocity));
+            break;
+        case SND_SEQ_EVENT_CONTROLLER:
+        case SND_SEQ_EVENT_CONTROL14:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::Controller, ev->data.control.channel,
+                                  ev->data.control.param, 0, ev->data.control.value));
+            break;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::Program, ev->data.control.channel,
+                                  ev->data.control.value));
+            break;
+        case SND_SEQ_EVENT_CHANPRESS:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::ChannelPressure, ev->data.control.channel,
+                                  ev->data.control.value));
+            break;
+        case SND_SEQ_EVENT_PITCHBEND:
+            d->sendEvent(ev);
+            midiEvent(eventRecord(MIDIEventRecord::PitchBend, ev->data.control.channel,
+                                  0, 0, ev->data.control.value));
+            break;
+        case SND_SEQ_EVENT_PORT_START:
+        case SND_SEQ_EVENT_PORT_EXIT:
+        case SND_SEQ_EVENT_PORT_CHANGE:
+        case SND_SEQ_EVENT_CLIENT_START:
+        case SND_SEQ_EVENT_CLIENT_EXIT:
+        case SND_SEQ_EVENT_CLIENT_CHANGE:
+        case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+        case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+            break;
+        default:
+            d->sendEvent(ev);
+        }
     }
 
     State ALSAMIDIObject::state() const
@@ -278,7 +368,7 @@ namespace KMid {
 
     qint32 ALSAMIDIObject::tickInterval() const
     {
-        return d->m_player->getEchoResolution();
+        return d->m_player->echoResolution();
     }
 
     qint64 ALSAMIDIObject::currentTime() const
@@ -288,7 +378,7 @@ namespace KMid {
 
     qreal ALSAMIDIObject::duration() const
     {
-        return d->m_duration;
+        return d->m_song.getDuration();
     }
 
     qint64 ALSAMIDIObject::remainingTime() const
@@ -303,41 +393,48 @@ namespace KMid {
         return d->m_loadingMessages.join(QString(QChar::LineSeparator));
     }
 
+    /**
+     * Table of the meta data keys and their song text types
+     */
+    static QHash<QString, Song::TextType> metaDataTypes()
+    {
+        static const struct {
+            const char *key;
+            Song::TextType type;
+        } table[] = {
+            { "SMF_TEXT", Song::Text },
+            { "SMF_COPYRIGHT", Song::Copyright },
+            { "SMF_TRACKNAMES", Song::TrackName },
+            { "SMF_INSTRUMENTNAMES", Song::InstrumentName },
+            { "SMF_LYRICS", Song::Lyric },
+            { "SMF_MARKERS", Song::Marker },
+            { "SMF_CUES", Song::Cue },
+            { "KAR_FILETYPE", Song::KarFileType },
+            { "KAR_VERSION", Song::KarVersion },
+            { "KAR_INFORMATION", Song::KarInformation },
+            { "KAR_LANGUAGE", Song::KarLanguage },
+            { "KAR_TITLES", Song::KarTitles },
+            { "KAR_WARNINGS", Song::KarWarnings }
+        };
+        QHash<QString, Song::TextType> types;
+        for (unsigned int i = 0; i < sizeof(table)/sizeof(table[0]); ++i)
+            types.insert(QLatin1String(table[i].key), table[i].type);
+        return types;
+    }
+
     QStringList ALSAMIDIObject::metaData(const QString & key) const
     {
-        if (key == "SMF_TEXT")
-            return d->m_song.getText(Song::Text);
-        else if (key == "SMF_COPYRIGHT")
-            return d->m_song.getText(Song::Copyright);
-        else if (key == "SMF_TRACKNAMES")
-            return d->m_song.getText(Song::TrackName);
-        else if (key == "SMF_INSTRUMENTNAMES")
-            return d->m_song.getText(Song::InstrumentName);
-        else if (key == "SMF_LYRICS")
-            return d->m_song.getText(Song::Lyric);
-        else if (key == "SMF_MARKERS")
-            return d->m_song.getText(Song::Marker);
-        else if (key == "SMF_CUES")
-            return d->m_song.getText(Song::Cue);
-        else if (key == "KAR_FILETYPE")
-            return d->m_song.getText(Song::KarFileType);
-        else if (key == "KAR_VERSION")
-            return d->m_song.getText(Song::KarVersion);
-        else if (key == "KAR_INFORMATION")
-            return d->m_song.getText(Song::KarInformation);
-        else if (key == "KAR_LANGUAGE")
-            return d->m_song.getText(Song::KarLanguage);
-        else if (key == "KAR_TITLES")
-            return d->m_song.getText(Song::KarTitles);
-        else if (key == "KAR_WARNINGS")
-            return d->m_song.getText(Song::KarWarnings);
+        static const QHash<QString, Song::TextType> types = metaDataTypes();
+        QHash<QString, Song::TextType>::const_iterator it = types.constFind(key);
+        if (it != types.constEnd())
+            return d->m_song.getText(it.value());
         return QStringList();
     }
 
     qint64 ALSAMIDIObject::totalTime() const
     {
         if (d->m_song.isEmpty()) return 0;
-        return d->m_song.last()->getTick();
+        return d->m_song.getLastTick();
     }
 
     QString ALSAMIDIObject::currentSource() const
@@ -348,6 +445,7 @@ namespace KMid {
 
     void ALSAMIDIObject::setCurrentSource(const QString &source)
     {
+        d->m_gapTimer->stop();
         if (d->m_playList.contains(source)) {
             d->m_playlistIndex = d->m_playList.indexOf(source);
         } else {
@@ -411,16 +509,31 @@ namespace KMid {
 
     void ALSAMIDIObject::play()
     {
+        d->m_gapTimer->stop();
         if (!d->m_song.isEmpty() && !d->m_player->isRunning()) {
+            if (d->m_gapTime.isValid()) {
+                d->m_lastGap = d->m_gapTime.elapsed();
+                d->m_gapTime.invalidate();
+                kDebug() << "gap between songs:" << d->m_lastGap << "ms";
+            }
             if (currentTime() == 0) {
-                if (d->m_initialTempo != 0)
+                if (d->m_song.getInitialTempo() != 0)
                     d->setQueueTempo();
+                d->m_out->beginBatch();
                 d->m_out->sendResetMessage();
                 d->m_out->resetControllers();
                 sendInitialProgramChanges();
-                d->m_lastBeat = 0;
+                d->m_out->commitBatch();
                 d->m_lastTempo = 0;
             }
+            d->m_player->setOutput(d->m_directOutput ? d->m_out : 0,
+                                   d->m_outputPort->getPortId());
+            d->m_player->setMonitor(d->m_monitorEvents);
+            d->m_player->setBatchWindow(
+                    d->m_song.ticksWithin(d->m_batchWindow * d->m_tempoFactor));
+            d->m_lastEchoTime = -1;
+            d->m_anchorClock = -1;
+            d->m_clock.start();
             d->m_player->start();
             updateState( PlayingState );
         }
@@ -438,6 +551,8 @@ namespace KMid {
 
     void ALSAMIDIObject::stop()
     {
+        d->m_gapTimer->stop();
+        d->m_gapTime.invalidate();
         if (d->m_player->isRunning() || (d->m_state == PausedState)) {
             updateState( StoppedState );
             d->m_player->stop();
@@ -446,15 +561,14 @@ namespace KMid {
             d->m_player->resetPosition();
             d->m_queue->setTickPosition(0);
             d->m_client->drainOutput();
-            d->m_lastBeat = 0;
             emit tick(0);
         }
     }
 
     void ALSAMIDIObject::seek(qint64 time)
     {
-        if ( !(time < 0) && !d->m_song.empty() &&
-             (time < d->m_song.last()->getTick()) ) {
+        if ( !(time < 0) && !d->m_song.isEmpty() &&
+             (time < d->m_song.getLastTick()) ) {
             bool running = (d->m_state == PlayingState);
             if (running) {
                 d->m_player->stop();
@@ -462,6 +576,7 @@ namespace KMid {
             }
             d->m_player->setPosition(time);
             d->m_queue->setTickPosition(time);
+            chaseState(time);
             if (running) {
                 d->m_player->start();
                 updateState( PlayingState );
@@ -469,8 +584,29 @@ namespace KMid {
         }
     }
 
+    /**
+     * Schedules again the song events already queued to the output device,
+     * after a change of the output transformations. They were transformed
+     * when the player scheduled them, up to several seconds in advance, so
+     * they are removed from the queue and scheduled again from the current
+     * position, like seek() does. Otherwise a change of mute, volume or
+     * program lock would be heard late, and a transposition would leave
+     * note offs shifted differently than their note ons.
+     */
+    void ALSAMIDIObject::rescheduleEvents()
+    {
+        if (d->m_state == PlayingState && d->m_player->output() != NULL) {
+            d->m_player->stop();
+            qint64 time = d->m_queue->getStatus().getTickTime();
+            d->m_player->setPosition(time);
+            chaseState(time);
+            d->m_player->start();
+        }
+    }
+
     void ALSAMIDIObject::clear()
     {
+        cancelLoad();
         d->m_song.clear();
         clearQueue();
     }
@@ -486,243 +622,242 @@ namespace KMid {
         }
     }
 
-    void ALSAMIDIObject::appendEvent(SequencerEvent* ev)
-    {
-        unsigned long tick = d->m_engine->getCurrentTime();
-        ev->setSource(d->m_portId);
-        ev->scheduleTick(d->m_queueId, tick, false);
-        if (ev->getSequencerType() != SND_SEQ_EVENT_TEMPO)
-            ev->setDestination(d->m_clientId, d->m_portId);
-        d->m_song.append(ev);
-        updateLoadProgress();
-    }
-
-    void ALSAMIDIObject::headerEvent(int format, int ntrks, int division)
-    {
-        d->m_song.setHeader(format, ntrks, division);
-        d->m_beatLength = division;
-        d->m_beatMax = 4;
-        d->m_lastBeat = 0;
-        d->m_beatCount = 1;
-        d->m_barCount = 1;
-        updateLoadProgress();
-    }
-
-    void ALSAMIDIObject::noteOnEvent(int chan, int pitch, int vol)
-    {
-        if (pitch > d->m_highestMidiNote)
-            d->m_highestMidiNote = pitch;
-        if (pitch < d->m_lowestMidiNote)
-            d->m_lowestMidiNote = pitch;
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new NoteOnEvent (chan, pitch, vol);
-        appendEvent(ev);
-    }
-
-    void ALSAMIDIObject::noteOffEvent(int chan, int pitch, int vol)
+    /**
+     * Starts loading a song, without blocking. Remote files are downloaded
+     * first. The file is parsed in a worker thread, reporting the progress
+     * with the loadProgress() signal, and the song becomes the current one
+     * in loadFinished(). A previous load still in progress is cancelled.
+     */
+    void ALSAMIDIObject::openFile(const QString &fileName)
     {
-        if (pitch > d->m_highestMidiNote)
-            d->m_highestMidiNote = pitch;
-        if (pitch < d->m_lowestMidiNote)
-            d->m_lowestMidiNote = pitch;
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new NoteOffEvent (chan, pitch, vol);
-        appendEvent(ev);
+        cancelLoad();
+        updateState( LoadingState );
+        d->m_song.clear();
+        d->m_loadingMessages.clear();
+        d->m_loadingFile = fileName;
+        KUrl url(fileName);
+        if (url.isLocalFile()) {
+            d->m_loader->load(fileName, url.toLocalFile());
+        } else {
+            d->m_downloadJob = KIO::storedGet(url, KIO::NoReload, KIO::HideProgressInfo);
+            connect( d->m_downloadJob, SIGNAL(result(KJob*)),
+                     SLOT(downloadFinished(KJob*)) );
+        }
     }
 
-    void ALSAMIDIObject::keyPressEvent(int chan, int pitch, int press)
+    void ALSAMIDIObject::downloadFinished(KJob *job)
     {
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new KeyPressEvent (chan, pitch, press);
-        appendEvent(ev);
+        if (job != d->m_downloadJob)
+            return;
+        d->m_downloadJob = 0;
+        if (job->error()) {
+            d->m_loadingMessages << job->errorString();
+            d->m_loadingFile.clear();
+            updateState( ErrorState );
+        } else {
+            KIO::StoredTransferJob *transfer = static_cast<KIO::StoredTransferJob*>(job);
+            d->m_loader->load(d->m_loadingFile, transfer->data());
+        }
     }
 
-    void ALSAMIDIObject::ctlChangeEvent(int chan, int ctl, int value)
+    /**
+     * Commits the song parsed by the worker thread, unless the load has
+     * been cancelled or superseded by a newer one.
+     */
+    void ALSAMIDIObject::loadFinished()
     {
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new ControllerEvent (chan, ctl, value);
-        appendEvent(ev);
+        if (d->m_loader->isRunning() || d->m_loader->cancelled() ||
+            d->m_loadingFile.isEmpty() ||
+            d->m_loader->fileName() != d->m_loadingFile)
+            return;
+        d->m_loadingFile.clear();
+        commitSong(d->m_loader);
     }
 
-    void ALSAMIDIObject::pitchBendEvent(int chan, int value)
+    /**
+     * Abandons the download or the parsing of a song in progress.
+     */
+    void ALSAMIDIObject::cancelLoad()
     {
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new PitchBendEvent (chan, value);
-        appendEvent(ev);
+        d->m_loadingFile.clear();
+        if (d->m_downloadJob != 0) {
+            d->m_downloadJob->kill();
+            d->m_downloadJob = 0;
+        }
+        if (d->m_loader->isRunning()) {
+            d->m_loader->cancel();
+            d->m_loader->wait();
+        }
     }
 
-    void ALSAMIDIObject::programEvent(int chan, int patch)
+    /**
+     * Makes the song loaded by a loader the current one, and starts
+     * pre-loading the next song of the queue.
+     */
+    void ALSAMIDIObject::commitSong(SongLoader *loader)
     {
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        if (d->m_channelPatches[chan] < 0)
-            d->m_channelPatches[chan] = patch;
-        SequencerEvent* ev = new ProgramChangeEvent (chan, patch);
-        appendEvent(ev);
+        d->m_loadingMessages = loader->errors();
+        if (!loader->succeeded()) {
+            d->m_song.clear();
+            updateState( ErrorState );
+            return;
+        }
+        loader->takeSong(d->m_song);
+        d->m_song.setTextCodec(d->m_codec);
+        if (!d->m_song.isEmpty()) {
+            d->m_player->setSong(&d->m_song);
+            d->setQueueTempo();
+            d->m_player->resetPosition();
+            setTickInterval(d->m_song.getDivision() / 6);
+            updateState( StoppedState );
+            emit currentSourceChanged(d->m_song.getFileName());
+            preloadNext();
+        }
     }
 
-    void ALSAMIDIObject::chanPressEvent(int chan, int press)
+    /**
+     * Loads the next local file of the queue in a worker thread, while the
+     * current song is playing.
+     */
+    void ALSAMIDIObject::preloadNext()
     {
-        d->m_channelUsed[chan] = true;
-        d->m_channelEvents[chan]++;
-        SequencerEvent* ev = new ChanPressEvent (chan, press);
-        appendEvent(ev);
+        int next = d->m_playlistIndex + 1;
+        if (d->m_playlistIndex < 0 || next >= d->m_playList.count())
+            return;
+        const QString& source = d->m_playList.at(next);
+        KUrl url(source);
+        if (!url.isLocalFile() || d->m_preloader->fileName() == source)
+            return;
+        if (d->m_preloader->isRunning()) {
+            d->m_preloader->cancel();
+            d->m_preloader->wait();
+        }
+        d->m_preloader->load(source, url.toLocalFile());
     }
 
-    void ALSAMIDIObject::sysexEvent(const QByteArray& data)
+    void ALSAMIDIObject::songFinished()
     {
-        SequencerEvent* ev = new SysExEvent (data);
-        appendEvent(ev);
+        updateState( StoppedState );
+        d->m_player->resetPosition();
+        d->m_out->allNotesOff();
+        d->m_gapTime.start();
+        bool goNext = d->m_playlistIndex < d->m_playList.count()-1;
+        emit finished();
+        if (goNext && (d->m_playlistIndex < d->m_playList.count()-1)) {
+            if (d->m_songGap > 0)
+                d->m_gapTimer->start(d->m_songGap);
+            else
+                nextSong();
+        }
     }
 
-    void ALSAMIDIObject::metaEvent(int type, const QByteArray& data)
+    /**
+     * Changes to the next song of the queue. If it has been pre-loaded,
+     * it is used right away; if it is still being pre-loaded, it is used
+     * when the pre-loader finishes, without waiting for it here; otherwise,
+     * it is opened as usual.
+     */
+    void ALSAMIDIObject::nextSong()
     {
-        if ( (type >= Song::FIRST_TYPE) && (type <= Song::Cue) ) {
-            qint64 tick = d->m_engine->getCurrentTime();
-            d->m_song.addMetaData(static_cast<Song::TextType>(type), data, tick);
-            switch ( type ) {
-            case Song::Lyric:
-            case Song::Text:
-                if ((data.length() > 0) && (data[0] != '@') && (data[0] != '%') ) {
-                    VariableEvent *ev = new VariableEvent(data);
-                    ev->setSequencerType(SND_SEQ_EVENT_USR_VAR0);
-                    appendEvent(ev);
-                }
-                break;
-            case Song::TrackName:
-            case Song::InstrumentName:
-                if (d->m_trackLabel.isEmpty())
-                    d->m_trackLabel = data;
-                break;
+        int next = d->m_playlistIndex + 1;
+        if (next >= d->m_playList.count())
+            return;
+        const QString& source = d->m_playList.at(next);
+        if (d->m_preloader->fileName() == source && !d->m_preloader->cancelled()) {
+            if (d->m_preloader->isRunning()) {
+                d->m_gapTimer->stop();
+                cancelLoad();
+                d->m_playlistIndex = next;
+                updateState( LoadingState );
+                d->m_song.clear();
+                d->m_loadingMessages.clear();
+                d->m_loadingFile = source;
+                return;
+            }
+            if (d->m_preloader->succeeded()) {
+                cancelLoad();
+                d->m_playlistIndex = next;
+                updateState( LoadingState );
+                commitSong(d->m_preloader);
+                return;
             }
         }
+        setCurrentSource(source);
     }
 
-    void ALSAMIDIObject::tempoEvent(int tempo)
-    {
-        if ( d->m_initialTempo == 0 )
-            d->m_initialTempo = tempo;
-        SequencerEvent* ev = new TempoEvent (d->m_queueId, tempo);
-        appendEvent(ev);
-    }
-
-    void ALSAMIDIObject::endOfTrackEvent()
+    /**
+     * Commits the song of the pre-loader when the next song was requested
+     * before it finished. If it failed, the song is opened as usual.
+     */
+    void ALSAMIDIObject::preloadFinished()
     {
-        qreal seconds = d->m_engine->getRealTime() / 1600.0;
-        if (seconds > d->m_duration) d->m_duration = seconds;
+        if (d->m_preloader->isRunning() || d->m_preloader->cancelled() ||
+            d->m_loadingFile.isEmpty() ||
+            d->m_preloader->fileName() != d->m_loadingFile)
+            return;
+        d->m_loadingFile.clear();
+        if (d->m_preloader->succeeded())
+            commitSong(d->m_preloader);
+        else
+            openFile(d->m_preloader->fileName());
     }
 
-    void ALSAMIDIObject::timeSigEvent(int b0, int b1, int b2, int b3)
+    void ALSAMIDIObject::setSongGap(int msecs)
     {
-        SequencerEvent* ev = new SequencerEvent();
-        ev->setSequencerType(SND_SEQ_EVENT_TIMESIGN);
-        ev->setRaw8(0, b0);
-        ev->setRaw8(1, b1);
-        ev->setRaw8(2, b2);
-        ev->setRaw8(3, b3);
-        appendEvent(ev);
-        d->m_beatMax = b0;
-        d->m_beatLength = d->m_song.getDivision() * 4 / ::pow(2, b1);
+        d->m_songGap = qMax(0, msecs);
     }
 
-    void ALSAMIDIObject::errorHandler(const QString& errorStr)
+    /**
+     * Sets the time spanned by the batches of events written by the player.
+     * It is converted into ticks at the fastest tempo of the song and the
+     * current time skew when the playback starts, so a later change of the
+     * skew only applies from the next start.
+     */
+    void ALSAMIDIObject::setBatchWindow(int msecs)
     {
-        d->m_loadingMessages << QString("%1 at file offset %2<br>")
-            .arg(errorStr).arg(d->m_engine->getFilePos());
+        d->m_batchWindow = qMax(0, msecs);
     }
 
-    void ALSAMIDIObject::updateLoadProgress()
+    /**
+     * Iterates the events of the current song through the player, including
+     * the echo events, like the output thread does, but without scheduling
+     * them. Only allowed when the playback is stopped.
+     */
+    qint64 ALSAMIDIObject::dryRun()
     {
-        qint64 ticks = d->m_engine->getCurrentTime();
-        if (ticks > d->m_tick) {
-            qint64 diff = ticks - d->m_lastBeat;
-            while (diff >= d->m_beatLength) {
-                SequencerEvent* ev = new SequencerEvent();
-                ev->setSequencerType(SND_SEQ_EVENT_USR8);
-                ev->setRaw32(0, d->m_barCount);
-                ev->setRaw8(4, d->m_beatCount);
-                ev->setRaw8(5, d->m_beatMax);
-                ev->setSource(d->m_portId);
-                ev->scheduleTick(d->m_queueId, d->m_lastBeat, false);
-                ev->setDestination(d->m_clientId, d->m_portId);
-                d->m_song.append(ev);
-
-                d->m_lastBeat += d->m_beatLength;
-                diff -= d->m_beatLength;
-                d->m_beatCount++;
-                if (d->m_beatCount > d->m_beatMax) {
-                    d->m_beatCount = 1;
-                    d->m_barCount++;
-                }
-            }
-            d->m_tick = ticks;
+        if (d->m_song.isEmpty() || d->m_player->isRunning() ||
+            d->m_state == PausedState)
+            return -1;
+        qint64 count = 0;
+        d->m_player->resetPosition();
+        while (d->m_player->hasNext()) {
+            d->m_player->nextEvent();
+            ++count;
         }
+        d->m_player->resetPosition();
+        return count;
     }
 
-    void ALSAMIDIObject::openFile(const QString &fileName)
+    /**
+     * Enables the timing statistics of the loopback port and the output.
+     * The lateness of the events handled by the loopback port is recorded
+     * for each type of event, and the time spent sending them to the output
+     * device as well. With direct output, the channel events are scheduled
+     * by the kernel straight to the device, so they are not measured: only
+     * the echo, beat, time signature and lyric events are.
+     */
+    void ALSAMIDIObject::setTimingStats(bool enable)
     {
-        QMutexLocker locker(&d->m_openMutex);
-        QString tmpFile;
-        if(KIO::NetAccess::download(fileName, tmpFile, 0)) {
-            updateState( LoadingState );
-            d->m_song.clear();
-            d->m_loadingMessages.clear();
-            d->m_tick = 0;
-            d->m_initialTempo = 0;
-            d->m_duration = 0;
-            d->m_lastBeat = 0;
-            d->m_barCount = 0;
-            d->m_beatCount = 0;
-            d->m_beatMax = 4;
-            d->m_lowestMidiNote = 127;
-            d->m_highestMidiNote = 0;
-            for(int i=0; i<MIDI_CHANNELS; ++i) {
-                d->m_channelUsed[i] = false;
-                d->m_channelEvents[i] = 0;
-                d->m_channelLabel[i].clear();
-                d->m_channelPatches[i] = -1;
-            }
-            try {
-                d->m_engine->readFromFile(tmpFile);
-                if (!d->m_song.isEmpty()) {
-                    d->m_song.sort();
-                    addSongPadding();
-                    if (d->m_initialTempo == 0)
-                        d->m_initialTempo = 500000;
-                    d->m_song.setFileName(fileName);
-                    d->m_player->setSong(&d->m_song);
-                    d->setQueueTempo();
-                    d->m_player->resetPosition();
-                    setTickInterval(d->m_song.getDivision() / 6);
-                    updateState( StoppedState );
-                    emit currentSourceChanged(fileName);
-                }
-            } catch (...) {
-                d->m_song.clear();
-                updateState( ErrorState );
-            }
-            KIO::NetAccess::removeTempFile(tmpFile);
-        } else {
-            d->m_loadingMessages << KIO::NetAccess::lastErrorString();
-            updateState( ErrorState );
-        }
+        d->m_stats.setEnabled(enable);
+        d->m_out->setTimingStats(enable);
     }
 
-    void ALSAMIDIObject::songFinished()
+    void ALSAMIDIObject::setSongCacheSize(int mbytes)
     {
-        updateState( StoppedState );
-        d->m_player->resetPosition();
-        d->m_lastBeat = 0;
-        d->m_out->allNotesOff();
-        bool goNext = d->m_playlistIndex < d->m_playList.count()-1;
-        emit finished();
-        if (goNext && (d->m_playlistIndex < d->m_playList.count()-1))
-            setCurrentSource(d->m_playList.at(d->m_playlistIndex+1));
+        if (d->m_cache == NULL)
+            return;
+        d->m_cache->setMaximumSize(qint64(mbytes) << 20);
+        d->m_cache->expire();
     }
 
     void ALSAMIDIObject::updateState(State newState)
@@ -756,6 +891,11 @@ namespace KMid {
         return d->m_song.getLyrics(time);
     }
 
+    int ALSAMIDIObject::lyricsOffset(qint64 time) const
+    {
+        return d->m_song.getLyricsOffset(time);
+    }
+
     qreal ALSAMIDIObject::currentTempo()
     {
         return d->m_queue->getTempo().getRealBPM();
@@ -764,30 +904,18 @@ namespace KMid {
     bool ALSAMIDIObject::channelUsed(int channel)
     {
         if (channel >= 0 && channel < MIDI_CHANNELS)
-            return d->m_channelUsed[channel];
+            return d->m_song.isChannelUsed(channel);
         return false;
     }
 
     int ALSAMIDIObject::lowestMidiNote()
     {
-        return d->m_lowestMidiNote;
+        return d->m_song.getLowestNote();
     }
 
     int ALSAMIDIObject::highestMidiNote()
     {
-        return d->m_highestMidiNote;
-    }
-
-    void ALSAMIDIObject::addSongPadding()
-    {
-        unsigned long tick = d->m_song.last()->getTick();
-        tick += (d->m_beatMax * d->m_beatLength); // a full bar
-        SequencerEvent* ev = new SystemEvent(SND_SEQ_EVENT_ECHO);
-        ev->setSource(d->m_portId);
-        ev->scheduleTick(d->m_queueId, tick, false);
-        ev->setDestination(d->m_clientId, d->m_portId);
-        d->m_song.append(ev);
-        updateLoadProgress();
+        return d->m_song.getHighestNote();
     }
 
     bool ALSAMIDIObject::guessTextEncoding()
@@ -798,37 +926,13 @@ namespace KMid {
         return res;
     }
 
-    void ALSAMIDIObject::slotTrackStart()
-    {
-        for(int i=0; i<MIDI_CHANNELS; ++i)
-            d->m_channelEvents[i] = 0;
-        d->m_trackLabel.clear();
-        updateLoadProgress();
-    }
-
-    void ALSAMIDIObject::slotTrackEnd()
-    {
-        int max = 0;
-        int chan = -1;
-        if (!d->m_trackLabel.isEmpty()) {
-            for(int i=0; i<MIDI_CHANNELS; ++i)
-                if (d->m_channelEvents[i] > max) {
-                    max = d->m_channelEvents[i];
-                    chan = i;
-                }
-            if (chan >= 0 && chan < MIDI_CHANNELS)
-                d->m_channelLabel[chan] = d->m_trackLabel;
-        }
-        updateLoadProgress();
-    }
-
     QString ALSAMIDIObject::channelLabel(int channel)
     {
         if (channel >= 0 && channel < MIDI_CHANNELS) {
             if (d->m_codec == NULL)
-                return QString::fromAscii(d->m_channelLabel[channel]);
+                return QString::fromAscii(d->m_song.getChannelLabel(channel));
             else
-                return d->m_codec->toUnicode(d->m_channelLabel[channel]);
+                return d->m_codec->toUnicode(d->m_song.getChannelLabel(channel));
         }
         return QString();
     }
@@ -842,11 +946,18 @@ namespace KMid {
         else if (key == QLatin1String("SMF_DIVISION"))
             return QVariant(d->m_song.getDivision());
         else if (key == QLatin1String("NUM_BARS"))
-            return QVariant(d->m_barCount);
+            return QVariant(d->m_song.getBarCount());
         else if (key == QLatin1String("NUM_BEATS")) {
-            int beats = d->m_song.last()->getTick() / d->m_song.getDivision();
+            int beats = d->m_song.getLastTick() / d->m_song.getDivision();
             return QVariant(beats);
-        }
+        } else if (key == QLatin1String("SONG_GAP"))
+            return QVariant(d->m_lastGap);
+        else if (key == QLatin1String("CACHE_HITS"))
+            return QVariant(d->m_cache != NULL ? d->m_cache->hits() : 0);
+        else if (key == QLatin1String("CACHE_MISSES"))
+            return QVariant(d->m_cache != NULL ? d->m_cache->misses() : 0);
+        else if (key == QLatin1String("TIMING_STATS"))
+            return QVariant(d->m_stats.report("LOOPBACK") + d->m_out->timingStats());
         return QVariant();
     }
 
@@ -854,19 +965,83 @@ namespace KMid {
     {
         if (channel >= 0 && channel < MIDI_CHANNELS) {
             if (key == QLatin1String("INITIAL_PATCH"))
-                return QVariant(d->m_channelPatches[channel]);
+                return QVariant(d->m_song.getChannelPatch(channel));
             else if (key == QLatin1String("LABEL"))
-                return QVariant(d->m_channelLabel[channel]);
+                return QVariant(d->m_song.getChannelLabel(channel));
             else if (key == QLatin1String("USED"))
-                return QVariant(d->m_channelUsed[channel]);
+                return QVariant(d->m_song.isChannelUsed(channel));
         }
         return QVariant();
     }
 
+    /**
+     * Restores the state of the MIDI channels at a song position: silences
+     * the channels, resets the controllers, and sends at once the programs
+     * and controllers that the song has set up to that position.
+     */
+    void ALSAMIDIObject::chaseState(qint64 time)
+    {
+        ChaseState state = d->m_song.getChaseState(d->m_song.indexOf(time));
+        EventList events;
+        state.getEvents(events);
+        d->m_out->beginBatch();
+        d->m_out->allNotesOff();
+        d->m_out->resetControllers();
+        for (int i = 0; i < MIDI_CHANNELS; ++i) {
+            if (state.channel(i).program < 0)
+                d->m_out->sendInitialProgram(i, d->m_song.getChannelPatch(i));
+        }
+        SequencerEvent ev;
+        for (int i = 0; i < events.count(); ++i) {
+            events.copyEvent(i, ev.getHandle());
+            d->m_out->sendEvent(&ev);
+        }
+        d->m_out->commitBatch();
+    }
+
+    /**
+     * Enables scheduling the MIDI channel and SysEx events of the song
+     * directly to the output device, instead of sending them through the
+     * loopback port first. It takes effect the next time that the playback
+     * is started.
+     */
+    void ALSAMIDIObject::setDirectOutput(bool enable)
+    {
+        d->m_directOutput = enable;
+    }
+
+    bool ALSAMIDIObject::directOutput() const
+    {
+        return d->m_directOutput;
+    }
+
+    /**
+     * Enables the MIDI channel event signals (midiNoteOn(), midiController()
+     * and so on) when the direct output is enabled. Disabling them saves
+     * the loopback round trip of these events. It takes effect the next
+     * time that the playback is started.
+     */
+    void ALSAMIDIObject::setMonitorEvents(bool enable)
+    {
+        d->m_monitorEvents = enable;
+    }
+
+    bool ALSAMIDIObject::monitorEvents() const
+    {
+        return d->m_monitorEvents;
+    }
+
+    void ALSAMIDIObject::outputDeviceChanged(const QString& device)
+    {
+        d->m_outputPort->unsubscribeAll();
+        if (!device.isEmpty())
+            d->m_outputPort->subscribeTo(device);
+    }
+
     void ALSAMIDIObject::sendInitialProgramChanges()
     {
         for (int i = 0; i < MIDI_CHANNELS; ++i) {
-            int patch(d->m_channelPatches[i]);
+            int patch(d->m_song.getChannelPatch(i));
             d->m_out->sendInitialProgram(i, patch);
         }
     }
@@ -24,6 +24,8 @@
 #include <alsaclient.h>
 #include <QObject>
 
+class KJob;
+
 namespace drumstick {
     class SequencerEvent;
 }
@@ -32,8 +34,9 @@ using namespace drumstick;
 namespace KMid {
 
     class ALSAMIDIOutput;
+    class SongLoader;
 
-    class ALSAMIDIObject: public MIDIObject, public SequencerEventHandler {
+    class ALSAMIDIObject: public MIDIObject, public SequencerRawEventHandler {
         Q_OBJECT
     public:
         ALSAMIDIObject(QObject *parent = 0);
@@ -60,17 +63,26 @@ namespace KMid {
         qreal timeSkew();
         QString getTextEncoding() const;
         QStringList getLyrics(qint64 time) const;
+        int lyricsOffset(qint64 time) const;
         qreal currentTempo();
         bool channelUsed(int channel);
         int lowestMidiNote();
         int highestMidiNote();
-        void handleSequencerEvent(SequencerEvent* ev);
-        void addSongPadding();
+        void handleRawEvent(const snd_seq_event_t* ev);
         bool guessTextEncoding();
         QString channelLabel(int channel);
         QVariant songProperty(const QString& key);
         QVariant channelProperty(int channel, const QString& key);
         void sendInitialProgramChanges();
+        void setDirectOutput(bool enable);
+        bool directOutput() const;
+        void setMonitorEvents(bool enable);
+        bool monitorEvents() const;
+        void setSongGap(int msecs);
+        void setBatchWindow(int msecs);
+        qint64 dryRun();
+        void setTimingStats(bool enable);
+        void setSongCacheSize(int mbytes);
 
     public Q_SLOTS:
         void setTickInterval(qint32 interval);
@@ -82,29 +94,22 @@ namespace KMid {
         void setTimeSkew(qreal skew);
         void setTextEncoding(const QString& encoding);
 
-        void headerEvent(int format, int ntrks, int division);
-        void noteOnEvent(int chan, int pitch, int vol);
-        void noteOffEvent(int chan, int pitch, int vol);
-        void keyPressEvent(int chan, int pitch, int press);
-        void ctlChangeEvent(int chan, int ctl, int value);
-        void pitchBendEvent(int chan, int value);
-        void programEvent(int chan, int patch);
-        void chanPressEvent(int chan, int press);
-        void sysexEvent(const QByteArray& data);
-        void metaEvent(int type, const QByteArray& data);
-        void tempoEvent(int tempo);
-        void endOfTrackEvent();
-        void errorHandler(const QString& errorStr);
-        void timeSigEvent(int b0, int b1, int b2, int b3);
-        void appendEvent(SequencerEvent *ev);
-        void updateLoadProgress();
         void openFile(const QString &fileName);
         void songFinished();
+        void nextSong();
+        void downloadFinished(KJob *job);
+        void loadFinished();
+        void preloadFinished();
         void updateState(State newState);
-        void slotTrackStart();
-        void slotTrackEnd();
+        void outputDeviceChanged(const QString& device);
+        void rescheduleEvents();
 
     private:
+        void commitSong(SongLoader *loader);
+        void cancelLoad();
+        void preloadNext();
+        void chaseState(qint64 time);
+
         class ALSAMIDIObjectPrivate;
         ALSAMIDIObjectPrivate * const d;
     };
@@ -19,6 +19,8 @@
 
 #include "alsamidioutput.h"
 #include "midimapper.h"
+#include "latencystats.h"
+#include "rcupointer.h"
 
 #include <cmath>
 #include <alsaclient.h>
@@ -29,6 +31,9 @@
 #include <QStringList>
 #include <QMutex>
 #include <QMutexLocker>
+#include <QThread>
+#include <QAtomicPointer>
+#include <QElapsedTimer>
 
 using namespace drumstick;
 
@@ -36,6 +41,22 @@ namespace KMid {
 
     class ALSAMIDIOutput::ALSAMIDIOutputPrivate {
     public:
+        /**
+         * Precomputed output transformations. A table is never modified
+         * after being published, so it can be read without locking.
+         */
+        struct TransformTable {
+            uchar channel[MIDI_CHANNELS];
+            uchar controller[128];
+            uchar note[128];
+            uchar drumKey[128];
+            uchar patch[MIDI_CHANNELS][128];
+            uchar volume[MIDI_CHANNELS][128];
+            bool muted[MIDI_CHANNELS];
+            bool locked[MIDI_CHANNELS];
+            int bendRatio;
+        };
+
         ALSAMIDIOutputPrivate(ALSAMIDIOutput *q) :
             m_out(q),
             m_client(0),
@@ -44,17 +65,20 @@ namespace KMid {
             m_portId(0),
             m_pitchShift(0),
             m_clientFilter(true),
-            m_runtimeAlsaDrivers(0)
+            m_runtimeAlsaDrivers(0),
+            m_batchThread(0),
+            m_batchDepth(0)
         {
             for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
-                m_lastpgm[chan] = 0;
+                m_lastpgm[chan].store(0);
                 m_volumeShift[chan] = 1.0;
-                m_volume[chan] = 100;
+                m_volume[chan].store(100);
                 m_muted[chan] = false;
                 m_locked[chan] = false;
                 m_lockedpgm[chan] = 0;
             }
             m_runtimeAlsaDrivers = getRuntimeALSADriverNumber();
+            updateTable();
         }
 
         ALSAMIDIOutput *m_out;
@@ -67,104 +91,136 @@ namespace KMid {
         int m_runtimeAlsaDrivers;
         QString m_currentOutput;
         QStringList m_outputDevices;
-        int m_lastpgm[MIDI_CHANNELS];
+        QAtomicInt m_lastpgm[MIDI_CHANNELS];
         int m_lockedpgm[MIDI_CHANNELS];
         qreal m_volumeShift[MIDI_CHANNELS];
-        int m_volume[MIDI_CHANNELS];
+        QAtomicInt m_volume[MIDI_CHANNELS];
         bool m_muted[MIDI_CHANNELS];
         bool m_locked[MIDI_CHANNELS];
         QByteArray m_resetMessage;
-        QMutex m_outMutex;
-
-        void transformControllerEvent(SequencerEvent *ev)
-        {
-            ControllerEvent *event = static_cast<ControllerEvent*>(ev);
-            if (m_mapper != NULL && m_mapper->isOK()) {
-                int param = event->getParam();
-                param = m_mapper->controller(param);
-                if (param >= 0 && param < 128)
-                    event->setParam(param);
-            }
-            if (event->getParam() == MIDI_CTL_MSB_MAIN_VOLUME) {
-                int chan = event->getChannel();
-                int value = event->getValue();
-                m_volume[chan] = value;
-                value = floor(value * m_volumeShift[chan]);
-                if (value < 0) value = 0;
-                if (value > 127) value = 127;
-                event->setValue(value);
-            }
-        }
-
-        void transformNoteEvent(SequencerEvent *ev)
+        QMutex m_varMutex;
+        QMutex m_tableMutex;
+        RcuPointer<TransformTable> m_table;
+        QMutex m_batchMutex;
+        QAtomicPointer<QThread> m_batchThread;
+        int m_batchDepth;
+        LatencyStats m_stats;
+
+        /**
+         * Builds the transformation tables from the current mapper, pitch
+         * shift, volume, mute and lock settings, and publishes them. The
+         * previous tables are deleted by a later update, once no thread is
+         * reading them; the update itself never waits for the readers.
+         */
+        void updateTable()
         {
-            int note, channel;
-            NoteEvent *event = static_cast<NoteEvent*>(ev);
-            channel = event->getChannel();
-            if (channel != MIDI_GM_DRUM_CHANNEL) {
-                note = event->getKey() + m_pitchShift;
+            QMutexLocker locker(&m_tableMutex);
+            TransformTable *t = new TransformTable;
+            bool mapped = (m_mapper != NULL && m_mapper->isOK());
+            for (int i = 0; i < 128; ++i) {
+                int note = i + m_pitchShift;
                 while (note > 127) note -= 12;
                 while (note < 0) note += 12;
-                event->setKey(note);
-            } else if (m_mapper != NULL && m_mapper->isOK()) {
-                note = m_mapper->key( event->getChannel(),
-                                      m_lastpgm[channel],
-                                      event->getKey() );
-                if (note >= 0 && note < 128)
-                    event->setKey(note);
+                t->note[i] = note;
+                t->drumKey[i] = i;
+                t->controller[i] = i;
+                if (mapped) {
+                    int key = m_mapper->key(MIDI_GM_DRUM_CHANNEL, 0, i);
+                    if (key >= 0 && key < 128)
+                        t->drumKey[i] = key;
+                    int param = m_mapper->controller(i);
+                    if (param >= 0 && param < 128)
+                        t->controller[i] = param;
+                }
             }
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+                t->channel[chan] = chan;
+                if (mapped) {
+                    int channel = m_mapper->channel(chan);
+                    if (channel >= 0 && channel < MIDI_CHANNELS)
+                        t->channel[chan] = channel;
+                }
+                for (int i = 0; i < 128; ++i) {
+                    t->patch[chan][i] = i;
+                    if (mapped) {
+                        int pgm = m_mapper->patch(chan, i);
+                        if (pgm >= 0 && pgm < 128)
+                            t->patch[chan][i] = pgm;
+                    }
+                    int value = floor(i * m_volumeShift[chan]);
+                    if (value < 0) value = 0;
+                    if (value > 127) value = 127;
+                    t->volume[chan][i] = value;
+                }
+                t->muted[chan] = m_muted[chan];
+                t->locked[chan] = m_locked[chan];
+            }
+            t->bendRatio = mapped ? m_mapper->pitchBender(4096) : 4096;
+            m_table.publish(t);
         }
 
-        void transformProgramEvent(SequencerEvent *ev)
+        const TransformTable* acquireTable(int *slot)
         {
-            ProgramChangeEvent *event = static_cast<ProgramChangeEvent*>(ev);
-            int channel = event->getChannel();
-            m_lastpgm[channel] = event->getValue();
-            if (m_mapper != NULL && m_mapper->isOK()) {
-                int pgm = m_mapper->patch(channel, m_lastpgm[channel]);
-                if (pgm >= 0 && pgm < 128)
-                    event->setValue(pgm);
-            }
+            return m_table.acquire(slot);
         }
 
-        void transformPitchBendEvent(SequencerEvent *ev)
+        void releaseTable(int slot)
         {
-            PitchBendEvent *event = static_cast<PitchBendEvent*>(ev);
-            if (m_mapper != NULL && m_mapper->isOK()) {
-                int value = event->getValue();
-                value = m_mapper->pitchBender(value);
-                if (value < -8192) value = -8192;
-                if (value > 8191) value = 8191;
-                event->setValue(value);
-            }
+            m_table.release(slot);
         }
 
-        void transformEvent(SequencerEvent *ev)
+        void transformEvent(SequencerEvent *ev, const TransformTable *t)
         {
-            switch ( ev->getSequencerType() ) {
-            case SND_SEQ_EVENT_CONTROLLER:
-                transformControllerEvent(ev);
+            snd_seq_event_t *event = ev->getHandle();
+            switch ( event->type ) {
+            case SND_SEQ_EVENT_CONTROLLER: {
+                    uint chan = event->data.control.channel & 0x0f;
+                    event->data.control.param = t->controller[event->data.control.param & 0x7f];
+                    if (event->data.control.param == MIDI_CTL_MSB_MAIN_VOLUME) {
+                        int value = qBound(0, event->data.control.value, 127);
+                        m_volume[chan].store(value);
+                        event->data.control.value = t->volume[chan][value];
+                    }
+                }
                 break;
             case SND_SEQ_EVENT_NOTEOFF:
-            case SND_SEQ_EVENT_NOTEON:
-                transformNoteEvent(ev);
+            case SND_SEQ_EVENT_NOTEON: {
+                    uchar note = event->data.note.note & 0x7f;
+                    if (event->data.note.channel != MIDI_GM_DRUM_CHANNEL)
+                        event->data.note.note = t->note[note];
+                    else
+                        event->data.note.note = t->drumKey[note];
+                }
                 break;
-            case SND_SEQ_EVENT_PGMCHANGE:
-                transformProgramEvent(ev);
+            case SND_SEQ_EVENT_PGMCHANGE: {
+                    uint chan = event->data.control.channel & 0x0f;
+                    int pgm = event->data.control.value & 0x7f;
+                    m_lastpgm[chan].store(pgm);
+                    event->data.control.value = t->patch[chan][pgm];
+                }
                 break;
             case SND_SEQ_EVENT_PITCHBEND:
-                transformPitchBendEvent(ev);
+                if (t->bendRatio != 4096) {
+                    int value = event->data.control.value * t->bendRatio / 4096;
+                    event->data.control.value = qBound(-8192, value, 8191);
+                }
                 break;
             default:
                 break;
             }
-            if (SequencerEvent::isChannel(ev) &&
-                m_mapper != NULL && m_mapper->isOK()) {
-                ChannelEvent *event = static_cast<ChannelEvent*>(ev);
-                int channel = m_mapper->channel(event->getChannel());
-                if (channel >= 0 && channel < MIDI_CHANNELS)
-                    event->setChannel(channel);
+            if (SequencerEvent::isChannel(ev))
+                event->data.note.channel = t->channel[event->data.note.channel & 0x0f];
+        }
+
+        bool discardEvent(SequencerEvent *ev, bool discardable, const TransformTable *t)
+        {
+            if (discardable && SequencerEvent::isChannel(ev)) {
+                ChannelEvent *cev = static_cast<ChannelEvent*>(ev);
+                return t->muted[ cev->getChannel() ] ||
+                       ( (cev->getSequencerType() == SND_SEQ_EVENT_PGMCHANGE)
+                         && t->locked[ cev->getChannel() ] );
             }
+            return false;
         }
 
         bool clientIsAdvanced(int clientId)
@@ -248,14 +304,21 @@ namespace KMid {
     {
         if (channel >= 0 && channel < MIDI_CHANNELS) {
             d->m_volumeShift[channel] = value;
-            sendController(channel, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[channel]);
+            d->updateTable();
+            sendController(channel, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[channel].load());
             emit volumeChanged( channel, value );
+            emit transformChanged();
         } else if ( channel == -1 ) {
-            for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
                 d->m_volumeShift[chan] = value;
-                sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[chan]);
+            d->updateTable();
+            beginBatch();
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
+                sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[chan].load());
+            commitBatch();
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
                 emit volumeChanged( chan, value );
-            }
+            emit transformChanged();
         }
     }
 
@@ -306,11 +369,15 @@ namespace KMid {
         if (channel >= 0 && channel < MIDI_CHANNELS) {
             if (d->m_muted[channel] != mute) {
                 if (mute) {
+                    beginBatch();
                     sendController(channel, MIDI_CTL_ALL_NOTES_OFF, 0);
                     sendController(channel, MIDI_CTL_ALL_SOUNDS_OFF, 0);
+                    commitBatch();
                 }
                 d->m_muted[channel] = mute;
+                d->updateTable();
                 emit mutedChanged( channel, mute );
+                emit transformChanged();
             }
         }
     }
@@ -321,8 +388,10 @@ namespace KMid {
             if (d->m_locked[channel] != lock) {
                 d->m_locked[channel] = lock;
                 if (lock)
-                    d->m_lockedpgm[channel] = d->m_lastpgm[channel];
+                    d->m_lockedpgm[channel] = d->m_lastpgm[channel].load();
+                d->updateTable();
                 emit lockedChanged( channel, lock );
+                emit transformChanged();
             }
         }
     }
@@ -330,6 +399,8 @@ namespace KMid {
     void ALSAMIDIOutput::setMidiMap(MidiMapper *map)
     {
         d->m_mapper = map;
+        d->updateTable();
+        emit transformChanged();
     }
 
     void ALSAMIDIOutput::setPitchShift(int amt)
@@ -337,6 +408,8 @@ namespace KMid {
         if (d->m_pitchShift != amt) {
             allNotesOff();
             d->m_pitchShift = amt;
+            d->updateTable();
+            emit transformChanged();
         }
     }
 
@@ -349,18 +422,22 @@ namespace KMid {
 
     void ALSAMIDIOutput::allNotesOff()
     {
+        beginBatch();
         for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
             sendController(chan, MIDI_CTL_ALL_NOTES_OFF, 0);
             sendController(chan, MIDI_CTL_ALL_SOUNDS_OFF, 0);
         }
+        commitBatch();
     }
 
     void ALSAMIDIOutput::resetControllers()
     {
+        beginBatch();
         for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
             sendController(chan, MIDI_CTL_RESET_CONTROLLERS, 0);
             sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, 100);
         }
+        commitBatch();
     }
 
     void ALSAMIDIOutput::sendResetMessage()
@@ -369,26 +446,96 @@ namespace KMid {
             sendSysexEvent(d->m_resetMessage);
     }
 
-    void ALSAMIDIOutput::sendEvent(SequencerEvent *ev, bool discardable)
+    /**
+     * Applies the output transformations to an event: MIDI mapping, pitch
+     * shift and volume. This is useful for events that are scheduled to
+     * the output device by other sequencer clients. It only reads the
+     * current transformation tables, without locking.
+     * @return false if the event should be discarded, because the channel
+     * is muted or its program is locked
+     */
+    bool ALSAMIDIOutput::transformEvent(SequencerEvent *ev, bool discardable)
+    {
+        int slot;
+        const ALSAMIDIOutputPrivate::TransformTable *t = d->acquireTable(&slot);
+        d->transformEvent(ev, t);
+        bool discard = d->discardEvent(ev, discardable, t);
+        d->releaseTable(slot);
+        return !discard;
+    }
+
+    /**
+     * Starts a batch of events. The events sent by the calling thread are
+     * stored in the output buffer of the ALSA library until the outermost
+     * commitBatch(), which writes them with a single drain. Only one thread
+     * at a time may own a batch; the events sent by other threads, like the
+     * sequencer input thread, are still written directly.
+     */
+    void ALSAMIDIOutput::beginBatch()
+    {
+        if (d->m_batchThread.load() == QThread::currentThread()) {
+            ++d->m_batchDepth;
+            return;
+        }
+        d->m_batchMutex.lock();
+        d->m_batchThread.store(QThread::currentThread());
+        d->m_batchDepth = 1;
+    }
+
+    void ALSAMIDIOutput::commitBatch()
     {
-        QMutexLocker locker(&d->m_outMutex);
-        d->transformEvent(ev);
-        bool discard(false);
-        if (SequencerEvent::isChannel(ev)) {
-            ChannelEvent *cev = static_cast<ChannelEvent*>(ev);
-            discard = discardable &&
-                      ( d->m_muted[ cev->getChannel() ] ||
-                        ( (cev->getSequencerType() == SND_SEQ_EVENT_PGMCHANGE)
-                           && d->m_locked[ cev->getChannel() ] ) );
+        if (d->m_batchThread.load() != QThread::currentThread())
+            return;
+        if (--d->m_batchDepth == 0) {
+            d->m_client->drainOutput();
+            d->m_batchThread.store(0);
+            d->m_batchMutex.unlock();
         }
-        if (!discard) {
+    }
+
+    /**
+     * Sends an event to the output device. This may be called at the same
+     * time from the sequencer input thread and from the GUI thread. Fixed
+     * length events are written to the sequencer with a single system call
+     * each, without any shared state, so they are sent without locking.
+     * Variable length events (SysEx) are copied by the ALSA library into a
+     * temporary buffer owned by the client handle, and they are serialized.
+     * Inside a batch, the events are appended to the output buffer instead.
+     * When the timing statistics are enabled, the time spent sending each
+     * event is recorded.
+     */
+    void ALSAMIDIOutput::sendEvent(SequencerEvent *ev, bool discardable)
+    {
+        QElapsedTimer timer;
+        bool timing = d->m_stats.isEnabled();
+        if (timing)
+            timer.start();
+        if (transformEvent(ev, discardable)) {
             ev->setSource(d->m_portId);
             ev->setSubscribers();
             ev->setDirect();
-            d->m_client->outputDirect(ev);
+            if (d->m_batchThread.load() == QThread::currentThread())
+                d->m_client->output(ev);
+            else if (snd_seq_ev_is_variable(ev->getHandle())) {
+                QMutexLocker locker(&d->m_varMutex);
+                d->m_client->outputDirect(ev);
+            } else
+                d->m_client->outputDirect(ev);
+            if (timing)
+                d->m_stats.recordEvent(ev->getSequencerType(), timer.nsecsElapsed() / 1000);
         }
     }
 
+    void ALSAMIDIOutput::setTimingStats(bool enable)
+    {
+        d->m_stats.setEnabled(enable);
+    }
+
+    QStringList ALSAMIDIOutput::timingStats() const
+    {
+        return d->m_stats.report("OUTPUT");
+    }
+
     void ALSAMIDIOutput::sendNoteOn(int chan, int note, int vel)
     {
         NoteOnEvent ev(chan, note, vel);
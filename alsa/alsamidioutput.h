@@ -47,6 +47,11 @@ namespace KMid {
         int pitchShift();
         MidiClient* client() const;
         MidiPort* loopbackPort();
+        bool transformEvent(SequencerEvent *ev, bool discardable = true);
+        void beginBatch();
+        void commitBatch();
+        void setTimingStats(bool enable);
+        QStringList timingStats() const;
 
     public Q_SLOTS:
         void setVolume(int channel, qreal);
@@ -74,6 +79,13 @@ namespace KMid {
         void sendEvent(SequencerEvent *ev, bool discardable = true);
         void sendInitialProgram(int channel, int value);
 
+    Q_SIGNALS:
+        /**
+         * Emitted when the mapping, pitch shift, volume, mute or program
+         * lock applied by transformEvent() has changed.
+         */
+        void transformChanged();
+
     private:
         class ALSAMIDIOutputPrivate;
         ALSAMIDIOutputPrivate *d;
@@ -0,0 +1,198 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "chasestate.h"
+#include "song.h"
+
+namespace KMid {
+
+    ChaseState::ChaseState()
+    {
+        clear();
+    }
+
+    void ChaseState::clear()
+    {
+        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            Channel& ch = m_channels[chan];
+            ch.program = -1;
+            ch.nrpnSelected = false;
+            for(int ctl = 0; ctl < 128; ++ctl)
+                ch.controller[ctl] = -1;
+            for(int i = 0; i < RPN_COUNT; ++i) {
+                ch.rpn[i][0] = -1;
+                ch.rpn[i][1] = -1;
+            }
+            clearControllers(ch);
+        }
+    }
+
+    /**
+     * Forgets the controllers affected by a "Reset All Controllers"
+     * message, as described by the MIDI recommended practice RP-015.
+     */
+    void ChaseState::clearControllers(Channel& ch)
+    {
+        static const int resetControllers[] = {
+            MIDI_CTL_MSB_MODWHEEL, MIDI_CTL_MSB_EXPRESSION,
+            MIDI_CTL_SUSTAIN, MIDI_CTL_PORTAMENTO,
+            MIDI_CTL_SOSTENUTO, MIDI_CTL_SOFT_PEDAL,
+            MIDI_CTL_NONREG_PARM_NUM_LSB, MIDI_CTL_NONREG_PARM_NUM_MSB,
+            MIDI_CTL_REGIST_PARM_NUM_LSB, MIDI_CTL_REGIST_PARM_NUM_MSB
+        };
+        for(unsigned int i = 0; i < sizeof(resetControllers)/sizeof(int); ++i)
+            ch.controller[resetControllers[i]] = -1;
+        ch.pressure = -1;
+        ch.pitchBend = 0;
+    }
+
+    /**
+     * Updates the state with a song event.
+     */
+    void ChaseState::update(const snd_seq_event_t& ev)
+    {
+        if (ev.data.control.channel >= MIDI_CHANNELS)
+            return;
+        Channel& ch = m_channels[ev.data.control.channel];
+        switch (ev.type) {
+        case SND_SEQ_EVENT_PGMCHANGE:
+            ch.program = ev.data.control.value;
+            break;
+        case SND_SEQ_EVENT_PITCHBEND:
+            ch.pitchBend = ev.data.control.value;
+            break;
+        case SND_SEQ_EVENT_CHANPRESS:
+            ch.pressure = ev.data.control.value;
+            break;
+        case SND_SEQ_EVENT_CONTROLLER: {
+                unsigned int ctl = ev.data.control.param;
+                qint8 value = ev.data.control.value & 0x7f;
+                switch (ctl) {
+                case MIDI_CTL_RESET_CONTROLLERS:
+                    clearControllers(ch);
+                    break;
+                case MIDI_CTL_NONREG_PARM_NUM_LSB:
+                case MIDI_CTL_NONREG_PARM_NUM_MSB:
+                    ch.controller[ctl] = value;
+                    ch.nrpnSelected = true;
+                    break;
+                case MIDI_CTL_REGIST_PARM_NUM_LSB:
+                case MIDI_CTL_REGIST_PARM_NUM_MSB:
+                    ch.controller[ctl] = value;
+                    ch.nrpnSelected = false;
+                    break;
+                case MIDI_CTL_MSB_DATA_ENTRY:
+                case MIDI_CTL_LSB_DATA_ENTRY: {
+                        int param = ch.controller[MIDI_CTL_REGIST_PARM_NUM_LSB];
+                        if (!ch.nrpnSelected &&
+                            ch.controller[MIDI_CTL_REGIST_PARM_NUM_MSB] == 0 &&
+                            param >= 0 && param < RPN_COUNT)
+                            ch.rpn[param][ctl == MIDI_CTL_MSB_DATA_ENTRY ? 0 : 1] = value;
+                    }
+                    break;
+                case MIDI_CTL_DATA_INCREMENT:
+                case MIDI_CTL_DATA_DECREMENT:
+                    break;
+                default:
+                    if (ctl < MIDI_CTL_ALL_SOUNDS_OFF)
+                        ch.controller[ctl] = value;
+                    break;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void ChaseState::appendController(EventList& events, int chan, int ctl, int value) const
+    {
+        ControllerEvent ev(chan, ctl, value);
+        events.append(ev.getHandle());
+    }
+
+    /**
+     * Gets the events needed to restore the known state of all channels,
+     * after a "Reset All Controllers" message. The bank select is sent
+     * before the program change, and the registered parameters are sent
+     * before the parameter selection of the song is restored.
+     */
+    void ChaseState::getEvents(EventList& events) const
+    {
+        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            const Channel& ch = m_channels[chan];
+            if (ch.controller[MIDI_CTL_MSB_BANK] >= 0)
+                appendController(events, chan, MIDI_CTL_MSB_BANK, ch.controller[MIDI_CTL_MSB_BANK]);
+            if (ch.controller[MIDI_CTL_LSB_BANK] >= 0)
+                appendController(events, chan, MIDI_CTL_LSB_BANK, ch.controller[MIDI_CTL_LSB_BANK]);
+            if (ch.program >= 0) {
+                ProgramChangeEvent ev(chan, ch.program);
+                events.append(ev.getHandle());
+            }
+            for(int ctl = 0; ctl < MIDI_CTL_ALL_SOUNDS_OFF; ++ctl) {
+                switch (ctl) {
+                case MIDI_CTL_MSB_BANK:
+                case MIDI_CTL_LSB_BANK:
+                case MIDI_CTL_NONREG_PARM_NUM_LSB:
+                case MIDI_CTL_NONREG_PARM_NUM_MSB:
+                case MIDI_CTL_REGIST_PARM_NUM_LSB:
+                case MIDI_CTL_REGIST_PARM_NUM_MSB:
+                    break;
+                default:
+                    if (ch.controller[ctl] >= 0)
+                        appendController(events, chan, ctl, ch.controller[ctl]);
+                    break;
+                }
+            }
+            bool rpnSent = false;
+            for(int i = 0; i < RPN_COUNT; ++i) {
+                if (ch.rpn[i][0] < 0 && ch.rpn[i][1] < 0)
+                    continue;
+                appendController(events, chan, MIDI_CTL_REGIST_PARM_NUM_MSB, 0);
+                appendController(events, chan, MIDI_CTL_REGIST_PARM_NUM_LSB, i);
+                if (ch.rpn[i][0] >= 0)
+                    appendController(events, chan, MIDI_CTL_MSB_DATA_ENTRY, ch.rpn[i][0]);
+                if (ch.rpn[i][1] >= 0)
+                    appendController(events, chan, MIDI_CTL_LSB_DATA_ENTRY, ch.rpn[i][1]);
+                rpnSent = true;
+            }
+            int msb = ch.nrpnSelected ? MIDI_CTL_NONREG_PARM_NUM_MSB : MIDI_CTL_REGIST_PARM_NUM_MSB;
+            int lsb = ch.nrpnSelected ? MIDI_CTL_NONREG_PARM_NUM_LSB : MIDI_CTL_REGIST_PARM_NUM_LSB;
+            if (ch.controller[msb] >= 0 || ch.controller[lsb] >= 0) {
+                if (ch.controller[msb] >= 0)
+                    appendController(events, chan, msb, ch.controller[msb]);
+                if (ch.controller[lsb] >= 0)
+                    appendController(events, chan, lsb, ch.controller[lsb]);
+            } else if (rpnSent) {
+                // deselect the parameter, so stray data entries are ignored
+                appendController(events, chan, MIDI_CTL_REGIST_PARM_NUM_MSB, 127);
+                appendController(events, chan, MIDI_CTL_REGIST_PARM_NUM_LSB, 127);
+            }
+            if (ch.pitchBend != 0) {
+                PitchBendEvent ev(chan, ch.pitchBend);
+                events.append(ev.getHandle());
+            }
+            if (ch.pressure > 0) {
+                ChanPressEvent ev(chan, ch.pressure);
+                events.append(ev.getHandle());
+            }
+        }
+    }
+
+}
@@ -0,0 +1,71 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef INCLUDED_CHASESTATE_H
+#define INCLUDED_CHASESTATE_H
+
+#include <alsaevent.h>
+#include "midimapper.h"
+
+using namespace drumstick;
+
+namespace KMid {
+
+    class EventList;
+
+    /**
+     * State of the MIDI channels at some point of a song: bank, program,
+     * controllers, registered parameters, pitch bend and channel pressure.
+     * It is used to "chase" this state when the playback starts in the
+     * middle of a song. Negative values mean that the state is unknown.
+     */
+    class ChaseState
+    {
+    public:
+        /**
+         * Number of chased registered parameters: pitch bend sensitivity,
+         * fine tuning, coarse tuning, tuning program and tuning bank.
+         */
+        static const int RPN_COUNT = 5;
+
+        struct Channel {
+            qint8 program;
+            qint8 pressure;
+            qint16 pitchBend;
+            bool nrpnSelected;
+            qint8 controller[128];
+            qint8 rpn[RPN_COUNT][2];
+        };
+
+        ChaseState();
+        void clear();
+        void update(const snd_seq_event_t& ev);
+        void getEvents(EventList& events) const;
+        const Channel& channel(int chan) const { return m_channels[chan]; }
+
+    private:
+        void clearControllers(Channel& ch);
+        void appendController(EventList& events, int chan, int ctl, int value) const;
+
+        Channel m_channels[MIDI_CHANNELS];
+    };
+
+}
+
+#endif /*INCLUDED_CHASESTATE_H*/
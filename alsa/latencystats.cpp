@@ -0,0 +1,148 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "latencystats.h"
+#include <alsaevent.h>
+#include <cmath>
+
+namespace KMid {
+
+    void LatencyHistogram::reset()
+    {
+        for (int i = 0; i < BUCKETS; ++i)
+            m_buckets[i].store(0);
+        m_count.store(0);
+        m_total.store(0);
+        m_max.store(0);
+    }
+
+    qint64 LatencyHistogram::mean() const
+    {
+        quint32 count = m_count.load();
+        return count == 0 ? 0 : m_total.load() / count;
+    }
+
+    /**
+     * Gets the highest value counted by a bucket.
+     */
+    qint64 LatencyHistogram::bucketLimit(int index)
+    {
+        if (index < SUB_BUCKETS)
+            return index;
+        int shift = index / SUB_BUCKETS - 1;
+        qint64 lowest = qint64(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+        return lowest + (Q_INT64_C(1) << shift) - 1;
+    }
+
+    /**
+     * Gets the value below or equal to which the given percentage of the
+     * recorded values fall, within the precision of the buckets.
+     */
+    qint64 LatencyHistogram::percentile(qreal percent) const
+    {
+        quint32 count = m_count.load();
+        if (count == 0)
+            return 0;
+        quint64 target = qMax<quint64>(1, ::ceil(count * percent / 100.0));
+        quint64 seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += m_buckets[i].load();
+            if (seen >= target)
+                return qMin(bucketLimit(i), max());
+        }
+        return max();
+    }
+
+    /**
+     * Enables or disables the recording. The histograms are cleared when
+     * it is enabled, so each measurement starts from scratch.
+     */
+    void LatencyStats::setEnabled(bool enable)
+    {
+        if (enable && !isEnabled())
+            reset();
+        m_enabled.store(enable ? 1 : 0);
+    }
+
+    void LatencyStats::reset()
+    {
+        for (int i = 0; i < CATEGORIES; ++i)
+            m_histograms[i].reset();
+    }
+
+    int LatencyStats::category(int alsaType)
+    {
+        switch (alsaType) {
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+        case SND_SEQ_EVENT_NOTE:
+            return Note;
+        case SND_SEQ_EVENT_CONTROLLER:
+        case SND_SEQ_EVENT_CONTROL14:
+        case SND_SEQ_EVENT_NONREGPARAM:
+        case SND_SEQ_EVENT_REGPARAM:
+            return Controller;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            return Program;
+        case SND_SEQ_EVENT_KEYPRESS:
+        case SND_SEQ_EVENT_CHANPRESS:
+            return Pressure;
+        case SND_SEQ_EVENT_PITCHBEND:
+            return PitchBend;
+        case SND_SEQ_EVENT_SYSEX:
+            return SysEx;
+        case SND_SEQ_EVENT_ECHO:
+            return Echo;
+        case SND_SEQ_EVENT_USR8:
+            return Beat;
+        case SND_SEQ_EVENT_TIMESIGN:
+            return TimeSignature;
+        case SND_SEQ_EVENT_USR_VAR0:
+            return Lyric;
+        default:
+            return Other;
+        }
+    }
+
+    /**
+     * Gets a line of text for each category with recorded values: the
+     * number of events, the mean, some percentiles and the maximum, in
+     * microseconds.
+     */
+    QStringList LatencyStats::report(const QString& title) const
+    {
+        static const char *names[CATEGORIES] = {
+            "NOTE", "CONTROLLER", "PROGRAM", "PRESSURE", "PITCHBEND", "SYSEX",
+            "ECHO", "BEAT", "TIMESIGN", "LYRIC", "JITTER", "OTHER"
+        };
+        QStringList lines;
+        for (int i = 0; i < CATEGORIES; ++i) {
+            const LatencyHistogram& h = m_histograms[i];
+            if (h.count() == 0)
+                continue;
+            lines += QString("%1 %2: count=%3 mean=%4 p50=%5 p90=%6 p99=%7 p99.9=%8 max=%9 us")
+                     .arg(title).arg(names[i]).arg(h.count()).arg(h.mean())
+                     .arg(h.percentile(50)).arg(h.percentile(90))
+                     .arg(h.percentile(99)).arg(h.percentile(99.9)).arg(h.max());
+        }
+        return lines;
+    }
+
+}
@@ -0,0 +1,120 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef INCLUDED_LATENCYSTATS_H
+#define INCLUDED_LATENCYSTATS_H
+
+#include <QtGlobal>
+#include <QAtomicInteger>
+#include <QStringList>
+
+namespace KMid {
+
+    /**
+     * Lock free histogram of time intervals in microseconds. Like the HDR
+     * histograms, the width of the buckets grows with the magnitude of the
+     * values: intervals shorter than SUB_BUCKETS are counted exactly, and
+     * the longer ones with a relative error below 1/SUB_BUCKETS. Values
+     * may be recorded from several threads at the same time, and nothing
+     * is allocated after construction.
+     */
+    class LatencyHistogram
+    {
+    public:
+        static const int SUB_BITS = 4;
+        static const int SUB_BUCKETS = 1 << SUB_BITS;
+        static const int MAX_BITS = 32; /**< longer intervals are clamped */
+        static const int BUCKETS = SUB_BUCKETS * (MAX_BITS - SUB_BITS + 1);
+
+        LatencyHistogram() { reset(); }
+
+        void record(qint64 usecs)
+        {
+            if (usecs < 0)
+                usecs = 0;
+            else if (usecs >> MAX_BITS)
+                usecs = (Q_INT64_C(1) << MAX_BITS) - 1;
+            m_buckets[bucketIndex(usecs)].fetchAndAddRelaxed(1);
+            m_count.fetchAndAddRelaxed(1);
+            m_total.fetchAndAddRelaxed(usecs);
+            qint64 max = m_max.load();
+            while (usecs > max && !m_max.testAndSetRelaxed(max, usecs, max))
+                ;
+        }
+
+        void reset();
+        quint32 count() const { return m_count.load(); }
+        qint64 max() const { return m_max.load(); }
+        qint64 mean() const;
+        qint64 percentile(qreal percent) const;
+
+        static int bucketIndex(quint64 usecs)
+        {
+            if (usecs < quint64(SUB_BUCKETS))
+                return int(usecs);
+            int msb = 0;
+            for (int bits = MAX_BITS / 2; bits > 0; bits >>= 1)
+                if (usecs >> (msb + bits))
+                    msb += bits;
+            int shift = msb - SUB_BITS;
+            return SUB_BUCKETS * (shift + 1) + int((usecs >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        static qint64 bucketLimit(int index);
+
+    private:
+        QAtomicInteger<quint32> m_buckets[BUCKETS];
+        QAtomicInteger<quint32> m_count;
+        QAtomicInteger<qint64> m_total;
+        QAtomicInteger<qint64> m_max;
+    };
+
+    /**
+     * Histograms of the event timing of the ALSA backend, one for each
+     * category of sequencer events. Recording is disabled by default.
+     */
+    class LatencyStats
+    {
+    public:
+        enum Category {
+            Note, Controller, Program, Pressure, PitchBend, SysEx,
+            Echo, Beat, TimeSignature, Lyric, Jitter, Other,
+            CATEGORIES
+        };
+
+        LatencyStats() : m_enabled(0) {}
+
+        bool isEnabled() const { return m_enabled.load() != 0; }
+        void setEnabled(bool enable);
+        void reset();
+        void record(int category, qint64 usecs) { m_histograms[category].record(usecs); }
+        void recordEvent(int alsaType, qint64 usecs) { record(category(alsaType), usecs); }
+        QStringList report(const QString& title) const;
+
+        static int category(int alsaType);
+
+    private:
+        QAtomicInt m_enabled;
+        LatencyHistogram m_histograms[CATEGORIES];
+    };
+
+}
+
+#endif /*INCLUDED_LATENCYSTATS_H*/
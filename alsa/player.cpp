@@ -19,36 +19,45 @@
 
 #include "player.h"
 #include "song.h"
+#include "alsamidioutput.h"
+
+#include <alsaclient.h>
 
 namespace KMid {
 
     Player::Player(MidiClient *seq, int portId)
         : SequencerOutputThread(seq, portId),
+        m_output(0),
+        m_clientId(-1),
+        m_outputPortId(-1),
+        m_monitor(true),
         m_song(0),
-        m_songIterator(0),
+        m_songIndex(0),
         m_songPosition(0),
+        m_lastEcho(0),
         m_echoResolution(0)
     {
         moveToThread(this);
+        snd_seq_ev_clear(&m_echo);
+        m_echo.type = SND_SEQ_EVENT_ECHO;
+        if (seq != NULL) {
+            m_clientId = seq->getClientId();
+            snd_seq_ev_set_source(&m_echo, portId);
+            snd_seq_ev_set_dest(&m_echo, seq->getClientId(), portId);
+            snd_seq_ev_schedule_tick(&m_echo, m_QueueId, 0, 0);
+        }
     }
 
     Player::~Player()
     {
         if (isRunning())
             stop();
-        if (m_songIterator != NULL) {
-            delete m_songIterator;
-        }
     }
 
     void Player::setSong(Song* s)
     {
         m_song = s;
         if (m_song != NULL) {
-            if (m_songIterator != NULL) {
-                delete m_songIterator;
-            }
-            m_songIterator = new SongIterator(*m_song);
             if (m_echoResolution == 0)
                 m_echoResolution = m_song->getDivision() / 12;
             resetPosition();
@@ -57,30 +66,55 @@ namespace KMid {
 
     void Player::resetPosition()
     {
-        if ((m_song != NULL) && (m_songIterator != NULL)) {
-            m_songIterator->toFront();
-            m_songPosition = 0;
-        }
+        m_songIndex = 0;
+        m_songPosition = 0;
+        m_lastEcho = 0;
     }
 
     void Player::setPosition(unsigned int pos)
     {
         m_songPosition = pos;
-        m_songIterator->toFront();
-        while (m_songIterator->hasNext() &&
-              (m_songIterator->next()->getTick() < pos)) {};
-        if (m_songIterator->hasPrevious())
-            m_songIterator->previous();
+        m_lastEcho = pos;
+        m_songIndex = 0;
+        if (m_song != NULL)
+            m_songIndex = m_song->indexOf(pos);
     }
 
     bool Player::hasNext()
     {
-        return m_songIterator->hasNext();
+        return (m_song != NULL) && (m_songIndex < m_song->count());
     }
 
+    /**
+     * Returns the next song event. The echo events are merged here with
+     * the song events, every echo resolution ticks, instead of being
+     * generated by the output thread. The same object is reused for every
+     * event, so it is only valid until the next call. The song events are
+     * addressed here to this client, port and queue, because the events of
+     * precompiled song files are stored without addresses.
+     */
     SequencerEvent* Player::nextEvent()
     {
-        return m_songIterator->next();
+        if (m_echoResolution > 0 &&
+            m_lastEcho + m_echoResolution <= m_song->getTick(m_songIndex)) {
+            m_lastEcho += m_echoResolution;
+            m_echo.time.tick = m_lastEcho;
+            *m_event.getHandle() = m_echo;
+            return &m_event;
+        }
+        snd_seq_event_t* ev = m_event.getHandle();
+        m_song->copyEvent(m_songIndex++, ev);
+        ev->source.port = m_PortId;
+        ev->queue = m_QueueId;
+        if (ev->type == SND_SEQ_EVENT_TEMPO) {
+            ev->dest.client = SND_SEQ_CLIENT_SYSTEM;
+            ev->dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
+            ev->data.queue.queue = m_QueueId;
+        } else {
+            ev->dest.client = m_clientId;
+            ev->dest.port = m_PortId;
+        }
+        return &m_event;
     }
 
     unsigned int Player::getInitialPosition()
@@ -88,14 +122,51 @@ namespace KMid {
         return m_songPosition;
     }
 
-    unsigned int Player::getEchoResolution()
+    void Player::setEchoResolution( const qint32 r )
     {
-        return m_echoResolution;
+        m_echoResolution = r;
     }
 
-    void Player::setEchoResolution( const qint32 r )
+    /**
+     * Sets the output for the MIDI channel and SysEx events. When it is set,
+     * these events are transformed by the output when they are scheduled,
+     * and delivered by the queue from the given port to its subscribers,
+     * instead of to the loopback port. Must not be changed while playing.
+     * @param output the output providing the event transformations, or NULL
+     * @param portId a port subscribed to the same device as the output
+     */
+    void Player::setOutput(ALSAMIDIOutput* output, int portId)
     {
-        m_echoResolution = r;
+        m_output = output;
+        m_outputPortId = portId;
+    }
+
+    /**
+     * Enables sending an untransformed copy of the MIDI channel events to
+     * the loopback port as well, when there is an output set, so they can
+     * be monitored. Must not be changed while playing.
+     */
+    void Player::setMonitor(bool enable)
+    {
+        m_monitor = enable;
+    }
+
+    void Player::sendSongEvent(SequencerEvent* ev)
+    {
+        if (m_output != NULL) {
+            bool channel = SequencerEvent::isChannel(ev);
+            if (channel || ev->getSequencerType() == SND_SEQ_EVENT_SYSEX) {
+                if (channel && m_monitor)
+                    SequencerOutputThread::sendSongEvent(ev);
+                if (m_output->transformEvent(ev)) {
+                    ev->setSource(m_outputPortId);
+                    ev->setSubscribers();
+                    SequencerOutputThread::sendSongEvent(ev);
+                }
+                return;
+            }
+        }
+        SequencerOutputThread::sendSongEvent(ev);
     }
 
 }
@@ -28,6 +28,8 @@ using namespace drumstick;
 
 namespace KMid {
 
+    class ALSAMIDIOutput;
+
     class Player : public SequencerOutputThread
     {
         Q_OBJECT
@@ -38,17 +40,30 @@ namespace KMid {
         virtual bool hasNext();
         virtual SequencerEvent* nextEvent();
         virtual unsigned int getInitialPosition();
-        virtual unsigned int getEchoResolution();
 
         void setSong(Song* s);
         void resetPosition();
         void setPosition(unsigned int pos);
         void setEchoResolution( const qint32 r );
+        qint32 echoResolution() const { return m_echoResolution; }
+        void setOutput(ALSAMIDIOutput* output, int portId);
+        ALSAMIDIOutput* output() const { return m_output; }
+        void setMonitor(bool enable);
+
+    protected:
+        virtual void sendSongEvent(SequencerEvent* ev);
 
     private:
+        ALSAMIDIOutput* m_output;
+        int m_clientId;
+        int m_outputPortId;
+        bool m_monitor;
         Song* m_song;
-        SongIterator* m_songIterator;
+        int m_songIndex;
+        SequencerEvent m_event;
+        snd_seq_event_t m_echo;
         qint64 m_songPosition;
+        qint64 m_lastEcho;
         qint32 m_echoResolution;
     };
 
@@ -0,0 +1,150 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef INCLUDED_RCUPOINTER_H
+#define INCLUDED_RCUPOINTER_H
+
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QThread>
+
+namespace KMid {
+
+    /**
+     * A pointer to an immutable object, read without locks and replaced by
+     * publishing a new object (read-copy-update).
+     *
+     * Each reader claims a slot recording the epoch in which it started
+     * reading. Publishing never waits for the readers: the replaced object
+     * is retired with the current epoch, and deleted by a later publish()
+     * once every slot in use has started after it was retired. A reader
+     * only waits when all the slots are in use at the same time.
+     */
+    template <typename T>
+    class RcuPointer
+    {
+    public:
+        static const int READER_SLOTS = 16;
+
+        explicit RcuPointer(T *object = 0) : m_epoch(1), m_object(object)
+        {
+            for (int i = 0; i < READER_SLOTS; ++i)
+                m_slots[i].store(0);
+        }
+
+        /**
+         * Deletes the current and the retired objects. There must be no
+         * readers left.
+         */
+        ~RcuPointer()
+        {
+            delete m_object.load();
+            for (int i = 0; i < m_retired.count(); ++i)
+                delete m_retired[i].first;
+        }
+
+        /**
+         * Starts reading. The returned object remains valid until
+         * release() is called with the same slot.
+         * @param slot Returns the reader slot, to be passed to release()
+         */
+        const T* acquire(int *slot)
+        {
+            for (;;) {
+                quint32 epoch = m_epoch.loadAcquire();
+                for (int i = 0; i < READER_SLOTS; ++i) {
+                    if (m_slots[i].testAndSetOrdered(0, epoch)) {
+                        *slot = i;
+                        return m_object.loadAcquire();
+                    }
+                }
+                QThread::yieldCurrentThread();
+            }
+        }
+
+        /**
+         * Finishes reading the object returned by acquire().
+         */
+        void release(int slot)
+        {
+            m_slots[slot].storeRelease(0);
+        }
+
+        /**
+         * Replaces the object, which must not be modified after this call.
+         * The previous object is deleted later, when no reader can be
+         * using it anymore.
+         */
+        void publish(T *object)
+        {
+            QMutexLocker locker(&m_mutex);
+            T *old = m_object.fetchAndStoreOrdered(object);
+            quint32 epoch = m_epoch.fetchAndAddOrdered(1);
+            if (old != 0)
+                m_retired.append(qMakePair(old, epoch));
+            reclaim();
+        }
+
+        /**
+         * Number of replaced objects not deleted yet.
+         */
+        int retiredCount() const
+        {
+            QMutexLocker locker(&m_mutex);
+            return m_retired.count();
+        }
+
+    private:
+        /**
+         * Deletes the retired objects older than the oldest reader. The
+         * slots are read with ordered read-modify-write operations, so a
+         * reader not seen here is guaranteed to see the new object.
+         */
+        void reclaim()
+        {
+            quint32 oldest = m_epoch.loadAcquire();
+            for (int i = 0; i < READER_SLOTS; ++i) {
+                quint32 epoch = m_slots[i].fetchAndAddOrdered(0);
+                if (epoch != 0 && epoch < oldest)
+                    oldest = epoch;
+            }
+            QList< QPair<T*, quint32> > kept;
+            for (int i = 0; i < m_retired.count(); ++i) {
+                if (m_retired[i].second < oldest)
+                    delete m_retired[i].first;
+                else
+                    kept.append(m_retired[i]);
+            }
+            m_retired = kept;
+        }
+
+        mutable QMutex m_mutex;
+        QAtomicInteger<quint32> m_epoch;
+        QAtomicInteger<quint32> m_slots[READER_SLOTS];
+        QAtomicPointer<T> m_object;
+        QList< QPair<T*, quint32> > m_retired;
+    };
+
+}
+
+#endif /*INCLUDED_RCUPOINTER_H*/
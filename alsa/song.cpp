@@ -18,6 +18,8 @@
 */
 
 #include "song.h"
+#include <algorithm>
+#include <QDataStream>
 #include <QTextDecoder>
 #include <KEncodingProber>
 #include <KGlobal>
@@ -26,30 +28,168 @@
 
 namespace KMid {
 
-    static inline bool eventLessThan(const SequencerEvent* s1, const SequencerEvent* s2)
+    void EventList::clear()
     {
-        return s1->getTick() < s2->getTick();
+        m_events.clear();
+        m_data.clear();
+        m_file.clear();
     }
 
-    Song::~Song()
+    void EventList::reserve(int size)
+    {
+        m_events.reserve(size);
+    }
+
+    /**
+     * Replaces the contents of the list with the events of an open song
+     * file, which are used in place.
+     */
+    void EventList::setFile(const QSharedPointer<SongFileReader>& file)
     {
         clear();
+        m_file = file;
+    }
+
+    /**
+     * Appends a copy of an event record. The variable length data, if any,
+     * is copied to the data buffer, and the record keeps its offset there.
+     */
+    void EventList::append(const snd_seq_event_t* ev)
+    {
+        Q_ASSERT(m_file.isNull());
+        m_events.append(*ev);
+        if (snd_seq_ev_is_variable(ev)) {
+            quintptr offset = m_data.size();
+            m_data.append(static_cast<const char*>(ev->data.ext.ptr), ev->data.ext.len);
+            m_events.last().data.ext.ptr = reinterpret_cast<void*>(offset);
+        }
+    }
+
+    /**
+     * Appends a copy of the event at index i of another list.
+     */
+    void EventList::append(const EventList& other, int i)
+    {
+        Q_ASSERT(m_file.isNull());
+        const snd_seq_event_t& src = other.at(i);
+        m_events.append(src);
+        if (snd_seq_ev_is_variable(&src)) {
+            snd_seq_event_t& ev = m_events.last();
+            const char* data = other.eventData(src);
+            if (data == NULL)
+                ev.data.ext.len = 0;
+            ev.data.ext.ptr = reinterpret_cast<void*>(quintptr(m_data.size()));
+            m_data.append(data, ev.data.ext.len);
+        }
+    }
+
+    /**
+     * Gets the variable length data of an event of this list. The bounds
+     * are checked for mapped files, which may be damaged.
+     * @return the data, or NULL if it is out of bounds
+     */
+    const char* EventList::eventData(const snd_seq_event_t& ev) const
+    {
+        quintptr offset = reinterpret_cast<quintptr>(ev.data.ext.ptr);
+        if (m_file.isNull())
+            return m_data.constData() + offset;
+        if (offset > quintptr(m_file->dataSize()) ||
+            ev.data.ext.len > m_file->dataSize() - offset)
+            return NULL;
+        return m_file->data() + offset;
+    }
+
+    /**
+     * Copies the event at index i, pointing its variable length data to the
+     * data buffer of this list. The copy is valid while the list is not
+     * modified.
+     */
+    void EventList::copyEvent(int i, snd_seq_event_t* ev) const
+    {
+        *ev = at(i);
+        if (snd_seq_ev_is_variable(ev)) {
+            const char* data = eventData(*ev);
+            if (data == NULL) {
+                ev->data.ext.len = 0;
+                data = "";
+            }
+            ev->data.ext.ptr = const_cast<char*>(data);
+        }
+    }
+
+    static inline bool eventTickLessThan(const snd_seq_event_t& ev, snd_seq_tick_time_t tick)
+    {
+        return ev.time.tick < tick;
+    }
+
+    /**
+     * Finds the first event at or after a given time, with a binary search.
+     * The list must be sorted by time.
+     * @return The index of the event, or count() if there is none
+     */
+    int EventList::indexOf(snd_seq_tick_time_t tick) const
+    {
+        if (!m_file.isNull())
+            return m_file->indexOf(tick);
+        QVector<snd_seq_event_t>::const_iterator it =
+            std::lower_bound(m_events.constBegin(), m_events.constEnd(), tick, eventTickLessThan);
+        return it - m_events.constBegin();
     }
 
-    void Song::sort()
+    Song::~Song()
     {
-        qStableSort(begin(), end(), eventLessThan);
+        clear();
     }
 
     void Song::clear()
     {
-        while (!isEmpty())
-            delete takeFirst();
+        EventList::clear();
         m_fileName.clear();
         m_text.clear();
+        m_tempoMap.clear();
+        m_chaseStates.clear();
+        m_lyricsText.clear();
+        m_lyricsTicks.clear();
+        m_lyricsEnds.clear();
+        m_decodedText.clear();
+        m_detectedEncoding.clear();
         m_format = 0;
         m_ntrks = 0;
         m_division = 0;
+        m_initialTempo = 0;
+        m_barCount = 0;
+        m_lowestNote = 127;
+        m_highestNote = 0;
+        m_duration = 0;
+        clearChannels();
+    }
+
+    void Song::clearChannels()
+    {
+        for(int i = 0; i < MIDI_CHANNELS; ++i) {
+            m_channelUsed[i] = false;
+            m_channelPatches[i] = -1;
+            m_channelLabel[i].clear();
+        }
+    }
+
+    void Song::setNoteRange(int lowest, int highest)
+    {
+        m_lowestNote = lowest;
+        m_highestNote = highest;
+    }
+
+    /**
+     * Sets the summary of a MIDI channel: whether the song uses it, its
+     * initial program, and the name of the track playing it.
+     */
+    void Song::setChannelInfo(int channel, bool used, int patch, const QByteArray& label)
+    {
+        if (channel >= 0 && channel < MIDI_CHANNELS) {
+            m_channelUsed[channel] = used;
+            m_channelPatches[channel] = patch;
+            m_channelLabel[channel] = label;
+        }
     }
 
     void Song::setHeader(int format, int ntrks, int division)
@@ -64,6 +204,87 @@ namespace KMid {
         m_fileName = fileName;
     }
 
+    void Song::setTempoMap(const QSmfTempoMap& tempoMap)
+    {
+        m_tempoMap = tempoMap;
+    }
+
+    qreal Song::ticksToSeconds(qint64 tick) const
+    {
+        return m_tempoMap.ticksToSeconds(tick);
+    }
+
+    /**
+     * Gets the longest span of ticks that never lasts more than a given
+     * time, at the fastest tempo of the song. With a SMPTE division the
+     * ticks have a fixed duration.
+     * @param msecs the time in milliseconds
+     * @return the number of ticks, at least one, or zero for no time
+     */
+    unsigned int Song::ticksWithin(qreal msecs) const
+    {
+        static const qreal MAX_TICKS = 1 << 24;
+        if (msecs <= 0 || m_division <= 0)
+            return 0;
+        qreal ticks;
+        if (m_division & 0x8000) {
+            qreal frames = 256 - ((m_division >> 8) & 0xff);
+            ticks = msecs * frames * (m_division & 0xff) / 1000.0;
+        } else {
+            quint64 fastest = (m_initialTempo > 0) ? m_initialTempo : 500000;
+            if (m_tempoMap.isEmpty() || m_tempoMap.at(0).time > 0)
+                fastest = qMin(fastest, Q_UINT64_C(500000));
+            for (int i = 0; i < m_tempoMap.count(); ++i)
+                if (m_tempoMap.at(i).tempo > 0)
+                    fastest = qMin(fastest, m_tempoMap.at(i).tempo);
+            ticks = msecs * 1000.0 * m_division / fastest;
+        }
+        return (unsigned int) qBound(qreal(1), ticks, MAX_TICKS);
+    }
+
+    /**
+     * Takes a snapshot of the channels state every CHASE_INTERVAL events.
+     * Snapshot n is the state before the event at index n * CHASE_INTERVAL.
+     * It must be called after the song events are complete.
+     */
+    void Song::updateChaseStates()
+    {
+        ChaseState state;
+        m_chaseStates.clear();
+        m_chaseStates.reserve(count() / CHASE_INTERVAL + 1);
+        for(int i = 0; i < count(); ++i) {
+            if (i % CHASE_INTERVAL == 0)
+                m_chaseStates.append(state);
+            state.update(at(i));
+        }
+    }
+
+    /**
+     * Gets the channels state before the event at a given index, starting
+     * from the nearest previous snapshot.
+     */
+    ChaseState Song::getChaseState(int index) const
+    {
+        ChaseState state;
+        int first = 0;
+        if (isMapped()) {
+            const SongFileReader& file = *m_file;
+            if (file.chaseStateCount() > 0) {
+                int n = qBound(0, index / CHASE_INTERVAL, file.chaseStateCount() - 1);
+                state = file.chaseState(n);
+                first = n * CHASE_INTERVAL;
+            }
+        } else if (!m_chaseStates.isEmpty()) {
+            int n = qBound(0, index / CHASE_INTERVAL, m_chaseStates.count() - 1);
+            state = m_chaseStates.at(n);
+            first = n * CHASE_INTERVAL;
+        }
+        int last = qMin(index, count());
+        for(int i = first; i < last; ++i)
+            state.update(at(i));
+        return state;
+    }
+
     void Song::addMetaData(TextType type, const QByteArray& text, const qint64 tick)
     {
         if ( (type >= FIRST_TYPE) && (type <= Cue) ) {
@@ -93,22 +314,80 @@ namespace KMid {
                 }
             }
             m_text[t][tick].append(text);
+            m_decodedText.remove(t);
         }
     }
 
     void Song::appendStringToList(QStringList &list, QString &s, TextType type)
     {
+        static const QRegExp karTags("@[IKLTVW]");
+        static const QRegExp slashes("[/\\\\]+");
+        static const QRegExp newLines("[\r\n]+");
+        static const QString separator(QChar::LineSeparator);
         if (type == Text || type >= KarFileType)
-            s.replace(QRegExp("@[IKLTVW]"), QString(QChar::LineSeparator));
+            s.replace(karTags, separator);
         if (type == Text || type == Lyric)
-            s.replace(QRegExp("[/\\\\]+"), QString(QChar::LineSeparator));
-        s.replace(QRegExp("[\r\n]+"), QString(QChar::LineSeparator));
+            s.replace(slashes, separator);
+        s.replace(newLines, separator);
         list.append(s);
     }
 
+    /**
+     * Sets the codec of the song texts, discarding the texts decoded with
+     * the previous one, and builds the lyrics timeline. It must be called
+     * after the meta data is complete.
+     */
     void Song::setTextCodec(QTextCodec *c)
     {
         m_codec = c;
+        m_decodedText.clear();
+        updateLyrics();
+    }
+
+    /**
+     * Decodes and normalizes the lyrics once, keeping the time of each
+     * fragment and the offset of its end in the whole text. The text
+     * events are used instead when the song has no lyrics.
+     */
+    void Song::updateLyrics()
+    {
+        TextType type = m_text.value(Lyric).isEmpty() ? Text : Lyric;
+        const TimeStampedData data = m_text.value(type);
+        QStringList list;
+        m_lyricsTicks.clear();
+        m_lyricsEnds.clear();
+        m_lyricsTicks.reserve(data.count());
+        m_lyricsEnds.reserve(data.count());
+        int offset = 0;
+        TimeStampedData::const_iterator it;
+        for (it = data.constBegin(); it != data.constEnd(); ++it) {
+            QString s = decodeBytes(it.value());
+            appendStringToList(list, s, type);
+            offset += list.last().length();
+            m_lyricsTicks.append(it.key());
+            m_lyricsEnds.append(offset);
+        }
+        m_lyricsText = list.join(QString());
+        m_decodedText[type] = list;
+    }
+
+    /**
+     * Number of lyrics fragments up to a given time, inclusive.
+     */
+    int Song::lyricsCount(qint64 time) const
+    {
+        return std::upper_bound(m_lyricsTicks.constBegin(), m_lyricsTicks.constEnd(), time)
+               - m_lyricsTicks.constBegin();
+    }
+
+    /**
+     * Gets the length of the lyrics text sung up to a given time, inclusive.
+     * @see getLyricsText()
+     */
+    int Song::getLyricsOffset(qint64 time) const
+    {
+        int n = lyricsCount(time);
+        return (n > 0) ? m_lyricsEnds.at(n - 1) : 0;
     }
 
     QString Song::decodeBytes(const QByteArray &ba)
@@ -118,70 +397,173 @@ namespace KMid {
         return m_codec->toUnicode(ba);
     }
 
+    /**
+     * Gets the texts of a type, decoded with the current codec. They are
+     * decoded only once, and kept until the codec changes.
+     */
     QStringList Song::getText(TextType type)
     {
+        if ( (type < FIRST_TYPE) || (type > LAST_TYPE) )
+            return QStringList();
+        QMap<TextType, QStringList>::const_iterator it = m_decodedText.constFind(type);
+        if (it != m_decodedText.constEnd())
+            return it.value();
         QStringList list;
-        if ( (type >= FIRST_TYPE) && (type <= LAST_TYPE) ) {
-            foreach(const QByteArray &a, m_text[type]) {
-                QString s = decodeBytes(a);
-                appendStringToList(list, s, type);
-            }
+        foreach(const QByteArray &a, m_text.value(type)) {
+            QString s = decodeBytes(a);
+            appendStringToList(list, s, type);
         }
+        m_decodedText.insert(type, list);
         return list;
     }
 
+    /**
+     * Gets the lyrics fragments up to a given time, inclusive, from the
+     * lyrics timeline.
+     */
     QStringList Song::getLyrics(qint64 time)
     {
-        TextType t;
         QStringList list;
-        TimeStampedData::const_iterator it, end;
-        if (m_text[Lyric].empty()) {
-            t = Text;
-            it = m_text[Text].constBegin();
-            if (m_text[Text].empty())
-                end = m_text[Text].constEnd();
-            else {
-                const TimeStampedData d = m_text[Text];
-                end = d.upperBound(time);
-            }
-        } else {
-            t = Lyric;
-            const TimeStampedData d = m_text[Lyric];
-            it = d.constBegin();
-            end = d.upperBound(time);
-        }
-        for (; it != end; ++it ) {
-            QString s = decodeBytes(it.value());
-            appendStringToList(list, s, t);
+        int n = lyricsCount(time);
+        int start = 0;
+        for (int i = 0; i < n; ++i) {
+            list.append(m_lyricsText.mid(start, m_lyricsEnds.at(i) - start));
+            start = m_lyricsEnds.at(i);
         }
         return list;
     }
 
-    bool Song::guessTextCodec()
+    /**
+     * Writes the song properties, detected encoding, channels summary,
+     * tempo map and meta text.
+     * The file name and the text codec are not written.
+     */
+    void Song::writeProperties(QDataStream& stream) const
     {
-        KEncodingProber prober;
-        TimeStampedData::const_iterator it, end;
-        if (m_text[Lyric].empty()) {
-            it = m_text[Text].constBegin();
-            end = m_text[Text].constEnd();
-        } else {
-            it = m_text[Lyric].constBegin();
-            end = m_text[Lyric].constEnd();
+        stream << qint32(m_format) << qint32(m_ntrks) << qint32(m_division)
+               << qint32(m_initialTempo) << qint32(m_barCount)
+               << qint32(m_lowestNote) << qint32(m_highestNote) << double(m_duration)
+               << m_detectedEncoding;
+        for(int i = 0; i < MIDI_CHANNELS; ++i)
+            stream << m_channelUsed[i] << qint32(m_channelPatches[i]) << m_channelLabel[i];
+        stream << qint32(m_tempoMap.count());
+        for(int i = 0; i < m_tempoMap.count(); ++i)
+            stream << m_tempoMap.at(i).time << m_tempoMap.at(i).tempo;
+        stream << qint32(m_text.count());
+        QMap<TextType, TimeStampedData>::const_iterator it;
+        for(it = m_text.constBegin(); it != m_text.constEnd(); ++it)
+            stream << qint32(it.key()) << it.value();
+    }
+
+    /**
+     * Reads the data written by writeProperties().
+     * @return false if the data is incomplete
+     */
+    bool Song::readProperties(QDataStream& stream)
+    {
+        qint32 format, ntrks, division, initialTempo, barCount, lowestNote, highestNote;
+        double duration;
+        stream >> format >> ntrks >> division >> initialTempo >> barCount
+               >> lowestNote >> highestNote >> duration >> m_detectedEncoding;
+        setHeader(format, ntrks, division);
+        setInitialTempo(initialTempo);
+        setBarCount(barCount);
+        setNoteRange(lowestNote, highestNote);
+        setDuration(duration);
+        for(int i = 0; i < MIDI_CHANNELS; ++i) {
+            bool used;
+            qint32 patch;
+            QByteArray label;
+            stream >> used >> patch >> label;
+            setChannelInfo(i, used, patch, label);
+        }
+        qint32 n;
+        stream >> n;
+        m_tempoMap.clear();
+        m_tempoMap.setDivision(division);
+        for(int i = 0; i < n && stream.status() == QDataStream::Ok; ++i) {
+            quint64 time, tempo;
+            stream >> time >> tempo;
+            m_tempoMap.addTempo(tempo, time);
+        }
+        stream >> n;
+        m_text.clear();
+        m_decodedText.clear();
+        for(int i = 0; i < n && stream.status() == QDataStream::Ok; ++i) {
+            qint32 type;
+            TimeStampedData text;
+            stream >> type >> text;
+            if (type >= FIRST_TYPE && type <= LAST_TYPE)
+                m_text[TextType(type)] = text;
         }
-        if (it == end)
+        return stream.status() == QDataStream::Ok;
+    }
+
+    /**
+     * Writes the song as a precompiled song file.
+     * @see SongFileWriter
+     */
+    bool Song::save(QIODevice& device) const
+    {
+        SongFileWriter writer;
+        return writer.write(&device, *this);
+    }
+
+    /**
+     * Opens a precompiled song file. The events are used in place from
+     * the memory mapped file, which is kept open while the song or any
+     * copy of it is using it.
+     * @return false if the file is not a valid song file
+     */
+    bool Song::open(const QString& fileName)
+    {
+        clear();
+        QSharedPointer<SongFileReader> file(new SongFileReader);
+        if (!file->open(fileName) || !file->readProperties(*this)) {
+            clear();
             return false;
-        for (; it != end; ++it )
+        }
+        setFile(file);
+        return true;
+    }
+
+    /**
+     * Detects the encoding of the lyrics, or the text events when there are
+     * no lyrics. This is the expensive part of guessTextCodec(), done once
+     * by the loader, so the result is stored with the song and the cache.
+     */
+    void Song::detectTextEncoding()
+    {
+        KEncodingProber prober;
+        m_detectedEncoding.clear();
+        QMap<TextType, TimeStampedData>::const_iterator found = m_text.constFind(Lyric);
+        if (found == m_text.constEnd() || found.value().isEmpty())
+            found = m_text.constFind(Text);
+        if (found == m_text.constEnd() || found.value().isEmpty())
+            return;
+        TimeStampedData::const_iterator it, end = found.value().constEnd();
+        for (it = found.value().constBegin(); it != end; ++it )
             prober.feed( it.value() );
-        if ( prober.confidence() > 0.6 ) {
-            QTextCodec *codec = QTextCodec::codecForName(prober.encoding());
-            if (codec == NULL)
-                kWarning() << "Unsupported encoding detected:" << prober.encoding();
-            else {
-                setTextCodec(codec);
-                return true;
-            }
+        if ( prober.confidence() > 0.6 )
+            m_detectedEncoding = prober.encoding();
+    }
+
+    /**
+     * Sets the text codec for the encoding found by detectTextEncoding().
+     * @return true if a supported encoding was detected
+     */
+    bool Song::guessTextCodec()
+    {
+        if (m_detectedEncoding.isEmpty())
+            return false;
+        QTextCodec *codec = QTextCodec::codecForName(m_detectedEncoding);
+        if (codec == NULL) {
+            kWarning() << "Unsupported encoding detected:" << m_detectedEncoding;
+            return false;
         }
-        return false;
+        if (codec != m_codec)
+            setTextCodec(codec);
+        return true;
     }
 
 }
@@ -22,16 +22,62 @@
 
 #include <QStringList>
 #include <QMap>
+#include <QVector>
+#include <QSharedPointer>
 #include <alsaevent.h>
+#include <qsmf.h>
 #include "midiobject.h"
+#include "chasestate.h"
+#include "songfile.h"
 
 class QTextCodec;
+class QIODevice;
+class QDataStream;
 
 using namespace drumstick;
 
 namespace KMid {
 
-    class Song : public QList<SequencerEvent*>
+    /**
+     * Compact storage of sequencer events. The ALSA event records are kept
+     * in a contiguous array, and the variable length data of events like
+     * SysEx and lyrics is appended to a separate byte buffer. Alternatively,
+     * the events may be read in place from a memory mapped song file set
+     * with setFile(); such a list can not be appended to.
+     */
+    class EventList
+    {
+    public:
+        EventList() { }
+
+        void clear();
+        void reserve(int size);
+        void append(const snd_seq_event_t* ev);
+        void append(const EventList& other, int i);
+        void copyEvent(int i, snd_seq_event_t* ev) const;
+        int indexOf(snd_seq_tick_time_t tick) const;
+        void setFile(const QSharedPointer<SongFileReader>& file);
+
+        bool isMapped() const { return !m_file.isNull(); }
+        int count() const { return m_file.isNull() ? m_events.count() : m_file->eventCount(); }
+        bool isEmpty() const { return count() == 0; }
+        const snd_seq_event_t& at(int i) const
+        {
+            return m_file.isNull() ? m_events.at(i) : m_file->event(i);
+        }
+        snd_seq_event_type_t getType(int i) const { return at(i).type; }
+        snd_seq_tick_time_t getTick(int i) const { return at(i).time.tick; }
+        snd_seq_tick_time_t getLastTick() const { return at(count() - 1).time.tick; }
+
+    private:
+        const char* eventData(const snd_seq_event_t& ev) const;
+
+        QVector<snd_seq_event_t> m_events;
+        QByteArray m_data;
+        QSharedPointer<SongFileReader> m_file;
+    };
+
+    class Song : public EventList
     {
     public:
 
@@ -52,33 +98,74 @@ namespace KMid {
             FIRST_TYPE = Text, LAST_TYPE = KarWarnings
         };
 
-        Song() : QList<SequencerEvent*>(),
+        Song() : EventList(),
             m_format(0),
             m_ntrks(0),
             m_division(0),
+            m_initialTempo(0),
+            m_barCount(0),
+            m_lowestNote(127),
+            m_highestNote(0),
+            m_duration(0),
             m_codec(0)
-        { }
+        {
+            clearChannels();
+        }
         virtual ~Song();
 
         void clear();
-        void sort();
         void setHeader(int format, int ntrks, int division);
         void setFileName(const QString& fileName);
+        void setTempoMap(const QSmfTempoMap& tempoMap);
         void addMetaData(TextType type, const QByteArray& text, const qint64 tick);
         void setTextCodec(QTextCodec *c);
+        void detectTextEncoding();
         bool guessTextCodec();
+        void updateChaseStates();
+        ChaseState getChaseState(int index) const;
+        void setInitialTempo(int tempo) { m_initialTempo = tempo; }
+        void setBarCount(int bars) { m_barCount = bars; }
+        void setNoteRange(int lowest, int highest);
+        void setDuration(qreal seconds) { m_duration = seconds; }
+        void setChannelInfo(int channel, bool used, int patch, const QByteArray& label);
 
         int getFormat() const { return m_format; }
         int getTracks() const { return m_ntrks; }
         int getDivision() const { return m_division; }
         QString getFileName() const { return m_fileName; }
         QTextCodec* getTextCodec() const { return m_codec; }
+        QByteArray getDetectedEncoding() const { return m_detectedEncoding; }
+        const QSmfTempoMap& getTempoMap() const { return m_tempoMap; }
+        int getInitialTempo() const { return m_initialTempo; }
+        int getBarCount() const { return m_barCount; }
+        int getLowestNote() const { return m_lowestNote; }
+        int getHighestNote() const { return m_highestNote; }
+        qreal getDuration() const { return m_duration; }
+        bool isChannelUsed(int channel) const { return m_channelUsed[channel]; }
+        int getChannelPatch(int channel) const { return m_channelPatches[channel]; }
+        QByteArray getChannelLabel(int channel) const { return m_channelLabel[channel]; }
+        qreal ticksToSeconds(qint64 tick) const;
+        unsigned int ticksWithin(qreal msecs) const;
         QStringList getText(TextType type);
         QStringList getLyrics(qint64 time);
+        QString getLyricsText() const { return m_lyricsText; }
+        int getLyricsOffset(qint64 time) const;
+        bool save(QIODevice& device) const;
+        bool open(const QString& fileName);
+        void writeProperties(QDataStream& stream) const;
+        bool readProperties(QDataStream& stream);
+
+        /**
+         * Number of events between two chase state snapshots
+         */
+        static const int CHASE_INTERVAL = 1024;
 
     private:
         void appendStringToList(QStringList &list, QString &s, TextType type = Text);
         QString decodeBytes(const QByteArray &ba);
+        void clearChannels();
+        void updateLyrics();
+        int lyricsCount(qint64 time) const;
 
         /**
          * Time-stamped data, like lyrics and similar meta data
@@ -88,12 +175,35 @@ namespace KMid {
         int m_format;
         int m_ntrks;
         int m_division;
+        int m_initialTempo;
+        int m_barCount;
+        int m_lowestNote;
+        int m_highestNote;
+        qreal m_duration;
+        bool m_channelUsed[MIDI_CHANNELS];
+        int m_channelPatches[MIDI_CHANNELS];
+        QByteArray m_channelLabel[MIDI_CHANNELS];
         QTextCodec *m_codec;
+        QByteArray m_detectedEncoding;
         QString m_fileName;
+        QSmfTempoMap m_tempoMap;
         QMap<TextType, TimeStampedData> m_text;
+        QVector<ChaseState> m_chaseStates;
+
+        /**
+         * Lyrics timeline: the decoded and normalized lyrics, or the text
+         * events when there are no lyrics, and for each fragment its time
+         * and the offset of its end in the text.
+         */
+        QString m_lyricsText;
+        QVector<qint64> m_lyricsTicks;
+        QVector<int> m_lyricsEnds;
+
+        /**
+         * Texts already decoded with the current codec, by type
+         */
+        QMap<TextType, QStringList> m_decodedText;
     };
-    
-    typedef QListIterator<SequencerEvent*> SongIterator;
 
 }
 
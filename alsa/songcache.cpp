@@ -0,0 +1,210 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "songcache.h"
+#include "song.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QThread>
+#include <KDebug>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+namespace KMid {
+
+    /**
+     * Creates a cache storing its files in a directory. An empty directory
+     * name disables the cache.
+     */
+    SongCache::SongCache(const QString& directory)
+        : m_directory(directory),
+        m_maximumSize(DEFAULT_MAXIMUM_SIZE),
+        m_hits(0),
+        m_misses(0)
+    { }
+
+    /**
+     * Gets the cache key of a local file, from its path, inode, size and
+     * modification time. The contents are not read. A file modified in the
+     * last seconds may still be written within the resolution of the file
+     * system timestamps, so it gets no key and the caller must use
+     * dataKey() instead.
+     * @return the key, or an empty key for a recently modified file
+     */
+    QByteArray SongCache::fileKey(const QString& localFile)
+    {
+        static const qint64 RECENT_MSECS = 2000;
+        QFileInfo info(localFile);
+        qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        if (QDateTime::currentMSecsSinceEpoch() - modified < RECENT_MSECS)
+            return QByteArray();
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(info.absoluteFilePath().toUtf8());
+        hash.addData(QByteArray::number(info.size()));
+        hash.addData(QByteArray::number(modified));
+        struct stat st;
+        if (::stat(QFile::encodeName(info.absoluteFilePath()).constData(), &st) == 0) {
+            hash.addData(QByteArray::number(quint64(st.st_dev)));
+            hash.addData(QByteArray::number(quint64(st.st_ino)));
+        }
+        return hash.result().toHex();
+    }
+
+    /**
+     * Gets the cache key of the contents of a file.
+     */
+    QByteArray SongCache::dataKey(const QByteArray& data)
+    {
+        return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    }
+
+    /**
+     * Gets the name of the cache file for a key.
+     */
+    QString SongCache::fileName(const QByteArray& key) const
+    {
+        return QDir(m_directory).filePath(QString::fromLatin1(key) + QLatin1String(".song"));
+    }
+
+    /**
+     * Opens a song from the cache. The events are used in place from the
+     * mapped file. A cached file that can not be read by this version of
+     * the program is removed.
+     * @return true if the song was found in the cache
+     */
+    bool SongCache::load(const QByteArray& key, Song& song)
+    {
+        if (!isEnabled())
+            return false;
+        QString file = fileName(key);
+        bool ok = song.open(file);
+        if (!ok && QFile::exists(file)) {
+            kDebug() << "removing invalid cache file" << file;
+            QFile::remove(file);
+        }
+        if (ok) {
+            // the modification time of the cache files orders them by use
+            ::utime(QFile::encodeName(file).constData(), NULL);
+            m_hits.ref();
+        } else
+            m_misses.ref();
+        return ok;
+    }
+
+    /**
+     * Saves a song in the cache. The file is written with a temporary name
+     * and then renamed, so other threads never see a partial file.
+     */
+    void SongCache::store(const QByteArray& key, const Song& song)
+    {
+        if (!isEnabled())
+            return;
+        QFile file(temporaryFileName(key));
+        if (!file.open(QIODevice::WriteOnly)) {
+            kWarning() << "cannot create the cache file" << file.fileName();
+            return;
+        }
+        bool ok = song.save(file);
+        file.close();
+        if (ok)
+            ok = storeFile(key, file.fileName());
+        else
+            file.remove();
+        if (!ok)
+            kWarning() << "cannot write the cache file" << fileName(key);
+    }
+
+    /**
+     * Gets a name for writing a cache file, unique for the calling thread,
+     * to be stored later with storeFile().
+     */
+    QString SongCache::temporaryFileName(const QByteArray& key) const
+    {
+        return fileName(key) + QString(".%1.tmp")
+            .arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+    }
+
+    /**
+     * Moves an already written song file into the cache. The file is
+     * renamed, so other threads never see a partial file.
+     * @return false if the file could not be moved
+     */
+    bool SongCache::storeFile(const QByteArray& key, const QString& songFile)
+    {
+        QString target = fileName(key);
+        QFile::remove(target);
+        if (QFile::rename(songFile, target)) {
+            expire();
+            return true;
+        }
+        QFile::remove(songFile);
+        return false;
+    }
+
+    /**
+     * Sets the limit of the total size of the cache files.
+     * @param bytes the maximum size, or zero for no limit
+     */
+    void SongCache::setMaximumSize(qint64 bytes)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_maximumSize = qMax(Q_INT64_C(0), bytes);
+    }
+
+    qint64 SongCache::maximumSize() const
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_maximumSize;
+    }
+
+    /**
+     * Removes the least recently used cache files until the total size is
+     * within maximumSize(). Songs opened from the removed files keep their
+     * mappings. Nothing is done while another thread is expiring files.
+     */
+    void SongCache::expire()
+    {
+        if (!isEnabled() || !m_mutex.tryLock())
+            return;
+        qint64 limit = m_maximumSize;
+        if (limit <= 0) {
+            m_mutex.unlock();
+            return;
+        }
+        QFileInfoList files = QDir(m_directory).entryInfoList(
+                QStringList(QLatin1String("*.song")), QDir::Files,
+                QDir::Time | QDir::Reversed);
+        qint64 total = 0;
+        foreach(const QFileInfo& info, files)
+            total += info.size();
+        for (int i = 0; i < files.count() && total > limit; ++i) {
+            if (QFile::remove(files[i].absoluteFilePath()))
+                total -= files[i].size();
+        }
+        m_mutex.unlock();
+    }
+
+}
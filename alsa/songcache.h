@@ -0,0 +1,81 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef INCLUDED_SONGCACHE_H
+#define INCLUDED_SONGCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QMutex>
+
+namespace KMid {
+
+    class Song;
+
+    /**
+     * Disk cache of loaded songs. Each song is saved with Song::save() in a
+     * file named after a key of its source: a hash of the path, inode, size
+     * and modification time for local files, or a hash of the contents for
+     * downloaded files. Opening a cached song is a memory mapping of the
+     * file and a validation of its header, see SongFileReader. The cache
+     * may be used from several threads at once.
+     *
+     * The total size of the cache files is limited by maximumSize(): when
+     * a song is stored, the least recently used files are removed.
+     */
+    class SongCache
+    {
+    public:
+        /**
+         * Default limit of the total size of the cache files, in bytes
+         */
+        static const qint64 DEFAULT_MAXIMUM_SIZE = Q_INT64_C(256) << 20;
+
+        explicit SongCache(const QString& directory);
+
+        static QByteArray fileKey(const QString& localFile);
+        static QByteArray dataKey(const QByteArray& data);
+
+        bool load(const QByteArray& key, Song& song);
+        void store(const QByteArray& key, const Song& song);
+        bool storeFile(const QByteArray& key, const QString& songFile);
+        QString fileName(const QByteArray& key) const;
+        QString temporaryFileName(const QByteArray& key) const;
+        void setMaximumSize(qint64 bytes);
+        qint64 maximumSize() const;
+        void expire();
+
+        QString directory() const { return m_directory; }
+        bool isEnabled() const { return !m_directory.isEmpty(); }
+        int hits() const { return m_hits.load(); }
+        int misses() const { return m_misses.load(); }
+
+    private:
+        QString m_directory;
+        qint64 m_maximumSize;
+        mutable QMutex m_mutex;
+        QAtomicInt m_hits;
+        QAtomicInt m_misses;
+    };
+
+}
+
+#endif /*INCLUDED_SONGCACHE_H*/
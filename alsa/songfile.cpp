@@ -0,0 +1,313 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include "songfile.h"
+#include "song.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <QDataStream>
+#include <QIODevice>
+
+namespace KMid {
+
+    static const char SONG_FILE_MAGIC[4] = { 'K', 'M', 'S', 'F' };
+    static const int WRITE_BUFFER_EVENTS = 4096;
+
+    static inline quint64 alignedSize(quint64 size)
+    {
+        return (size + 7) & ~quint64(7);
+    }
+
+    static bool writeSection(QIODevice* device, const char* data, quint64 size)
+    {
+        static const char padding[8] = { 0 };
+        quint64 pad = alignedSize(size) - size;
+        return device->write(data, size) == qint64(size) &&
+               device->write(padding, pad) == qint64(pad);
+    }
+
+    static bool validSection(quint64 offset, quint64 count, quint64 size, qint64 fileSize)
+    {
+        return offset % 8 == 0 && offset <= quint64(fileSize) &&
+               count <= quint64(INT_MAX / size) &&
+               count * size <= quint64(fileSize) - offset;
+    }
+
+    SongFileWriter::SongFileWriter() :
+        m_device(0),
+        m_count(0),
+        m_lastTick(0),
+        m_ok(false)
+    { }
+
+    /**
+     * Starts writing a song file to an open device. The header is written
+     * again by finish(), when the size of the sections is known.
+     */
+    bool SongFileWriter::begin(QIODevice* device)
+    {
+        m_device = device;
+        m_buffer.clear();
+        m_buffer.reserve(WRITE_BUFFER_EVENTS);
+        m_data.clear();
+        m_chaseStates.clear();
+        m_index.clear();
+        m_state.clear();
+        m_count = 0;
+        m_lastTick = 0;
+        SongFileHeader header;
+        ::memset(&header, 0, sizeof(header));
+        m_ok = writeSection(m_device, reinterpret_cast<const char*>(&header), sizeof(header));
+        return m_ok;
+    }
+
+    /**
+     * Appends an event. The events must be appended sorted by time, and the
+     * variable length data of the event, if any, is copied.
+     */
+    void SongFileWriter::appendEvent(const snd_seq_event_t* ev)
+    {
+        if (m_count % Song::CHASE_INTERVAL == 0)
+            m_chaseStates.append(m_state);
+        if (m_count % SongFileHeader::INDEX_INTERVAL == 0)
+            m_index.append(ev->time.tick);
+        m_state.update(*ev);
+        m_buffer.append(*ev);
+        snd_seq_event_t& rec = m_buffer.last();
+        rec.source.client = 0;
+        rec.source.port = 0;
+        rec.dest.client = 0;
+        rec.dest.port = 0;
+        rec.queue = 0;
+        if (rec.type == SND_SEQ_EVENT_TEMPO)
+            rec.data.queue.queue = 0;
+        if (snd_seq_ev_is_variable(ev)) {
+            rec.data.ext.ptr = reinterpret_cast<void*>(quintptr(m_data.size()));
+            m_data.append(static_cast<const char*>(ev->data.ext.ptr), ev->data.ext.len);
+        }
+        m_lastTick = ev->time.tick;
+        m_count++;
+        if (m_buffer.count() == WRITE_BUFFER_EVENTS)
+            flush();
+    }
+
+    bool SongFileWriter::flush()
+    {
+        if (m_ok && !m_buffer.isEmpty()) {
+            qint64 size = m_buffer.count() * sizeof(snd_seq_event_t);
+            m_ok = m_device->write(reinterpret_cast<const char*>(m_buffer.constData()), size) == size;
+        }
+        m_buffer.clear();
+        return m_ok;
+    }
+
+    /**
+     * Writes the sections following the events, with the properties and
+     * meta data of a song, and the header.
+     * @param song the song providing the properties; its events are ignored
+     * @return true if the file has been written successfully
+     */
+    bool SongFileWriter::finish(const Song& song)
+    {
+        if (!flush())
+            return false;
+        QByteArray meta;
+        QDataStream stream(&meta, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_6);
+        song.writeProperties(stream);
+
+        SongFileHeader header;
+        ::memset(&header, 0, sizeof(header));
+        ::memcpy(header.magic, SONG_FILE_MAGIC, sizeof(header.magic));
+        header.version = SongFileHeader::VERSION;
+        header.byteOrder = SongFileHeader::BYTE_ORDER;
+        header.eventSize = sizeof(snd_seq_event_t);
+        header.pointerSize = sizeof(void*);
+        header.chaseSize = sizeof(ChaseState);
+        header.eventsOffset = alignedSize(sizeof(header));
+        header.eventCount = m_count;
+        header.dataOffset = header.eventsOffset + alignedSize(m_count * sizeof(snd_seq_event_t));
+        header.dataSize = m_data.size();
+        header.chaseOffset = header.dataOffset + alignedSize(header.dataSize);
+        header.chaseCount = m_chaseStates.count();
+        header.indexOffset = header.chaseOffset +
+                             alignedSize(header.chaseCount * sizeof(ChaseState));
+        header.indexCount = m_index.count();
+        header.metaOffset = header.indexOffset + alignedSize(header.indexCount * sizeof(quint32));
+        header.metaSize = meta.size();
+
+        // the events were written unpadded
+        static const char padding[8] = { 0 };
+        qint64 pad = header.dataOffset - header.eventsOffset - m_count * sizeof(snd_seq_event_t);
+        m_ok = m_device->write(padding, pad) == pad &&
+               writeSection(m_device, m_data.constData(), m_data.size()) &&
+               writeSection(m_device, reinterpret_cast<const char*>(m_chaseStates.constData()),
+                            m_chaseStates.count() * sizeof(ChaseState)) &&
+               writeSection(m_device, reinterpret_cast<const char*>(m_index.constData()),
+                            m_index.count() * sizeof(quint32)) &&
+               writeSection(m_device, meta.constData(), meta.size()) &&
+               m_device->seek(0) &&
+               writeSection(m_device, reinterpret_cast<const char*>(&header), sizeof(header));
+        m_data.clear();
+        m_chaseStates.clear();
+        m_index.clear();
+        return m_ok;
+    }
+
+    /**
+     * Writes a whole song to an open device.
+     */
+    bool SongFileWriter::write(QIODevice* device, const Song& song)
+    {
+        if (!begin(device))
+            return false;
+        snd_seq_event_t ev;
+        for(int i = 0; i < song.count() && m_ok; ++i) {
+            song.copyEvent(i, &ev);
+            appendEvent(&ev);
+        }
+        return finish(song);
+    }
+
+    SongFileReader::SongFileReader() :
+        m_map(0),
+        m_events(0),
+        m_eventCount(0),
+        m_data(0),
+        m_dataSize(0),
+        m_chaseStates(0),
+        m_chaseCount(0),
+        m_index(0),
+        m_indexCount(0),
+        m_meta(0),
+        m_metaSize(0)
+    { }
+
+    SongFileReader::~SongFileReader()
+    {
+        close();
+    }
+
+    /**
+     * Maps a song file in memory, validating its header and the bounds of
+     * its sections. The contents of the sections are not read.
+     * @return false if the file is not a valid song file for this machine
+     */
+    bool SongFileReader::open(const QString& fileName)
+    {
+        close();
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::ReadOnly))
+            return false;
+        qint64 size = m_file.size();
+        SongFileHeader header;
+        if (size < qint64(sizeof(header)) ||
+            m_file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+            ::memcmp(header.magic, SONG_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SongFileHeader::VERSION ||
+            header.byteOrder != SongFileHeader::BYTE_ORDER ||
+            header.eventSize != sizeof(snd_seq_event_t) ||
+            header.pointerSize != sizeof(void*) ||
+            header.chaseSize != sizeof(ChaseState) ||
+            !validSection(header.eventsOffset, header.eventCount, sizeof(snd_seq_event_t), size) ||
+            !validSection(header.dataOffset, header.dataSize, 1, size) ||
+            !validSection(header.chaseOffset, header.chaseCount, sizeof(ChaseState), size) ||
+            !validSection(header.indexOffset, header.indexCount, sizeof(quint32), size) ||
+            !validSection(header.metaOffset, header.metaSize, 1, size) ||
+            header.indexCount != (header.eventCount + SongFileHeader::INDEX_INTERVAL - 1) /
+                                 SongFileHeader::INDEX_INTERVAL) {
+            m_file.close();
+            return false;
+        }
+        m_map = m_file.map(0, size);
+        if (m_map == NULL) {
+            m_file.close();
+            return false;
+        }
+        m_events = reinterpret_cast<const snd_seq_event_t*>(m_map + header.eventsOffset);
+        m_eventCount = header.eventCount;
+        m_data = reinterpret_cast<const char*>(m_map + header.dataOffset);
+        m_dataSize = header.dataSize;
+        m_chaseStates = reinterpret_cast<const ChaseState*>(m_map + header.chaseOffset);
+        m_chaseCount = header.chaseCount;
+        m_index = reinterpret_cast<const quint32*>(m_map + header.indexOffset);
+        m_indexCount = header.indexCount;
+        m_meta = reinterpret_cast<const char*>(m_map + header.metaOffset);
+        m_metaSize = header.metaSize;
+        return true;
+    }
+
+    void SongFileReader::close()
+    {
+        if (m_map != NULL) {
+            m_file.unmap(m_map);
+            m_file.close();
+        }
+        m_map = 0;
+        m_events = 0;
+        m_eventCount = 0;
+        m_data = 0;
+        m_dataSize = 0;
+        m_chaseStates = 0;
+        m_chaseCount = 0;
+        m_index = 0;
+        m_indexCount = 0;
+        m_meta = 0;
+        m_metaSize = 0;
+    }
+
+    /**
+     * Reads the song properties, channels summary, tempo map and meta text
+     * into a song. The events are not read.
+     */
+    bool SongFileReader::readProperties(Song& song) const
+    {
+        if (m_meta == NULL)
+            return false;
+        QByteArray meta = QByteArray::fromRawData(m_meta, m_metaSize);
+        QDataStream stream(meta);
+        stream.setVersion(QDataStream::Qt_4_6);
+        return song.readProperties(stream);
+    }
+
+    /**
+     * Finds the first event at or after a given time. The tick index is
+     * searched first, and then only the events between two index entries.
+     * @return The index of the event, or eventCount() if there is none
+     */
+    int SongFileReader::indexOf(snd_seq_tick_time_t tick) const
+    {
+        static const int interval = SongFileHeader::INDEX_INTERVAL;
+        int n = std::lower_bound(m_index, m_index + m_indexCount, tick) - m_index;
+        const snd_seq_event_t* first = m_events + qMax(0, n - 1) * interval;
+        const snd_seq_event_t* last = m_events + qMin(n * interval, m_eventCount);
+        while (first < last) {
+            const snd_seq_event_t* middle = first + (last - first) / 2;
+            if (middle->time.tick < tick)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return first - m_events;
+    }
+
+}
@@ -0,0 +1,160 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef INCLUDED_SONGFILE_H
+#define INCLUDED_SONGFILE_H
+
+#include <QFile>
+#include <QVector>
+#include <alsaevent.h>
+#include "chasestate.h"
+
+class QIODevice;
+
+namespace KMid {
+
+    class Song;
+
+    /**
+     * Header of a precompiled song file. This is the playback format of the
+     * songs, designed to be memory mapped and used in place. It is stored
+     * in the native byte order, and every section starts at a multiple of
+     * 8 bytes from the beginning of the file:
+     *
+     * - events: eventCount fixed size records of type snd_seq_event_t,
+     *   sorted by tick. The source, destination and queue addresses are
+     *   zero, and they are assigned by the Player. The variable length
+     *   events hold in data.ext.ptr the offset of their data in the data
+     *   section instead of a pointer.
+     * - data: the variable length data of the events, like SysEx messages
+     *   and lyrics, one after another.
+     * - chase: chaseCount ChaseState records. Record n is the state of the
+     *   channels before the event at index n * Song::CHASE_INTERVAL.
+     * - index: indexCount quint32 values. Value n is the tick of the event
+     *   at index n * INDEX_INTERVAL, so the event at a given time can be
+     *   found touching a small part of the events section.
+     * - meta: the song properties, channels summary, tempo map and meta
+     *   text, serialized with QDataStream by Song::writeProperties().
+     *
+     * Files written with a different version, byte order or record sizes
+     * are rejected by the reader.
+     */
+    struct SongFileHeader {
+        static const quint32 VERSION = 3;
+        static const quint32 BYTE_ORDER = 0x01020304;
+        static const int INDEX_INTERVAL = 256;
+
+        char magic[4];
+        quint32 version;
+        quint32 byteOrder;
+        quint32 eventSize;
+        quint32 pointerSize;
+        quint32 chaseSize;
+        quint64 eventsOffset;
+        quint64 eventCount;
+        quint64 dataOffset;
+        quint64 dataSize;
+        quint64 chaseOffset;
+        quint64 chaseCount;
+        quint64 indexOffset;
+        quint64 indexCount;
+        quint64 metaOffset;
+        quint64 metaSize;
+    };
+
+    /**
+     * Writes a precompiled song file. The events are appended one by one,
+     * already sorted by time, and written to the device in blocks, while
+     * the chase states and the tick index are built. The remaining sections
+     * are written by finish(), so a song can be converted without keeping
+     * its events in memory. The device must be seekable.
+     */
+    class SongFileWriter
+    {
+    public:
+        SongFileWriter();
+
+        bool begin(QIODevice* device);
+        void appendEvent(const snd_seq_event_t* ev);
+        bool finish(const Song& song);
+        bool write(QIODevice* device, const Song& song);
+
+        int count() const { return m_count; }
+        snd_seq_tick_time_t lastTick() const { return m_lastTick; }
+
+    private:
+        bool flush();
+
+        QIODevice* m_device;
+        QVector<snd_seq_event_t> m_buffer;
+        QByteArray m_data;
+        QVector<ChaseState> m_chaseStates;
+        QVector<quint32> m_index;
+        ChaseState m_state;
+        int m_count;
+        snd_seq_tick_time_t m_lastTick;
+        bool m_ok;
+    };
+
+    /**
+     * Reads a precompiled song file in place. The file is memory mapped,
+     * and only the header is validated when it is opened. The events, their
+     * data and the chase states are used directly from the mapping, without
+     * copies, so the pages of the file are read by the system only when
+     * the Player reaches them.
+     */
+    class SongFileReader
+    {
+    public:
+        SongFileReader();
+        ~SongFileReader();
+
+        bool open(const QString& fileName);
+        void close();
+        bool readProperties(Song& song) const;
+        int indexOf(snd_seq_tick_time_t tick) const;
+
+        bool isOpen() const { return m_map != NULL; }
+        QString fileName() const { return m_file.fileName(); }
+        int eventCount() const { return m_eventCount; }
+        const snd_seq_event_t& event(int i) const { return m_events[i]; }
+        const char* data() const { return m_data; }
+        int dataSize() const { return m_dataSize; }
+        int chaseStateCount() const { return m_chaseCount; }
+        const ChaseState& chaseState(int i) const { return m_chaseStates[i]; }
+
+    private:
+        QFile m_file;
+        uchar* m_map;
+        const snd_seq_event_t* m_events;
+        int m_eventCount;
+        const char* m_data;
+        int m_dataSize;
+        const ChaseState* m_chaseStates;
+        int m_chaseCount;
+        const quint32* m_index;
+        int m_indexCount;
+        const char* m_meta;
+        int m_metaSize;
+    };
+
+}
+
+#endif /*INCLUDED_SONGFILE_H*/
@@ -0,0 +1,540 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "songloader.h"
+#include "trackloader.h"
+#include "songcache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <alsaevent.h>
+
+#include <QFile>
+#include <QThreadPool>
+#include <QVector>
+
+namespace KMid {
+
+    SongLoader::SongLoader(int clientId, int portId, int queueId, QObject *parent)
+        : QThread(parent),
+        m_clientId(clientId),
+        m_portId(portId),
+        m_queueId(queueId),
+        m_engine(0),
+        m_cache(0),
+        m_writer(0),
+        m_cancel(0),
+        m_ok(false),
+        m_progress(-1),
+        m_lastBeat(0),
+        m_beatLength(0),
+        m_beatMax(4),
+        m_barCount(0),
+        m_beatCount(0)
+    { }
+
+    SongLoader::~SongLoader()
+    {
+        cancel();
+        wait();
+    }
+
+    /**
+     * Starts loading a file in the worker thread.
+     * @param fileName the name of the song, usually an URL
+     * @param localFile the local file to be read
+     */
+    void SongLoader::load(const QString& fileName, const QString& localFile)
+    {
+        m_fileName = fileName;
+        m_localFile = localFile;
+        m_data.clear();
+        m_cancel.storeRelease(0);
+        start();
+    }
+
+    /**
+     * Starts loading the contents of a downloaded file in the worker thread.
+     * @param fileName the name of the song, usually an URL
+     * @param data the file contents
+     */
+    void SongLoader::load(const QString& fileName, const QByteArray& data)
+    {
+        m_fileName = fileName;
+        m_localFile.clear();
+        m_data = data;
+        m_cancel.storeRelease(0);
+        start();
+    }
+
+    /**
+     * Requests a load in progress to be abandoned as soon as possible.
+     */
+    void SongLoader::cancel()
+    {
+        m_cancel.storeRelease(1);
+    }
+
+    void SongLoader::run()
+    {
+        if (m_localFile.isEmpty())
+            loadData(m_fileName, m_data);
+        else
+            loadFile(m_fileName, m_localFile);
+        m_data.clear();
+    }
+
+    /**
+     * Moves the loaded song to another one, leaving the loader empty.
+     * The events are implicitly shared, not copied.
+     */
+    void SongLoader::takeSong(Song& song)
+    {
+        song = m_song;
+        m_song.clear();
+        m_fileName.clear();
+        m_ok = false;
+    }
+
+    /**
+     * Gets the contents of an open file, mapped in memory when possible.
+     * The mapping, if any, must be released by the caller.
+     */
+    static QByteArray fileContents(QFile& file, uchar** map)
+    {
+        *map = file.map(0, file.size());
+        if (*map != NULL)
+            return QByteArray::fromRawData(reinterpret_cast<const char *>(*map), file.size());
+        return file.readAll();
+    }
+
+    /**
+     * Loads a file in the calling thread. The file is mapped in memory
+     * when possible.
+     * @return true if the song has been loaded
+     */
+    bool SongLoader::loadFile(const QString& fileName, const QString& localFile)
+    {
+        QFile file(localFile);
+        if (!file.open(QIODevice::ReadOnly)) {
+            m_fileName = fileName;
+            m_ok = false;
+            m_errors.clear();
+            m_song.clear();
+            return false;
+        }
+        uchar *map = 0;
+        QByteArray data = fileContents(file, &map);
+        QByteArray key;
+        if (m_cache != 0 && m_cache->isEnabled()) {
+            key = SongCache::fileKey(localFile);
+            if (key.isEmpty())
+                key = SongCache::dataKey(data);
+        }
+        bool ok = loadData(fileName, data, key);
+        if (map != NULL)
+            file.unmap(map);
+        return ok;
+    }
+
+    /**
+     * Loads the contents of a SMF in the calling thread.
+     * @return true if the song has been loaded
+     */
+    bool SongLoader::loadData(const QString& fileName, const QByteArray& data)
+    {
+        QByteArray key;
+        if (m_cache != 0 && m_cache->isEnabled())
+            key = SongCache::dataKey(data);
+        return loadData(fileName, data, key);
+    }
+
+    /**
+     * Gets the song from the cache, or parses the data and stores the song
+     * in the cache when it has been loaded without errors.
+     * @param key the cache key, or an empty key to skip the cache
+     */
+    bool SongLoader::loadData(const QString& fileName, const QByteArray& data,
+                              const QByteArray& key)
+    {
+        m_fileName = fileName;
+        m_ok = false;
+        m_errors.clear();
+        m_song.clear();
+        m_progress = -1;
+        setProgress(0);
+        if (!key.isEmpty() && m_cache->load(key, m_song)) {
+            m_song.setFileName(m_fileName);
+            m_ok = true;
+            setProgress(100);
+        } else if (!key.isEmpty() && data.size() >= LARGE_FILE_SIZE) {
+            if (convertToCache(data, key) && !cancelled()) {
+                m_song.setFileName(m_fileName);
+                m_ok = true;
+                setProgress(100);
+            } else
+                m_song.clear();
+        } else if (loadSong(data) && !cancelled()) {
+            m_ok = true;
+            if (!key.isEmpty() && m_errors.isEmpty())
+                m_cache->store(key, m_song);
+            setProgress(100);
+        } else
+            m_song.clear();
+        return m_ok;
+    }
+
+    /**
+     * Converts a SMF into a precompiled song file, in the calling thread.
+     * The tracks are spooled to temporary song files and merged into the
+     * new one, so the events are never kept in memory all at once.
+     * @return true if the song file has been written
+     * @see SongFileWriter
+     */
+    bool SongLoader::convertFile(const QString& localFile, const QString& songFile)
+    {
+        m_fileName = localFile;
+        m_ok = false;
+        m_errors.clear();
+        m_song.clear();
+        m_progress = -1;
+        QFile file(localFile);
+        if (!file.open(QIODevice::ReadOnly))
+            return false;
+        setProgress(0);
+        uchar *map = 0;
+        QByteArray data = fileContents(file, &map);
+        bool ok = convertData(data, songFile);
+        if (map != NULL)
+            file.unmap(map);
+        m_song.clear();
+        if (ok)
+            setProgress(100);
+        return ok;
+    }
+
+    bool SongLoader::convertData(const QByteArray& data, const QString& songFile)
+    {
+        QFile file(songFile);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        SongFileWriter writer;
+        bool ok = writer.begin(&file);
+        if (ok) {
+            m_writer = &writer;
+            ok = loadSong(data) && !cancelled();
+            m_writer = 0;
+        }
+        ok = ok && writer.finish(m_song);
+        file.close();
+        if (!ok)
+            file.remove();
+        return ok;
+    }
+
+    /**
+     * Converts a SMF into the cache, and opens the song file. Songs with
+     * errors are opened, but not kept in the cache, so the messages are
+     * shown again the next time.
+     */
+    bool SongLoader::convertToCache(const QByteArray& data, const QByteArray& key)
+    {
+        QString songFile = m_cache->temporaryFileName(key);
+        if (!convertData(data, songFile))
+            return false;
+        if (m_errors.isEmpty())
+            return m_cache->storeFile(key, songFile) &&
+                   m_song.open(m_cache->fileName(key));
+        bool ok = m_song.open(songFile);
+        QFile::remove(songFile);
+        return ok;
+    }
+
+    void SongLoader::setProgress(int percent)
+    {
+        if (percent != m_progress) {
+            m_progress = percent;
+            emit progress(percent);
+        }
+    }
+
+    bool SongLoader::loadSong(const QByteArray& data)
+    {
+        bool ok = false;
+        m_lastBeat = 0;
+        m_beatLength = 0;
+        m_beatMax = 4;
+        m_barCount = 0;
+        m_beatCount = 0;
+        QSmf engine;
+        engine.setHandler(this);
+        m_engine = &engine;
+        try {
+            ok = parseTracks(data);
+            int count = (m_writer != 0) ? m_writer->count() : m_song.count();
+            if (ok && count > 0) {
+                addSongPadding();
+                if (m_writer == 0)
+                    m_song.updateChaseStates();
+                if (m_song.getInitialTempo() == 0)
+                    m_song.setInitialTempo(500000);
+                m_song.setBarCount(m_barCount);
+                m_song.setFileName(m_fileName);
+                m_song.detectTextEncoding();
+            }
+        } catch (...) {
+            ok = false;
+        }
+        m_engine = 0;
+        return ok;
+    }
+
+    void SongLoader::handleHeader(int format, int ntrks, int division)
+    {
+        m_song.setHeader(format, ntrks, division);
+        m_beatLength = division;
+        m_beatMax = 4;
+        m_lastBeat = 0;
+        m_beatCount = 1;
+        m_barCount = 1;
+    }
+
+    void SongLoader::handleError(const QString& errorStr)
+    {
+        m_errors << QString("%1 at file offset %2<br>")
+            .arg(errorStr).arg(m_engine->getFilePos());
+    }
+
+    /**
+     * Appends the beat marks located before a given time, using the current
+     * time signature.
+     */
+    void SongLoader::appendBeats(qint64 tick)
+    {
+        if (m_beatLength <= 0)
+            return;
+        while (m_lastBeat < tick) {
+            SequencerEvent ev;
+            ev.setSequencerType(SND_SEQ_EVENT_USR8);
+            ev.setRaw32(0, m_barCount);
+            ev.setRaw8(4, m_beatCount);
+            ev.setRaw8(5, m_beatMax);
+            ev.setSource(m_portId);
+            ev.scheduleTick(m_queueId, m_lastBeat, false);
+            ev.setDestination(m_clientId, m_portId);
+            appendEvent(ev.getHandle());
+
+            m_lastBeat += m_beatLength;
+            m_beatCount++;
+            if (m_beatCount > m_beatMax) {
+                m_beatCount = 1;
+                m_barCount++;
+            }
+        }
+    }
+
+    /**
+     * Appends an event to the song, or to the song file being written.
+     */
+    void SongLoader::appendEvent(const snd_seq_event_t* ev)
+    {
+        if (m_writer != 0)
+            m_writer->appendEvent(ev);
+        else
+            m_song.append(ev);
+    }
+
+    /**
+     * Parses a SMF. The track chunks are located first, then the tracks are
+     * parsed in parallel, each one into a list of events already sorted by
+     * time. The lists are finally merged into the song. The progress of
+     * the parsing is polled while the tracks are being loaded. When a song
+     * file is being written, the tracks are spooled to temporary files.
+     */
+    bool SongLoader::parseTracks(const QByteArray& data)
+    {
+        static const int PROGRESS_INTERVAL = 100; // milliseconds
+        QList<TrackLoader*> loaders;
+        QList<QByteArray> chunks = m_engine->indexTracks(data);
+        qint64 totalBytes = 0;
+        foreach(const QByteArray& chunk, chunks) {
+            loaders.append(new TrackLoader(chunk, chunk.constData() - data.constData(),
+                                           m_song.getDivision(), m_clientId,
+                                           m_portId, m_queueId, &m_cancel));
+            loaders.last()->setSpooled(m_writer != 0);
+            totalBytes += chunk.size();
+        }
+        if (!loaders.isEmpty()) {
+            QThreadPool pool;
+            foreach(TrackLoader* loader, loaders)
+                pool.start(loader);
+            while (!pool.waitForDone(PROGRESS_INTERVAL)) {
+                qint64 bytes = 0;
+                foreach(TrackLoader* loader, loaders)
+                    bytes += loader->position();
+                if (totalBytes > 0)
+                    setProgress(60 * bytes / totalBytes);
+            }
+        }
+        setProgress(60);
+
+        bool ok = !cancelled();
+        bool channelUsed[MIDI_CHANNELS];
+        int channelPatches[MIDI_CHANNELS];
+        QByteArray channelLabel[MIDI_CHANNELS];
+        int lowestNote = 127;
+        int highestNote = 0;
+        int initialTempo = 0;
+        qint64 lastTick = 0;
+        for(int i=0; i<MIDI_CHANNELS; ++i) {
+            channelUsed[i] = false;
+            channelPatches[i] = -1;
+        }
+        foreach(TrackLoader* loader, loaders) {
+            ok &= !loader->failed();
+            m_errors << loader->errors();
+            foreach(const TrackLoader::MetaData& meta, loader->metaData())
+                m_song.addMetaData(meta.type, meta.text, meta.tick);
+            for(int i=0; i<MIDI_CHANNELS; ++i) {
+                channelUsed[i] |= loader->channelUsed(i);
+                if (channelPatches[i] < 0)
+                    channelPatches[i] = loader->channelPatch(i);
+            }
+            if (loader->labelChannel() >= 0)
+                channelLabel[loader->labelChannel()] = loader->trackLabel();
+            lowestNote = qMin(lowestNote, loader->lowestMidiNote());
+            highestNote = qMax(highestNote, loader->highestMidiNote());
+            if (initialTempo == 0)
+                initialTempo = loader->initialTempo();
+            lastTick = qMax(lastTick, loader->lastTick());
+        }
+        for(int i=0; i<MIDI_CHANNELS; ++i)
+            m_song.setChannelInfo(i, channelUsed[i], channelPatches[i], channelLabel[i]);
+        m_song.setNoteRange(lowestNote, highestNote);
+        m_song.setInitialTempo(initialTempo);
+        if (ok) {
+            mergeTracks(loaders);
+            m_song.setDuration(m_song.ticksToSeconds(lastTick));
+        }
+        qDeleteAll(loaders);
+        return ok && !cancelled();
+    }
+
+    /**
+     * Position of the next event to be merged from a track
+     */
+    struct TrackCursor {
+        qint64 tick;
+        int track;
+        int index;
+    };
+
+    /**
+     * Heap ordering: the earliest event on top, and for events at the same
+     * time, the one from the first track. This keeps the order of a stable
+     * sort of all the tracks appended one after another.
+     */
+    static bool laterEvent(const TrackCursor& c1, const TrackCursor& c2)
+    {
+        if (c1.tick != c2.tick)
+            return c1.tick > c2.tick;
+        return c1.track > c2.track;
+    }
+
+    /**
+     * Merges the sorted event lists of all tracks into the song, or into
+     * the song file being written, inserting the beat marks and building
+     * the tempo map along the way. It stops early if the load is cancelled.
+     */
+    void SongLoader::mergeTracks(const QList<TrackLoader*>& loaders)
+    {
+        QVector<TrackCursor> heap;
+        int total = 0;
+        for(int i=0; i<loaders.count(); ++i) {
+            const EventList& events = loaders[i]->events();
+            if (!events.isEmpty()) {
+                TrackCursor c;
+                c.tick = events.getTick(0);
+                c.track = i;
+                c.index = 0;
+                heap.append(c);
+                total += events.count();
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), laterEvent);
+        if (m_writer == 0)
+            m_song.reserve(total);
+
+        QSmfTempoMap tempoMap;
+        tempoMap.setDivision(m_song.getDivision());
+        tempoMap.addTempo(500000, 0);
+        int merged = 0;
+        while (!heap.isEmpty()) {
+            if ((++merged % 4096) == 0) {
+                if (cancelled())
+                    break;
+                setProgress(60 + 35 * merged / total);
+            }
+            std::pop_heap(heap.begin(), heap.end(), laterEvent);
+            TrackCursor& c = heap.last();
+            const EventList& events = loaders[c.track]->events();
+            const snd_seq_event_t& ev = events.at(c.index);
+            appendBeats(c.tick);
+            if (m_writer != 0) {
+                snd_seq_event_t copy;
+                events.copyEvent(c.index, &copy);
+                m_writer->appendEvent(&copy);
+            } else
+                m_song.append(events, c.index);
+            switch (ev.type) {
+            case SND_SEQ_EVENT_TEMPO:
+                tempoMap.addTempo(ev.data.queue.param.value, c.tick);
+                break;
+            case SND_SEQ_EVENT_TIMESIGN:
+                m_beatMax = ev.data.raw8.d[0];
+                m_beatLength = m_song.getDivision() * 4 / ::pow(2, ev.data.raw8.d[1]);
+                break;
+            }
+            if (++c.index < events.count()) {
+                c.tick = events.getTick(c.index);
+                std::push_heap(heap.begin(), heap.end(), laterEvent);
+            } else {
+                heap.removeLast();
+            }
+        }
+        m_song.setTempoMap(tempoMap);
+    }
+
+    /**
+     * Appends the beat marks of a full bar after the last event, and an
+     * echo event marking the end of the song.
+     */
+    void SongLoader::addSongPadding()
+    {
+        unsigned long tick = (m_writer != 0) ? m_writer->lastTick() : m_song.getLastTick();
+        tick += (m_beatMax * m_beatLength); // a full bar
+        appendBeats(tick - m_beatLength + 1);
+        SystemEvent ev(SND_SEQ_EVENT_ECHO);
+        ev.setSource(m_portId);
+        ev.scheduleTick(m_queueId, tick, false);
+        ev.setDestination(m_clientId, m_portId);
+        appendEvent(ev.getHandle());
+    }
+
+}
@@ -0,0 +1,123 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef INCLUDED_SONGLOADER_H
+#define INCLUDED_SONGLOADER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QStringList>
+#include <qsmf.h>
+#include "song.h"
+
+using namespace drumstick;
+
+namespace KMid {
+
+    class TrackLoader;
+    class SongCache;
+
+    /**
+     * Loads a SMF into a Song, with the beat marks, the tempo map, the
+     * chase state snapshots, the channels summary and the detected text
+     * encoding. The file may be loaded in the calling thread with
+     * loadFile(), or in a worker thread with load(). In the later case,
+     * the results must not be accessed until the thread has finished, and
+     * the progress is reported by the progress() signal. When a SongCache is set, the songs are looked up
+     * in the cache before parsing, and stored there after a clean load.
+     * Large files are converted directly into the cache with convertFile(),
+     * and played from the mapped song file.
+     */
+    class SongLoader : public QThread, public QSmfHandler
+    {
+        Q_OBJECT
+    public:
+        SongLoader(int clientId, int portId, int queueId, QObject *parent = 0);
+        virtual ~SongLoader();
+
+        void load(const QString& fileName, const QString& localFile);
+        void load(const QString& fileName, const QByteArray& data);
+        bool loadFile(const QString& fileName, const QString& localFile);
+        bool loadData(const QString& fileName, const QByteArray& data);
+        bool convertFile(const QString& localFile, const QString& songFile);
+        void cancel();
+        void takeSong(Song& song);
+        void setCache(SongCache* cache) { m_cache = cache; }
+
+        bool succeeded() const { return m_ok; }
+        bool cancelled() const { return m_cancel.loadAcquire() != 0; }
+        QString fileName() const { return m_fileName; }
+        QStringList errors() const { return m_errors; }
+
+        void handleHeader(int format, int ntrks, int division);
+        void handleError(const QString& errorStr);
+
+        /**
+         * Size of the SMF files, in bytes, converted into the cache instead
+         * of being loaded in memory. Such a file holds about one million
+         * events.
+         */
+        static const int LARGE_FILE_SIZE = 4 * 1024 * 1024;
+
+    Q_SIGNALS:
+        /**
+         * Emitted from the worker thread while loading a song.
+         * @param percent completed part of the load, from 0 to 100
+         */
+        void progress(int percent);
+
+    protected:
+        virtual void run();
+
+    private:
+        bool loadData(const QString& fileName, const QByteArray& data, const QByteArray& key);
+        bool convertData(const QByteArray& data, const QString& songFile);
+        bool convertToCache(const QByteArray& data, const QByteArray& key);
+        bool loadSong(const QByteArray& data);
+        void appendEvent(const snd_seq_event_t* ev);
+        bool parseTracks(const QByteArray& data);
+        void mergeTracks(const QList<TrackLoader*>& loaders);
+        void appendBeats(qint64 tick);
+        void addSongPadding();
+        void setProgress(int percent);
+
+        int m_clientId;
+        int m_portId;
+        int m_queueId;
+        QSmf *m_engine;
+        SongCache *m_cache;
+        SongFileWriter *m_writer;
+        QAtomicInt m_cancel;
+        bool m_ok;
+        QString m_fileName;
+        QString m_localFile;
+        QByteArray m_data;
+        QStringList m_errors;
+        int m_progress;
+        Song m_song;
+        qint64 m_lastBeat;
+        qint64 m_beatLength;
+        int m_beatMax;
+        int m_barCount;
+        int m_beatCount;
+    };
+
+}
+
+#endif /*INCLUDED_SONGLOADER_H*/
@@ -0,0 +1,279 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "trackloader.h"
+
+#include <stdexcept>
+#include <alsaevent.h>
+
+namespace KMid {
+
+    TrackLoader::TrackLoader(const QByteArray& chunk, qint64 fileOffset,
+                             int division, int clientId, int portId,
+                             int queueId, const QAtomicInt *cancel)
+        : QRunnable(),
+        m_chunk(chunk),
+        m_fileOffset(fileOffset),
+        m_division(division),
+        m_clientId(clientId),
+        m_portId(portId),
+        m_queueId(queueId),
+        m_engine(0),
+        m_cancel(cancel),
+        m_position(0),
+        m_failed(false),
+        m_spooled(false),
+        m_spool(0),
+        m_writer(0),
+        m_labelChannel(-1),
+        m_lowestMidiNote(127),
+        m_highestMidiNote(0),
+        m_initialTempo(0),
+        m_lastTick(0)
+    {
+        setAutoDelete(false);
+        for(int i=0; i<MIDI_CHANNELS; ++i) {
+            m_channelUsed[i] = false;
+            m_channelEvents[i] = 0;
+            m_channelPatches[i] = -1;
+        }
+    }
+
+    TrackLoader::~TrackLoader()
+    {
+        m_events.clear();
+        delete m_spool;
+    }
+
+    /**
+     * Parses the track. The parser delivers the events to this object by
+     * direct calls, in the worker thread.
+     */
+    void TrackLoader::run()
+    {
+        QSmf engine;
+        SongFileWriter writer;
+        engine.setHandler(this);
+        m_engine = &engine;
+        if (m_spooled) {
+            m_spool = new QTemporaryFile;
+            if (m_spool->open() && writer.begin(m_spool))
+                m_writer = &writer;
+            else
+                m_failed = true;
+        }
+        if (!m_failed) {
+            try {
+                m_engine->readTrackChunk(m_chunk, m_division);
+            } catch (...) {
+                m_failed = true;
+            }
+        }
+        if (m_writer != 0) {
+            m_writer = 0;
+            m_failed |= !writer.finish(Song());
+            m_spool->close();
+            QSharedPointer<SongFileReader> file(new SongFileReader);
+            if (!m_failed && file->open(m_spool->fileName()))
+                m_events.setFile(file);
+            else
+                m_failed = true;
+        }
+        m_position.storeRelease(m_chunk.size());
+        m_engine = 0;
+    }
+
+    /**
+     * Only the tick position of the parser is used: the tracks are parsed
+     * without the tempo changes of the other tracks, so the real time
+     * reported by QSmf is not valid here. The song tempo map is built
+     * from the merged events instead.
+     */
+    void TrackLoader::appendEvent(SequencerEvent& ev)
+    {
+        unsigned long tick = m_engine->getCurrentTime();
+        ev.setSource(m_portId);
+        ev.scheduleTick(m_queueId, tick, false);
+        if (ev.getSequencerType() != SND_SEQ_EVENT_TEMPO)
+            ev.setDestination(m_clientId, m_portId);
+        int count;
+        if (m_writer != 0) {
+            m_writer->appendEvent(ev.getHandle());
+            count = m_writer->count();
+        } else {
+            m_events.append(ev.getHandle());
+            count = m_events.count();
+        }
+        if ((count % 1024) == 0) {
+            m_position.storeRelease(m_engine->getFilePos());
+            if (m_cancel != 0 && m_cancel->loadAcquire() != 0)
+                throw std::runtime_error("track loading cancelled");
+        }
+    }
+
+    void TrackLoader::noteEvent(int chan, int pitch)
+    {
+        if (pitch > m_highestMidiNote)
+            m_highestMidiNote = pitch;
+        if (pitch < m_lowestMidiNote)
+            m_lowestMidiNote = pitch;
+        channelEvent(chan);
+    }
+
+    void TrackLoader::channelEvent(int chan)
+    {
+        m_channelUsed[chan] = true;
+        m_channelEvents[chan]++;
+    }
+
+    void TrackLoader::handleNoteOn(int chan, int pitch, int vol)
+    {
+        noteEvent(chan, pitch);
+        NoteOnEvent ev(chan, pitch, vol);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleNoteOff(int chan, int pitch, int vol)
+    {
+        noteEvent(chan, pitch);
+        NoteOffEvent ev(chan, pitch, vol);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleKeyPress(int chan, int pitch, int press)
+    {
+        channelEvent(chan);
+        KeyPressEvent ev(chan, pitch, press);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleCtlChange(int chan, int ctl, int value)
+    {
+        channelEvent(chan);
+        ControllerEvent ev(chan, ctl, value);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handlePitchBend(int chan, int value)
+    {
+        channelEvent(chan);
+        PitchBendEvent ev(chan, value);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleProgram(int chan, int patch)
+    {
+        channelEvent(chan);
+        if (m_channelPatches[chan] < 0)
+            m_channelPatches[chan] = patch;
+        ProgramChangeEvent ev(chan, patch);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleChanPress(int chan, int press)
+    {
+        channelEvent(chan);
+        ChanPressEvent ev(chan, press);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleSysex(const QByteArray& data)
+    {
+        SysExEvent ev(data);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleMetaMisc(int type, const QByteArray& data)
+    {
+        if ( (type >= Song::FIRST_TYPE) && (type <= Song::Cue) ) {
+            MetaData meta;
+            meta.type = static_cast<Song::TextType>(type);
+            meta.text = data;
+            meta.tick = m_engine->getCurrentTime();
+            m_metaData.append(meta);
+            switch ( type ) {
+            case Song::Lyric:
+            case Song::Text:
+                if ((data.length() > 0) && (data[0] != '@') && (data[0] != '%') ) {
+                    VariableEvent ev(data);
+                    ev.setSequencerType(SND_SEQ_EVENT_USR_VAR0);
+                    appendEvent(ev);
+                }
+                break;
+            case Song::TrackName:
+            case Song::InstrumentName:
+                if (m_trackLabel.isEmpty())
+                    m_trackLabel = data;
+                break;
+            }
+        }
+    }
+
+    void TrackLoader::handleTempo(int tempo)
+    {
+        if ( m_initialTempo == 0 )
+            m_initialTempo = tempo;
+        TempoEvent ev(m_queueId, tempo);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleTimeSig(int b0, int b1, int b2, int b3)
+    {
+        SequencerEvent ev;
+        ev.setSequencerType(SND_SEQ_EVENT_TIMESIGN);
+        ev.setRaw8(0, b0);
+        ev.setRaw8(1, b1);
+        ev.setRaw8(2, b2);
+        ev.setRaw8(3, b3);
+        appendEvent(ev);
+    }
+
+    void TrackLoader::handleEndOfTrack()
+    {
+        qint64 ticks = m_engine->getCurrentTime();
+        if (ticks > m_lastTick) m_lastTick = ticks;
+    }
+
+    void TrackLoader::handleError(const QString& errorStr)
+    {
+        m_errors << QString("%1 at file offset %2<br>")
+            .arg(errorStr).arg(m_fileOffset + m_engine->getFilePos());
+    }
+
+    void TrackLoader::handleTrackStart()
+    {
+        for(int i=0; i<MIDI_CHANNELS; ++i)
+            m_channelEvents[i] = 0;
+        m_trackLabel.clear();
+    }
+
+    void TrackLoader::handleTrackEnd()
+    {
+        int max = 0;
+        m_labelChannel = -1;
+        if (!m_trackLabel.isEmpty()) {
+            for(int i=0; i<MIDI_CHANNELS; ++i)
+                if (m_channelEvents[i] > max) {
+                    max = m_channelEvents[i];
+                    m_labelChannel = i;
+                }
+        }
+    }
+
+}
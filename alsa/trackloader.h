@@ -0,0 +1,131 @@
+/*
+    KMid Backend using the ALSA Sequencer
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef INCLUDED_TRACKLOADER_H
+#define INCLUDED_TRACKLOADER_H
+
+#include <QRunnable>
+#include <QStringList>
+#include <QAtomicInt>
+#include <qsmf.h>
+#include <QTemporaryFile>
+#include "song.h"
+#include "midimapper.h"
+
+using namespace drumstick;
+
+namespace KMid {
+
+    /**
+     * Parses a single SMF track chunk into a list of events sorted by time.
+     * Each loader has its own QSmf parser, so several tracks of the same
+     * file may be loaded at once by a thread pool. The parsing is abandoned
+     * when the optional cancel flag is set. A spooled loader writes the
+     * events to a temporary song file instead of keeping them in memory,
+     * and the events list reads them from the mapped file.
+     */
+    class TrackLoader : public QRunnable, public QSmfHandler
+    {
+    public:
+        /**
+         * Meta data found in the track, to be added to the Song later
+         */
+        struct MetaData {
+            Song::TextType type;
+            QByteArray text;
+            qint64 tick;
+        };
+
+        TrackLoader(const QByteArray& chunk, qint64 fileOffset, int division,
+                    int clientId, int portId, int queueId,
+                    const QAtomicInt *cancel = 0);
+        virtual ~TrackLoader();
+        virtual void run();
+        void setSpooled(bool spooled) { m_spooled = spooled; }
+
+        /**
+         * Number of bytes of the chunk parsed so far. It may be read from
+         * any thread while the track is being parsed.
+         */
+        int position() const { return m_position.loadAcquire(); }
+
+        const EventList& events() const { return m_events; }
+        bool failed() const { return m_failed; }
+        QStringList errors() const { return m_errors; }
+        QList<MetaData> metaData() const { return m_metaData; }
+        QByteArray trackLabel() const { return m_trackLabel; }
+        int labelChannel() const { return m_labelChannel; }
+        bool channelUsed(int channel) const { return m_channelUsed[channel]; }
+        int channelPatch(int channel) const { return m_channelPatches[channel]; }
+        int lowestMidiNote() const { return m_lowestMidiNote; }
+        int highestMidiNote() const { return m_highestMidiNote; }
+        int initialTempo() const { return m_initialTempo; }
+        qint64 lastTick() const { return m_lastTick; }
+
+        void handleNoteOn(int chan, int pitch, int vol);
+        void handleNoteOff(int chan, int pitch, int vol);
+        void handleKeyPress(int chan, int pitch, int press);
+        void handleCtlChange(int chan, int ctl, int value);
+        void handlePitchBend(int chan, int value);
+        void handleProgram(int chan, int patch);
+        void handleChanPress(int chan, int press);
+        void handleSysex(const QByteArray& data);
+        void handleMetaMisc(int type, const QByteArray& data);
+        void handleTempo(int tempo);
+        void handleTimeSig(int b0, int b1, int b2, int b3);
+        void handleEndOfTrack();
+        void handleError(const QString& errorStr);
+        void handleTrackStart();
+        void handleTrackEnd();
+
+    private:
+        void appendEvent(SequencerEvent& ev);
+        void noteEvent(int chan, int pitch);
+        void channelEvent(int chan);
+
+        QByteArray m_chunk;
+        qint64 m_fileOffset;
+        int m_division;
+        int m_clientId;
+        int m_portId;
+        int m_queueId;
+        QSmf *m_engine;
+        const QAtomicInt *m_cancel;
+        QAtomicInt m_position;
+        bool m_failed;
+        bool m_spooled;
+        QTemporaryFile *m_spool;
+        SongFileWriter *m_writer;
+        EventList m_events;
+        QStringList m_errors;
+        QList<MetaData> m_metaData;
+        QByteArray m_trackLabel;
+        int m_labelChannel;
+        bool m_channelUsed[MIDI_CHANNELS];
+        int m_channelEvents[MIDI_CHANNELS];
+        int m_channelPatches[MIDI_CHANNELS];
+        int m_lowestMidiNote;
+        int m_highestMidiNote;
+        int m_initialTempo;
+        qint64 m_lastTick;
+    };
+
+}
+
+#endif /*INCLUDED_TRACKLOADER_H*/
@@ -190,6 +190,35 @@ public:
     virtual void handleSequencerEvent(SequencerEvent* ev) = 0;
 };
 
+/**
+ * Sequencer raw events handler.
+ *
+ * This abstract class is used to define an interface that other class can
+ * implement to receive the sequencer events without any memory allocation.
+ * The events are delivered as the ALSA records read by the client, instead
+ * of SequencerEvent copies, so it is suitable for realtime threads.
+ *
+ * @see MidiClient::setRawHandler()
+ * @since 0.3.0
+ */
+class DRUMSTICK_EXPORT SequencerRawEventHandler
+{
+public:
+    /** Destructor */
+    virtual ~SequencerRawEventHandler() {}
+
+    /**
+     * Callback function to be implemented by the derived class.
+     * It will be invoked by the client to deliver received events to the
+     * registered listener. The record and its variable length data belong
+     * to the ALSA input buffer, and they are valid only during the call.
+     *
+     * @param ev A pointer to the received ALSA event record
+     * @see MidiClient::setRawHandler(), MidiClient::doEvents()
+     */
+    virtual void handleRawEvent(const snd_seq_event_t* ev) = 0;
+};
+
 /**
  * Client management.
  *
@@ -312,6 +341,12 @@ public:
     bool getEventsEnabled() const { return m_eventsEnabled; }
     /** Sets a sequencer event handler enabling the callback delivery mode */
     void setHandler(SequencerEventHandler* handler)  { m_handler = handler; }
+    /**
+     * Sets a sequencer raw event handler, enabling the allocation free
+     * callback delivery mode. It takes precedence over the other modes.
+     * @since 0.3.0
+     */
+    void setRawHandler(SequencerRawEventHandler* handler)  { m_rawHandler = handler; }
     bool parseAddress( const QString& straddr, snd_seq_addr& result );
 
 signals:
@@ -353,6 +388,7 @@ private:
     QPointer<SequencerInputThread> m_Thread;
     QPointer<MidiQueue> m_Queue;
     SequencerEventHandler* m_handler;
+    SequencerRawEventHandler* m_rawHandler;
 
     ClientInfo m_Info;
     ClientInfoList m_ClientList;
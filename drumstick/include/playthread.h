@@ -22,7 +22,7 @@
 
 #include "alsaevent.h"
 #include <QThread>
-#include <QReadWriteLock>
+#include <QAtomicInt>
 
 /**
  * @file playthread.h
@@ -77,6 +77,14 @@ public:
      * @return Pointer to the next SequencerEvent to be played.
      */
     virtual SequencerEvent* nextEvent() = 0;
+    /**
+     * Gets the output batch window in ticks. Zero means that the events
+     * are sent to the sequencer one by one.
+     * @return Batch window (ticks)
+     * @since 0.3.0
+     */
+    unsigned int getBatchWindow() const { return m_BatchWindow; }
+    void setBatchWindow(unsigned int ticks);
 
     /**
      * Stops playing the current sequence.
@@ -108,11 +116,12 @@ protected:
     MidiClient *m_MidiClient;   /**< MidiClient instance pointer */
     MidiQueue *m_Queue;         /**< MidiQueue instance pointer */
     int m_PortId;               /**< MidiPort numeric identifier */
-    bool m_Stopped;             /**< Stopped status */
+    QAtomicInt m_Stopped;       /**< Stopped status */
     int m_QueueId;              /**< MidiQueue numeric identifier */
     int m_npfds;                /**< Number of pollfd pointers */
     pollfd* m_pfds;             /**< Array of pollfd pointers */
-    QReadWriteLock m_mutex;     /**< Mutex object used for synchronization */
+    unsigned int m_BatchWindow; /**< Output batch window in ticks */
+    unsigned int m_BatchTick;   /**< Time of the first event in the batch */
 };
 
 } /* namespace drumstick */
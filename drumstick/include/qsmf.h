@@ -24,6 +24,7 @@
 
 #include "macros.h"
 #include <QObject>
+#include <QVector>
 
 class QDataStream;
 
@@ -75,6 +76,128 @@ namespace drumstick {
 #define major_mode          0 /**< Major mode scale */
 #define minor_mode          1 /**< Minor mode scale */
 
+/**
+ * Tempo map of a Standard MIDI File
+ *
+ * This class stores the tempo changes of a SMF sorted by their location in
+ * ticks, along with the elapsed time at each change. Converting a tick
+ * location into real time is a binary search over the tempo changes.
+ * @since 0.3.0
+ */
+class DRUMSTICK_EXPORT QSmfTempoMap
+{
+public:
+    QSmfTempoMap();
+
+    /**
+     * Tempo change within a SMF or sequence
+     */
+    struct Entry
+    {
+        quint64 time;       /**< location in ticks */
+        quint64 tempo;      /**< microseconds per quarter note */
+        double microsecs;   /**< elapsed microseconds at this location */
+    };
+
+    void clear();
+    bool isEmpty() const;
+    int count() const;
+    const Entry& at(int i) const;
+    int getDivision() const;
+    void setDivision(int division);
+    void addTempo(quint64 tempo, quint64 time);
+    int indexOf(quint64 ticks) const;
+    quint64 tempoAt(quint64 ticks) const;
+    double ticksToMicroseconds(quint64 ticks) const;
+    double ticksToMicroseconds(quint64 ticks, int index) const;
+    double ticksToSeconds(quint64 ticks) const;
+
+private:
+    QVector<Entry> m_entries;
+    int m_division;
+};
+
+/**
+ * Standard MIDI Files events handler
+ *
+ * This abstract class defines an interface that other classes can implement
+ * to receive the events of a SMF being read, as plain virtual function calls.
+ * It is an alternative to the signals of QSmf, avoiding the signal dispatching
+ * overhead for every event. Only the needed functions have to be reimplemented;
+ * the default implementations do nothing.
+ *
+ * @see QSmf::setHandler()
+ * @since 0.3.0
+ */
+class DRUMSTICK_EXPORT QSmfHandler
+{
+public:
+    /** Destructor */
+    virtual ~QSmfHandler() {}
+
+    /** Called for a SMF read error. @see QSmf::signalSMFError() */
+    virtual void handleError(const QString& errorStr) { Q_UNUSED(errorStr) }
+    /** Called after reading a SMF header. @see QSmf::signalSMFHeader() */
+    virtual void handleHeader(int format, int ntrks, int division)
+    { Q_UNUSED(format) Q_UNUSED(ntrks) Q_UNUSED(division) }
+    /** Called after reading a Note On message. @see QSmf::signalSMFNoteOn() */
+    virtual void handleNoteOn(int chan, int pitch, int vol)
+    { Q_UNUSED(chan) Q_UNUSED(pitch) Q_UNUSED(vol) }
+    /** Called after reading a Note Off message. @see QSmf::signalSMFNoteOff() */
+    virtual void handleNoteOff(int chan, int pitch, int vol)
+    { Q_UNUSED(chan) Q_UNUSED(pitch) Q_UNUSED(vol) }
+    /** Called after reading a Polyphonic Aftertouch message. @see QSmf::signalSMFKeyPress() */
+    virtual void handleKeyPress(int chan, int pitch, int press)
+    { Q_UNUSED(chan) Q_UNUSED(pitch) Q_UNUSED(press) }
+    /** Called after reading a Control Change message. @see QSmf::signalSMFCtlChange() */
+    virtual void handleCtlChange(int chan, int ctl, int value)
+    { Q_UNUSED(chan) Q_UNUSED(ctl) Q_UNUSED(value) }
+    /** Called after reading a Bender message. @see QSmf::signalSMFPitchBend() */
+    virtual void handlePitchBend(int chan, int value)
+    { Q_UNUSED(chan) Q_UNUSED(value) }
+    /** Called after reading a Program change message. @see QSmf::signalSMFProgram() */
+    virtual void handleProgram(int chan, int patch)
+    { Q_UNUSED(chan) Q_UNUSED(patch) }
+    /** Called after reading a Channel Aftertouch message. @see QSmf::signalSMFChanPress() */
+    virtual void handleChanPress(int chan, int press)
+    { Q_UNUSED(chan) Q_UNUSED(press) }
+    /** Called after reading a System Exclusive message. @see QSmf::signalSMFSysex() */
+    virtual void handleSysex(const QByteArray& data) { Q_UNUSED(data) }
+    /** Called after reading a Sequencer specific message. @see QSmf::signalSMFSeqSpecific() */
+    virtual void handleSeqSpecific(const QByteArray& data) { Q_UNUSED(data) }
+    /** Called after reading an unregistered SMF Meta message. @see QSmf::signalSMFMetaUnregistered() */
+    virtual void handleMetaUnregistered(int typ, const QByteArray& data)
+    { Q_UNUSED(typ) Q_UNUSED(data) }
+    /** Called after reading any SMF Meta message. @see QSmf::signalSMFMetaMisc() */
+    virtual void handleMetaMisc(int typ, const QByteArray& data)
+    { Q_UNUSED(typ) Q_UNUSED(data) }
+    /** Called after reading a Sequence number message. @see QSmf::signalSMFSequenceNum() */
+    virtual void handleSequenceNum(int seq) { Q_UNUSED(seq) }
+    /** Called after reading a Forced channel message. @see QSmf::signalSMFforcedChannel() */
+    virtual void handleForcedChannel(int channel) { Q_UNUSED(channel) }
+    /** Called after reading a Forced port message. @see QSmf::signalSMFforcedPort() */
+    virtual void handleForcedPort(int port) { Q_UNUSED(port) }
+    /** Called after reading a SMF text message. @see QSmf::signalSMFText() */
+    virtual void handleText(int typ, const QString& data)
+    { Q_UNUSED(typ) Q_UNUSED(data) }
+    /** Called after reading a SMPT offset message. @see QSmf::signalSMFSmpte() */
+    virtual void handleSmpte(int b0, int b1, int b2, int b3, int b4)
+    { Q_UNUSED(b0) Q_UNUSED(b1) Q_UNUSED(b2) Q_UNUSED(b3) Q_UNUSED(b4) }
+    /** Called after reading a SMF Time signature message. @see QSmf::signalSMFTimeSig() */
+    virtual void handleTimeSig(int b0, int b1, int b2, int b3)
+    { Q_UNUSED(b0) Q_UNUSED(b1) Q_UNUSED(b2) Q_UNUSED(b3) }
+    /** Called after reading a SMF Key Signature message. @see QSmf::signalSMFKeySig() */
+    virtual void handleKeySig(int b0, int b1) { Q_UNUSED(b0) Q_UNUSED(b1) }
+    /** Called after reading a Tempo Change message. @see QSmf::signalSMFTempo() */
+    virtual void handleTempo(int tempo) { Q_UNUSED(tempo) }
+    /** Called after reading a End-Of-Track message. @see QSmf::signalSMFendOfTrack() */
+    virtual void handleEndOfTrack() { }
+    /** Called after reading a track prefix. @see QSmf::signalSMFTrackStart() */
+    virtual void handleTrackStart() { }
+    /** Called after a track has finished. @see QSmf::signalSMFTrackEnd() */
+    virtual void handleTrackEnd() { }
+};
+
 /**
  * Standard MIDI Files input/output
  *
@@ -90,6 +213,9 @@ public:
 
     void readFromStream(QDataStream *stream);
     void readFromFile(const QString& fileName);
+    QList<QByteArray> indexTracks(const QByteArray& data);
+    void readTrackChunk(const QByteArray& chunk, int division);
+    void readTrackChunk(const QByteArray& chunk, const QSmfTempoMap& tempoMap);
     void writeToStream(QDataStream *stream);
     void writeToFile(const QString& fileName);
 
@@ -121,6 +247,11 @@ public:
     void setFileFormat(int fileFormat);
     QTextCodec* getTextCodec();
     void setTextCodec(QTextCodec *codec);
+    bool getBufferedReading();
+    void setBufferedReading(bool enable);
+    const QSmfTempoMap& getTempoMap() const;
+    QSmfHandler* getHandler();
+    void setHandler(QSmfHandler* handler);
 
 signals:
     /**
@@ -277,24 +408,18 @@ signals:
     void signalSMFWriteTrack(int track);
 
 private:
-    /**
-     * Tempo change within a SMF or sequence
-     */
-    struct QSmfRecTempo
-    {
-        quint64 tempo;
-        quint64 time;
-    };
-
     class QSmfPrivate;
     QSmfPrivate *d;
 
     void SMFRead();
     void SMFWrite();
+    void readFromBuffer(const quint8 *data, quint64 size);
+    quint64 readBlock(quint64 length);
     quint8 getByte();
     void putByte(quint8 value);
     void readHeader();
     void readTrack();
+    bool readTrackHeader();
     quint16 to16bit(quint8 c1, quint8 c2);
     quint32 to32bit(quint8 c1, quint8 c2, quint8 c3, quint8 c4);
     quint16 read16bit();
@@ -302,11 +427,8 @@ private:
     void write16bit(quint16 data);
     void write32bit(quint32 data);
     void writeVarLen(quint64 value);
-    double ticksToSecs(quint64 ticks, quint16 division, quint64 tempo);
     long readVarLen();
     void readExpected(const QString& s);
-    void addTempo(quint64 tempo, quint64 time);
-    quint64 findTempo();
     void SMFError(const QString& s);
     void channelMessage(quint8 status, quint8 c1, quint8 c2);
     void msgInit();
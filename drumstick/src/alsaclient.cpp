@@ -325,7 +325,8 @@ MidiClient::MidiClient( QObject* parent ) :
     m_SeqHandle(NULL),
     m_Thread(NULL),
     m_Queue(NULL),
-    m_handler(NULL)
+    m_handler(NULL),
+    m_rawHandler(NULL)
 { }
 
 /**
@@ -541,7 +542,9 @@ MidiClient::getSequencerType()
 /**
  * Dispatch the events received from the Sequencer.
  *
- * There are three methods of events delivering:
+ * There are three methods of events delivering, besides the raw events
+ * handler set by setRawHandler(), which receives the ALSA records without
+ * allocating any SequencerEvent object:
  * <ul>
  * <li>A Callback method. To use this method, you must derive a class from
  * SequencerEventHandler, overriding the method
@@ -566,7 +569,21 @@ MidiClient::doEvents()
         snd_seq_event_t* evp = NULL;
         SequencerEvent* event = NULL;
         err = snd_seq_event_input(m_SeqHandle, &evp);
-        if ((err >= 0) && (evp != NULL)) {
+        if ((err >= 0) && (evp != NULL) && (m_rawHandler != NULL)) {
+            switch (evp->type) {
+            case SND_SEQ_EVENT_PORT_CHANGE:
+            case SND_SEQ_EVENT_PORT_EXIT:
+            case SND_SEQ_EVENT_PORT_START:
+            case SND_SEQ_EVENT_CLIENT_CHANGE:
+            case SND_SEQ_EVENT_CLIENT_EXIT:
+            case SND_SEQ_EVENT_CLIENT_START:
+                m_NeedRefreshClientList = true;
+                break;
+            default:
+                break;
+            }
+            m_rawHandler->handleRawEvent(evp);
+        } else if ((err >= 0) && (evp != NULL)) {
             switch (evp->type) {
 
             case SND_SEQ_EVENT_NOTE:
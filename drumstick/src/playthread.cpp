@@ -20,8 +20,6 @@
 #include "playthread.h"
 #include "alsaclient.h"
 #include "alsaqueue.h"
-#include <QReadLocker>
-#include <QWriteLocker>
 
 /**
  * @file playthread.cpp
@@ -65,10 +63,12 @@ SequencerOutputThread::SequencerOutputThread(MidiClient *seq, int portId)
     m_MidiClient(seq),
     m_Queue(0),
     m_PortId(portId),
-    m_Stopped(false),
+    m_Stopped(0),
     m_QueueId(0),
     m_npfds(0),
-    m_pfds(0)
+    m_pfds(0),
+    m_BatchWindow(0),
+    m_BatchTick(0)
 {
     if (m_MidiClient != NULL) {
         m_Queue = m_MidiClient->getQueue();
@@ -84,8 +84,7 @@ SequencerOutputThread::SequencerOutputThread(MidiClient *seq, int portId)
 bool
 SequencerOutputThread::stopRequested()
 {
-	QReadLocker locker(&m_mutex);
-    return m_Stopped;
+    return m_Stopped.loadAcquire() != 0;
 }
 
 /**
@@ -94,9 +93,7 @@ SequencerOutputThread::stopRequested()
 void
 SequencerOutputThread::stop()
 {
-	QWriteLocker locker(&m_mutex);
-    m_Stopped = true;
-    locker.unlock();
+    m_Stopped.storeRelease(1);
     while (isRunning())
         wait(TIMEOUT);
 }
@@ -118,19 +115,47 @@ SequencerOutputThread::sendEchoEvent(int tick)
 }
 
 /**
- * Sends a SequencerEvent
+ * Sends a SequencerEvent. If there is a batch window, the event is
+ * appended to the output buffer, which is drained when the event is
+ * beyond the window of the current batch, or when the buffer is full.
  * @param ev SequencerEvent object pointer
  */
 void
 SequencerOutputThread::sendSongEvent(SequencerEvent* ev)
 {
     if (m_MidiClient != NULL) {
-        while (!stopRequested() &&
-               (snd_seq_event_output_direct(m_MidiClient->getHandle(), ev->getHandle()) < 0))
-            poll(m_pfds, m_npfds, TIMEOUT);
+        if (m_BatchWindow > 0) {
+            if (ev->getTick() >= m_BatchTick + m_BatchWindow) {
+                drainOutput();
+                m_BatchTick = ev->getTick();
+            }
+            while (!stopRequested() &&
+                   (snd_seq_event_output(m_MidiClient->getHandle(), ev->getHandle()) < 0))
+                poll(m_pfds, m_npfds, TIMEOUT);
+        } else {
+            while (!stopRequested() &&
+                   (snd_seq_event_output_direct(m_MidiClient->getHandle(), ev->getHandle()) < 0))
+                poll(m_pfds, m_npfds, TIMEOUT);
+        }
     }
 }
 
+/**
+ * Sets the output batch window in ticks. When it is not zero, the events
+ * are collected in the client output buffer and sent to the sequencer in
+ * batches spanning this time, saving one system call for each event. The
+ * events are still scheduled by the queue at their own time, so the
+ * window must be short enough to be sent ahead of the queue position.
+ * It must not be changed while playing.
+ * @param ticks Batch window (ticks)
+ * @since 0.3.0
+ */
+void
+SequencerOutputThread::setBatchWindow(unsigned int ticks)
+{
+    m_BatchWindow = ticks;
+}
+
 /**
  * Flush the ALSA output buffer.
  */
@@ -171,6 +196,7 @@ void SequencerOutputThread::run()
             m_pfds = (pollfd*) alloca(m_npfds * sizeof(pollfd));
             snd_seq_poll_descriptors(m_MidiClient->getHandle(), m_pfds, m_npfds, POLLOUT);
             last_tick = getInitialPosition();
+            m_BatchTick = last_tick;
             if (last_tick == 0) {
                 m_Queue->start();
             } else {
@@ -189,6 +215,8 @@ void SequencerOutputThread::run()
                     sendSongEvent(ev);
             }
             if (stopRequested()) {
+                if (m_BatchWindow > 0)
+                    m_MidiClient->dropOutputBuffer();
                 m_Queue->clear();
                 emit stopped();
             } else {
@@ -214,8 +242,7 @@ void SequencerOutputThread::run()
  */
 void SequencerOutputThread::start( Priority priority )
 {
-	QWriteLocker locker(&m_mutex);
-    m_Stopped = false;
+    m_Stopped.storeRelease(0);
     QThread::start( priority );
 }
 
@@ -52,44 +52,42 @@ public:
         m_CurrTime(0),
         m_RealTime(0),
         m_DblRealTime(0),
-        m_DblOldRealtime(0),
         m_Division(96),
         m_CurrTempo(500000),
-        m_OldCurrTempo(500000),
-        m_OldRealTime(0),
-        m_OldCurrTime(0),
-        m_RevisedTime(0),
-        m_TempoChangeTime(0),
         m_ToBeRead(0),
         m_NumBytesWritten(0),
         m_Tracks(0),
         m_fileFormat(0),
         m_LastStatus(0),
         m_codec(0),
-        m_IOStream(0)
+        m_Handler(0),
+        m_IOStream(0),
+        m_Buffered(false),
+        m_Buffer(0),
+        m_BufferSize(0),
+        m_BufferPos(0)
     { }
 
     bool m_Interactive;     /**< file and track headers are not required */
     quint64 m_CurrTime;     /**< current time in delta-time units */
     quint64 m_RealTime;     /**< current time in 1/16 centisecond-time units */
     double m_DblRealTime;   /**< as above, floating */
-    double m_DblOldRealtime;
     int m_Division;         /**< ticks per beat. Default = 96 */
     quint64 m_CurrTempo;    /**< microseconds per quarter note */
-    quint64 m_OldCurrTempo;
-    quint64 m_OldRealTime;
-    quint64 m_OldCurrTime;
-    quint64 m_RevisedTime;
-    quint64 m_TempoChangeTime;
     quint64 m_ToBeRead;
     quint64 m_NumBytesWritten;
     int m_Tracks;
     int m_fileFormat;
     int m_LastStatus;
     QTextCodec *m_codec;
+    QSmfHandler *m_Handler; /**< receives the events instead of the signals */
     QDataStream *m_IOStream;
     QByteArray m_MsgBuff;
-    QList<QSmfRecTempo> m_TempoList;
+    QSmfTempoMap m_TempoMap;
+    bool m_Buffered;        /**< read the whole SMF into memory before parsing */
+    const quint8 *m_Buffer; /**< contiguous SMF data, or NULL when streaming */
+    quint64 m_BufferSize;
+    quint64 m_BufferPos;
 };
 
 /**
@@ -106,7 +104,6 @@ QSmf::QSmf(QObject * parent) :
  */
 QSmf::~QSmf()
 {
-    d->m_TempoList.clear();
     delete d;
 }
 
@@ -116,6 +113,8 @@ QSmf::~QSmf()
  */
 bool QSmf::endOfSmf()
 {
+    if (d->m_Buffer != NULL)
+        return d->m_BufferPos >= d->m_BufferSize;
     return d->m_IOStream->atEnd();
 }
 
@@ -126,7 +125,15 @@ bool QSmf::endOfSmf()
 quint8 QSmf::getByte()
 {
     quint8 b = 0;
-    if (!d->m_IOStream->atEnd())
+    if (d->m_Buffer != NULL)
+    {
+        if (d->m_BufferPos < d->m_BufferSize)
+        {
+            b = d->m_Buffer[d->m_BufferPos++];
+            d->m_ToBeRead--;
+        }
+    }
+    else if (!d->m_IOStream->atEnd())
     {
         *d->m_IOStream >> b;
         d->m_ToBeRead--;
@@ -135,26 +142,47 @@ quint8 QSmf::getByte()
 }
 
 /**
- * Puts a single byte to the SMF stream
- * @param value A Single byte
+ * Reads a block of bytes from the SMF stream into the message buffer.
+ * The length is clipped to the remaining bytes of the current chunk and
+ * of the SMF data.
+ * @param length Number of bytes requested
+ * @return Number of bytes actually read
  */
-void QSmf::putByte(quint8 value)
+quint64 QSmf::readBlock(quint64 length)
 {
-    *d->m_IOStream << value;
-    d->m_NumBytesWritten++;
+    if (length > d->m_ToBeRead)
+    {
+        length = d->m_ToBeRead;
+    }
+    if (d->m_Buffer != NULL)
+    {
+        quint64 avail = d->m_BufferSize - d->m_BufferPos;
+        if (length > avail)
+        {
+            length = avail;
+        }
+        d->m_MsgBuff.append(reinterpret_cast<const char *>(d->m_Buffer + d->m_BufferPos), length);
+        d->m_BufferPos += length;
+        d->m_ToBeRead -= length;
+        return length;
+    }
+    quint64 count = 0;
+    while ((count < length) && !endOfSmf())
+    {
+        msgAdd(getByte());
+        count++;
+    }
+    return count;
 }
 
 /**
- * Adds a tempo change to the internal tempo list
- * @param tempo Tempo in microseconds per quarter
- * @param time Location in ticks
+ * Puts a single byte to the SMF stream
+ * @param value A Single byte
  */
-void QSmf::addTempo(quint64 tempo, quint64 time)
+void QSmf::putByte(quint8 value)
 {
-    QSmfRecTempo tempoRec;
-    tempoRec.tempo = tempo;
-    tempoRec.time = time;
-    d->m_TempoList.append(tempoRec);
+    *d->m_IOStream << value;
+    d->m_NumBytesWritten++;
 }
 
 /**
@@ -166,8 +194,7 @@ void QSmf::readHeader()
     d->m_RealTime = 0;
     d->m_Division = 96;
     d->m_CurrTempo = 500000;
-    d->m_OldCurrTempo = 500000;
-    addTempo(d->m_CurrTempo, 0);
+    d->m_TempoMap.clear();
     if (d->m_Interactive)
     {
         d->m_fileFormat= 0;
@@ -182,7 +209,12 @@ void QSmf::readHeader()
         d->m_Tracks = read16bit();
         d->m_Division = read16bit();
     }
-    emit signalSMFHeader(d->m_fileFormat, d->m_Tracks, d->m_Division);
+    d->m_TempoMap.setDivision(d->m_Division);
+    d->m_TempoMap.addTempo(d->m_CurrTempo, 0);
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleHeader(d->m_fileFormat, d->m_Tracks, d->m_Division);
+    else
+        emit signalSMFHeader(d->m_fileFormat, d->m_Tracks, d->m_Division);
 
     /* flush any extra stuff, in case the length of header is not */
     while ((d->m_ToBeRead > 0) && !endOfSmf())
@@ -208,8 +240,8 @@ void QSmf::readTrack()
     bool running; // 1 when running status used
     quint8 status; // status value (e.g. 0x90==note-on)
     int needed;
-    double delta_secs;
-    quint64 delta_ticks, save_time, save_tempo;
+    int tempo_index; // cursor over the tempo map
+    quint64 delta_ticks;
 
     sysexcontinue = false;
     status = 0;
@@ -217,20 +249,20 @@ void QSmf::readTrack()
     {
         d->m_ToBeRead = std::numeric_limits<unsigned long long>::max();
     }
-    else
+    else if (!readTrackHeader())
     {
-        readExpected("MTrk");
-        d->m_ToBeRead = read32bit();
+        return;
     }
     d->m_CurrTime = 0;
     d->m_RealTime = 0;
     d->m_DblRealTime = 0;
-    d->m_DblOldRealtime = 0;
-    d->m_OldCurrTime = 0;
-    d->m_OldRealTime = 0;
-    d->m_CurrTempo = findTempo();
+    tempo_index = d->m_TempoMap.indexOf(0);
+    d->m_CurrTempo = d->m_TempoMap.tempoAt(0);
 
-    emit signalSMFTrackStart();
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleTrackStart();
+    else
+        emit signalSMFTrackStart();
 
     while (!endOfSmf() && (d->m_Interactive || d->m_ToBeRead > 0))
     {
@@ -241,39 +273,22 @@ void QSmf::readTrack()
         else
         {
             delta_ticks = readVarLen();
-            d->m_RevisedTime = d->m_CurrTime;
             d->m_CurrTime += delta_ticks;
-            while (d->m_RevisedTime < d->m_CurrTime)
+            if (delta_ticks > 0)
             {
-                save_time = d->m_RevisedTime;
-                save_tempo = d->m_CurrTempo;
-                d->m_CurrTempo = findTempo();
-                if (d->m_CurrTempo != d->m_OldCurrTempo)
+                /* ticks only move forward within a track, so the tempo
+                   index advances like a cursor over the tempo map */
+                while ((tempo_index + 1 < d->m_TempoMap.count()) &&
+                       (d->m_TempoMap.at(tempo_index + 1).time <= d->m_CurrTime))
                 {
-                    d->m_OldCurrTempo = d->m_CurrTempo;
-                    d->m_OldRealTime = d->m_RealTime;
-                    if (d->m_RevisedTime != d->m_TempoChangeTime)
-                    {
-                        d->m_DblOldRealtime = d->m_DblRealTime;
-                        d->m_OldCurrTime = save_time;
-                    }
-                    delta_secs = ticksToSecs(d->m_RevisedTime - d->m_OldCurrTime,
-                            d->m_Division, save_tempo);
-                    d->m_DblRealTime = d->m_DblOldRealtime + delta_secs * 1600.0;
-                    d->m_RealTime = static_cast<quint64>(0.5 + d->m_DblRealTime);
-                    if (d->m_RevisedTime == d->m_TempoChangeTime)
-                    {
-                        d->m_OldCurrTime = d->m_RevisedTime;
-                        d->m_DblOldRealtime = d->m_DblRealTime;
-                    }
+                    tempo_index++;
                 }
-                else
+                if (tempo_index >= 0)
                 {
-                    delta_secs = ticksToSecs(d->m_RevisedTime - d->m_OldCurrTime,
-                            d->m_Division, d->m_CurrTempo);
-                    d->m_DblRealTime = d->m_DblOldRealtime + delta_secs * 1600.0;
-                    d->m_RealTime = static_cast<quint64>(0.5 + d->m_DblRealTime);
+                    d->m_CurrTempo = d->m_TempoMap.at(tempo_index).tempo;
                 }
+                d->m_DblRealTime = d->m_TempoMap.ticksToMicroseconds(d->m_CurrTime, tempo_index) * 0.0016;
+                d->m_RealTime = static_cast<quint64>(0.5 + d->m_DblRealTime);
             }
         }
 
@@ -325,24 +340,16 @@ void QSmf::readTrack()
         case meta_event:
             type = getByte();
             lookfor = readVarLen();
-            lookfor = d->m_ToBeRead - lookfor;
             msgInit();
-            while (d->m_ToBeRead > lookfor)
-            {
-                msgAdd(getByte());
-            }
+            readBlock(lookfor);
             metaEvent(type);
             break;
         case system_exclusive:
             lookfor = readVarLen();
-            lookfor = d->m_ToBeRead - lookfor;
             msgInit();
             msgAdd(system_exclusive);
-            while (d->m_ToBeRead > lookfor)
-            {
-                c = getByte();
-                msgAdd(c);
-            }
+            readBlock(lookfor);
+            c = d->m_MsgBuff.at(d->m_MsgBuff.size() - 1);
             if (c == end_of_sysex)
             {
                 sysEx();
@@ -354,15 +361,13 @@ void QSmf::readTrack()
             break;
         case end_of_sysex:
             lookfor = readVarLen();
-            lookfor = d->m_ToBeRead - lookfor;
             if (!sysexcontinue)
             {
                 msgInit();
             }
-            while (d->m_ToBeRead > lookfor)
+            if (readBlock(lookfor) > 0)
             {
-                c = getByte();
-                msgAdd(c);
+                c = d->m_MsgBuff.at(d->m_MsgBuff.size() - 1);
             }
             if (sysexcontinue)
             {
@@ -374,11 +379,61 @@ void QSmf::readTrack()
             }
             break;
         default:
-            badByte(c, d->m_IOStream->device()->pos() - 1);
+            badByte(c, getFilePos() - 1);
             break;
         }
     }
-    emit signalSMFTrackEnd();
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleTrackEnd();
+    else
+        emit signalSMFTrackEnd();
+}
+
+/**
+ * Reads the header of the next track chunk, setting the number of bytes
+ * to be read from it. Chunks of unknown types are skipped using their
+ * length, as required by the SMF specification; a chunk type that is not
+ * made of ASCII letters is reported as an error, and read as a track.
+ * @return True if a track chunk was found, false at the end of the SMF
+ */
+bool QSmf::readTrackHeader()
+{
+    while (!endOfSmf())
+    {
+        QByteArray type;
+        for (int j = 0; j < 4; ++j)
+        {
+            type.append(char(getByte()));
+        }
+        d->m_ToBeRead = read32bit();
+        if (type == "MTrk")
+        {
+            return true;
+        }
+        for (int j = 0; j < type.size(); ++j)
+        {
+            char c = type[j];
+            if (!((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')))
+            {
+                SMFError(QString("Invalid (%1) SMF format at %2")
+                         .arg(QString(type.toHex())).arg(getFilePos() - 8));
+                return true;
+            }
+        }
+        if (d->m_Buffer != NULL)
+        {
+            d->m_BufferPos = qMin(d->m_BufferPos + d->m_ToBeRead, d->m_BufferSize);
+            d->m_ToBeRead = 0;
+        }
+        else
+        {
+            while ((d->m_ToBeRead > 0) && !endOfSmf())
+            {
+                getByte();
+            }
+        }
+    }
+    return false;
 }
 
 /**
@@ -424,11 +479,22 @@ void QSmf::SMFWrite()
 void QSmf::readFromStream(QDataStream *stream)
 {
     d->m_IOStream = stream;
-    SMFRead();
+    if (d->m_Buffered && (stream->device() != NULL))
+    {
+        QByteArray data = stream->device()->readAll();
+        readFromBuffer(reinterpret_cast<const quint8 *>(data.constData()), data.size());
+    }
+    else
+    {
+        SMFRead();
+    }
 }
 
 /**
  * Reads a SMF stream from a disk file.
+ *
+ * In buffered reading mode, the file is memory mapped when possible, or
+ * read at once otherwise.
  * @param fileName Name of an existing file.
  */
 void QSmf::readFromFile(const QString& fileName)
@@ -436,10 +502,138 @@ void QSmf::readFromFile(const QString& fileName)
     QFile file(fileName);
     file.open(QIODevice::ReadOnly);
     QDataStream ds(&file);
+    if (d->m_Buffered)
+    {
+        uchar *data = file.map(0, file.size());
+        if (data != NULL)
+        {
+            d->m_IOStream = &ds;
+            readFromBuffer(data, file.size());
+            file.unmap(data);
+            file.close();
+            return;
+        }
+    }
     readFromStream(&ds);
     file.close();
 }
 
+/**
+ * Parses a SMF contained in a contiguous memory block.
+ * @param data Pointer to the first byte of the SMF data
+ * @param size Size of the SMF data in bytes
+ */
+void QSmf::readFromBuffer(const quint8 *data, quint64 size)
+{
+    d->m_Buffer = data;
+    d->m_BufferSize = size;
+    d->m_BufferPos = 0;
+    try
+    {
+        SMFRead();
+    }
+    catch (...)
+    {
+        d->m_Buffer = 0;
+        d->m_BufferSize = 0;
+        throw;
+    }
+    d->m_Buffer = 0;
+    d->m_BufferSize = 0;
+}
+
+/**
+ * Reads the header of a SMF contained in memory, and locates its tracks.
+ *
+ * The header is reported with signalSMFHeader() as usual, but the track
+ * contents are not parsed. Each track can then be parsed independently
+ * with readTrackChunk(), for instance using a different QSmf instance
+ * for each track in a separate thread.
+ *
+ * Chunks of unknown types are skipped, and not returned. The returned byte
+ * arrays are not copies: they point into @a data, which must remain
+ * unchanged while they are in use.
+ * @param data The SMF data
+ * @return The list of track chunks, including the chunk headers
+ * @since 0.3.0
+ */
+QList<QByteArray> QSmf::indexTracks(const QByteArray& data)
+{
+    QList<QByteArray> tracks;
+    quint64 offset, length;
+    d->m_Buffer = reinterpret_cast<const quint8 *>(data.constData());
+    d->m_BufferSize = data.size();
+    d->m_BufferPos = 0;
+    readHeader();
+    for (int i = d->m_Tracks; (i > 0) && readTrackHeader(); i--)
+    {
+        offset = d->m_BufferPos - 8;
+        length = d->m_ToBeRead;
+        d->m_BufferPos = qMin(d->m_BufferPos + length, d->m_BufferSize);
+        tracks.append(QByteArray::fromRawData(data.constData() + offset,
+                d->m_BufferPos - offset));
+    }
+    d->m_Buffer = 0;
+    d->m_BufferSize = 0;
+    return tracks;
+}
+
+/**
+ * Parses a single track chunk, as returned by indexTracks().
+ *
+ * The signals emitted are the same as for a track read by readFromFile() or
+ * readFromStream(), but the tempo map only contains the tempo changes of
+ * this track. In a format 1 SMF the tempo changes are usually found in the
+ * first track only, so getRealTime() and getCurrentTempo() are not valid
+ * while the other tracks are parsed: only getCurrentTime() may be used.
+ * Use the overload taking a tempo map when the real time is needed.
+ * @param chunk The track chunk, including the chunk header
+ * @param division Ticks per quarter note, as found in the SMF header
+ * @since 0.3.0
+ */
+void QSmf::readTrackChunk(const QByteArray& chunk, int division)
+{
+    QSmfTempoMap tempoMap;
+    tempoMap.setDivision(division);
+    tempoMap.addTempo(500000, 0);
+    readTrackChunk(chunk, tempoMap);
+}
+
+/**
+ * Parses a single track chunk, as returned by indexTracks(), using a known
+ * tempo map to compute the real time of the events.
+ *
+ * For a format 1 SMF the tempo map of the first track can be collected by
+ * parsing it first, and then shared by the parsers of the other tracks.
+ * Tempo changes found in the chunk are added to the map as usual.
+ * @param chunk The track chunk, including the chunk header
+ * @param tempoMap Tempo changes of the SMF, and its division
+ * @since 0.3.0
+ */
+void QSmf::readTrackChunk(const QByteArray& chunk, const QSmfTempoMap& tempoMap)
+{
+    d->m_Division = tempoMap.getDivision();
+    d->m_TempoMap = tempoMap;
+    if (d->m_TempoMap.isEmpty())
+        d->m_TempoMap.addTempo(500000, 0);
+    d->m_CurrTempo = d->m_TempoMap.tempoAt(0);
+    d->m_Buffer = reinterpret_cast<const quint8 *>(chunk.constData());
+    d->m_BufferSize = chunk.size();
+    d->m_BufferPos = 0;
+    try
+    {
+        readTrack();
+    }
+    catch (...)
+    {
+        d->m_Buffer = 0;
+        d->m_BufferSize = 0;
+        throw;
+    }
+    d->m_Buffer = 0;
+    d->m_BufferSize = 0;
+}
+
 /**
  * Writes a SMF stream
  * @param stream Pointer to an existing and opened stream
@@ -892,72 +1086,18 @@ void QSmf::readExpected(const QString& s)
         b = getByte();
         if (QChar(b) != s[j])
         {
-            SMFError(QString("Invalid (%1) SMF format at %2").arg(b, 0, 16).arg(d->m_IOStream->device()->pos()));
+            SMFError(QString("Invalid (%1) SMF format at %2").arg(b, 0, 16).arg(getFilePos()));
             break;
         }
     }
 }
 
-quint64 QSmf::findTempo()
-{
-    quint64 result, old_tempo, new_tempo;
-    QSmfRecTempo rec = d->m_TempoList.last();
-    old_tempo = d->m_CurrTempo;
-    new_tempo = d->m_CurrTempo;
-    QList<QSmfRecTempo>::Iterator it;
-    for( it = d->m_TempoList.begin(); it != d->m_TempoList.end(); ++it )
-    {
-        rec = (*it);
-        if (rec.time <= d->m_CurrTime)
-        {
-            old_tempo = rec.tempo;
-        }
-        new_tempo = rec.tempo;
-        if (rec.time > d->m_RevisedTime)
-        {
-            break;
-        }
-    }
-    if ((rec.time <= d->m_RevisedTime) || (rec.time > d->m_CurrTime))
-    {
-        d->m_RevisedTime = d->m_CurrTime;
-        result = old_tempo;
-    }
-    else
-    {
-        d->m_RevisedTime = rec.time;
-        d->m_TempoChangeTime = d->m_RevisedTime;
-        result = new_tempo;
-    }
-    return result;
-}
-
-/* This routine converts delta times in ticks into seconds. The
- else statement is needed because the formula is different for tracks
- based on notes and tracks based on SMPTE times. */
-double QSmf::ticksToSecs(quint64 ticks, quint16 division, quint64 tempo)
-{
-    double result;
-    double smpte_format;
-    double smpte_resolution;
-
-    if (division > 0)
-    {
-        result = static_cast<double>(ticks * tempo)/(division * 1000000.0);
-    }
-    else
-    {
-        smpte_format = upperByte(division);
-        smpte_resolution = lowerByte(division);
-        result = static_cast<double>(ticks)/(smpte_format * smpte_resolution
-                * 1000000.0);
-    }
-    return result;
-}
-
 void QSmf::SMFError(const QString& s)
 {
-    emit signalSMFError(s);
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleError(s);
+    else
+        emit signalSMFError(s);
 }
 
 void QSmf::channelMessage(quint8 status, quint8 c1, quint8 c2)
@@ -978,26 +1118,47 @@ void QSmf::channelMessage(quint8 status, quint8 c1, quint8 c2)
     switch (status & midi_command_mask)
     {
     case note_off:
-        emit signalSMFNoteOff(chan, c1, c2);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleNoteOff(chan, c1, c2);
+        else
+            emit signalSMFNoteOff(chan, c1, c2);
         break;
     case note_on:
-        emit signalSMFNoteOn(chan, c1, c2);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleNoteOn(chan, c1, c2);
+        else
+            emit signalSMFNoteOn(chan, c1, c2);
         break;
     case poly_aftertouch:
-        emit signalSMFKeyPress(chan, c1, c2);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleKeyPress(chan, c1, c2);
+        else
+            emit signalSMFKeyPress(chan, c1, c2);
         break;
     case control_change:
-        emit signalSMFCtlChange(chan, c1, c2);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleCtlChange(chan, c1, c2);
+        else
+            emit signalSMFCtlChange(chan, c1, c2);
         break;
     case program_chng:
-        emit signalSMFProgram(chan, c1);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleProgram(chan, c1);
+        else
+            emit signalSMFProgram(chan, c1);
         break;
     case channel_aftertouch:
-        emit signalSMFChanPress(chan, c1);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleChanPress(chan, c1);
+        else
+            emit signalSMFChanPress(chan, c1);
         break;
     case pitch_wheel:
         k = c1 + (c2 << 7) - 8192;
-        emit signalSMFPitchBend(chan, k);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handlePitchBend(chan, k);
+        else
+            emit signalSMFPitchBend(chan, k);
         break;
     default:
         SMFError(QString("Invalid MIDI status %1. Unhandled event").arg(status));
@@ -1007,13 +1168,15 @@ void QSmf::channelMessage(quint8 status, quint8 c1, quint8 c2)
 
 void QSmf::metaEvent(quint8 b)
 {
-    QSmfRecTempo rec;
     QByteArray m(d->m_MsgBuff);
 
     switch (b)
     {
     case sequence_number:
-        emit signalSMFSequenceNum(to16bit(m[0], m[1]));
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleSequenceNum(to16bit(m[0], m[1]));
+        else
+            emit signalSMFSequenceNum(to16bit(m[0], m[1]));
         break;
     case text_event:
     case copyright_notice:
@@ -1027,55 +1190,82 @@ void QSmf::metaEvent(quint8 b)
                 s = QString(m);
             else
                 s = d->m_codec->toUnicode(m);
-            emit signalSMFText(b, s);
+            if (d->m_Handler != NULL)
+                d->m_Handler->handleText(b, s);
+            else
+                emit signalSMFText(b, s);
         }
         break;
     case forced_channel:
-        emit signalSMFforcedChannel(m[0]);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleForcedChannel(m[0]);
+        else
+            emit signalSMFforcedChannel(m[0]);
         break;
     case forced_port:
-        emit signalSMFforcedPort(m[0]);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleForcedPort(m[0]);
+        else
+            emit signalSMFforcedPort(m[0]);
         break;
     case end_of_track:
-        emit signalSMFendOfTrack();
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleEndOfTrack();
+        else
+            emit signalSMFendOfTrack();
         break;
     case set_tempo:
         d->m_CurrTempo = to32bit(0, m[0], m[1], m[2]);
-        emit signalSMFTempo(d->m_CurrTempo);
-        rec = d->m_TempoList.last();
-        if (rec.tempo == d->m_CurrTempo)
-        {
-            return;
-        }
-        if (rec.time > d->m_CurrTime)
-        {
-            return;
-        }
-        addTempo(d->m_CurrTempo, d->m_CurrTime);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleTempo(d->m_CurrTempo);
+        else
+            emit signalSMFTempo(d->m_CurrTempo);
+        d->m_TempoMap.addTempo(d->m_CurrTempo, d->m_CurrTime);
         break;
     case smpte_offset:
-        emit signalSMFSmpte(m[0], m[1], m[2], m[3], m[4]);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleSmpte(m[0], m[1], m[2], m[3], m[4]);
+        else
+            emit signalSMFSmpte(m[0], m[1], m[2], m[3], m[4]);
         break;
     case time_signature:
-        emit signalSMFTimeSig(m[0], m[1], m[2], m[3]);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleTimeSig(m[0], m[1], m[2], m[3]);
+        else
+            emit signalSMFTimeSig(m[0], m[1], m[2], m[3]);
         break;
     case key_signature:
-        emit signalSMFKeySig(m[0], m[1]);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleKeySig(m[0], m[1]);
+        else
+            emit signalSMFKeySig(m[0], m[1]);
         break;
     case sequencer_specific:
-        emit signalSMFSeqSpecific(m);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleSeqSpecific(m);
+        else
+            emit signalSMFSeqSpecific(m);
         break;
     default:
-        emit signalSMFMetaUnregistered(b, m);
+        if (d->m_Handler != NULL)
+            d->m_Handler->handleMetaUnregistered(b, m);
+        else
+            emit signalSMFMetaUnregistered(b, m);
         break;
     }
-    emit signalSMFMetaMisc(b, m);
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleMetaMisc(b, m);
+    else
+        emit signalSMFMetaMisc(b, m);
 }
 
 void QSmf::sysEx()
 {
     QByteArray varr(d->m_MsgBuff);
-    emit signalSMFSysex(varr);
+    if (d->m_Handler != NULL)
+        d->m_Handler->handleSysex(varr);
+    else
+        emit signalSMFSysex(varr);
 }
 
 void QSmf::badByte(quint8 b, int p)
@@ -1194,6 +1384,8 @@ void QSmf::setFileFormat(int fileFormat)
  */
 long QSmf::getFilePos()
 {
+    if (d->m_Buffer != NULL)
+        return (long) d->m_BufferPos;
     return (long) d->m_IOStream->device()->pos();
 }
 
@@ -1219,4 +1411,246 @@ void QSmf::setTextCodec(QTextCodec *codec)
     d->m_codec = codec;
 }
 
+/**
+ * Gets the buffered reading mode
+ * @return True if the SMF data is read into memory before parsing
+ */
+bool QSmf::getBufferedReading()
+{
+    return d->m_Buffered;
+}
+
+/**
+ * Sets the buffered reading mode.
+ *
+ * When enabled, readFromFile() maps the whole file into memory, and
+ * readFromStream() reads all the remaining data of the stream device at once.
+ * The SMF is then parsed from the contiguous buffer instead of pulling every
+ * byte through the QDataStream. The signals emitted are the same in both modes.
+ *
+ * @param enable True to read the SMF data into memory before parsing
+ */
+void QSmf::setBufferedReading(bool enable)
+{
+    d->m_Buffered = enable;
+}
+
+/**
+ * Gets the tempo map of the last SMF read.
+ *
+ * The map is complete once the parsing has finished, and it remains
+ * valid until the next SMF is read.
+ * @return The tempo map
+ * @since 0.3.0
+ */
+const QSmfTempoMap& QSmf::getTempoMap() const
+{
+    return d->m_TempoMap;
+}
+
+/**
+ * Gets the events handler.
+ * @return The events handler, or NULL if the events are delivered as signals
+ * @since 0.3.0
+ */
+QSmfHandler* QSmf::getHandler()
+{
+    return d->m_Handler;
+}
+
+/**
+ * Sets an events handler, enabling the callback delivery mode.
+ *
+ * While a handler is set, the events read from a SMF are delivered to it,
+ * and the corresponding signals are not emitted. The signals used to request
+ * writing the tracks of a SMF are not affected.
+ * @param handler The events handler, or NULL to restore the signals
+ * @since 0.3.0
+ */
+void QSmf::setHandler(QSmfHandler* handler)
+{
+    d->m_Handler = handler;
+}
+
+/**
+ * Constructor
+ */
+QSmfTempoMap::QSmfTempoMap() :
+    m_division(96)
+{ }
+
+/**
+ * Removes all the tempo changes.
+ */
+void QSmfTempoMap::clear()
+{
+    m_entries.clear();
+}
+
+/**
+ * Checks if the map has no tempo changes.
+ * @return True if the map is empty
+ */
+bool QSmfTempoMap::isEmpty() const
+{
+    return m_entries.isEmpty();
+}
+
+/**
+ * Gets the number of tempo changes.
+ * @return The number of tempo changes
+ */
+int QSmfTempoMap::count() const
+{
+    return m_entries.count();
+}
+
+/**
+ * Gets a tempo change.
+ * @param i Index of the tempo change, between 0 and count() - 1
+ * @return The tempo change
+ */
+const QSmfTempoMap::Entry& QSmfTempoMap::at(int i) const
+{
+    return m_entries.at(i);
+}
+
+/**
+ * Gets the division used to convert ticks into time.
+ * @return Ticks per quarter note, or a SMPTE division
+ */
+int QSmfTempoMap::getDivision() const
+{
+    return m_division;
+}
+
+/**
+ * Sets the division used to convert ticks into time. The map should be
+ * empty when the division is changed.
+ * @param division Ticks per quarter note, or a SMPTE division
+ */
+void QSmfTempoMap::setDivision(int division)
+{
+    m_division = division;
+}
+
+/**
+ * Appends a tempo change.
+ *
+ * Tempo changes must be added in time order. A change located before the
+ * last one is ignored, a change at the same location replaces the last one,
+ * and a change to the same tempo is redundant and also ignored.
+ * @param tempo Tempo in microseconds per quarter
+ * @param time Location in ticks
+ */
+void QSmfTempoMap::addTempo(quint64 tempo, quint64 time)
+{
+    Entry rec;
+    rec.time = time;
+    rec.tempo = tempo;
+    rec.microsecs = 0;
+    if (!m_entries.isEmpty())
+    {
+        const Entry& last = m_entries.last();
+        if ((last.tempo == tempo) || (last.time > time))
+        {
+            return;
+        }
+        if (last.time == time)
+        {
+            m_entries.last().tempo = tempo;
+            return;
+        }
+        rec.microsecs = ticksToMicroseconds(time, m_entries.count() - 1);
+    }
+    m_entries.append(rec);
+}
+
+/**
+ * Finds the tempo change in effect at a location.
+ * @param ticks Location in ticks
+ * @return Index of the tempo change, or -1 if there is none
+ */
+int QSmfTempoMap::indexOf(quint64 ticks) const
+{
+    int first = 0;
+    int last = m_entries.count();
+    while (first < last)
+    {
+        int middle = first + (last - first) / 2;
+        if (m_entries.at(middle).time <= ticks)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+    return first - 1;
+}
+
+/**
+ * Gets the tempo in effect at a location.
+ * @param ticks Location in ticks
+ * @return Tempo in microseconds per quarter
+ */
+quint64 QSmfTempoMap::tempoAt(quint64 ticks) const
+{
+    int i = indexOf(ticks);
+    if (i < 0)
+        return 500000;
+    return m_entries.at(i).tempo;
+}
+
+/**
+ * Converts a location in ticks into real time.
+ * @param ticks Location in ticks
+ * @return Elapsed microseconds since the beginning
+ */
+double QSmfTempoMap::ticksToMicroseconds(quint64 ticks) const
+{
+    return ticksToMicroseconds(ticks, indexOf(ticks));
+}
+
+/**
+ * Converts a location in ticks into real time, using a known tempo change.
+ * This avoids the search when the caller walks the map sequentially.
+ * @param ticks Location in ticks
+ * @param index Index of the tempo change in effect at the location
+ * @return Elapsed microseconds since the beginning
+ */
+double QSmfTempoMap::ticksToMicroseconds(quint64 ticks, int index) const
+{
+    double microsecs = 0;
+    double tempo = 500000;
+    quint64 time = 0;
+    if (index >= 0)
+    {
+        const Entry& rec = m_entries.at(index);
+        microsecs = rec.microsecs;
+        tempo = rec.tempo;
+        time = rec.time;
+    }
+    if (ticks <= time)
+        return microsecs;
+    if (m_division & 0x8000)
+    {
+        /* SMPTE division: negative frames per second in the upper byte,
+           and ticks per frame in the lower byte */
+        double frames = 256 - ((m_division >> 8) & 0xff);
+        double resolution = m_division & 0xff;
+        return microsecs + (ticks - time) * 1000000.0 / (frames * resolution);
+    }
+    if (m_division == 0)
+        return microsecs;
+    return microsecs + (ticks - time) * tempo / m_division;
+}
+
+/**
+ * Converts a location in ticks into seconds.
+ * @param ticks Location in ticks
+ * @return Elapsed seconds since the beginning
+ */
+double QSmfTempoMap::ticksToSeconds(quint64 ticks) const
+{
+    return ticksToMicroseconds(ticks) / 1000000.0;
+}
+
 }
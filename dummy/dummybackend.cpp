@@ -47,6 +47,7 @@ namespace KMid {
     {
         d->m_object = new DummyMIDIObject(this);
         d->m_output = new DummyMIDIOutput(this);
+        d->m_object->initialize(d->m_output);
         d->m_initialized = true;
     }
 
@@ -18,221 +18,627 @@
 */
 
 #include "dummymidiobject.h"
+#include "dummymidioutput.h"
+#include "dummysong.h"
+#include "virtualclock.h"
+
+#include <QRegExp>
 #include <QStringList>
+#include <QTextCodec>
+#include <QTimer>
+#include <QUrl>
+#include <qmath.h>
 
 namespace KMid {
 
+    /**
+     * Maximum number of events delivered at once when running as fast as
+     * possible, before returning to the event loop.
+     */
+    static const int BATCH_EVENTS = 256;
+
+    /**
+     * Maximum wait between deliveries, so the tick signals keep flowing
+     * while there are no events to deliver.
+     */
+    static const int MAX_WAIT_MSECS = 20;
+
+    static inline MIDIEventRecord eventRecord(int type, int channel, int data1,
+                                              int data2 = 0, int value = 0)
+    {
+        MIDIEventRecord record;
+        record.type = type;
+        record.channel = channel;
+        record.data1 = data1;
+        record.data2 = data2;
+        record.value = value;
+        return record;
+    }
+
     class DummyMIDIObject::DummyMIDIObjectPrivate {
     public:
-        DummyMIDIObjectPrivate()
+        DummyMIDIObjectPrivate() :
+            m_out(0),
+            m_timer(0),
+            m_codec(0),
+            m_state(StoppedState),
+            m_playlistIndex(-1),
+            m_index(0),
+            m_tickInterval(0),
+            m_lastTick(0),
+            m_tempo(500000)
         {}
         virtual ~DummyMIDIObjectPrivate()
         {}
+
+        qint32 tickInterval() const
+        {
+            if (m_tickInterval == 0)
+                return m_song.getDivision() / 12;
+            return m_tickInterval;
+        }
+
+        DummyMIDIOutput *m_out;
+        QTimer *m_timer;
+        QTextCodec *m_codec;
+        State m_state;
+        DummySong m_song;
+        VirtualClock m_clock;
+        QStringList m_playList;
+        QStringList m_loadingMessages;
+        QString m_encoding;
+        int m_playlistIndex;
+        int m_index;
+        qint32 m_tickInterval;
+        qint64 m_lastTick;
+        int m_tempo;
     };
 
     DummyMIDIObject::DummyMIDIObject(QObject *parent) :
             MIDIObject(parent), d(new DummyMIDIObjectPrivate)
-    { }
-
+    {
+        d->m_timer = new QTimer(this);
+        d->m_timer->setSingleShot(true);
+        connect(d->m_timer, SIGNAL(timeout()), SLOT(playEvents()));
+    }
 
     DummyMIDIObject::~DummyMIDIObject()
     {
         delete d;
     }
 
+    void DummyMIDIObject::initialize(DummyMIDIOutput *output)
+    {
+        d->m_out = output;
+        d->m_out->setClock(&d->m_clock);
+    }
+
     State DummyMIDIObject::state() const
     {
-        return ErrorState;
+        return d->m_state;
     }
 
     qint32 DummyMIDIObject::tickInterval() const
     {
-        return 0;
+        return d->m_tickInterval;
     }
 
+    /**
+     * Returns the song position in ticks, from the virtual clock.
+     */
     qint64 DummyMIDIObject::currentTime() const
     {
-        return 0;
+        qint64 tick = d->m_song.timeToTick(d->m_clock.now());
+        return qMin(tick, d->m_song.getLastTick());
     }
 
     qreal DummyMIDIObject::duration() const
     {
-        return 0;
+        return d->m_song.getLastTime() / 1e6;
     }
 
     qint64 DummyMIDIObject::remainingTime() const
     {
-        return 0;
+        if (d->m_song.isEmpty())
+            return 0;
+        return totalTime() - currentTime();
     }
 
     QString DummyMIDIObject::errorString() const
     {
-        return QString();
+        return d->m_loadingMessages.join(QString(QChar::LineSeparator));
     }
 
-    QStringList DummyMIDIObject::metaData(const QString& /*key*/) const
+    QStringList DummyMIDIObject::metaData(const QString& key) const
     {
-        /*if (key == "SMF_TEXT")
-            //return d->m_song.getText(Song::Text);
+        int type = 0;
+        if (key == "SMF_TEXT")
+            type = text_event;
         else if (key == "SMF_COPYRIGHT")
-            //return d->m_song.getText(Song::Copyright);
+            type = copyright_notice;
         else if (key == "SMF_TRACKNAMES")
-            //return d->m_song.getText(Song::TrackName);
+            type = sequence_name;
         else if (key == "SMF_INSTRUMENTNAMES")
-            return d->m_song.getText(Song::InstrumentName);
+            type = instrument_name;
         else if (key == "SMF_LYRICS")
-            return d->m_song.getText(Song::Lyric);
+            type = lyric;
         else if (key == "SMF_MARKERS")
-            return d->m_song.getText(Song::Marker);
+            type = marker;
         else if (key == "SMF_CUES")
-            return d->m_song.getText(Song::Cue);
-        else if (key == "KAR_FILETYPE")
-            return d->m_song.getText(Song::KarFileType);
-        else if (key == "KAR_VERSION")
-            return d->m_song.getText(Song::KarVersion);
-        else if (key == "KAR_INFORMATION")
-            return d->m_song.getText(Song::KarInformation);
-        else if (key == "KAR_LANGUAGE")
-            return d->m_song.getText(Song::KarLanguage);
-        else if (key == "KAR_TITLES")
-            return d->m_song.getText(Song::KarTitles);
-        else if (key == "KAR_WARNINGS")
-            return d->m_song.getText(Song::KarWarnings);*/
-        return QStringList();
+            type = cue_point;
+        else
+            return QStringList();
+        return d->m_song.getText(type, d->m_codec);
     }
 
     qint64 DummyMIDIObject::totalTime() const
     {
-        return 0;
+        return d->m_song.getLastTick();
     }
 
     QString DummyMIDIObject::currentSource() const
     {
+        if ( !d->m_song.isEmpty() &&
+             d->m_playlistIndex >= 0 &&
+             d->m_playlistIndex < d->m_playList.size() )
+            return d->m_playList.at(d->m_playlistIndex);
         return QString();
     }
 
-    void DummyMIDIObject::setCurrentSource(const QString& /*source*/)
+    void DummyMIDIObject::setCurrentSource(const QString& source)
     {
+        if (d->m_playList.contains(source)) {
+            d->m_playlistIndex = d->m_playList.indexOf(source);
+        } else {
+            d->m_playList.clear();
+            d->m_playList << source;
+            d->m_playlistIndex = 0;
+        }
+        openFile(source);
     }
 
     QStringList DummyMIDIObject::queue() const
     {
-        return QStringList();
+        return d->m_playList;
     }
 
-    void DummyMIDIObject::setQueue(const QStringList& /*sources*/)
+    void DummyMIDIObject::setQueue(const QStringList& sources)
     {
+        d->m_playList = sources;
     }
 
-    void DummyMIDIObject::setQueue(const QList<QUrl>& /*urls*/ )
+    void DummyMIDIObject::setQueue(const QList<QUrl>& urls)
     {
+        d->m_playList.clear();
+        enqueue(urls);
     }
 
-    void DummyMIDIObject::enqueue(const QString& /*source*/)
+    void DummyMIDIObject::enqueue(const QString& source)
     {
+        d->m_playList.append(source);
     }
 
-    void DummyMIDIObject::enqueue(const QStringList& /*sources*/)
+    void DummyMIDIObject::enqueue(const QStringList& sources)
     {
+        d->m_playList += sources;
     }
 
-    void DummyMIDIObject::enqueue(const QList<QUrl>& /*urls*/)
+    void DummyMIDIObject::enqueue(const QList<QUrl>& urls)
     {
+        foreach(const QUrl &u, urls)
+            d->m_playList.append(u.toString());
     }
 
     void DummyMIDIObject::clearQueue()
     {
+        d->m_playList.clear();
+        d->m_playlistIndex = -1;
     }
 
+    /**
+     * Returns the speed of the virtual clock. Zero means that the songs
+     * are played as fast as possible.
+     */
     qreal DummyMIDIObject::timeSkew()
     {
-        return 0;
+        return d->m_clock.speed();
+    }
+
+    /**
+     * Loads a local file synchronously. The records of the output are
+     * cleared, so they only contain the messages of the current song.
+     */
+    void DummyMIDIObject::openFile(const QString &fileName)
+    {
+        QString localFile = fileName;
+        QUrl url(fileName);
+        if (url.isLocalFile())
+            localFile = url.toLocalFile();
+        d->m_timer->stop();
+        d->m_clock.stop();
+        d->m_clock.setTime(0);
+        d->m_index = 0;
+        d->m_lastTick = 0;
+        d->m_out->clearRecords();
+        updateState( LoadingState );
+        bool ok = d->m_song.load(localFile);
+        d->m_loadingMessages = d->m_song.errors();
+        if (ok) {
+            d->m_tempo = d->m_song.getInitialTempo();
+            updateState( StoppedState );
+            emit currentSourceChanged(fileName);
+        } else {
+            if (d->m_loadingMessages.isEmpty())
+                d->m_loadingMessages << QString("Cannot load %1").arg(fileName);
+            updateState( ErrorState );
+        }
     }
 
     /* SLOTS */
 
-    void DummyMIDIObject::setTickInterval(qint32 /*interval*/)
+    void DummyMIDIObject::setTickInterval(qint32 interval)
     {
+        d->m_tickInterval = interval;
     }
 
     void DummyMIDIObject::play()
     {
+        if ( !d->m_song.isEmpty() &&
+             (d->m_state == PausedState || d->m_state == StoppedState) ) {
+            if (currentTime() == 0) {
+                d->m_out->beginBatch();
+                d->m_out->sendResetMessage();
+                d->m_out->resetControllers();
+                for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+                    int patch = d->m_song.channelPatch(chan);
+                    if (patch >= 0)
+                        d->m_out->sendProgram(chan, patch);
+                }
+                d->m_out->commitBatch();
+            }
+            d->m_clock.start();
+            updateState( PlayingState );
+            d->m_timer->start(0);
+        }
     }
 
     void DummyMIDIObject::pause()
     {
+        if (d->m_state == PlayingState) {
+            d->m_timer->stop();
+            d->m_clock.stop();
+            d->m_out->allNotesOff();
+            updateState( PausedState );
+        }
     }
 
     void DummyMIDIObject::stop()
     {
-    }
-
-    void DummyMIDIObject::seek(qint64 /*time*/)
-    {
+        if (d->m_state == PlayingState || d->m_state == PausedState) {
+            d->m_timer->stop();
+            d->m_clock.stop();
+            d->m_out->allNotesOff();
+            d->m_clock.setTime(0);
+            d->m_index = 0;
+            d->m_lastTick = 0;
+            updateState( StoppedState );
+            emit tick(0);
+        }
+    }
+
+    /**
+     * Moves the playback to a song position, restoring the channel state
+     * at that point. The virtual clock jumps to the real time of the new
+     * position, so the following events keep their intended times.
+     */
+    void DummyMIDIObject::seek(qint64 time)
+    {
+        if ( !(time < 0) && !d->m_song.isEmpty() &&
+             (time < d->m_song.getLastTick()) ) {
+            d->m_timer->stop();
+            d->m_index = d->m_song.indexOf(time);
+            d->m_clock.setTime(d->m_song.tickToTime(time));
+            d->m_lastTick = time;
+            chaseState(d->m_index);
+            if (d->m_state == PlayingState)
+                scheduleEvents();
+        }
     }
 
     void DummyMIDIObject::clear()
     {
+        stop();
+        d->m_song.clear();
+        d->m_loadingMessages.clear();
+        clearQueue();
     }
 
-    void DummyMIDIObject::setTimeSkew(qreal /*skew*/)
+    /**
+     * Sets the speed of the virtual clock: 1.0 plays in real time, 2.0
+     * twice as fast, and zero as fast as possible.
+     */
+    void DummyMIDIObject::setTimeSkew(qreal skew)
     {
+        d->m_clock.setSpeed(skew);
+        if (d->m_state == PlayingState)
+            scheduleEvents();
     }
 
     QString DummyMIDIObject::getTextEncoding() const
     {
-        return QString();
+        return d->m_encoding;
     }
 
-    void DummyMIDIObject::setTextEncoding(const QString& /*encoding*/)
+    void DummyMIDIObject::setTextEncoding(const QString& encoding)
     {
+        if (encoding != d->m_encoding) {
+            if (encoding.isEmpty())
+                d->m_codec = NULL;
+            else
+                d->m_codec = QTextCodec::codecForName(encoding.toLatin1());
+            d->m_encoding = encoding;
+        }
     }
 
-    QStringList DummyMIDIObject::getLyrics(qint64 /*time*/) const
+    QStringList DummyMIDIObject::getLyrics(qint64 time) const
     {
-        return QStringList();
+        return d->m_song.getLyrics(time, d->m_codec);
     }
 
     qreal DummyMIDIObject::currentTempo()
     {
-        return 0;
+        qreal speed = d->m_clock.isFast() ? 1.0 : d->m_clock.speed();
+        return 6.0e7 / d->m_tempo * speed;
     }
 
-    bool DummyMIDIObject::channelUsed(int /*channel*/)
+    bool DummyMIDIObject::channelUsed(int channel)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS)
+            return d->m_song.channelUsed(channel);
         return false;
     }
 
     int DummyMIDIObject::lowestMidiNote()
     {
-        return 0;
+        return d->m_song.getLowestNote();
     }
 
     int DummyMIDIObject::highestMidiNote()
     {
-        return 0;
+        return d->m_song.getHighestNote();
     }
 
     bool DummyMIDIObject::guessTextEncoding()
     {
-        return false;
+        QByteArray encoding = d->m_song.detectTextEncoding();
+        if (encoding.isEmpty() || QTextCodec::codecForName(encoding) == NULL)
+            return false;
+        setTextEncoding(QString::fromLatin1(encoding));
+        return true;
     }
 
-    QString DummyMIDIObject::channelLabel(int /*channel*/)
+    QString DummyMIDIObject::channelLabel(int channel)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS)
+            return d->m_song.decode(d->m_song.channelLabel(channel), d->m_codec);
         return QString();
     }
 
-    QVariant DummyMIDIObject::songProperty(const QString& /*key*/)
-    {
+    /**
+     * Returns a song property. Besides the common ones, the dummy backend
+     * provides the playback records: VIRTUAL_TIME (the clock time in
+     * microseconds), RECORDED_EVENTS (the number of delivered messages),
+     * MAX_LATENESS (the maximum delivery delay in microseconds), and
+     * EVENT_LOG (the delivered messages, as described by
+     * DummyMIDIOutput::eventLog()).
+     */
+    QVariant DummyMIDIObject::songProperty(const QString& key)
+    {
+        if (key == QLatin1String("SMF_FORMAT"))
+            return QVariant(d->m_song.getFormat());
+        else if (key == QLatin1String("SMF_TRACKS"))
+            return QVariant(d->m_song.getTracks());
+        else if (key == QLatin1String("SMF_DIVISION"))
+            return QVariant(d->m_song.getDivision());
+        else if (key == QLatin1String("NUM_BEATS")) {
+            if (d->m_song.getDivision() <= 0)
+                return QVariant();
+            int beats = d->m_song.getLastTick() / d->m_song.getDivision();
+            return QVariant(beats);
+        } else if (key == QLatin1String("VIRTUAL_TIME"))
+            return QVariant(d->m_clock.now());
+        else if (key == QLatin1String("RECORDED_EVENTS"))
+            return QVariant(d->m_out->recordCount());
+        else if (key == QLatin1String("MAX_LATENESS"))
+            return QVariant(d->m_out->maxLateness());
+        else if (key == QLatin1String("EVENT_LOG"))
+            return QVariant(d->m_out->eventLog());
         return QVariant();
     }
 
-    QVariant DummyMIDIObject::channelProperty(int /*channel*/, const QString& /*key*/)
+    QVariant DummyMIDIObject::channelProperty(int channel, const QString& key)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS) {
+            if (key == QLatin1String("INITIAL_PATCH"))
+                return QVariant(d->m_song.channelPatch(channel));
+            else if (key == QLatin1String("LABEL"))
+                return QVariant(d->m_song.channelLabel(channel));
+            else if (key == QLatin1String("USED"))
+                return QVariant(d->m_song.channelUsed(channel));
+        }
         return QVariant();
     }
 
+    /**
+     * Delivers the song events that are due on the virtual clock. When
+     * running as fast as possible, the clock jumps to every event, and the
+     * events are delivered in batches.
+     */
+    void DummyMIDIObject::playEvents()
+    {
+        int batch = 0;
+        while (d->m_index < d->m_song.count()) {
+            const DummySongEvent& ev = d->m_song.at(d->m_index);
+            if (d->m_clock.isFast()) {
+                if (batch == BATCH_EVENTS)
+                    break;
+                ++batch;
+                d->m_clock.advance(ev.time);
+            } else if (ev.time > d->m_clock.now())
+                break;
+            sendEvent(ev);
+            d->m_index++;
+        }
+        qint64 time = currentTime();
+        if (time - d->m_lastTick >= d->tickInterval()) {
+            d->m_lastTick = time;
+            emit tick(time);
+        }
+        if (d->m_index < d->m_song.count())
+            scheduleEvents();
+        else
+            songFinished();
+    }
+
+    /**
+     * Arms the timer for the next song event.
+     */
+    void DummyMIDIObject::scheduleEvents()
+    {
+        if (d->m_clock.isFast() || d->m_index >= d->m_song.count()) {
+            d->m_timer->start(0);
+            return;
+        }
+        qint64 wait = d->m_song.at(d->m_index).time - d->m_clock.now();
+        wait = qint64(wait / d->m_clock.speed() / 1000);
+        d->m_timer->start(qBound<qint64>(0, wait, MAX_WAIT_MSECS));
+    }
+
+    void DummyMIDIObject::sendEvent(const DummySongEvent& ev)
+    {
+        int chan = ev.status & midi_channel_mask;
+        switch (ev.type) {
+        case DummySongEvent::Channel:
+            d->m_out->sendMessage(ev.status, ev.data1, ev.data2, ev.time);
+            switch (ev.status & midi_command_mask) {
+            case note_off:
+                midiEvent(eventRecord(MIDIEventRecord::NoteOff, chan, ev.data1, ev.data2));
+                break;
+            case note_on:
+                midiEvent(eventRecord(MIDIEventRecord::NoteOn, chan, ev.data1, ev.data2));
+                break;
+            case poly_aftertouch:
+                midiEvent(eventRecord(MIDIEventRecord::KeyPressure, chan, ev.data1, ev.data2));
+                break;
+            case control_change:
+                midiEvent(eventRecord(MIDIEventRecord::Controller, chan, ev.data1, 0, ev.value));
+                break;
+            case program_chng:
+                midiEvent(eventRecord(MIDIEventRecord::Program, chan, ev.data1));
+                break;
+            case channel_aftertouch:
+                midiEvent(eventRecord(MIDIEventRecord::ChannelPressure, chan, ev.data1));
+                break;
+            case pitch_wheel:
+                midiEvent(eventRecord(MIDIEventRecord::PitchBend, chan, 0, 0, ev.value));
+                break;
+            }
+            break;
+        case DummySongEvent::Sysex:
+            d->m_out->sendSysex(d->m_song.data(ev.value), ev.time);
+            break;
+        case DummySongEvent::Tempo:
+            d->m_tempo = ev.value;
+            emit tempoChanged(currentTempo());
+            break;
+        case DummySongEvent::TimeSignature:
+            emit timeSignatureChanged(ev.data1, int(qPow(2, ev.data2)));
+            break;
+        case DummySongEvent::Text:
+            if (ev.status == lyric || ev.status == text_event) {
+                const QByteArray& data = d->m_song.data(ev.value);
+                if (data.length() > 0 && data[0] != '@' && data[0] != '%') {
+                    static const QRegExp separators("[/\\\\\r\n]+");
+                    QString s = d->m_song.decode(data, d->m_codec);
+                    s.remove(separators);
+                    emit midiText(lyric, s, d->m_song.timeToTick(ev.time));
+                }
+            }
+            break;
+        }
+    }
+
+    /**
+     * Restores the channel state at a song position, sending the last
+     * controllers, program and pitch bend of every channel found before it.
+     */
+    void DummyMIDIObject::chaseState(int index)
+    {
+        int programs[MIDI_CHANNELS];
+        int benders[MIDI_CHANNELS];
+        int controllers[MIDI_CHANNELS][MIDI_CTL_ALL_SOUNDS_OFF];
+        for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            programs[chan] = -1;
+            benders[chan] = 0;
+            for (int ctl = 0; ctl < MIDI_CTL_ALL_SOUNDS_OFF; ++ctl)
+                controllers[chan][ctl] = -1;
+        }
+        for (int i = 0; i < index; ++i) {
+            const DummySongEvent& ev = d->m_song.at(i);
+            if (ev.type != DummySongEvent::Channel)
+                continue;
+            int chan = ev.status & midi_channel_mask;
+            switch (ev.status & midi_command_mask) {
+            case control_change:
+                if (ev.data1 < MIDI_CTL_ALL_SOUNDS_OFF)
+                    controllers[chan][ev.data1] = ev.data2;
+                break;
+            case program_chng:
+                programs[chan] = ev.data1;
+                break;
+            case pitch_wheel:
+                benders[chan] = ev.value;
+                break;
+            }
+        }
+        d->m_out->beginBatch();
+        d->m_out->allNotesOff();
+        d->m_out->resetControllers();
+        for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            for (int ctl = 0; ctl < MIDI_CTL_ALL_SOUNDS_OFF; ++ctl)
+                if (controllers[chan][ctl] >= 0)
+                    d->m_out->sendController(chan, ctl, controllers[chan][ctl]);
+            if (programs[chan] >= 0)
+                d->m_out->sendProgram(chan, programs[chan]);
+            if (benders[chan] != 0)
+                d->m_out->sendPitchBend(chan, benders[chan]);
+        }
+        d->m_out->commitBatch();
+    }
+
+    void DummyMIDIObject::songFinished()
+    {
+        d->m_timer->stop();
+        d->m_clock.stop();
+        d->m_clock.setTime(0);
+        d->m_index = 0;
+        d->m_lastTick = 0;
+        updateState( StoppedState );
+        bool goNext = d->m_playlistIndex < d->m_playList.count()-1;
+        emit finished();
+        if (goNext && (d->m_playlistIndex < d->m_playList.count()-1))
+            setCurrentSource(d->m_playList.at(d->m_playlistIndex+1));
+    }
+
+    void DummyMIDIObject::updateState(State newState)
+    {
+        State oldState = d->m_state;
+        if (oldState != newState) {
+            d->m_state = newState;
+            emit stateChanged(newState, oldState);
+        }
+    }
+
 }
 
 #include "dummymidiobject.moc"
@@ -25,6 +25,16 @@
 
 namespace KMid {
 
+    class DummyMIDIOutput;
+    struct DummySongEvent;
+
+    /**
+     * Player without any MIDI hardware or sequencer. Songs are loaded
+     * through QSmf and played against a virtual clock, at the speed given
+     * by the time skew, or as fast as possible when the time skew is zero.
+     * Every message is recorded by the output, with its intended and
+     * actual times, so the playback can be verified without a sound card.
+     */
     class DummyMIDIObject : public MIDIObject
     {
         Q_OBJECT
@@ -33,6 +43,8 @@ namespace KMid {
         explicit DummyMIDIObject(QObject *parent = 0);
         ~DummyMIDIObject();
 
+        void initialize(DummyMIDIOutput *output);
+
         qint32 tickInterval() const;
         qint64 currentTime() const;
         State state() const;
@@ -72,7 +84,17 @@ namespace KMid {
         void setTimeSkew(qreal skew);
         void setTextEncoding(const QString& encoding);
 
+    private Q_SLOTS:
+        void playEvents();
+
     private:
+        void openFile(const QString &fileName);
+        void scheduleEvents();
+        void sendEvent(const DummySongEvent& ev);
+        void chaseState(int index);
+        void songFinished();
+        void updateState(State newState);
+
         class DummyMIDIObjectPrivate;
         DummyMIDIObjectPrivate * const d;
     };
@@ -18,14 +18,136 @@
 */
 
 #include "dummymidioutput.h"
-#include <QStringList>
+#include "virtualclock.h"
+#include "midimapper.h"
+
+#include <qsmf.h>
+#include <QVector>
+
+using namespace drumstick;
 
 namespace KMid {
 
+    static const QLatin1String DEVICE_NAME("Dummy");
+
     class DummyMIDIOutput::DummyMIDIOutputPrivate {
     public:
-        DummyMIDIOutputPrivate() {}
+        DummyMIDIOutputPrivate() :
+            m_batchDepth(0),
+            m_batchCount(0),
+            m_clock(0),
+            m_mapper(0),
+            m_pitchShift(0),
+            m_maxLateness(0)
+        {
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+                m_volumeShift[chan] = 1.0;
+                m_volume[chan] = 100;
+                m_muted[chan] = false;
+                m_locked[chan] = false;
+            }
+        }
+
         virtual ~DummyMIDIOutputPrivate() {}
+
+        qint64 now() const
+        {
+            return (m_clock != 0) ? m_clock->now() : 0;
+        }
+
+        /**
+         * Applies the output transformations to a channel message, like
+         * ALSAMIDIOutput does.
+         * @return false if the message should be discarded, because the
+         * channel is muted or its program is locked
+         */
+        bool transform(quint8 *message)
+        {
+            int status = message[0] & midi_command_mask;
+            int chan = message[0] & midi_channel_mask;
+            bool mapped = (m_mapper != NULL && m_mapper->isOK());
+            switch (status) {
+            case note_off:
+            case note_on:
+                if (chan != MIDI_GM_DRUM_CHANNEL) {
+                    int note = message[1] + m_pitchShift;
+                    while (note > 127) note -= 12;
+                    while (note < 0) note += 12;
+                    message[1] = note;
+                } else if (mapped) {
+                    int key = m_mapper->key(MIDI_GM_DRUM_CHANNEL, 0, message[1]);
+                    if (key >= 0 && key < 128)
+                        message[1] = key;
+                }
+                break;
+            case control_change:
+                if (mapped) {
+                    int param = m_mapper->controller(message[1]);
+                    if (param >= 0 && param < 128)
+                        message[1] = param;
+                }
+                if (message[1] == MIDI_CTL_MSB_MAIN_VOLUME) {
+                    m_volume[chan] = message[2];
+                    message[2] = qBound(0, int(message[2] * m_volumeShift[chan]), 127);
+                }
+                break;
+            case program_chng:
+                if (mapped) {
+                    int pgm = m_mapper->patch(chan, message[1]);
+                    if (pgm >= 0 && pgm < 128)
+                        message[1] = pgm;
+                }
+                break;
+            case pitch_wheel:
+                if (mapped) {
+                    int ratio = m_mapper->pitchBender(4096);
+                    if (ratio != 4096) {
+                        int value = (message[1] + message[2] * 0x80) - 8192;
+                        value = qBound(-8192, value * ratio / 4096, 8191) + 8192;
+                        message[1] = value & 0x7f;
+                        message[2] = value >> 7;
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+            if (m_muted[chan] || (status == program_chng && m_locked[chan]))
+                return false;
+            if (mapped) {
+                int channel = m_mapper->channel(chan);
+                if (channel >= 0 && channel < MIDI_CHANNELS)
+                    message[0] = status | channel;
+            }
+            return true;
+        }
+
+        void record(const quint8 *message, int length, int sysex, qint64 intended)
+        {
+            DummyOutputRecord rec;
+            rec.intended = intended;
+            rec.actual = now();
+            for (int i = 0; i < 3; ++i)
+                rec.message[i] = (i < length) ? message[i] : 0;
+            rec.length = length;
+            rec.sysex = sysex;
+            m_maxLateness = qMax(m_maxLateness, rec.actual - rec.intended);
+            m_records.append(rec);
+        }
+
+        int m_batchDepth;
+        int m_batchCount;
+        const VirtualClock *m_clock;
+        MidiMapper *m_mapper;
+        int m_pitchShift;
+        qreal m_volumeShift[MIDI_CHANNELS];
+        int m_volume[MIDI_CHANNELS];
+        bool m_muted[MIDI_CHANNELS];
+        bool m_locked[MIDI_CHANNELS];
+        QByteArray m_resetMessage;
+        QVector<DummyOutputRecord> m_records;
+        QList<QByteArray> m_sysex;
+        qint64 m_maxLateness;
     };
 
     DummyMIDIOutput::DummyMIDIOutput(QObject *parent) :
@@ -37,8 +159,10 @@ namespace KMid {
         delete d;
     }
 
-    qreal DummyMIDIOutput::volume(int /*channel*/) const
+    qreal DummyMIDIOutput::volume(int channel) const
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS)
+            return d->m_volumeShift[channel];
         return -1.0;
     }
 
@@ -49,121 +173,277 @@ namespace KMid {
 
     QString DummyMIDIOutput::outputDeviceName() const
     {
-        return QString();
+        return DEVICE_NAME;
     }
 
-    bool DummyMIDIOutput::isMuted(int /*channel*/) const
+    bool DummyMIDIOutput::isMuted(int channel) const
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS)
+            return d->m_muted[channel];
         return false;
     }
 
     MidiMapper* DummyMIDIOutput::midiMap()
     {
-        return NULL;
+        return d->m_mapper;
     }
 
     int DummyMIDIOutput::pitchShift()
     {
-        return 0;
+        return d->m_pitchShift;
     }
 
     QStringList DummyMIDIOutput::outputDeviceList(bool /*basicOnly*/)
     {
-        return QStringList();
+        return QStringList(DEVICE_NAME);
+    }
+
+    void DummyMIDIOutput::beginBatch()
+    {
+        d->m_batchDepth++;
+    }
+
+    void DummyMIDIOutput::commitBatch()
+    {
+        if (d->m_batchDepth > 0 && --d->m_batchDepth == 0)
+            d->m_batchCount++;
+    }
+
+    /**
+     * Returns the number of batches committed so far.
+     */
+    int DummyMIDIOutput::batchCount() const
+    {
+        return d->m_batchCount;
+    }
+
+    /**
+     * Sets the clock providing the delivery time of the messages.
+     */
+    void DummyMIDIOutput::setClock(const VirtualClock *clock)
+    {
+        d->m_clock = clock;
+    }
+
+    /**
+     * Delivers a channel message scheduled at a time of the virtual clock.
+     */
+    void DummyMIDIOutput::sendMessage(quint8 status, quint8 data1, quint8 data2, qint64 intended)
+    {
+        quint8 message[3] = { status, data1, data2 };
+        if (d->transform(message)) {
+            int command = status & midi_command_mask;
+            int length = (command == program_chng || command == channel_aftertouch) ? 2 : 3;
+            d->record(message, length, -1, intended);
+        }
+    }
+
+    /**
+     * Delivers a system exclusive message scheduled at a time of the
+     * virtual clock.
+     */
+    void DummyMIDIOutput::sendSysex(const QByteArray& data, qint64 intended)
+    {
+        d->m_sysex.append(data);
+        d->record(0, 0, d->m_sysex.count() - 1, intended);
+    }
+
+    int DummyMIDIOutput::recordCount() const
+    {
+        return d->m_records.count();
+    }
+
+    const DummyOutputRecord& DummyMIDIOutput::record(int i) const
+    {
+        return d->m_records.at(i);
+    }
+
+    /**
+     * Returns the bytes of a recorded message.
+     */
+    QByteArray DummyMIDIOutput::recordMessage(int i) const
+    {
+        const DummyOutputRecord& rec = d->m_records.at(i);
+        if (rec.sysex >= 0)
+            return d->m_sysex.at(rec.sysex);
+        return QByteArray(reinterpret_cast<const char*>(rec.message), rec.length);
+    }
+
+    /**
+     * Returns the maximum delay of the recorded messages, in microseconds.
+     */
+    qint64 DummyMIDIOutput::maxLateness() const
+    {
+        return d->m_maxLateness;
+    }
+
+    /**
+     * Returns the recorded messages, one per line, with the intended and
+     * actual times in microseconds, and the message bytes in hexadecimal.
+     */
+    QStringList DummyMIDIOutput::eventLog() const
+    {
+        QStringList log;
+        for (int i = 0; i < d->m_records.count(); ++i) {
+            const DummyOutputRecord& rec = d->m_records.at(i);
+            log << QString("%1\t%2\t%3").arg(rec.intended).arg(rec.actual)
+                   .arg(QString::fromLatin1(recordMessage(i).toHex()));
+        }
+        return log;
+    }
+
+    void DummyMIDIOutput::clearRecords()
+    {
+        d->m_records.clear();
+        d->m_sysex.clear();
+        d->m_maxLateness = 0;
     }
 
     /* SLOTS */
 
-    void DummyMIDIOutput::setVolume(int /*channel*/, qreal /*value*/)
+    void DummyMIDIOutput::setVolume(int channel, qreal value)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS) {
+            d->m_volumeShift[channel] = value;
+            sendController(channel, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[channel]);
+            emit volumeChanged( channel, value );
+        } else if ( channel == -1 ) {
+            beginBatch();
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+                d->m_volumeShift[chan] = value;
+                sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, d->m_volume[chan]);
+            }
+            commitBatch();
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
+                emit volumeChanged( chan, value );
+        }
     }
 
     void DummyMIDIOutput::reloadDeviceList()
     {
     }
 
-    bool DummyMIDIOutput::setOutputDevice(int /*index*/)
+    bool DummyMIDIOutput::setOutputDevice(int index)
     {
-        return false;
+        return (index == 0);
     }
 
-    bool DummyMIDIOutput::setOutputDeviceName(const QString& /*name*/ )
+    bool DummyMIDIOutput::setOutputDeviceName(const QString& name)
     {
-        return false;
+        return (name == DEVICE_NAME);
     }
 
-    void DummyMIDIOutput::setMuted(int /*channel*/, bool /*mute*/)
+    void DummyMIDIOutput::setMuted(int channel, bool mute)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS) {
+            if (d->m_muted[channel] != mute) {
+                if (mute) {
+                    beginBatch();
+                    sendController(channel, MIDI_CTL_ALL_NOTES_OFF, 0);
+                    sendController(channel, MIDI_CTL_ALL_SOUNDS_OFF, 0);
+                    commitBatch();
+                }
+                d->m_muted[channel] = mute;
+                emit mutedChanged( channel, mute );
+            }
+        }
     }
 
-    void DummyMIDIOutput::setLocked(int /*channel*/, bool /*lock*/)
+    void DummyMIDIOutput::setLocked(int channel, bool lock)
     {
+        if (channel >= 0 && channel < MIDI_CHANNELS) {
+            if (d->m_locked[channel] != lock) {
+                d->m_locked[channel] = lock;
+                emit lockedChanged( channel, lock );
+            }
+        }
     }
 
-    void DummyMIDIOutput::setMidiMap(MidiMapper* /*map*/)
+    void DummyMIDIOutput::setMidiMap(MidiMapper* map)
     {
+        d->m_mapper = map;
     }
 
-    void DummyMIDIOutput::setPitchShift(int /*amt*/)
+    void DummyMIDIOutput::setPitchShift(int amt)
     {
+        if (d->m_pitchShift != amt) {
+            allNotesOff();
+            d->m_pitchShift = amt;
+        }
     }
 
-    void DummyMIDIOutput::setResetMessage(const QByteArray& /*msg*/)
+    void DummyMIDIOutput::setResetMessage(const QByteArray& msg)
     {
+        d->m_resetMessage = msg;
     }
 
     /* Realtime MIDI slots */
 
     void DummyMIDIOutput::allNotesOff()
     {
-//        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
-//            sendController(chan, MIDI_CTL_ALL_NOTES_OFF, 0);
-//            sendController(chan, MIDI_CTL_ALL_SOUNDS_OFF, 0);
-//        }
+        beginBatch();
+        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            sendController(chan, MIDI_CTL_ALL_NOTES_OFF, 0);
+            sendController(chan, MIDI_CTL_ALL_SOUNDS_OFF, 0);
+        }
+        commitBatch();
     }
 
     void DummyMIDIOutput::resetControllers()
     {
-//        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
-//            sendController(chan, MIDI_CTL_RESET_CONTROLLERS, 0);
-//            sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, 100);
-//        }
+        beginBatch();
+        for(int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            sendController(chan, MIDI_CTL_RESET_CONTROLLERS, 0);
+            sendController(chan, MIDI_CTL_MSB_MAIN_VOLUME, 100);
+        }
+        commitBatch();
     }
 
     void DummyMIDIOutput::sendResetMessage()
     {
+        if (d->m_resetMessage.size() > 0)
+            sendSysexEvent(d->m_resetMessage);
     }
 
-    void DummyMIDIOutput::sendNoteOn(int /*chan*/, int /*note*/, int /*vel*/)
+    void DummyMIDIOutput::sendNoteOn(int chan, int note, int vel)
     {
+        sendMessage(note_on | chan, note, vel, d->now());
     }
 
-    void DummyMIDIOutput::sendNoteOff(int /*chan*/, int /*note*/, int /*vel*/)
+    void DummyMIDIOutput::sendNoteOff(int chan, int note, int vel)
     {
+        sendMessage(note_off | chan, note, vel, d->now());
     }
 
-    void DummyMIDIOutput::sendController(int /*chan*/, int /*control*/, int /*value*/)
+    void DummyMIDIOutput::sendController(int chan, int control, int value)
     {
+        sendMessage(control_change | chan, control, value, d->now());
     }
 
-    void DummyMIDIOutput::sendKeyPressure(int /*chan*/, int /*note*/, int /*value*/)
+    void DummyMIDIOutput::sendKeyPressure(int chan, int note, int value)
     {
+        sendMessage(poly_aftertouch | chan, note, value, d->now());
     }
 
-    void DummyMIDIOutput::sendProgram(int /*chan*/, int /*program*/)
+    void DummyMIDIOutput::sendProgram(int chan, int program)
     {
+        sendMessage(program_chng | chan, program, 0, d->now());
     }
 
-    void DummyMIDIOutput::sendChannelPressure(int /*chan*/, int /*value*/)
+    void DummyMIDIOutput::sendChannelPressure(int chan, int value)
     {
+        sendMessage(channel_aftertouch | chan, value, 0, d->now());
     }
 
-    void DummyMIDIOutput::sendPitchBend(int /*chan*/, int /*value*/)
+    void DummyMIDIOutput::sendPitchBend(int chan, int value)
     {
+        int bender = qBound(0, value + 8192, 16383);
+        sendMessage(pitch_wheel | chan, bender & 0x7f, bender >> 7, d->now());
     }
 
-    void DummyMIDIOutput::sendSysexEvent(const QByteArray& /*data*/)
+    void DummyMIDIOutput::sendSysexEvent(const QByteArray& data)
     {
+        sendSysex(data, d->now());
     }
 
 }
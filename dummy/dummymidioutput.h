@@ -22,8 +22,30 @@
 
 #include "midioutput.h"
 #include <QObject>
+#include <QStringList>
 
 namespace KMid {
+
+    class VirtualClock;
+
+    /**
+     * MIDI message delivered by the dummy output, with the time when it
+     * was scheduled and the time when it was delivered, in microseconds
+     * of the virtual clock. Realtime messages are delivered immediately.
+     */
+    struct DummyOutputRecord {
+        qint64 intended;
+        qint64 actual;
+        quint8 message[3];
+        quint8 length;   /**< message length, 0 for system exclusive */
+        qint32 sysex;    /**< index of the system exclusive data, or -1 */
+    };
+
+    /**
+     * Output of the dummy backend. It does not produce any sound: every
+     * message is transformed like a real output would do (MIDI mapping,
+     * pitch shift, volume, muted and locked channels) and recorded.
+     */
     class DummyMIDIOutput : public MIDIOutput
     {
         Q_OBJECT
@@ -39,6 +61,19 @@ namespace KMid {
         virtual bool isMuted(int channel) const;
         virtual MidiMapper* midiMap();
         virtual int pitchShift();
+        virtual void beginBatch();
+        virtual void commitBatch();
+        int batchCount() const;
+
+        void setClock(const VirtualClock *clock);
+        void sendMessage(quint8 status, quint8 data1, quint8 data2, qint64 intended);
+        void sendSysex(const QByteArray& data, qint64 intended);
+        int recordCount() const;
+        const DummyOutputRecord& record(int i) const;
+        QByteArray recordMessage(int i) const;
+        qint64 maxLateness() const;
+        QStringList eventLog() const;
+        void clearRecords();
 
     public Q_SLOTS:
         void setVolume(int channel, qreal);
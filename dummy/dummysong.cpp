@@ -0,0 +1,362 @@
+/*
+    KMid Dummy Backend
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "dummysong.h"
+
+#include <QTextCodec>
+#include <KEncodingProber>
+#include <algorithm>
+
+namespace KMid {
+
+    static bool earlierEvent(const DummySongEvent& a, const DummySongEvent& b)
+    {
+        return a.tick < b.tick;
+    }
+
+    static bool earlierTick(const DummySongEvent& ev, qint64 tick)
+    {
+        return ev.tick < tick;
+    }
+
+    DummySong::DummySong() :
+        m_engine(0)
+    {
+        clear();
+    }
+
+    void DummySong::clear()
+    {
+        m_events.clear();
+        m_data.clear();
+        m_tempoMap.clear();
+        m_errors.clear();
+        m_format = 0;
+        m_ntrks = 0;
+        m_division = 0;
+        m_initialTempo = 0;
+        m_lowestNote = 127;
+        m_highestNote = 0;
+        for (int i = 0; i < MIDI_CHANNELS; ++i) {
+            m_channelUsed[i] = false;
+            m_channelPatches[i] = -1;
+            m_channelEvents[i] = 0;
+            m_channelLabel[i].clear();
+        }
+        m_trackLabel.clear();
+    }
+
+    /**
+     * Reads a Standard MIDI File, replacing the song contents. The events
+     * of all the tracks are merged keeping their order within every tick.
+     * @return true if the song has any event, even if there were errors
+     */
+    bool DummySong::load(const QString& fileName)
+    {
+        clear();
+        QSmf engine;
+        engine.setHandler(this);
+        m_engine = &engine;
+        try {
+            engine.readFromFile(fileName);
+        } catch (...) {
+            m_events.clear();
+        }
+        m_engine = 0;
+        if (m_events.isEmpty())
+            return false;
+        std::stable_sort(m_events.begin(), m_events.end(), earlierEvent);
+        if (m_initialTempo == 0)
+            m_initialTempo = 500000;
+        updateTimes();
+        return true;
+    }
+
+    /**
+     * Builds the tempo map and stores the real time of every event.
+     */
+    void DummySong::updateTimes()
+    {
+        m_tempoMap.clear();
+        m_tempoMap.setDivision(m_division);
+        m_tempoMap.addTempo(500000, 0);
+        foreach(const DummySongEvent& ev, m_events)
+            if (ev.type == DummySongEvent::Tempo)
+                m_tempoMap.addTempo(ev.value, ev.tick);
+        int index = 0;
+        QVector<DummySongEvent>::iterator it;
+        for (it = m_events.begin(); it != m_events.end(); ++it) {
+            while ( index + 1 < m_tempoMap.count() &&
+                    m_tempoMap.at(index + 1).time <= quint64(it->tick) )
+                ++index;
+            it->time = qint64(m_tempoMap.ticksToMicroseconds(it->tick, index));
+        }
+    }
+
+    qint64 DummySong::getLastTick() const
+    {
+        return m_events.isEmpty() ? 0 : m_events.last().tick;
+    }
+
+    /**
+     * Returns the real time of the last event, in microseconds.
+     */
+    qint64 DummySong::getLastTime() const
+    {
+        return m_events.isEmpty() ? 0 : m_events.last().time;
+    }
+
+    /**
+     * Returns the index of the first event located at or after a tick.
+     */
+    int DummySong::indexOf(qint64 tick) const
+    {
+        return std::lower_bound(m_events.begin(), m_events.end(),
+                                tick, earlierTick) - m_events.begin();
+    }
+
+    qint64 DummySong::tickToTime(qint64 tick) const
+    {
+        if (m_tempoMap.isEmpty() || tick <= 0)
+            return 0;
+        return qint64(m_tempoMap.ticksToMicroseconds(tick));
+    }
+
+    /**
+     * Converts a real time in microseconds into ticks, searching the tempo
+     * change in effect at that time.
+     */
+    qint64 DummySong::timeToTick(qint64 time) const
+    {
+        if (m_tempoMap.isEmpty() || m_division <= 0 || time <= 0)
+            return 0;
+        int first = 0;
+        int last = m_tempoMap.count();
+        while (first < last) {
+            int middle = first + (last - first) / 2;
+            if (m_tempoMap.at(middle).microsecs <= time)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        const QSmfTempoMap::Entry& entry = m_tempoMap.at(qMax(0, first - 1));
+        return entry.time + qint64((time - entry.microsecs) * m_division / entry.tempo);
+    }
+
+    QString DummySong::decode(const QByteArray& text, QTextCodec *codec) const
+    {
+        if (codec == NULL)
+            return QString::fromLatin1(text);
+        return codec->toUnicode(text);
+    }
+
+    /**
+     * Guesses the encoding of the lyrics, or of the texts when the song
+     * has no lyrics.
+     * @return the encoding name, or an empty string if it is unknown
+     */
+    QByteArray DummySong::detectTextEncoding() const
+    {
+        int type = text_event;
+        foreach(const DummySongEvent& ev, m_events)
+            if (ev.type == DummySongEvent::Text && ev.status == lyric) {
+                type = lyric;
+                break;
+            }
+        KEncodingProber prober;
+        bool found = false;
+        foreach(const DummySongEvent& ev, m_events)
+            if (ev.type == DummySongEvent::Text && ev.status == type) {
+                prober.feed(m_data.at(ev.value));
+                found = true;
+            }
+        if (found && prober.confidence() > 0.6)
+            return prober.encoding();
+        return QByteArray();
+    }
+
+    /**
+     * Returns the meta texts of a type, like lyrics or markers.
+     */
+    QStringList DummySong::getText(int type, QTextCodec *codec) const
+    {
+        QStringList list;
+        foreach(const DummySongEvent& ev, m_events)
+            if (ev.type == DummySongEvent::Text && ev.status == type)
+                list << decode(m_data.at(ev.value), codec);
+        return list;
+    }
+
+    /**
+     * Returns the lyrics sung up to a tick, or the texts when the song has
+     * no lyrics, without the karaoke file tags.
+     */
+    QStringList DummySong::getLyrics(qint64 tick, QTextCodec *codec) const
+    {
+        QStringList lyrics;
+        QStringList texts;
+        foreach(const DummySongEvent& ev, m_events) {
+            if (ev.tick > tick)
+                break;
+            if (ev.type != DummySongEvent::Text)
+                continue;
+            const QByteArray& data = m_data.at(ev.value);
+            if (data.isEmpty() || data[0] == '@' || data[0] == '%')
+                continue;
+            if (ev.status == lyric)
+                lyrics << decode(data, codec);
+            else if (ev.status == text_event)
+                texts << decode(data, codec);
+        }
+        return lyrics.isEmpty() ? texts : lyrics;
+    }
+
+    void DummySong::appendEvent(quint8 type, quint8 status, quint8 data1,
+                                quint8 data2, qint32 value)
+    {
+        DummySongEvent ev;
+        ev.tick = m_engine->getCurrentTime();
+        ev.time = 0;
+        ev.type = type;
+        ev.status = status;
+        ev.data1 = data1;
+        ev.data2 = data2;
+        ev.value = value;
+        m_events.append(ev);
+    }
+
+    void DummySong::channelEvent(int status, int chan, int data1, int data2, qint32 value)
+    {
+        m_channelUsed[chan] = true;
+        m_channelEvents[chan]++;
+        appendEvent(DummySongEvent::Channel, status | chan, data1, data2, value);
+    }
+
+    /* QSmfHandler */
+
+    void DummySong::handleError(const QString& errorStr)
+    {
+        m_errors << QString("%1 at file offset %2<br>")
+            .arg(errorStr).arg(m_engine->getFilePos());
+    }
+
+    void DummySong::handleHeader(int format, int ntrks, int division)
+    {
+        m_format = format;
+        m_ntrks = ntrks;
+        m_division = division;
+    }
+
+    void DummySong::handleNoteOn(int chan, int pitch, int vol)
+    {
+        m_lowestNote = qMin(m_lowestNote, pitch);
+        m_highestNote = qMax(m_highestNote, pitch);
+        channelEvent(note_on, chan, pitch, vol);
+    }
+
+    void DummySong::handleNoteOff(int chan, int pitch, int vol)
+    {
+        channelEvent(note_off, chan, pitch, vol);
+    }
+
+    void DummySong::handleKeyPress(int chan, int pitch, int press)
+    {
+        channelEvent(poly_aftertouch, chan, pitch, press);
+    }
+
+    void DummySong::handleCtlChange(int chan, int ctl, int value)
+    {
+        channelEvent(control_change, chan, ctl, value, value);
+    }
+
+    void DummySong::handlePitchBend(int chan, int value)
+    {
+        int bender = value + 8192;
+        channelEvent(pitch_wheel, chan, bender & 0x7f, (bender >> 7) & 0x7f, value);
+    }
+
+    void DummySong::handleProgram(int chan, int patch)
+    {
+        if (m_channelPatches[chan] < 0)
+            m_channelPatches[chan] = patch;
+        channelEvent(program_chng, chan, patch, 0);
+    }
+
+    void DummySong::handleChanPress(int chan, int press)
+    {
+        channelEvent(channel_aftertouch, chan, press, 0);
+    }
+
+    void DummySong::handleSysex(const QByteArray& data)
+    {
+        m_data.append(data);
+        appendEvent(DummySongEvent::Sysex, system_exclusive, 0, 0, m_data.count() - 1);
+    }
+
+    void DummySong::handleMetaMisc(int type, const QByteArray& data)
+    {
+        if (type >= text_event && type <= cue_point) {
+            m_data.append(data);
+            appendEvent(DummySongEvent::Text, type, 0, 0, m_data.count() - 1);
+            if ( (type == sequence_name || type == instrument_name) &&
+                 m_trackLabel.isEmpty() )
+                m_trackLabel = data;
+        }
+    }
+
+    void DummySong::handleTempo(int tempo)
+    {
+        if (m_initialTempo == 0)
+            m_initialTempo = tempo;
+        appendEvent(DummySongEvent::Tempo, 0, 0, 0, tempo);
+    }
+
+    void DummySong::handleTimeSig(int b0, int b1, int b2, int b3)
+    {
+        Q_UNUSED(b2)
+        Q_UNUSED(b3)
+        appendEvent(DummySongEvent::TimeSignature, 0, b0, b1);
+    }
+
+    void DummySong::handleTrackStart()
+    {
+        for (int i = 0; i < MIDI_CHANNELS; ++i)
+            m_channelEvents[i] = 0;
+        m_trackLabel.clear();
+    }
+
+    /**
+     * Labels the channel with most events in the track with the track name.
+     */
+    void DummySong::handleTrackEnd()
+    {
+        if (m_trackLabel.isEmpty())
+            return;
+        int max = 0;
+        int chan = -1;
+        for (int i = 0; i < MIDI_CHANNELS; ++i)
+            if (m_channelEvents[i] > max) {
+                max = m_channelEvents[i];
+                chan = i;
+            }
+        if (chan >= 0)
+            m_channelLabel[chan] = m_trackLabel;
+    }
+
+}
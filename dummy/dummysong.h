@@ -0,0 +1,131 @@
+/*
+    KMid Dummy Backend
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef DUMMYSONG_H
+#define DUMMYSONG_H
+
+#include "midimapper.h"
+#include <qsmf.h>
+#include <QVector>
+#include <QStringList>
+
+class QTextCodec;
+
+using namespace drumstick;
+
+namespace KMid {
+
+    /**
+     * Song event of the dummy backend. The channel messages are stored as
+     * status and data bytes, and the variable length data of the system
+     * exclusive and text events is stored in the song.
+     */
+    struct DummySongEvent {
+        enum Type { Channel, Sysex, Tempo, Text, TimeSignature };
+        qint64 tick;
+        qint64 time;     /**< microseconds from the start of the song */
+        quint8 type;
+        quint8 status;   /**< status byte, or meta event type of texts */
+        quint8 data1;
+        quint8 data2;
+        qint32 value;    /**< tempo, pitch bend, or index of the data */
+    };
+
+    /**
+     * Song loaded through QSmf, sorted by time, with the real time of
+     * every event precomputed from the tempo map.
+     */
+    class DummySong : public QSmfHandler
+    {
+    public:
+        DummySong();
+
+        bool load(const QString& fileName);
+        void clear();
+
+        bool isEmpty() const { return m_events.isEmpty(); }
+        int count() const { return m_events.count(); }
+        const DummySongEvent& at(int i) const { return m_events.at(i); }
+        const QByteArray& data(int i) const { return m_data.at(i); }
+        QStringList errors() const { return m_errors; }
+
+        int getFormat() const { return m_format; }
+        int getTracks() const { return m_ntrks; }
+        int getDivision() const { return m_division; }
+        int getInitialTempo() const { return m_initialTempo; }
+        int getLowestNote() const { return m_lowestNote; }
+        int getHighestNote() const { return m_highestNote; }
+        bool channelUsed(int chan) const { return m_channelUsed[chan]; }
+        int channelPatch(int chan) const { return m_channelPatches[chan]; }
+        const QByteArray& channelLabel(int chan) const { return m_channelLabel[chan]; }
+        qint64 getLastTick() const;
+        qint64 getLastTime() const;
+
+        int indexOf(qint64 tick) const;
+        qint64 tickToTime(qint64 tick) const;
+        qint64 timeToTick(qint64 time) const;
+        QStringList getText(int type, QTextCodec *codec) const;
+        QStringList getLyrics(qint64 tick, QTextCodec *codec) const;
+        QString decode(const QByteArray& text, QTextCodec *codec) const;
+        QByteArray detectTextEncoding() const;
+
+        /* QSmfHandler */
+        void handleError(const QString& errorStr);
+        void handleHeader(int format, int ntrks, int division);
+        void handleNoteOn(int chan, int pitch, int vol);
+        void handleNoteOff(int chan, int pitch, int vol);
+        void handleKeyPress(int chan, int pitch, int press);
+        void handleCtlChange(int chan, int ctl, int value);
+        void handlePitchBend(int chan, int value);
+        void handleProgram(int chan, int patch);
+        void handleChanPress(int chan, int press);
+        void handleSysex(const QByteArray& data);
+        void handleMetaMisc(int type, const QByteArray& data);
+        void handleTempo(int tempo);
+        void handleTimeSig(int b0, int b1, int b2, int b3);
+        void handleTrackStart();
+        void handleTrackEnd();
+
+    private:
+        void appendEvent(quint8 type, quint8 status, quint8 data1,
+                         quint8 data2, qint32 value = 0);
+        void channelEvent(int status, int chan, int data1, int data2, qint32 value = 0);
+        void updateTimes();
+
+        QSmf *m_engine;
+        QVector<DummySongEvent> m_events;
+        QList<QByteArray> m_data;
+        QSmfTempoMap m_tempoMap;
+        QStringList m_errors;
+        int m_format;
+        int m_ntrks;
+        int m_division;
+        int m_initialTempo;
+        int m_lowestNote;
+        int m_highestNote;
+        bool m_channelUsed[MIDI_CHANNELS];
+        int m_channelPatches[MIDI_CHANNELS];
+        int m_channelEvents[MIDI_CHANNELS];
+        QByteArray m_channelLabel[MIDI_CHANNELS];
+        QByteArray m_trackLabel;
+    };
+
+}
+
+#endif // DUMMYSONG_H
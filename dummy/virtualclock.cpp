@@ -0,0 +1,88 @@
+/*
+    KMid Dummy Backend
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "virtualclock.h"
+
+namespace KMid {
+
+    VirtualClock::VirtualClock() :
+        m_origin(0),
+        m_speed(1.0),
+        m_running(false)
+    { }
+
+    /**
+     * Sets the speed factor, keeping the current time.
+     * @param speed the factor, or zero to run as fast as possible
+     */
+    void VirtualClock::setSpeed(qreal speed)
+    {
+        m_origin = now();
+        m_speed = qMax<qreal>(0.0, speed);
+        if (m_running)
+            m_timer.start();
+    }
+
+    void VirtualClock::start()
+    {
+        if (!m_running) {
+            m_running = true;
+            m_timer.start();
+        }
+    }
+
+    /**
+     * Stops the clock, freezing the current time.
+     */
+    void VirtualClock::stop()
+    {
+        if (m_running) {
+            m_origin = now();
+            m_running = false;
+        }
+    }
+
+    /**
+     * Moves the clock to a time, forwards or backwards.
+     */
+    void VirtualClock::setTime(qint64 time)
+    {
+        m_origin = time;
+        if (m_running)
+            m_timer.start();
+    }
+
+    /**
+     * Moves the clock forward to a time, when running as fast as possible.
+     * Otherwise the time only follows the system clock.
+     */
+    void VirtualClock::advance(qint64 time)
+    {
+        if (isFast() && time > m_origin)
+            m_origin = time;
+    }
+
+    qint64 VirtualClock::now() const
+    {
+        if (!m_running || isFast())
+            return m_origin;
+        return m_origin + qint64(m_timer.nsecsElapsed() / 1000 * m_speed);
+    }
+
+}
@@ -0,0 +1,59 @@
+/*
+    KMid Dummy Backend
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef VIRTUALCLOCK_H
+#define VIRTUALCLOCK_H
+
+#include <QElapsedTimer>
+
+namespace KMid {
+
+    /**
+     * Playback clock of the dummy backend, in microseconds of song time.
+     * While running, it follows the monotonic system clock multiplied by
+     * the speed factor. With a null speed it runs as fast as possible: the
+     * time only moves when it is advanced explicitly to the next event,
+     * so the playback does not depend on the machine load.
+     */
+    class VirtualClock
+    {
+    public:
+        VirtualClock();
+
+        void setSpeed(qreal speed);
+        qreal speed() const { return m_speed; }
+        bool isFast() const { return m_speed <= 0; }
+        bool isRunning() const { return m_running; }
+
+        void start();
+        void stop();
+        void setTime(qint64 time);
+        void advance(qint64 time);
+        qint64 now() const;
+
+    private:
+        QElapsedTimer m_timer;
+        qint64 m_origin;
+        qreal m_speed;
+        bool m_running;
+    };
+
+}
+
+#endif // VIRTUALCLOCK_H
@@ -28,11 +28,11 @@ Authors:
     Antonio Larrosa Jimenez <larrosa@kde.org>
     Pedro Lopez-Cabanillas <plcl@users.sourceforge.net>
 
-%package -n libkmidbackend1
+%package -n libkmidbackend2
 Summary:        KDE MIDI/Karaoke Player Backend
 Group:          System/Libraries
 
-%description -n libkmidbackend1
+%description -n libkmidbackend2
 KMid is a MIDI/Karaoke player with KDE interface, based on the ALSA
 sequencer.
 
@@ -45,7 +45,7 @@ Authors:
 %package -n libkmidbackend-devel
 Summary:        Development package for the libkmidbackend library
 Group:          Development/Libraries/C and C++
-Requires:       libkmidbackend1 = %{version}
+Requires:       libkmidbackend2 = %{version}
 Requires:       glibc-devel libstdc++-devel libkde4-devel
 
 %description -n libkmidbackend-devel
@@ -73,9 +73,9 @@ rm -f %{buildroot}/usr/share/doc/kde/HTML/*/%{name}/common
 %find_lang %name
 %kde_post_install
 
-%post -n libkmidbackend1 -p /sbin/ldconfig
+%post -n libkmidbackend2 -p /sbin/ldconfig
 
-%postun -n libkmidbackend1 -p /sbin/ldconfig
+%postun -n libkmidbackend2 -p /sbin/ldconfig
 
 %clean
 rm -rf $RPM_BUILD_ROOT
@@ -96,7 +96,7 @@ rm -rf $RPM_BUILD_ROOT
 %{_datadir}/icons/hicolor/*/*/*
 %{_datadir}/dbus-1/interfaces/*
 
-%files -n libkmidbackend1
+%files -n libkmidbackend2
 %defattr(-,root,root)
 %{_libdir}/libkmidbackend.so.*
 
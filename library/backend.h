@@ -48,6 +48,14 @@ namespace KMid {
 
             virtual bool initialized() = 0;
 
+            /**
+             * Returns the reason why the backend could not be initialized,
+             * to be shown by the application, or an empty string. Backends
+             * must not show any user interface themselves, because they are
+             * also loaded by applications without one.
+             */
+            virtual QString initializationError() { return QString(); }
+
             virtual bool hasSoftSynths() = 0;
 
             virtual void setupConfigurationWidget(QWidget* widget) = 0;
@@ -0,0 +1,96 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef MIDIEVENTRING_H
+#define MIDIEVENTRING_H
+
+#include <QtGlobal>
+#include <QAtomicInteger>
+
+namespace KMid {
+
+    /**
+     * Compact record of a sequenced MIDI channel event, for feedback to
+     * the application. The meaning of the data fields depends on the type:
+     * note and velocity or pressure in data1 and data2, controller number in
+     * data1 and its value in value, program or channel pressure in data1,
+     * and the pitch bender value in value.
+     */
+    struct MIDIEventRecord {
+        enum Type {
+            NoteOff, NoteOn, KeyPressure, Controller,
+            Program, ChannelPressure, PitchBend
+        };
+        quint8 type;
+        quint8 channel;
+        quint8 data1;
+        quint8 data2;
+        qint16 value;
+    };
+
+    /**
+     * Lock free ring buffer of MIDIEventRecord, for a single producer
+     * thread and a single consumer thread. Nothing is allocated after
+     * construction, and records are dropped when the buffer is full.
+     */
+    class MIDIEventRing
+    {
+    public:
+        static const quint32 CAPACITY = 4096; /**< must be a power of two */
+
+        MIDIEventRing() : m_head(0), m_tail(0) {}
+
+        /**
+         * Appends a record. To be called only from the producer thread.
+         * @return false if the buffer is full and the record was dropped
+         */
+        bool push(const MIDIEventRecord& record)
+        {
+            quint32 head = m_head.load();
+            if (head - m_tail.loadAcquire() >= CAPACITY)
+                return false;
+            m_records[head & (CAPACITY - 1)] = record;
+            m_head.storeRelease(head + 1);
+            return true;
+        }
+
+        /**
+         * Removes up to max records, copying them to the records array.
+         * To be called only from the consumer thread.
+         * @return the number of records copied
+         */
+        int read(MIDIEventRecord* records, int max)
+        {
+            quint32 tail = m_tail.load();
+            quint32 count = qMin<quint32>(m_head.loadAcquire() - tail, max);
+            for (quint32 i = 0; i < count; ++i)
+                records[i] = m_records[(tail + i) & (CAPACITY - 1)];
+            m_tail.storeRelease(tail + count);
+            return count;
+        }
+
+    private:
+        QAtomicInteger<quint32> m_head;
+        QAtomicInteger<quint32> m_tail;
+        MIDIEventRecord m_records[CAPACITY];
+    };
+
+}
+
+#endif /* MIDIEVENTRING_H */
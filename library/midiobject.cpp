@@ -1 +1,73 @@
 #include "midiobject.h"
+
+namespace KMid {
+
+    class MIDIObject::MIDIObjectPrivate {
+    public:
+        MIDIObjectPrivate() : m_buffered(0) {}
+
+        QAtomicInt m_buffered;
+        MIDIEventRing m_events;
+    };
+
+    MIDIObject::MIDIObject(QObject *parent) : QObject(parent),
+        d(new MIDIObjectPrivate)
+    { }
+
+    MIDIObject::~MIDIObject()
+    {
+        delete d;
+    }
+
+    void MIDIObject::setBufferedEvents(bool enable)
+    {
+        d->m_buffered.storeRelease(enable ? 1 : 0);
+    }
+
+    bool MIDIObject::bufferedEvents() const
+    {
+        return d->m_buffered.loadAcquire() != 0;
+    }
+
+    int MIDIObject::readMidiEvents(MIDIEventRecord* records, int max)
+    {
+        return d->m_events.read(records, max);
+    }
+
+    /**
+     * Delivers a sequenced MIDI channel event to the application, either
+     * storing it in the ring buffer or emitting the corresponding signal.
+     * To be called by the backends from a single thread.
+     */
+    void MIDIObject::midiEvent(const MIDIEventRecord& record)
+    {
+        if (d->m_buffered.loadAcquire() != 0) {
+            d->m_events.push(record);
+            return;
+        }
+        switch (record.type) {
+        case MIDIEventRecord::NoteOff:
+            emit midiNoteOff(record.channel, record.data1, record.data2);
+            break;
+        case MIDIEventRecord::NoteOn:
+            emit midiNoteOn(record.channel, record.data1, record.data2);
+            break;
+        case MIDIEventRecord::KeyPressure:
+            emit midiKeyPressure(record.channel, record.data1, record.data2);
+            break;
+        case MIDIEventRecord::Controller:
+            emit midiController(record.channel, record.data1, record.value);
+            break;
+        case MIDIEventRecord::Program:
+            emit midiProgram(record.channel, record.data1);
+            break;
+        case MIDIEventRecord::ChannelPressure:
+            emit midiChannelPressure(record.channel, record.data1);
+            break;
+        case MIDIEventRecord::PitchBend:
+            emit midiPitchBend(record.channel, record.value);
+            break;
+        }
+    }
+
+}
@@ -21,6 +21,7 @@
 #define MIDIOBJECT_H
 
 #include "kmidmacros.h"
+#include "midieventring.h"
 
 #include <QObject>
 #include <QUrl>
@@ -73,8 +74,8 @@ namespace KMid {
     {
         Q_OBJECT
     public:
-        MIDIObject(QObject *parent = 0) : QObject(parent) {}
-        virtual ~MIDIObject() {}
+        MIDIObject(QObject *parent = 0);
+        virtual ~MIDIObject();
 
         /**
          * Return the time interval between two ticks.
@@ -256,6 +257,16 @@ namespace KMid {
          */
         virtual QStringList getLyrics(qint64 time) const = 0;
 
+        /**
+         * Returns the length of the lyrics text sung up to the given time.
+         * The lyrics text is the concatenation of metaData("SMF_LYRICS"),
+         * or metaData("SMF_TEXT") when the song has no lyrics, so the
+         * sung part can be highlighted without searching the text. The
+         * default implementation returns -1, meaning not available.
+         * @param time the musical time
+         */
+        virtual int lyricsOffset(qint64 time) const { Q_UNUSED(time) return -1; }
+
         /**
          * Returns the current song tempo (in qpm).
          */
@@ -312,6 +323,80 @@ namespace KMid {
          */
         virtual QVariant channelProperty(int channel, const QString& key) = 0;
 
+        /**
+         * Sets the silence between the end of a song and the start of the
+         * next one from the queue. The default implementation ignores it.
+         *
+         * @param msecs the gap length in milliseconds
+         */
+        virtual void setSongGap(int msecs) { Q_UNUSED(msecs) }
+
+        /**
+         * Sets the longest time spanned by the events written to the
+         * sequencer at once. Longer batches save system calls, but the
+         * events must still be sent ahead of their time. The default
+         * implementation ignores it.
+         *
+         * @param msecs the batch length in milliseconds, or zero to send
+         * the events one by one
+         */
+        virtual void setBatchWindow(int msecs) { Q_UNUSED(msecs) }
+
+        /**
+         * Consumes the event stream of the current song as fast as possible,
+         * without delivering the events to any output, and rewinds it. It
+         * is meant to measure the sequencing overhead of the backend. The
+         * default implementation does nothing.
+         *
+         * @return the number of events consumed, or -1 if not supported
+         */
+        virtual qint64 dryRun() { return -1; }
+
+        /**
+         * Enables or disables collecting statistics about how late the
+         * events are delivered during the playback. The report is available
+         * as the song property "TIMING_STATS". The default implementation
+         * ignores it.
+         *
+         * @param enable the new state of the statistics
+         */
+        virtual void setTimingStats(bool enable) { Q_UNUSED(enable) }
+
+        /**
+         * Sets the limit of the total size of the disk cache of loaded
+         * songs, removing the least recently used songs beyond it. The
+         * default implementation ignores it.
+         *
+         * @param mbytes the maximum size in megabytes, or zero for no limit
+         */
+        virtual void setSongCacheSize(int mbytes) { Q_UNUSED(mbytes) }
+
+        /**
+         * Enables the buffered delivery of the sequenced MIDI channel
+         * events. When enabled, the events are stored in a lock free ring
+         * buffer instead of emitting the midiNoteOn(), midiNoteOff(),
+         * midiController() ... signals from the sequencer thread. The
+         * application must collect them periodically with readMidiEvents().
+         *
+         * @param enable true to buffer the events
+         */
+        void setBufferedEvents(bool enable);
+
+        /**
+         * Returns true if the MIDI channel events are buffered
+         */
+        bool bufferedEvents() const;
+
+        /**
+         * Removes the buffered MIDI channel events, up to a maximum. It must
+         * be called always from the same thread, usually the GUI thread.
+         *
+         * @param records array receiving the events
+         * @param max maximum number of events to be read
+         * @return the number of events read
+         */
+        int readMidiEvents(MIDIEventRecord* records, int max);
+
     public Q_SLOTS:
 
         /**
@@ -469,12 +554,23 @@ namespace KMid {
          */
         void currentSourceChanged(const QString &newSource);
 
+        /**
+         * Emitted while a source is being loaded, in LoadingState.
+         *
+         * \param percent The completed part of the load, from 0 to 100.
+         */
+        void loadProgress(int percent);
+
         /**
          * Sequenced SMF events (for feedback to the application)
          */
         void tempoChanged(const qreal tempo);
         void timeSignatureChanged(const int numerator, const int denominator);
-        void midiText(const int type, const QString &txt);
+        /**
+         * Emitted when a text event is played. The musical time of the
+         * event is given for lyricsOffset(), or -1 when not available.
+         */
+        void midiText(const int type, const QString &txt, const qint64 tick = -1);
         void midiNoteOn(const int chan, const int note, const int vel);
         void midiNoteOff(const int chan, const int note, const int vel);
         void midiController(const int chan, const int control, const int value);
@@ -485,6 +581,12 @@ namespace KMid {
         void midiSysex(const QByteArray &data);
         void beat(const int bar, const int beat, const int max);
 
+    protected:
+        void midiEvent(const MIDIEventRecord& record);
+
+    private:
+        class MIDIObjectPrivate;
+        MIDIObjectPrivate * const d;
     };
 
 }
@@ -61,6 +61,22 @@ namespace KMid {
 
         virtual int pitchShift() = 0;
 
+        /**
+         * Starts a batch of realtime MIDI messages. The messages sent by
+         * the calling thread until commitBatch() may be queued and sent
+         * together, instead of one by one. Batches can be nested; only the
+         * outermost commitBatch() sends the messages.
+         *
+         * The default implementation does nothing, sending every message
+         * immediately.
+         */
+        virtual void beginBatch() {}
+
+        /**
+         * Sends the messages queued since the matching beginBatch().
+         */
+        virtual void commitBatch() {}
+
     public Q_SLOTS:
 
         /**
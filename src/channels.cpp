@@ -199,6 +199,24 @@ void Channels::slotNoteOff(int channel, int /*note*/, int /*vel*/)
     m_voices[channel] -= 1;
 }
 
+void Channels::midiEvents(const KMid::MIDIEventRecord* records, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const KMid::MIDIEventRecord& r = records[i];
+        switch (r.type) {
+        case KMid::MIDIEventRecord::NoteOn:
+            slotNoteOn(r.channel, r.data1, r.data2);
+            break;
+        case KMid::MIDIEventRecord::NoteOff:
+            slotNoteOff(r.channel, r.data1, r.data2);
+            break;
+        case KMid::MIDIEventRecord::Program:
+            slotPatch(r.channel, r.data1);
+            break;
+        }
+    }
+}
+
 void Channels::slotPatchChanged(int channel)
 {
     int p = m_patch[channel]->currentIndex();
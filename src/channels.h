@@ -22,6 +22,7 @@
 
 #include "midimapper.h"
 #include "instrumentset.h"
+#include "midieventring.h"
 #include <KMainWindow>
 
 class QSignalMapper;
@@ -37,6 +38,7 @@ public:
     Channels( QWidget* parent = 0 );
     virtual ~Channels();
     void enableChannel(int channel, bool enable);
+    void midiEvents(const KMid::MIDIEventRecord* records, int count);
     qreal volumeFactor();
     void setVolumeFactor(qreal factor);
 
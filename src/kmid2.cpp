@@ -36,6 +36,7 @@
 #include <QTextDocument>
 #include <QToolTip>
 #include <QTextCursor>
+#include <QTextCharFormat>
 #include <QScrollBar>
 #include <QDockWidget>
 #include <QTimer>
@@ -70,11 +71,14 @@ KMid2::KMid2() : KXmlGuiWindow(),
       m_connected(false),
       m_seeking(false),
       m_seekamt(0),
+      m_pendingPosition(0),
+      m_lyricsOffset(0),
       m_rtempo(0.0),
       m_loader(0),
       m_currentBackend(0),
       m_midiobj(0),
       m_midiout(0),
+      m_eventsTimer(0),
       m_settings(new Settings)
 {
     (void) new KMidAdaptor(this);
@@ -101,21 +105,27 @@ void KMid2::slotLoaded(Backend *backend, const QString& library, const QString&
     m_backends.append(midiBackend);
     backend->setParent(this);
     qDebug() << library << name << backend->initialized();
+    if (!backend->initialized() && !backend->initializationError().isEmpty())
+        KMessageBox::error(this, backend->initializationError(),
+                i18nc("@title:window","%1 Backend Error", name));
     if ( backend != 0 && backend->initialized() &&
          m_currentBackend == 0 &&
          (m_settings->midi_backend().isEmpty() ||
           m_settings->midi_backend() == library) ) {
         m_midiobj = backend->midiObject();
+        m_midiobj->setBufferedEvents(true);
         m_midiout = backend->midiOutput();
         m_midiout->setMidiMap(&m_mapper);
         connect(m_midiobj, SIGNAL(stateChanged(State,State)),
                 SLOT(slotUpdateState(State,State)));
-        connect(m_midiobj, SIGNAL(midiText(int,const QString&)),
-                SLOT(slotMidiTextEvent(int,const QString&)));
+        connect(m_midiobj, SIGNAL(midiText(int,const QString&,qint64)),
+                SLOT(slotMidiTextEvent(int,const QString&,qint64)));
         connect(m_midiobj, SIGNAL(tick(qint64)), SLOT(slotTick(qint64)));
         connect(m_midiobj, SIGNAL(finished()), SLOT(finished()));
         connect(m_midiobj, SIGNAL(currentSourceChanged(QString)),
                 SLOT(slotSourceChanged(QString)));
+        connect(m_midiobj, SIGNAL(loadProgress(int)),
+                SLOT(slotLoadProgress(int)));
         connect(m_midiobj, SIGNAL(timeSignatureChanged(int,int)),
                 SLOT(slotTimeSignatureEvent(int,int)));
         connect(m_midiobj, SIGNAL(beat(int,int,int)),
@@ -133,20 +143,8 @@ void KMid2::slotLoaded(Backend *backend, const QString& library, const QString&
                  SIGNAL(timeSignatureEvent(int,int)) );
         connect( m_midiobj, SIGNAL(beat(int,int,int)),
                  SIGNAL(beat(int,int,int)) );
-        connect( m_midiobj, SIGNAL(midiNoteOn(int,int,int)),
-                 SIGNAL(midiNoteOnEvent(int,int,int)) );
-        connect( m_midiobj, SIGNAL(midiNoteOff(int,int,int)),
-                 SIGNAL(midiNoteOffEvent(int,int,int)) );
-        connect( m_midiobj, SIGNAL(midiController(int,int,int)),
-                 SIGNAL(midiControllerEvent(int,int,int)) );
-        connect( m_midiobj, SIGNAL(midiKeyPressure(int,int,int)),
-                 SIGNAL(midiKeyPressureEvent(int,int,int)) );
-        connect( m_midiobj, SIGNAL(midiProgram(int,int)),
-                 SIGNAL(midiProgramEvent(int,int)) );
-        connect( m_midiobj, SIGNAL(midiChannelPressure(int,int)),
-                 SIGNAL(midiChannelPressureEvent(int,int)) );
-        connect( m_midiobj, SIGNAL(midiPitchBend(int,int)),
-                 SIGNAL(midiPitchBendEvent(int,int)) );
+        /* the MIDI channel events are buffered, and the D-Bus signals
+           are emitted by slotMidiEvents() */
 
         if (backend->hasSoftSynths())
             backend->initializeSoftSynths(m_settings);
@@ -160,6 +158,9 @@ void KMid2::initialize()
     m_songName.clear();
     m_songEncoding.clear();
     m_playList.clear();
+    m_eventsTimer = new QTimer(this);
+    m_eventsTimer->setInterval(40);
+    connect(m_eventsTimer, SIGNAL(timeout()), SLOT(slotMidiEvents()));
     m_loader = new BackendLoader(this);
     connect(m_loader, SIGNAL(loaded(Backend*,const QString&,const QString&)),
                       SLOT(slotLoaded(Backend*,const QString&,const QString&)));
@@ -184,12 +185,6 @@ void KMid2::initialize()
 
     m_pianola = new Pianola(this);
     connect(m_pianola, SIGNAL(closed()), SLOT(slotPianolaClosed()));
-    connect(m_midiobj, SIGNAL(midiNoteOn(int,int,int)),
-            m_pianola, SLOT(slotNoteOn(int,int,int)),
-            Qt::QueuedConnection);
-    connect(m_midiobj, SIGNAL(midiNoteOff(int,int,int)),
-            m_pianola, SLOT(slotNoteOff(int,int,int)),
-            Qt::QueuedConnection);
     connect(m_pianola, SIGNAL(noteOn(int,int,int)),
             m_midiout, SLOT(sendNoteOn(int,int,int)),
             Qt::QueuedConnection);
@@ -199,15 +194,6 @@ void KMid2::initialize()
 
     m_channels = new Channels(this);
     connect(m_channels, SIGNAL(closed()), SLOT(slotChannelsClosed()));
-    connect(m_midiobj, SIGNAL(midiNoteOn(int,int,int)),
-            m_channels, SLOT(slotNoteOn(int,int,int)),
-            Qt::QueuedConnection);
-    connect(m_midiobj, SIGNAL(midiNoteOff(int,int,int)),
-            m_channels, SLOT(slotNoteOff(int,int,int)),
-            Qt::QueuedConnection);
-    connect(m_midiobj, SIGNAL(midiProgram(int,int)),
-            m_channels, SLOT(slotPatch(int,int)),
-            Qt::QueuedConnection);
     connect(m_channels, SIGNAL(mute(int,bool)),
             m_midiout, SLOT(setMuted(int,bool)),
             Qt::QueuedConnection);
@@ -328,6 +314,12 @@ void KMid2::setupActions()
     connect(m_fileInfo, SIGNAL(triggered()), SLOT(slotFileInfo()));
     actionCollection()->addAction("file_info", m_fileInfo);
 
+    m_timingStats = new KAction(this);
+    m_timingStats->setText(i18nc("@action:inmenu","Timing Statistics..."));
+    m_timingStats->setWhatsThis(i18nc("@info:whatsthis","Show the timing statistics collected during the playback"));
+    connect(m_timingStats, SIGNAL(triggered()), SLOT(slotTimingStats()));
+    actionCollection()->addAction("timing_stats", m_timingStats);
+
     m_loop = new KToggleAction(this);
     m_loop->setText(i18nc("@action playlist repeat", "Repeat") );
     m_loop->setIcon(QIcon("media-playlist-repeat"));
@@ -470,6 +462,10 @@ void KMid2::slotSourceChanged(const QString &src)
     updateTempoLabel();
     m_seekamt = m_midiobj->totalTime() / 10;
     m_seeking = false;
+    if (m_pendingPosition > 0) {
+        m_timeSlider->setValue(m_pendingPosition);
+        m_pendingPosition = 0;
+    }
     if (m_pianola != 0) {
         int loNote = m_midiobj->lowestMidiNote();
         int hiNote = m_midiobj->highestMidiNote();
@@ -497,21 +493,20 @@ void KMid2::slotSourceChanged(const QString &src)
     }
 }
 
+void KMid2::slotLoadProgress(int percent)
+{
+    updateState("disabled_state",
+                i18nc("@info:status player loading", "loading %1%", percent));
+}
+
 void KMid2::displayLyrics()
 {
     qint64 time = m_midiobj->currentTime();
     if ( m_songEncoding.isEmpty() &&
          m_midiobj->guessTextEncoding() ) {
-            QByteArray encoding = m_midiobj->getTextEncoding().toLatin1();
-            foreach( const QString& name,
-                     KGlobal::charsets()->descriptiveEncodingNames() ) {
-                QString codecName = KGlobal::charsets()->encodingForName(name);
-                QTextCodec* codec = QTextCodec::codecForName(codecName.toLatin1());
-                if (codec != 0 && encoding == codec->name() ) {
-                    slotSelectEncoding(name);
-                    break;
-                }
-            }
+            QString name = m_encodingNames.value(m_midiobj->getTextEncoding().toLatin1());
+            if (!name.isEmpty())
+                slotSelectEncoding(name);
     }
     QString s = m_midiobj->metaData("SMF_LYRICS").join("");
     if (s.isEmpty()) s = m_midiobj->metaData("SMF_TEXT").join("");
@@ -526,7 +521,11 @@ void KMid2::displayLyrics()
     m_lyricsText->setTextColor(kapp->palette().text().color());
     m_lyricsText->setTextBackgroundColor(kapp->palette().color(QPalette::Disabled, QPalette::Background));
     m_lyricsText->setPlainText(s);
-    if (time != 0) {
+    m_lyricsOffset = 0;
+    int offset = (time != 0) ? m_midiobj->lyricsOffset(time) : -1;
+    if (offset >= 0) {
+        highlightLyrics(offset);
+    } else if (time != 0) {
         m_lyricsText->moveCursor(QTextCursor::Start);
         s = m_midiobj->getLyrics(time).join("");
         if (m_lyricsText->find(s, QTextDocument::FindCaseSensitively)) {
@@ -541,6 +540,12 @@ void KMid2::displayLyrics()
 void KMid2::slotUpdateState( State newState, State /*oldState*/ )
 {
     if (newState != PausedState) m_pause->setChecked(false);
+    if (newState == PlayingState)
+        m_eventsTimer->start();
+    else if (m_eventsTimer->isActive()) {
+        m_eventsTimer->stop();
+        slotMidiEvents();
+    }
     switch(newState) {
     case PlayingState:
         updateState("playing_state", i18nc("@info:status player playing", "playing"));
@@ -564,6 +569,51 @@ void KMid2::slotUpdateState( State newState, State /*oldState*/ )
     emit playerStateChanged(newState);
 }
 
+/**
+ * Collects the MIDI events buffered by the sequencer thread, once per frame,
+ * and delivers them to the widgets and the D-Bus interface in a batch.
+ */
+void KMid2::slotMidiEvents()
+{
+    static const int MAX_EVENTS = 1024;
+    MIDIEventRecord records[MAX_EVENTS];
+    if (m_midiobj == 0)
+        return;
+    int count = m_midiobj->readMidiEvents(records, MAX_EVENTS);
+    if (count == 0)
+        return;
+    if (m_pianola != 0)
+        m_pianola->midiEvents(records, count);
+    if (m_channels != 0)
+        m_channels->midiEvents(records, count);
+    for (int i = 0; i < count; ++i) {
+        const MIDIEventRecord& r = records[i];
+        switch (r.type) {
+        case MIDIEventRecord::NoteOff:
+            emit midiNoteOffEvent(r.channel, r.data1, r.data2);
+            break;
+        case MIDIEventRecord::NoteOn:
+            emit midiNoteOnEvent(r.channel, r.data1, r.data2);
+            break;
+        case MIDIEventRecord::KeyPressure:
+            emit midiKeyPressureEvent(r.channel, r.data1, r.data2);
+            break;
+        case MIDIEventRecord::Controller:
+            emit midiControllerEvent(r.channel, r.data1, r.value);
+            break;
+        case MIDIEventRecord::Program:
+            emit midiProgramEvent(r.channel, r.data1);
+            break;
+        case MIDIEventRecord::ChannelPressure:
+            emit midiChannelPressureEvent(r.channel, r.data1);
+            break;
+        case MIDIEventRecord::PitchBend:
+            emit midiPitchBendEvent(r.channel, r.value);
+            break;
+        }
+    }
+}
+
 void KMid2::updateState(const QString &newState, const QString &stateName)
 {
     setCaption(i18nc("@info:status", "%1 [%2]", m_songName, stateName));
@@ -661,20 +711,51 @@ void KMid2::slotSelectEncoding(const QString& encoding)
         m_midiobj->setTextEncoding(m_songEncoding);
 }
 
-void KMid2::slotMidiTextEvent(const int type, const QString &txt)
+void KMid2::slotMidiTextEvent(const int type, const QString &txt, const qint64 tick)
 {
-    if ( (type == 5) && // lyrics
-         (m_lyricsText->find(txt.trimmed(), QTextDocument::FindCaseSensitively)) ) {
+    if (type != 5) // lyrics
+        return;
+    int offset = (tick < 0) ? -1 : m_midiobj->lyricsOffset(tick);
+    if (offset >= 0) {
+        highlightLyrics(offset);
+        scrollLyrics();
+    } else if (m_lyricsText->find(txt.trimmed(), QTextDocument::FindCaseSensitively)) {
         m_lyricsText->setTextColor(m_settings->color());
-        QRect r = m_lyricsText->cursorRect();
-        QScrollBar *s = m_lyricsText->verticalScrollBar();
-        int half = m_lyricsText->viewport()->height() / 2;
-        int newpos = s->value() + r.top() - half;
-        if ((r.top() > half) && (newpos < s->maximum()))
-            s->setValue(newpos);
+        scrollLyrics();
     }
 }
 
+/**
+ * Highlights the lyrics from the last highlighted position up to the given
+ * offset, so only the newly sung part of the text is formatted.
+ */
+void KMid2::highlightLyrics(int offset)
+{
+    QTextDocument *doc = m_lyricsText->document();
+    offset = qMin(offset, doc->characterCount() - 1);
+    if (offset <= m_lyricsOffset)
+        return;
+    QTextCursor csr(doc);
+    csr.setPosition(m_lyricsOffset);
+    csr.setPosition(offset, QTextCursor::KeepAnchor);
+    QTextCharFormat format;
+    format.setForeground(m_settings->color());
+    csr.mergeCharFormat(format);
+    csr.clearSelection();
+    m_lyricsText->setTextCursor(csr);
+    m_lyricsOffset = offset;
+}
+
+void KMid2::scrollLyrics()
+{
+    QRect r = m_lyricsText->cursorRect();
+    QScrollBar *s = m_lyricsText->verticalScrollBar();
+    int half = m_lyricsText->viewport()->height() / 2;
+    int newpos = s->value() + r.top() - half;
+    if ((r.top() > half) && (newpos < s->maximum()))
+        s->setValue(newpos);
+}
+
 void KMid2::updateTempoLabel()
 {
     qreal rtempo = m_midiobj->currentTempo();
@@ -890,6 +971,14 @@ void KMid2::slotReadSettings()
     }
     if (m_midiout != 0)
         m_midiout->setResetMessage(m_resetMessage);
+    if (m_midiobj != 0)
+        m_midiobj->setSongGap(m_settings->song_gap());
+    if (m_midiobj != 0)
+        m_midiobj->setBatchWindow(m_settings->batch_window());
+    if (m_midiobj != 0)
+        m_midiobj->setTimingStats(m_settings->timing_stats());
+    if (m_midiobj != 0)
+        m_midiobj->setSongCacheSize(m_settings->song_cache_size());
     m_autoSongSettings->setChecked(m_settings->auto_song_settings());
     slotSelectEncoding(m_settings->encoding());
     displayLyrics();
@@ -970,6 +1059,18 @@ void KMid2::slotFileInfo()
             QString(), KMessageBox::Notify | KMessageBox::AllowLink );
 }
 
+void KMid2::slotTimingStats()
+{
+    QStringList stats = dumpTimingStats();
+    QString infostr;
+    if (stats.isEmpty())
+        infostr = i18nc("@info","No timing statistics have been collected. "
+                        "They can be enabled in the MIDI settings.");
+    else
+        infostr = stats.join(QLatin1String("<nl/>"));
+    KMessageBox::information(this, infostr, i18nc("@title:window","Timing Statistics"));
+}
+
 void KMid2::fileSaveLyrics()
 {
     QString lyrics = m_lyricsText->toPlainText();
@@ -1312,6 +1413,12 @@ void KMid2::setupDockWidgets()
     m_comboCodecs->setWhatsThis(i18nc("@info:whatsthis","Character encoding for lyrics and other text"));
     m_comboCodecs->addItem(i18nc("@item:inlistbox Default MIDI text encoding", "Default ( ASCII )"));
     m_comboCodecs->addItems( KGlobal::charsets()->descriptiveEncodingNames() );
+    foreach( const QString& name, KGlobal::charsets()->descriptiveEncodingNames() ) {
+        QString codecName = KGlobal::charsets()->encodingForName(name);
+        QTextCodec* codec = QTextCodec::codecForName(codecName.toLatin1());
+        if (codec != 0 && !m_encodingNames.contains(codec->name()))
+            m_encodingNames.insert(codec->name(), name);
+    }
     m_comboCodecs->setCurrentItem(m_settings->encoding());
     m_encDock->setWidget(m_comboCodecs);
     addDockWidget(Qt::TopDockWidgetArea, m_encDock);
@@ -1625,8 +1732,8 @@ void KMid2::reload()
         QString cursrc = m_midiobj->currentSource();
         if (!cursrc.isEmpty()) {
             m_midiobj->clear();
+            m_pendingPosition = curpos;
             m_midiobj->setCurrentSource(cursrc);
-            m_timeSlider->setValue(curpos);
         }
     }
 }
@@ -1783,3 +1890,11 @@ QDBusVariant KMid2::channelProperty(int channel, const QString& key)
         return QDBusVariant(m_midiobj->channelProperty(channel, key));
     return QDBusVariant();
 }
+
+QStringList KMid2::dumpTimingStats()
+{
+    QStringList stats;
+    if (m_midiobj != 0)
+        stats = m_midiobj->songProperty("TIMING_STATS").toStringList();
+    return stats;
+}
@@ -28,6 +28,7 @@
 #include <KXmlGuiWindow>
 #include <KProcess>
 #include <QDBusVariant>
+#include <QHash>
 
 class Pianola;
 class Channels;
@@ -39,6 +40,7 @@ class QUrl;
 class KComboBox;
 class KTextEdit;
 class KRecentFilesAction;
+class QTimer;
 
 namespace KMid {
       class Backend;
@@ -102,6 +104,7 @@ public:
     bool openUrl(const QString& url);
     QDBusVariant songProperty(const QString& key);
     QDBusVariant channelProperty(int channel, const QString& key);
+    QStringList dumpTimingStats();
 
 public slots:
     void setMuted(int channel, bool muted);
@@ -129,7 +132,7 @@ private slots:
     void slotUpdateState(State newState, State oldState);
     void slotSelectEncoding(int i);
     void slotSelectEncoding(const QString& encoding);
-    void slotMidiTextEvent(const int type, const QString &txt);
+    void slotMidiTextEvent(const int type, const QString &txt, const qint64 tick);
     void slotBeat(const int bars, const int beats, const int maxbeats);
     void slotTimeSignatureEvent(const int numerator, const int denominator);
     void slotTempoReset();
@@ -144,8 +147,10 @@ private slots:
     void slotTick(qint64 tick);
     void slotEditSettings();
     void slotSourceChanged(const QString &src);
+    void slotLoadProgress(int percent);
     void slotModeChanged(int mode);
     void slotFileInfo();
+    void slotTimingStats();
     void slotReadSettings();
     void slotWriteSettings();
     void slotApplySettings(const QString&);
@@ -167,6 +172,7 @@ private slots:
     void slotBackendChanged(int index);
     void slotDockVolLocationChanged ( Qt::DockWidgetArea area );
     void slotTempoChanged(qreal);
+    void slotMidiEvents();
 
 signals:
     void playerStateChanged(int state);
@@ -192,6 +198,8 @@ private:
     void updateState(const QString &newState, const QString &stateName);
     void initialize();
     void displayLyrics();
+    void highlightLyrics(int offset);
+    void scrollLyrics();
     void updateTempoLabel();
     bool queryExit();
     void displayBeat(const int bars, const int beats);
@@ -205,6 +213,8 @@ private:
     bool m_connected;
     bool m_seeking;
     qint64 m_seekamt;
+    qint64 m_pendingPosition;
+    int m_lyricsOffset;
     qreal m_rtempo;
     BackendLoader *m_loader;
     Backend *m_currentBackend;
@@ -228,6 +238,7 @@ private:
     KAction *m_previous;
     KAction *m_next;
     KAction *m_fileInfo;
+    KAction *m_timingStats;
     KAction *m_fileSaveLyrics;
     KAction *m_playListSave;
     KAction *m_playListLoad;
@@ -240,8 +251,10 @@ private:
 
     QPointer<Pianola> m_pianola;
     QPointer<Channels> m_channels;
+    QTimer *m_eventsTimer;
     QString m_songName;
     QString m_songEncoding;
+    QHash<QByteArray, QString> m_encodingNames;
     QString m_playList;
 
     MidiMapper m_mapper;
@@ -73,7 +73,8 @@ public:
         m_autoStart(true),
         m_volfactor(1.0),
         m_playerReady(false),
-        m_playPending(false)
+        m_playPending(false),
+        m_pendingPosition(0)
     {
         if (parentWidget != 0)
             m_view = new KMidPartView(parentWidget);
@@ -103,6 +104,7 @@ public:
     double m_volfactor;
     bool m_playerReady;
     bool m_playPending;
+    qlonglong m_pendingPosition;
     QMutex m_connmutex;
 };
 
@@ -273,7 +275,8 @@ void KMidPart::slotLoaded( Backend *backend,
     midiBackend.name = name;
     d->m_backends.append(midiBackend);
     backend->setParent(this);
-    qDebug() << library << name << backend->initialized();
+    qDebug() << library << name << backend->initialized()
+             << backend->initializationError();
     if ( backend != NULL && backend->initialized() &&
          d->m_currentBackend == NULL &&
          (d->m_settings->midi_backend().isEmpty() ||
@@ -446,9 +449,6 @@ bool KMidPart::openFile()
     QString localFile = localFilePath();
     if (d->m_midiobj != 0) {
         d->m_midiobj->setCurrentSource(localFile);
-        d->m_midiobj->seek(0);
-        if (d->m_view != 0)
-            d->m_view->resetTimePosition(d->m_midiobj->totalTime());
     }
     return true;
 }
@@ -525,7 +525,11 @@ void KMidPart::slotSourceChanged(QString src)
 {
     QMutexLocker locker(&d->m_connmutex);
     if (d->m_view != 0)
-        d->m_view->setPosition(0);
+        d->m_view->resetTimePosition(d->m_midiobj->totalTime());
+    if (d->m_pendingPosition > 0) {
+        seek(d->m_pendingPosition);
+        d->m_pendingPosition = 0;
+    }
     if (d->m_autoStart) {
         if (d->m_playerReady) {
             locker.unlock();
@@ -570,8 +574,8 @@ void KMidPart::reload()
         QString cursrc = d->m_midiobj->currentSource();
         if (!cursrc.isEmpty()) {
             d->m_midiobj->clear();
+            d->m_pendingPosition = curpos;
             d->m_midiobj->setCurrentSource(cursrc);
-            seek(curpos);
         }
     }
 }
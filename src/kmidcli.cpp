@@ -0,0 +1,229 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "kmidcli.h"
+#include "backendloader.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QUrl>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+KMidCli::KMidCli(QObject *parent) :
+    QObject(parent),
+    m_backend(0),
+    m_midiobj(0),
+    m_midiout(0),
+    m_index(-1),
+    m_errors(0),
+    m_dryRun(false),
+    m_totalEvents(0),
+    m_totalTime(0),
+    m_out(stdout),
+    m_err(stderr)
+{ }
+
+KMidCli::~KMidCli()
+{
+    if (m_midiobj != 0)
+        m_midiobj->stop();
+}
+
+/**
+ * Loads all the available backends, choosing the first initialized one
+ * whose library or name matches the requested one, or the first one if
+ * no backend is requested.
+ */
+bool KMidCli::initialize(const QString& backend)
+{
+    m_backendName = backend;
+    BackendLoader *loader = new BackendLoader(this);
+    connect(loader, SIGNAL(loaded(Backend*,const QString&,const QString&)),
+                    SLOT(slotLoaded(Backend*,const QString&,const QString&)));
+    loader->loadAllBackends();
+    delete loader;
+    if (m_backend == 0) {
+        m_err << "No MIDI backend loaded." << endl;
+        return false;
+    }
+    return true;
+}
+
+void KMidCli::slotLoaded(Backend *backend, const QString& library, const QString& name)
+{
+    if (backend == 0)
+        return;
+    backend->setParent(this);
+    if (!backend->initialized() && !backend->initializationError().isEmpty())
+        m_err << name << ": " << backend->initializationError() << endl;
+    if ( backend->initialized() && m_backend == 0 &&
+         (m_backendName.isEmpty() ||
+          m_backendName == library || m_backendName == name) ) {
+        m_backend = backend;
+        m_midiobj = backend->midiObject();
+        m_midiout = backend->midiOutput();
+        connect(m_midiobj, SIGNAL(stateChanged(State,State)),
+                SLOT(slotStateChanged(State,State)));
+        connect(m_midiobj, SIGNAL(currentSourceChanged(QString)),
+                SLOT(slotSourceChanged(QString)));
+        connect(m_midiobj, SIGNAL(finished()), SLOT(slotFinished()));
+    }
+}
+
+QStringList KMidCli::outputPorts()
+{
+    return m_midiout->outputDeviceList();
+}
+
+bool KMidCli::setOutputPort(const QString& port)
+{
+    return m_midiout->setOutputDeviceName(port);
+}
+
+/**
+ * Sets the playback speed factor, as the time skew of the backend. The
+ * dummy backend accepts zero, playing as fast as possible.
+ */
+void KMidCli::setSpeed(qreal speed)
+{
+    m_midiobj->setTimeSkew(speed);
+}
+
+/**
+ * Reads a playlist saved by KMid, with a song URL in every line.
+ */
+QStringList KMidCli::readPlaylist(const QString& fileName)
+{
+    QStringList list;
+    QFile file(fileName);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (!line.isEmpty())
+                list << line;
+        }
+    }
+    return list;
+}
+
+void KMidCli::start(const QStringList& sources)
+{
+    m_sources = sources;
+    m_index = -1;
+    m_midiobj->setQueue(m_sources);
+    openNext();
+}
+
+/**
+ * Loads the next song of the list, or quits after the last one. While
+ * playing, the backend advances to the next song by itself instead.
+ */
+void KMidCli::openNext()
+{
+    if (m_index + 1 >= m_sources.count()) {
+        quit();
+        return;
+    }
+    ++m_index;
+    m_loadTime.start();
+    m_midiobj->setCurrentSource(m_sources.at(m_index));
+}
+
+void KMidCli::slotSourceChanged(const QString& source)
+{
+    m_out << source << ": loaded in " << m_loadTime.elapsed() << " ms" << endl;
+    if (!m_dryRun) {
+        m_midiobj->play();
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    qint64 events = m_midiobj->dryRun();
+    qint64 nsecs = timer.nsecsElapsed();
+    if (events < 0) {
+        m_err << "The backend does not support the dry run mode." << endl;
+        ++m_errors;
+        quit();
+        return;
+    }
+    m_totalEvents += events;
+    m_totalTime += nsecs;
+    m_out << source << ": " << events << " events in "
+          << nsecs / 1000000.0 << " ms, "
+          << (nsecs > 0 ? qint64(events * 1e9 / nsecs) : 0)
+          << " events/s" << endl;
+    QMetaObject::invokeMethod(this, "openNext", Qt::QueuedConnection);
+}
+
+void KMidCli::slotStateChanged(State newState, State oldState)
+{
+    Q_UNUSED(oldState)
+    if (newState == ErrorState) {
+        m_err << m_sources.value(m_index) << ": "
+              << m_midiobj->errorString() << endl;
+        ++m_errors;
+        QMetaObject::invokeMethod(this, "openNext", Qt::QueuedConnection);
+    }
+}
+
+void KMidCli::slotFinished()
+{
+    QVariant recorded = m_midiobj->songProperty("RECORDED_EVENTS");
+    if (recorded.isValid())
+        m_out << m_sources.value(m_index) << ": " << recorded.toInt()
+              << " events recorded, max lateness "
+              << m_midiobj->songProperty("MAX_LATENESS").toLongLong()
+              << " us" << endl;
+    if (m_index + 1 >= m_sources.count()) {
+        quit();
+    } else {
+        ++m_index;
+        m_loadTime.start();
+    }
+}
+
+/**
+ * Returns the peak resident set size of the process, in KiB.
+ */
+qint64 KMidCli::peakMemory() const
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+    return -1;
+}
+
+void KMidCli::quit()
+{
+    if (m_dryRun)
+        m_out << "total: " << m_totalEvents << " events in "
+              << m_totalTime / 1000000.0 << " ms, "
+              << (m_totalTime > 0 ? qint64(m_totalEvents * 1e9 / m_totalTime) : 0)
+              << " events/s" << endl;
+    qint64 rss = peakMemory();
+    if (rss >= 0)
+        m_out << "peak RSS: " << rss << " KiB" << endl;
+    QCoreApplication::exit(m_errors > 0 ? 1 : 0);
+}
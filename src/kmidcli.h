@@ -0,0 +1,81 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef KMIDCLI_H
+#define KMIDCLI_H
+
+#include "backend.h"
+
+#include <QObject>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+using namespace KMid;
+
+/**
+ * Headless player, without any widget or user interface dependency. It
+ * loads a MIDI backend and plays a list of songs to an output port, or
+ * consumes their event streams as fast as possible in the dry run mode,
+ * reporting the load times, the event rates and the peak memory usage.
+ */
+class KMidCli : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit KMidCli(QObject *parent = 0);
+    virtual ~KMidCli();
+
+    bool initialize(const QString& backend);
+    QStringList outputPorts();
+    bool setOutputPort(const QString& port);
+    void setDryRun(bool dryRun) { m_dryRun = dryRun; }
+    void setSpeed(qreal speed);
+    void start(const QStringList& sources);
+
+    static QStringList readPlaylist(const QString& fileName);
+
+private Q_SLOTS:
+    void slotLoaded(Backend *backend, const QString& library, const QString& name);
+    void slotSourceChanged(const QString& source);
+    void slotStateChanged(State newState, State oldState);
+    void slotFinished();
+    void openNext();
+
+private:
+    void quit();
+    qint64 peakMemory() const;
+
+    QString m_backendName;
+    Backend *m_backend;
+    MIDIObject *m_midiobj;
+    MIDIOutput *m_midiout;
+    QStringList m_sources;
+    int m_index;
+    int m_errors;
+    bool m_dryRun;
+    QElapsedTimer m_loadTime;
+    qint64 m_totalEvents;
+    qint64 m_totalTime;
+    QTextStream m_out;
+    QTextStream m_err;
+};
+
+#endif // KMIDCLI_H
@@ -0,0 +1,110 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <config.h>
+#include "kmidcli.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFileInfo>
+#include <QUrl>
+
+static QString sourceUrl(const QString& arg)
+{
+    QFileInfo info(arg);
+    if (info.exists())
+        return QUrl::fromLocalFile(info.absoluteFilePath()).toString();
+    return arg;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    // shares the application data, like the song cache, with KMid
+    app.setApplicationName("kmid");
+    app.setApplicationVersion(VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless MIDI/Karaoke player");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption backendOption("backend",
+            "MIDI backend library or name.", "backend");
+    QCommandLineOption portOption(QStringList() << "p" << "port",
+            "Output port name.", "port");
+    QCommandLineOption listOption("list-ports",
+            "List the output ports and exit.");
+    QCommandLineOption playlistOption("playlist",
+            "Append the songs of a playlist file.", "file");
+    QCommandLineOption speedOption("speed",
+            "Playback speed factor. The dummy backend accepts 0, "
+            "playing as fast as possible.", "factor");
+    QCommandLineOption dryRunOption("dry-run",
+            "Consume the events as fast as possible, without output, "
+            "reporting the event rate, load time and peak memory usage.");
+    parser.addOption(backendOption);
+    parser.addOption(portOption);
+    parser.addOption(listOption);
+    parser.addOption(playlistOption);
+    parser.addOption(speedOption);
+    parser.addOption(dryRunOption);
+    parser.addPositionalArgument("files", "Song(s) to play.", "[files...]");
+    parser.process(app);
+
+    KMidCli cli;
+    if (!cli.initialize(parser.value(backendOption)))
+        return 1;
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if (parser.isSet(listOption)) {
+        foreach(const QString& port, cli.outputPorts())
+            out << port << endl;
+        return 0;
+    }
+    if (parser.isSet(portOption) &&
+        !cli.setOutputPort(parser.value(portOption))) {
+        err << "Cannot use the output port: "
+            << parser.value(portOption) << endl;
+        return 1;
+    }
+
+    QStringList sources;
+    foreach(const QString& arg, parser.positionalArguments())
+        sources << sourceUrl(arg);
+    foreach(const QString& fileName, parser.values(playlistOption))
+        sources << KMidCli::readPlaylist(fileName);
+    if (sources.isEmpty()) {
+        err << "No songs to play." << endl;
+        return 1;
+    }
+
+    if (parser.isSet(speedOption)) {
+        bool ok;
+        qreal speed = parser.value(speedOption).toDouble(&ok);
+        if (!ok || speed < 0) {
+            err << "Invalid speed factor: " << parser.value(speedOption) << endl;
+            return 1;
+        }
+        cli.setSpeed(speed);
+    }
+    cli.setDryRun(parser.isSet(dryRunOption));
+    cli.start(sources);
+    return app.exec();
+}
@@ -150,6 +150,17 @@ void Pianola::slotNoteOff(int channel, int note, int /*vel*/)
         m_piano[channel]->showNoteOff(note);
 }
 
+void Pianola::midiEvents(const KMid::MIDIEventRecord* records, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        const KMid::MIDIEventRecord& r = records[i];
+        if (r.type == KMid::MIDIEventRecord::NoteOn)
+            slotNoteOn(r.channel, r.data1, r.data2);
+        else if (r.type == KMid::MIDIEventRecord::NoteOff)
+            slotNoteOff(r.channel, r.data1, r.data2);
+    }
+}
+
 void Pianola::playNoteOn(int note)
 {
     PianoKeybd* p = static_cast<PianoKeybd*>(sender());
@@ -21,6 +21,7 @@
 #define PIANOLA_H
 
 #include "midimapper.h"
+#include "midieventring.h"
 #include <KMainWindow>
 
 class QSignalMapper;
@@ -37,6 +38,7 @@ public:
     virtual ~Pianola();
     void enableChannel(int channel, bool enable);
     void setNoteRange(int lowerNote, int upperNote);
+    void midiEvents(const KMid::MIDIEventRecord* records, int count);
 
 signals:
     void closed();
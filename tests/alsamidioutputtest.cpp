@@ -0,0 +1,368 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "alsamidioutput.h"
+#include "midimapper.h"
+
+#include <alsaevent.h>
+#include <alsa/asoundlib.h>
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+#include <QtTest>
+
+using namespace KMid;
+using namespace drumstick;
+
+/**
+ * Transforms note events in a loop, checking that every result comes
+ * from one of the configurations set by the main thread.
+ */
+class TransformReader : public QThread
+{
+public:
+    TransformReader(ALSAMIDIOutput *out, int mappedChannel,
+                    const QAtomicInt *stop, QSemaphore *started) :
+        m_out(out), m_mappedChannel(mappedChannel), m_stop(stop),
+        m_started(started), errors(0) {}
+
+    void run()
+    {
+        m_started->release();
+        do {
+            NoteOnEvent ev(0, 60, 100);
+            m_out->transformEvent(&ev, false);
+            if (ev.getKey() != 60 && ev.getKey() != 72)
+                errors++;
+            if (ev.getChannel() != 0 && ev.getChannel() != m_mappedChannel)
+                errors++;
+        } while (m_stop->loadAcquire() == 0);
+    }
+
+    ALSAMIDIOutput *m_out;
+    int m_mappedChannel;
+    const QAtomicInt *m_stop;
+    QSemaphore *m_started;
+    int errors;
+};
+
+/**
+ * Sends notes, controllers and SysEx messages from a separate thread,
+ * each thread on its own MIDI channel.
+ */
+class EventSender : public QThread
+{
+public:
+    static const int EVENTS = 1000;
+    static const int SYSEX_INTERVAL = 20;
+
+    EventSender(ALSAMIDIOutput *out, int channel, QSemaphore *go) :
+        m_out(out), m_channel(channel), m_go(go) {}
+
+    static QByteArray sysex(int channel, int i)
+    {
+        QByteArray data(32, char(channel));
+        data[0] = char(0xf0);
+        data[1] = char(0x7d);
+        data[2] = char(i & 0x7f);
+        data[31] = char(0xf7);
+        return data;
+    }
+
+    void run()
+    {
+        m_go->acquire();
+        for (int i = 0; i < EVENTS; ++i) {
+            if (i % 2)
+                m_out->sendNoteOn(m_channel, i & 0x7f, 1 + i % 127);
+            else
+                m_out->sendController(m_channel, 1, i & 0x7f);
+            if (i % SYSEX_INTERVAL == 0)
+                m_out->sendSysexEvent(sysex(m_channel, i));
+        }
+    }
+
+    ALSAMIDIOutput *m_out;
+    int m_channel;
+    QSemaphore *m_go;
+};
+
+/**
+ * A sequencer client subscribed to the output, counting the events
+ * received and checking their contents.
+ */
+class EventReceiver : public QThread
+{
+public:
+    EventReceiver() : m_handle(0), m_port(-1), notes(0), controllers(0),
+        sysexes(0), errors(0), expected(0)
+    {
+        if (snd_seq_open(&m_handle, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+            m_handle = 0;
+            return;
+        }
+        snd_seq_set_client_name(m_handle, "KMidOutputTest");
+        snd_seq_set_client_pool_input(m_handle, 2000);
+        snd_seq_set_input_buffer_size(m_handle, 256 * 1024);
+        m_port = snd_seq_create_simple_port(m_handle, "input",
+                SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    }
+
+    ~EventReceiver()
+    {
+        if (m_handle != 0)
+            snd_seq_close(m_handle);
+    }
+
+    QString deviceName() const
+    {
+        return QString("KMidOutputTest:%1").arg(m_port);
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (notes + controllers + sysexes < expected && timer.elapsed() < 10000) {
+            snd_seq_event_t *ev;
+            int err = snd_seq_event_input(m_handle, &ev);
+            if (err == -EAGAIN) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            if (err < 0 || ev == 0) {
+                errors++; // -ENOSPC: events lost by overrun
+                continue;
+            }
+            switch (ev->type) {
+            case SND_SEQ_EVENT_NOTEON:
+                notes++;
+                if (ev->data.note.velocity == 0)
+                    errors++;
+                break;
+            case SND_SEQ_EVENT_CONTROLLER:
+                controllers++;
+                if (ev->data.control.param != 1)
+                    errors++;
+                break;
+            case SND_SEQ_EVENT_SYSEX: {
+                    sysexes++;
+                    QByteArray data(static_cast<const char*>(ev->data.ext.ptr), ev->data.ext.len);
+                    if (data != EventSender::sysex(data.value(3), data.value(2)))
+                        errors++;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    snd_seq_t *m_handle;
+    int m_port;
+    int notes;
+    int controllers;
+    int sysexes;
+    int errors;
+    int expected;
+};
+
+class ALSAMIDIOutputTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void concurrentMapperUpdates();
+    void concurrentSends();
+    void transformEvents_data();
+    void transformEvents();
+
+private:
+    ALSAMIDIOutput *m_out;
+};
+
+void ALSAMIDIOutputTest::init()
+{
+    m_out = 0;
+    try {
+        m_out = new ALSAMIDIOutput;
+    } catch (...) {
+        m_out = 0;
+    }
+}
+
+void ALSAMIDIOutputTest::cleanup()
+{
+    delete m_out;
+}
+
+/**
+ * Stress test: the MIDI mapper and the pitch shift are changed while
+ * other threads transform events through the published tables.
+ */
+void ALSAMIDIOutputTest::concurrentMapperUpdates()
+{
+    static const int READERS = 3;
+    static const int UPDATES = 500;
+    if (m_out == 0)
+        QSKIP("the ALSA sequencer is not available");
+    MidiMapper mapper;
+    mapper.loadFile(KMID_MAPS_DIR "/YamahaQY10.map");
+    QVERIFY(mapper.isOK());
+
+    QAtomicInt stop(0);
+    QSemaphore started;
+    QList<TransformReader*> readers;
+    for (int i = 0; i < READERS; ++i) {
+        readers.append(new TransformReader(m_out, mapper.channel(0), &stop, &started));
+        readers.last()->start();
+    }
+    started.acquire(READERS);
+    for (int i = 0; i < UPDATES; ++i) {
+        m_out->setMidiMap((i % 2) ? &mapper : 0);
+        m_out->setPitchShift((i % 3) ? 12 : 0);
+    }
+    stop.storeRelease(1);
+    foreach(TransformReader *reader, readers) {
+        QVERIFY(reader->wait(10000));
+        QCOMPARE(reader->errors, 0);
+    }
+    qDeleteAll(readers);
+    m_out->setMidiMap(0);
+}
+
+/**
+ * Contention stress test: several threads send events at once, without
+ * a global output lock. Every event must arrive complete, and the SysEx
+ * messages must not be interleaved.
+ */
+void ALSAMIDIOutputTest::concurrentSends()
+{
+    static const int SENDERS = 4;
+    if (m_out == 0)
+        QSKIP("the ALSA sequencer is not available");
+    EventReceiver receiver;
+    QVERIFY(receiver.m_handle != 0);
+    QVERIFY(receiver.m_port >= 0);
+    m_out->outputDeviceList(false);
+    QVERIFY(m_out->setOutputDeviceName(receiver.deviceName()));
+
+    const int sysexCount = (EventSender::EVENTS + EventSender::SYSEX_INTERVAL - 1)
+                           / EventSender::SYSEX_INTERVAL;
+    receiver.expected = SENDERS * (EventSender::EVENTS + sysexCount);
+    receiver.start();
+    QSemaphore go;
+    QList<EventSender*> senders;
+    for (int i = 0; i < SENDERS; ++i) {
+        senders.append(new EventSender(m_out, i, &go));
+        senders.last()->start();
+    }
+    go.release(SENDERS);
+    foreach(EventSender *sender, senders)
+        QVERIFY(sender->wait(10000));
+    qDeleteAll(senders);
+    QVERIFY(receiver.wait(15000));
+    QCOMPARE(receiver.errors, 0);
+    QCOMPARE(receiver.notes, SENDERS * EventSender::EVENTS / 2);
+    QCOMPARE(receiver.controllers, SENDERS * EventSender::EVENTS / 2);
+    QCOMPARE(receiver.sysexes, SENDERS * sysexCount);
+}
+
+void ALSAMIDIOutputTest::transformEvents_data()
+{
+    QTest::addColumn<bool>("mapped");
+    QTest::addColumn<int>("shift");
+    QTest::newRow("plain") << false << 0;
+    QTest::newRow("pitch shift") << false << 5;
+    QTest::newRow("mapper and pitch shift") << true << 5;
+}
+
+/**
+ * Benchmark of transformEvent() over a fixed mix of notes, drum notes,
+ * controllers, program changes and pitch bends, restored before each
+ * pass because they are transformed in place.
+ */
+void ALSAMIDIOutputTest::transformEvents()
+{
+    static const int EVENTS = 256;
+    QFETCH(bool, mapped);
+    QFETCH(int, shift);
+    if (m_out == 0)
+        QSKIP("the ALSA sequencer is not available");
+    MidiMapper mapper;
+    if (mapped) {
+        mapper.loadFile(KMID_MAPS_DIR "/YamahaQY10.map");
+        QVERIFY(mapper.isOK());
+        m_out->setMidiMap(&mapper);
+    }
+    m_out->setPitchShift(shift);
+
+    QList<SequencerEvent*> events;
+    for (int i = 0; i < EVENTS; ++i) {
+        int chan = i % 9;
+        switch (i % 8) {
+        case 0:
+        case 2:
+            events.append(new NoteOnEvent(chan, 36 + i % 48, 100));
+            break;
+        case 1:
+        case 3:
+            events.append(new NoteOffEvent(chan, 36 + i % 48, 0));
+            break;
+        case 4:
+            events.append(new ControllerEvent(chan, (i % 16) ? 1 : 7, i & 0x7f));
+            break;
+        case 5:
+            events.append(new ProgramChangeEvent(chan, i & 0x7f));
+            break;
+        case 6:
+            events.append(new PitchBendEvent(chan, i * 64 - 8192));
+            break;
+        default:
+            events.append(new NoteOnEvent(MIDI_GM_DRUM_CHANNEL, 35 + i % 46, 100));
+            break;
+        }
+    }
+    QVector<snd_seq_event_t> original(EVENTS);
+    for (int i = 0; i < EVENTS; ++i)
+        original[i] = *events[i]->getHandle();
+
+    int sent = 0;
+    QBENCHMARK {
+        for (int i = 0; i < EVENTS; ++i) {
+            *events[i]->getHandle() = original[i];
+            if (m_out->transformEvent(events[i]))
+                ++sent;
+        }
+    }
+    QVERIFY(sent > 0);
+    qDeleteAll(events);
+    m_out->setPitchShift(0);
+    m_out->setMidiMap(0);
+}
+
+QTEST_MAIN(ALSAMIDIOutputTest)
+
+#include "alsamidioutputtest.moc"
@@ -0,0 +1,153 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "dummymidioutput.h"
+#include "midimapper.h"
+
+#include <QtTest>
+
+using namespace KMid;
+
+/**
+ * Counts the recorded controller messages with a given controller
+ * number, and checks that every channel got the same number of them.
+ */
+static int controllerCount(const DummyMIDIOutput& out, int controller)
+{
+    int perChannel[MIDI_CHANNELS] = { 0 };
+    int count = 0;
+    for (int i = 0; i < out.recordCount(); ++i) {
+        const DummyOutputRecord& rec = out.record(i);
+        if ((rec.message[0] & 0xf0) == 0xb0 && rec.message[1] == controller) {
+            perChannel[rec.message[0] & 0x0f]++;
+            count++;
+        }
+    }
+    for (int chan = 1; chan < MIDI_CHANNELS; ++chan)
+        if (perChannel[chan] != perChannel[0])
+            return -1;
+    return count;
+}
+
+class DummyOutputTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void allNotesOff();
+    void resetControllers();
+    void nestedBatches();
+    void masterVolume();
+    void mute();
+
+private:
+    DummyMIDIOutput *m_out;
+};
+
+void DummyOutputTest::init()
+{
+    m_out = new DummyMIDIOutput;
+}
+
+void DummyOutputTest::cleanup()
+{
+    delete m_out;
+}
+
+/**
+ * The notes and sounds off controllers for all the channels are sent in
+ * a single batch.
+ */
+void DummyOutputTest::allNotesOff()
+{
+    QCOMPARE(m_out->batchCount(), 0);
+    m_out->allNotesOff();
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), 2 * MIDI_CHANNELS);
+    QCOMPARE(controllerCount(*m_out, MIDI_CTL_ALL_NOTES_OFF), MIDI_CHANNELS);
+    QCOMPARE(controllerCount(*m_out, MIDI_CTL_ALL_SOUNDS_OFF), MIDI_CHANNELS);
+}
+
+void DummyOutputTest::resetControllers()
+{
+    m_out->resetControllers();
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), 2 * MIDI_CHANNELS);
+    QCOMPARE(controllerCount(*m_out, MIDI_CTL_RESET_CONTROLLERS), MIDI_CHANNELS);
+    QCOMPARE(controllerCount(*m_out, MIDI_CTL_MSB_MAIN_VOLUME), MIDI_CHANNELS);
+}
+
+/**
+ * Batches opened inside another batch are part of the outer one, like the
+ * burst sent when the playback starts or after a seek.
+ */
+void DummyOutputTest::nestedBatches()
+{
+    m_out->beginBatch();
+    m_out->allNotesOff();
+    m_out->resetControllers();
+    for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
+        m_out->sendProgram(chan, chan);
+    QCOMPARE(m_out->batchCount(), 0);
+    m_out->commitBatch();
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), 5 * MIDI_CHANNELS);
+
+    // an unbalanced commit is ignored
+    m_out->commitBatch();
+    QCOMPARE(m_out->batchCount(), 1);
+    m_out->sendNoteOn(0, 60, 100);
+    QCOMPARE(m_out->batchCount(), 1);
+}
+
+void DummyOutputTest::masterVolume()
+{
+    m_out->setVolume(-1, 0.5);
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), MIDI_CHANNELS);
+    for (int i = 0; i < m_out->recordCount(); ++i)
+        QCOMPARE(int(m_out->record(i).message[2]), 50);
+    m_out->setVolume(3, 1.0);
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), MIDI_CHANNELS + 1);
+}
+
+/**
+ * Muting a channel silences it in one batch, unmuting sends nothing.
+ */
+void DummyOutputTest::mute()
+{
+    m_out->setMuted(3, true);
+    QCOMPARE(m_out->batchCount(), 1);
+    QCOMPARE(m_out->recordCount(), 2);
+    m_out->setMuted(3, true);
+    QCOMPARE(m_out->batchCount(), 1);
+    m_out->sendNoteOn(3, 60, 100);
+    QCOMPARE(m_out->recordCount(), 2);
+    m_out->setMuted(3, false);
+    QCOMPARE(m_out->batchCount(), 1);
+    m_out->sendNoteOn(3, 60, 100);
+    QCOMPARE(m_out->recordCount(), 3);
+}
+
+QTEST_MAIN(DummyOutputTest)
+
+#include "dummyoutputtest.moc"
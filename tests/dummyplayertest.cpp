@@ -0,0 +1,173 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "dummymidiobject.h"
+#include "dummymidioutput.h"
+#include "smfbuilder.h"
+
+#include <QSignalSpy>
+#include <QTemporaryFile>
+#include <QtTest>
+
+using namespace KMid;
+
+class DummyPlayerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void playFast();
+    void seek();
+    void loadAndPlay_data();
+    void loadAndPlay();
+
+private:
+    bool playToEnd();
+
+    QTemporaryFile m_file;
+    DummyMIDIOutput *m_out;
+    DummyMIDIObject *m_object;
+};
+
+/**
+ * Writes a generated song of 16 tracks and about 300000 events.
+ */
+void DummyPlayerTest::initTestCase()
+{
+    QVERIFY(m_file.open());
+    m_file.write(SmfBuilder::randomSong(7, 16, 12000));
+    m_file.close();
+}
+
+void DummyPlayerTest::init()
+{
+    m_out = new DummyMIDIOutput;
+    m_object = new DummyMIDIObject;
+    m_object->initialize(m_out);
+    m_object->setTimeSkew(0);
+}
+
+void DummyPlayerTest::cleanup()
+{
+    delete m_object;
+    delete m_out;
+}
+
+/**
+ * Plays the current song as fast as possible.
+ * @return false if the song did not finish in time
+ */
+bool DummyPlayerTest::playToEnd()
+{
+    QSignalSpy spy(m_object, SIGNAL(finished()));
+    m_object->play();
+    return spy.wait(60000);
+}
+
+/**
+ * Every message of the song is delivered in order, at the time it was
+ * scheduled on the virtual clock.
+ */
+void DummyPlayerTest::playFast()
+{
+    m_object->setCurrentSource(m_file.fileName());
+    QCOMPARE(m_object->state(), StoppedState);
+    QCOMPARE(m_object->songProperty("SMF_TRACKS").toInt(), 16);
+    QVERIFY(playToEnd());
+    QCOMPARE(m_object->state(), StoppedState);
+
+    int count = m_object->songProperty("RECORDED_EVENTS").toInt();
+    QVERIFY(count > 15 * 12000);
+    QCOMPARE(m_object->songProperty("MAX_LATENESS").toLongLong(), Q_INT64_C(0));
+    int unordered = 0;
+    for (int i = 1; i < count; ++i)
+        if (m_out->record(i).intended < m_out->record(i - 1).intended)
+            ++unordered;
+    QCOMPARE(unordered, 0);
+    QVERIFY(m_out->record(count - 1).intended > 0);
+    // the start of the playback is a single burst
+    QCOMPARE(m_out->batchCount(), 1);
+}
+
+/**
+ * Seeking to the middle of the song chases the channel state in a single
+ * batch, and the playback continues with the same messages as a complete
+ * playback from that point.
+ */
+void DummyPlayerTest::seek()
+{
+    m_object->setCurrentSource(m_file.fileName());
+    QVERIFY(playToEnd());
+    QList<qint64> times;
+    for (int i = 0; i < m_out->recordCount(); ++i)
+        times.append(m_out->record(i).intended);
+
+    // half a beat away from the tempo changes, which are at every bar
+    int batches = m_out->batchCount();
+    int division = m_object->songProperty("SMF_DIVISION").toInt();
+    qint64 tick = m_object->songProperty("NUM_BEATS").toInt() / 2 * division + division / 2;
+    m_object->seek(tick);
+    QCOMPARE(m_out->batchCount(), batches + 1);
+    qint64 position = m_object->songProperty("VIRTUAL_TIME").toLongLong();
+    QVERIFY(position > 0);
+
+    int expected = 0;
+    foreach(qint64 t, times)
+        if (t >= position)
+            ++expected;
+    m_out->clearRecords();
+    QVERIFY(playToEnd());
+    QCOMPARE(m_out->recordCount(), expected);
+    QCOMPARE(m_out->batchCount(), batches + 1);
+    QCOMPARE(m_object->songProperty("MAX_LATENESS").toLongLong(), Q_INT64_C(0));
+}
+
+void DummyPlayerTest::loadAndPlay_data()
+{
+    QTest::addColumn<int>("tracks");
+    QTest::addColumn<int>("events");
+    QTest::newRow("small") << 4 << 1000;
+    QTest::newRow("large") << 16 << 12000;
+}
+
+/**
+ * Benchmark of loading a generated song and playing it as fast as
+ * possible, without MIDI hardware.
+ */
+void DummyPlayerTest::loadAndPlay()
+{
+    QFETCH(int, tracks);
+    QFETCH(int, events);
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(SmfBuilder::randomSong(tracks, tracks, events));
+    file.close();
+    QBENCHMARK {
+        m_object->setCurrentSource(file.fileName());
+        QVERIFY(playToEnd());
+    }
+    QVERIFY(m_object->songProperty("RECORDED_EVENTS").toInt() > (tracks - 1) * events);
+}
+
+QTEST_MAIN(DummyPlayerTest)
+
+#include "dummyplayertest.moc"
@@ -0,0 +1,173 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <alsaclient.h>
+#include <alsaevent.h>
+#include <alsaport.h>
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtTest>
+
+using namespace drumstick;
+
+/**
+ * Counts the note events received through either of the callback
+ * delivery modes of MidiClient, checking their contents.
+ */
+class EventCounter : public SequencerRawEventHandler, public SequencerEventHandler
+{
+public:
+    EventCounter() : notes(0), errors(0) {}
+
+    void handleRawEvent(const snd_seq_event_t* ev)
+    {
+        if (ev->type == SND_SEQ_EVENT_NOTEON) {
+            if (ev->data.note.note != 60 || ev->data.note.velocity != 100)
+                errors.ref();
+            notes.ref();
+        }
+    }
+
+    void handleSequencerEvent(SequencerEvent* ev)
+    {
+        NoteOnEvent *note = dynamic_cast<NoteOnEvent*>(ev);
+        if (note != 0) {
+            if (note->getKey() != 60 || note->getVelocity() != 100)
+                errors.ref();
+            notes.ref();
+        }
+        delete ev;
+    }
+
+    QAtomicInt notes;
+    QAtomicInt errors;
+};
+
+class MidiClientTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void inputHandler_data();
+    void inputHandler();
+
+private:
+    bool sendAndWait(int count);
+
+    MidiClient *m_client;
+    MidiPort *m_port;
+    EventCounter m_counter;
+};
+
+void MidiClientTest::initTestCase()
+{
+    m_client = 0;
+    try {
+        m_client = new MidiClient(this);
+        m_client->open();
+        m_client->setClientName("KMidClientTest");
+        m_client->setPoolInput(1000);
+        m_client->setInputBufferSize(64 * 1024);
+        m_port = m_client->createPort();
+        m_port->setPortName("loopback");
+        m_port->setCapability(SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT);
+        m_port->setPortType(SND_SEQ_PORT_TYPE_SPECIFIC);
+        m_client->startSequencerInput();
+    } catch (...) {
+        delete m_client;
+        m_client = 0;
+    }
+}
+
+void MidiClientTest::cleanupTestCase()
+{
+    if (m_client != 0) {
+        m_client->stopSequencerInput();
+        delete m_client;
+    }
+}
+
+/**
+ * Sends notes to the own port of the client, in chunks that fit in the
+ * input pool, waiting for each chunk to be handled by the input thread.
+ * @return false if the events were not received in time
+ */
+bool MidiClientTest::sendAndWait(int count)
+{
+    static const int CHUNK = 250;
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_source(&ev, m_port->getPortId());
+    snd_seq_ev_set_dest(&ev, m_client->getClientId(), m_port->getPortId());
+    snd_seq_ev_set_direct(&ev);
+    snd_seq_ev_set_noteon(&ev, 0, 60, 100);
+    QElapsedTimer timer;
+    timer.start();
+    for (int sent = 0; sent < count; ) {
+        int chunk = qMin(CHUNK, count - sent);
+        for (int i = 0; i < chunk; ++i)
+            snd_seq_event_output(m_client->getHandle(), &ev);
+        snd_seq_drain_output(m_client->getHandle());
+        sent += chunk;
+        while (m_counter.notes.load() < sent) {
+            if (timer.elapsed() > 10000)
+                return false;
+            QThread::yieldCurrentThread();
+        }
+    }
+    return true;
+}
+
+void MidiClientTest::inputHandler_data()
+{
+    QTest::addColumn<bool>("raw");
+    QTest::newRow("raw handler") << true;
+    QTest::newRow("event handler") << false;
+}
+
+/**
+ * Benchmark of the input thread delivering events to the raw handler,
+ * without allocations, and to the event handler, which gets a heap copy
+ * of each event.
+ */
+void MidiClientTest::inputHandler()
+{
+    static const int EVENTS = 5000;
+    QFETCH(bool, raw);
+    if (m_client == 0)
+        QSKIP("the ALSA sequencer is not available");
+    m_client->setRawHandler(raw ? &m_counter : 0);
+    m_client->setHandler(raw ? 0 : &m_counter);
+    QBENCHMARK {
+        m_counter.notes.store(0);
+        QVERIFY(sendAndWait(EVENTS));
+        QCOMPARE(m_counter.notes.load(), EVENTS);
+    }
+    QCOMPARE(m_counter.errors.load(), 0);
+    m_client->setRawHandler(0);
+    m_client->setHandler(0);
+}
+
+QTEST_MAIN(MidiClientTest)
+
+#include "midiclienttest.moc"
@@ -0,0 +1,175 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "player.h"
+#include "song.h"
+
+#include <alsaclient.h>
+#include <alsaport.h>
+#include <alsaqueue.h>
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QtTest>
+
+using namespace KMid;
+using namespace drumstick;
+
+/**
+ * Counts the note events received by the loopback port.
+ */
+class NoteCounter : public SequencerRawEventHandler
+{
+public:
+    NoteCounter() : notes(0) {}
+
+    void handleRawEvent(const snd_seq_event_t* ev)
+    {
+        if (ev->type == SND_SEQ_EVENT_NOTEON)
+            notes.ref();
+    }
+
+    QAtomicInt notes;
+};
+
+/**
+ * Number of write system calls of this process, from the task I/O
+ * accounting of the kernel.
+ * @return the count, or -1 if it is not available
+ */
+static qint64 writeCalls()
+{
+    QFile file("/proc/self/io");
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+    foreach(const QByteArray& line, file.readAll().split('\n'))
+        if (line.startsWith("syscw:"))
+            return line.mid(6).trimmed().toLongLong();
+    return -1;
+}
+
+class PlayerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void batchWindow();
+
+private:
+    qint64 play(Song& song, unsigned int window);
+
+    MidiClient *m_client;
+    MidiPort *m_port;
+    Player *m_player;
+    NoteCounter m_counter;
+};
+
+void PlayerTest::initTestCase()
+{
+    m_client = 0;
+    m_player = 0;
+    try {
+        m_client = new MidiClient(this);
+        m_client->open();
+        m_client->setClientName("KMidPlayerTest");
+        m_port = m_client->createPort();
+        m_port->setPortName("loopback");
+        m_port->setCapability(SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT);
+        m_port->setPortType(SND_SEQ_PORT_TYPE_SPECIFIC);
+        m_client->setRawHandler(&m_counter);
+        m_client->startSequencerInput();
+        m_player = new Player(m_client, m_port->getPortId());
+    } catch (...) {
+        delete m_client;
+        m_client = 0;
+    }
+}
+
+void PlayerTest::cleanupTestCase()
+{
+    delete m_player;
+    if (m_client != 0) {
+        m_client->stopSequencerInput();
+        delete m_client;
+    }
+}
+
+/**
+ * Plays a song to the loopback port, with a batch window in ticks.
+ * @return the number of write system calls while playing
+ */
+qint64 PlayerTest::play(Song& song, unsigned int window)
+{
+    MidiQueue *queue = m_client->getQueue();
+    queue->start();
+    queue->stop();
+    QueueTempo tempo = queue->getTempo();
+    tempo.setPPQ(song.getDivision());
+    tempo.setTempo(song.getInitialTempo());
+    queue->setTempo(tempo);
+    m_client->drainOutput();
+
+    m_counter.notes.store(0);
+    m_player->setSong(&song);
+    m_player->setBatchWindow(window);
+    qint64 before = writeCalls();
+    m_player->start();
+    if (!m_player->wait(30000))
+        return -1;
+    return writeCalls() - before;
+}
+
+/**
+ * Measures the write system calls saved by the output batches of 20 ms,
+ * playing a dense song at a fast tempo.
+ */
+void PlayerTest::batchWindow()
+{
+    static const int EVENTS = 4000;
+    if (m_client == 0)
+        QSKIP("the ALSA sequencer is not available");
+    if (writeCalls() < 0)
+        QSKIP("the I/O accounting of the kernel is not available");
+    Song song;
+    song.setHeader(0, 1, 384);
+    song.setInitialTempo(100000);
+    for (int i = 0; i < EVENTS; ++i) {
+        NoteOnEvent ev(i % 16, 60, 100);
+        ev.scheduleTick(0, i, false);
+        song.append(ev.getHandle());
+    }
+    unsigned int window = song.ticksWithin(20);
+    QCOMPARE(window, 76u);
+
+    qint64 direct = play(song, 0);
+    QTRY_COMPARE(m_counter.notes.load(), EVENTS);
+    qint64 batched = play(song, window);
+    QTRY_COMPARE(m_counter.notes.load(), EVENTS);
+    qDebug("%d events: %lld writes one by one, %lld writes in batches of %u ticks",
+           EVENTS, direct, batched, window);
+    QVERIFY(direct >= EVENTS);
+    QVERIFY(batched > 0);
+    QVERIFY(batched * 10 < direct);
+}
+
+QTEST_MAIN(PlayerTest)
+
+#include "playertest.moc"
@@ -0,0 +1,420 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "smfbuilder.h"
+#include <qsmf.h>
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QTemporaryFile>
+#include <QtTest>
+
+using namespace drumstick;
+
+/**
+ * Records every callback of a QSmf parse as a line of text, along with
+ * the tick and real time positions, so two parses can be compared.
+ */
+class SmfRecorder : public QSmfHandler
+{
+public:
+    explicit SmfRecorder(QSmf *engine) : m_engine(engine) {}
+
+    QStringList log;
+
+    void handleError(const QString& errorStr)
+    { Q_UNUSED(errorStr) add("error"); }
+    void handleHeader(int format, int ntrks, int division)
+    { add(QString("header %1 %2 %3").arg(format).arg(ntrks).arg(division)); }
+    void handleNoteOn(int chan, int pitch, int vol)
+    { add(QString("on %1 %2 %3").arg(chan).arg(pitch).arg(vol)); }
+    void handleNoteOff(int chan, int pitch, int vol)
+    { add(QString("off %1 %2 %3").arg(chan).arg(pitch).arg(vol)); }
+    void handleKeyPress(int chan, int pitch, int press)
+    { add(QString("kp %1 %2 %3").arg(chan).arg(pitch).arg(press)); }
+    void handleCtlChange(int chan, int ctl, int value)
+    { add(QString("ctl %1 %2 %3").arg(chan).arg(ctl).arg(value)); }
+    void handlePitchBend(int chan, int value)
+    { add(QString("bend %1 %2").arg(chan).arg(value)); }
+    void handleProgram(int chan, int patch)
+    { add(QString("pgm %1 %2").arg(chan).arg(patch)); }
+    void handleChanPress(int chan, int press)
+    { add(QString("cp %1 %2").arg(chan).arg(press)); }
+    void handleSysex(const QByteArray& data)
+    { add("sysex " + data.toHex()); }
+    void handleMetaMisc(int typ, const QByteArray& data)
+    { add(QString("meta %1 ").arg(typ) + data.toHex()); }
+    void handleText(int typ, const QString& data)
+    { add(QString("text %1 ").arg(typ) + data); }
+    void handleTempo(int tempo)
+    { add(QString("tempo %1").arg(tempo)); }
+    void handleEndOfTrack() { add("eot"); }
+    void handleTrackStart() { add("start"); }
+    void handleTrackEnd() { add("end"); }
+
+private:
+    void add(const QString& s)
+    {
+        log << QString("%1 %2 %3").arg(m_engine->getCurrentTime())
+                                  .arg(m_engine->getRealTime()).arg(s);
+    }
+
+    QSmf *m_engine;
+};
+
+/**
+ * Feeds the signals of a QSmf into a SmfRecorder, to check that both
+ * delivery modes report the same events.
+ */
+class SmfSignalRecorder : public QObject
+{
+    Q_OBJECT
+public:
+    SmfSignalRecorder(QSmf *engine, SmfRecorder *recorder) :
+        QObject(engine), r(recorder)
+    {
+        connect(engine, SIGNAL(signalSMFError(QString)), SLOT(error(QString)));
+        connect(engine, SIGNAL(signalSMFHeader(int,int,int)), SLOT(header(int,int,int)));
+        connect(engine, SIGNAL(signalSMFNoteOn(int,int,int)), SLOT(noteOn(int,int,int)));
+        connect(engine, SIGNAL(signalSMFNoteOff(int,int,int)), SLOT(noteOff(int,int,int)));
+        connect(engine, SIGNAL(signalSMFKeyPress(int,int,int)), SLOT(keyPress(int,int,int)));
+        connect(engine, SIGNAL(signalSMFCtlChange(int,int,int)), SLOT(ctlChange(int,int,int)));
+        connect(engine, SIGNAL(signalSMFPitchBend(int,int)), SLOT(pitchBend(int,int)));
+        connect(engine, SIGNAL(signalSMFProgram(int,int)), SLOT(program(int,int)));
+        connect(engine, SIGNAL(signalSMFChanPress(int,int)), SLOT(chanPress(int,int)));
+        connect(engine, SIGNAL(signalSMFSysex(QByteArray)), SLOT(sysex(QByteArray)));
+        connect(engine, SIGNAL(signalSMFMetaMisc(int,QByteArray)), SLOT(metaMisc(int,QByteArray)));
+        connect(engine, SIGNAL(signalSMFText(int,QString)), SLOT(text(int,QString)));
+        connect(engine, SIGNAL(signalSMFTempo(int)), SLOT(tempo(int)));
+        connect(engine, SIGNAL(signalSMFendOfTrack()), SLOT(endOfTrack()));
+        connect(engine, SIGNAL(signalSMFTrackStart()), SLOT(trackStart()));
+        connect(engine, SIGNAL(signalSMFTrackEnd()), SLOT(trackEnd()));
+    }
+
+public Q_SLOTS:
+    void error(const QString& s) { r->handleError(s); }
+    void header(int f, int n, int d) { r->handleHeader(f, n, d); }
+    void noteOn(int c, int p, int v) { r->handleNoteOn(c, p, v); }
+    void noteOff(int c, int p, int v) { r->handleNoteOff(c, p, v); }
+    void keyPress(int c, int p, int v) { r->handleKeyPress(c, p, v); }
+    void ctlChange(int c, int n, int v) { r->handleCtlChange(c, n, v); }
+    void pitchBend(int c, int v) { r->handlePitchBend(c, v); }
+    void program(int c, int p) { r->handleProgram(c, p); }
+    void chanPress(int c, int p) { r->handleChanPress(c, p); }
+    void sysex(const QByteArray& d) { r->handleSysex(d); }
+    void metaMisc(int t, const QByteArray& d) { r->handleMetaMisc(t, d); }
+    void text(int t, const QString& d) { r->handleText(t, d); }
+    void tempo(int t) { r->handleTempo(t); }
+    void endOfTrack() { r->handleEndOfTrack(); }
+    void trackStart() { r->handleTrackStart(); }
+    void trackEnd() { r->handleTrackEnd(); }
+
+private:
+    SmfRecorder *r;
+};
+
+/**
+ * Counts the note events without recording them, for the dispatch
+ * benchmark.
+ */
+class SmfCounter : public QObject, public QSmfHandler
+{
+    Q_OBJECT
+public:
+    SmfCounter() : notes(0) {}
+    int notes;
+    void handleNoteOn(int, int, int) { notes++; }
+    void handleNoteOff(int, int, int) { notes++; }
+public Q_SLOTS:
+    void noteOn(int, int, int) { notes++; }
+    void noteOff(int, int, int) { notes++; }
+};
+
+class QSmfTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void bufferedMatchesStream_data();
+    void bufferedMatchesStream();
+    void mappedFileMatchesStream();
+    void parse_data();
+    void parse();
+    void handlerMatchesSignals();
+    void unknownChunksAreSkipped();
+    void trackChunksWithTempoMap();
+    void tempoMap();
+    void dispatch_data();
+    void dispatch();
+
+private:
+    static QStringList parseStream(const QByteArray& smf, bool buffered);
+    static QByteArray handcrafted();
+};
+
+/**
+ * Parses @a smf from a QBuffer, either streaming byte by byte or reading
+ * the whole device into memory first.
+ */
+QStringList QSmfTest::parseStream(const QByteArray& smf, bool buffered)
+{
+    QSmf engine;
+    SmfRecorder recorder(&engine);
+    engine.setHandler(&recorder);
+    engine.setBufferedReading(buffered);
+    QBuffer buffer;
+    buffer.setData(smf);
+    buffer.open(QIODevice::ReadOnly);
+    QDataStream ds(&buffer);
+    engine.readFromStream(&ds);
+    return recorder.log;
+}
+
+/**
+ * A file exercising the corners of the parser: running status across
+ * note on/off, meta events breaking the running status, a SysEx split in
+ * continuation packets, and tempo changes in the middle of a track.
+ */
+QByteArray QSmfTest::handcrafted()
+{
+    SmfBuilder smf(1, 96);
+    SmfTrack conductor;
+    conductor.text(0, 0x03, "Title");
+    conductor.tempo(0, 500000);
+    conductor.meta(0, 0x58, QByteArray::fromHex("04021808"));
+    conductor.tempo(192, 250000);
+    conductor.tempo(96, 1000000);
+    conductor.endOfTrack();
+    smf.addTrack(conductor);
+
+    SmfTrack track;
+    track.program(0, 0, 19);
+    track.controller(0, 0, 7, 100);
+    track.controller(0, 0, 10, 64);
+    track.noteOn(0, 0, 60, 100);
+    track.noteOn(0, 0, 64, 100);
+    track.text(48, 0x05, "Hel");
+    track.noteOn(48, 0, 60, 0);
+    track.noteOn(0, 0, 64, 0);
+    track.sysex(10, QByteArray::fromHex("7e7f0901f7"));
+    track.sysex(10, QByteArray::fromHex("4310"));
+    track.sysexContinuation(5, QByteArray::fromHex("4c000004f7"));
+    track.pitchBend(20, 0, 0x2000);
+    track.pitchBend(20, 0, 0x3fff);
+    track.noteOff(500, 0, 60);
+    track.endOfTrack();
+    smf.addTrack(track);
+    return smf.build();
+}
+
+void QSmfTest::bufferedMatchesStream_data()
+{
+    QTest::addColumn<QByteArray>("smf");
+    QTest::newRow("handcrafted") << handcrafted();
+    QTest::newRow("random") << SmfBuilder::randomSong(1, 8, 2000);
+    QTest::newRow("truncated") << handcrafted().left(handcrafted().size() - 17);
+}
+
+void QSmfTest::bufferedMatchesStream()
+{
+    QFETCH(QByteArray, smf);
+    QStringList streamed = parseStream(smf, false);
+    QStringList buffered = parseStream(smf, true);
+    QVERIFY(streamed.count() > 3);
+    QCOMPARE(buffered, streamed);
+}
+
+void QSmfTest::mappedFileMatchesStream()
+{
+    QByteArray smf = SmfBuilder::randomSong(7, 4, 500);
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(smf);
+    file.close();
+
+    QSmf engine;
+    SmfRecorder recorder(&engine);
+    engine.setHandler(&recorder);
+    engine.setBufferedReading(true);
+    engine.readFromFile(file.fileName());
+    QCOMPARE(recorder.log, parseStream(smf, false));
+}
+
+void QSmfTest::parse_data()
+{
+    QTest::addColumn<bool>("buffered");
+    QTest::newRow("stream") << false;
+    QTest::newRow("buffered") << true;
+}
+
+/**
+ * Benchmark of a whole file parse, in both reading modes.
+ */
+void QSmfTest::parse()
+{
+    QFETCH(bool, buffered);
+    QByteArray smf = SmfBuilder::randomSong(42, 16, 20000);
+    QSmfHandler handler;
+    QSmf engine;
+    engine.setHandler(&handler);
+    engine.setBufferedReading(buffered);
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.setData(smf);
+        buffer.open(QIODevice::ReadOnly);
+        QDataStream ds(&buffer);
+        engine.readFromStream(&ds);
+    }
+}
+
+void QSmfTest::handlerMatchesSignals()
+{
+    QByteArray smf = handcrafted();
+    QStringList handled = parseStream(smf, true);
+
+    QSmf engine;
+    SmfRecorder recorder(&engine);
+    new SmfSignalRecorder(&engine, &recorder);
+    engine.setBufferedReading(true);
+    QBuffer buffer;
+    buffer.setData(smf);
+    buffer.open(QIODevice::ReadOnly);
+    QDataStream ds(&buffer);
+    engine.readFromStream(&ds);
+    QCOMPARE(recorder.log, handled);
+}
+
+void QSmfTest::unknownChunksAreSkipped()
+{
+    SmfTrack track;
+    track.noteOn(0, 0, 60, 100);
+    track.noteOff(96, 0, 60);
+    track.endOfTrack();
+    SmfBuilder plain(1, 96);
+    plain.addTrack(track);
+    plain.addTrack(track);
+    SmfBuilder extended(1, 96);
+    extended.addChunk("XFIH", QByteArray(13, '\xff'));
+    extended.addTrack(track);
+    extended.addChunk("XFKM", QByteArray::fromHex("4d54726b00000000"));
+    extended.addTrack(track);
+    extended.addChunk("XFKM", QByteArray(3, '\0'));
+
+    QStringList expected = parseStream(plain.build(), false);
+    QCOMPARE(parseStream(extended.build(), false), expected);
+    QCOMPARE(parseStream(extended.build(), true), expected);
+
+    QSmf engine;
+    QSmfHandler handler;
+    engine.setHandler(&handler);
+    QByteArray smf = extended.build();
+    QList<QByteArray> chunks = engine.indexTracks(smf);
+    QCOMPARE(chunks.count(), 2);
+    foreach(const QByteArray& chunk, chunks)
+        QCOMPARE(chunk, QByteArray("MTrk\0\0\0", 7) + char(track.data().size()) + track.data());
+}
+
+/**
+ * The tracks of a format 1 file parsed one by one, sharing the tempo map
+ * of the first track, report the same times as a whole file parse.
+ */
+void QSmfTest::trackChunksWithTempoMap()
+{
+    QByteArray smf = SmfBuilder::randomSong(3, 4, 300, 96);
+    QStringList expected = parseStream(smf, true);
+    expected.removeFirst(); // header
+
+    QSmf engine;
+    SmfRecorder recorder(&engine);
+    engine.setHandler(&recorder);
+    QList<QByteArray> chunks = engine.indexTracks(smf);
+    QCOMPARE(chunks.count(), 4);
+    recorder.log.clear();
+    engine.readTrackChunk(chunks.first(), 96);
+    QSmfTempoMap tempoMap = engine.getTempoMap();
+    QVERIFY(tempoMap.count() > 1);
+    recorder.log.clear();
+    foreach(const QByteArray& chunk, chunks)
+        engine.readTrackChunk(chunk, tempoMap);
+    QCOMPARE(recorder.log, expected);
+}
+
+void QSmfTest::tempoMap()
+{
+    QSmfTempoMap map;
+    map.setDivision(100);
+    map.addTempo(500000, 0);
+    map.addTempo(250000, 200);
+    map.addTempo(250000, 300);  // redundant
+    map.addTempo(1000000, 100); // out of order
+    map.addTempo(1000000, 400);
+    QCOMPARE(map.count(), 3);
+    QCOMPARE(map.indexOf(0), 0);
+    QCOMPARE(map.indexOf(399), 1);
+    QCOMPARE(map.tempoAt(400), quint64(1000000));
+    QCOMPARE(map.ticksToMicroseconds(100), 500000.0);
+    QCOMPARE(map.ticksToMicroseconds(300), 1250000.0);
+    QCOMPARE(map.ticksToMicroseconds(500), 2500000.0);
+    QCOMPARE(map.ticksToMicroseconds(500, map.indexOf(500)), 2500000.0);
+    QCOMPARE(map.ticksToSeconds(500), 2.5);
+
+    QSmfTempoMap smpte;
+    smpte.setDivision(0xe728); // 25 fps, 40 ticks per frame
+    smpte.addTempo(500000, 0);
+    QCOMPARE(smpte.ticksToMicroseconds(1000), 1000000.0);
+}
+
+void QSmfTest::dispatch_data()
+{
+    QTest::addColumn<bool>("handler");
+    QTest::newRow("signals") << false;
+    QTest::newRow("handler") << true;
+}
+
+/**
+ * Benchmark of the event delivery: QSmf signals against the direct
+ * QSmfHandler callbacks, both counting the notes of the same file.
+ */
+void QSmfTest::dispatch()
+{
+    QFETCH(bool, handler);
+    QByteArray smf = SmfBuilder::randomSong(42, 16, 20000);
+    SmfCounter counter;
+    QSmf engine;
+    engine.setBufferedReading(true);
+    if (handler) {
+        engine.setHandler(&counter);
+    } else {
+        connect(&engine, SIGNAL(signalSMFNoteOn(int,int,int)), &counter, SLOT(noteOn(int,int,int)));
+        connect(&engine, SIGNAL(signalSMFNoteOff(int,int,int)), &counter, SLOT(noteOff(int,int,int)));
+    }
+    QBENCHMARK {
+        counter.notes = 0;
+        QBuffer buffer;
+        buffer.setData(smf);
+        buffer.open(QIODevice::ReadOnly);
+        QDataStream ds(&buffer);
+        engine.readFromStream(&ds);
+    }
+    QVERIFY(counter.notes > 0);
+}
+
+QTEST_MAIN(QSmfTest)
+
+#include "qsmftest.moc"
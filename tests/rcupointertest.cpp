@@ -0,0 +1,156 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "rcupointer.h"
+
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QThread>
+#include <QtTest>
+
+using namespace KMid;
+
+static const quint32 POISON = 0xdeadbeef;
+
+/**
+ * A table filled with its stamp, poisoned when deleted, so a reader can
+ * detect a table freed or modified while in use.
+ */
+struct StampedTable {
+    explicit StampedTable(quint32 s) : stamp(s)
+    {
+        for (int i = 0; i < 256; ++i)
+            values[i] = s;
+    }
+    ~StampedTable()
+    {
+        stamp = POISON;
+        for (int i = 0; i < 256; ++i)
+            values[i] = POISON;
+    }
+    bool consistent() const
+    {
+        for (int i = 0; i < 256; ++i)
+            if (values[i] != stamp)
+                return false;
+        return stamp != POISON;
+    }
+    volatile quint32 stamp;
+    volatile quint32 values[256];
+};
+
+class TableReader : public QThread
+{
+public:
+    TableReader(RcuPointer<StampedTable> *table, const QAtomicInt *stop,
+                QSemaphore *started) :
+        m_table(table), m_stop(stop), m_started(started), reads(0), errors(0) {}
+
+    void run()
+    {
+        quint32 last = 0;
+        m_started->release();
+        do {
+            int slot;
+            const StampedTable *t = m_table->acquire(&slot);
+            quint32 stamp = t->stamp;
+            if (stamp < last)
+                errors++;
+            last = stamp;
+            // a table must not change or be freed while it is held
+            for (int i = 0; i < 4; ++i)
+                if (!t->consistent() || t->stamp != stamp)
+                    errors++;
+            m_table->release(slot);
+            reads++;
+        } while (m_stop->loadAcquire() == 0);
+    }
+
+    RcuPointer<StampedTable> *m_table;
+    const QAtomicInt *m_stop;
+    QSemaphore *m_started;
+    qint64 reads;
+    int errors;
+};
+
+class RcuPointerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void publishDoesNotWaitForReaders();
+    void concurrentUpdates();
+};
+
+/**
+ * A reader holding a table does not block publishing: the replaced tables
+ * are only deleted once the reader has finished.
+ */
+void RcuPointerTest::publishDoesNotWaitForReaders()
+{
+    RcuPointer<StampedTable> table(new StampedTable(1));
+    int slot;
+    const StampedTable *held = table.acquire(&slot);
+    for (quint32 i = 2; i <= 101; ++i)
+        table.publish(new StampedTable(i));
+    QCOMPARE(table.retiredCount(), 100);
+    QVERIFY(held->consistent());
+    QCOMPARE(quint32(held->stamp), quint32(1));
+    table.release(slot);
+
+    const StampedTable *current = table.acquire(&slot);
+    QCOMPARE(quint32(current->stamp), quint32(101));
+    table.release(slot);
+    table.publish(new StampedTable(102));
+    QCOMPARE(table.retiredCount(), 0);
+}
+
+/**
+ * Stress test: several readers keep reading the tables while a writer
+ * replaces them as fast as it can.
+ */
+void RcuPointerTest::concurrentUpdates()
+{
+    static const int READERS = 4;
+    static const quint32 UPDATES = 20000;
+    RcuPointer<StampedTable> table(new StampedTable(1));
+    QAtomicInt stop(0);
+    QSemaphore started;
+    QList<TableReader*> readers;
+    for (int i = 0; i < READERS; ++i) {
+        readers.append(new TableReader(&table, &stop, &started));
+        readers.last()->start();
+    }
+    started.acquire(READERS);
+    for (quint32 i = 2; i <= UPDATES; ++i)
+        table.publish(new StampedTable(i));
+    stop.storeRelease(1);
+    foreach(TableReader *reader, readers) {
+        QVERIFY(reader->wait(10000));
+        QCOMPARE(reader->errors, 0);
+        QVERIFY(reader->reads > 0);
+    }
+    qDeleteAll(readers);
+    table.publish(new StampedTable(UPDATES + 1));
+    QCOMPARE(table.retiredCount(), 0);
+}
+
+QTEST_MAIN(RcuPointerTest)
+
+#include "rcupointertest.moc"
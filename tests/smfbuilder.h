@@ -0,0 +1,239 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef SMFBUILDER_H
+#define SMFBUILDER_H
+
+#include <QByteArray>
+#include <QList>
+
+/**
+ * Encodes the events of a single SMF track chunk. Running status is used
+ * for consecutive channel messages with the same status byte, unless it
+ * is disabled.
+ */
+class SmfTrack
+{
+public:
+    SmfTrack() : m_status(0), m_running(true) {}
+
+    void setRunningStatus(bool enable) { m_running = enable; }
+
+    void delta(quint32 ticks)
+    {
+        quint8 buf[5];
+        int n = 0;
+        buf[n++] = ticks & 0x7f;
+        while ((ticks >>= 7) > 0)
+            buf[n++] = (ticks & 0x7f) | 0x80;
+        while (n > 0)
+            m_data.append(char(buf[--n]));
+    }
+
+    void channel(quint32 dt, int status, int b1, int b2 = -1)
+    {
+        delta(dt);
+        if (!m_running || status != m_status)
+            m_data.append(char(status));
+        m_status = status;
+        m_data.append(char(b1 & 0x7f));
+        if (b2 >= 0)
+            m_data.append(char(b2 & 0x7f));
+    }
+
+    void noteOn(quint32 dt, int chan, int note, int vel)
+    { channel(dt, 0x90 | chan, note, vel); }
+    void noteOff(quint32 dt, int chan, int note)
+    { channel(dt, 0x80 | chan, note, 0); }
+    void controller(quint32 dt, int chan, int ctl, int value)
+    { channel(dt, 0xb0 | chan, ctl, value); }
+    void program(quint32 dt, int chan, int pgm)
+    { channel(dt, 0xc0 | chan, pgm); }
+    void pitchBend(quint32 dt, int chan, int value)
+    { channel(dt, 0xe0 | chan, value & 0x7f, value >> 7); }
+
+    void meta(quint32 dt, int type, const QByteArray& data)
+    {
+        delta(dt);
+        m_status = 0;
+        m_data.append(char(0xff));
+        m_data.append(char(type));
+        varLen(data.size());
+        m_data.append(data);
+    }
+
+    void tempo(quint32 dt, quint32 usecs)
+    {
+        QByteArray data;
+        data.append(char(usecs >> 16));
+        data.append(char(usecs >> 8));
+        data.append(char(usecs));
+        meta(dt, 0x51, data);
+    }
+
+    void text(quint32 dt, int type, const QByteArray& text)
+    { meta(dt, type, text); }
+
+    /** Appends a complete SysEx message; @a body excludes the F0 byte */
+    void sysex(quint32 dt, const QByteArray& body)
+    {
+        delta(dt);
+        m_status = 0;
+        m_data.append(char(0xf0));
+        varLen(body.size());
+        m_data.append(body);
+    }
+
+    /** Appends a SysEx continuation packet (F7 event) */
+    void sysexContinuation(quint32 dt, const QByteArray& body)
+    {
+        delta(dt);
+        m_status = 0;
+        m_data.append(char(0xf7));
+        varLen(body.size());
+        m_data.append(body);
+    }
+
+    void endOfTrack(quint32 dt = 0) { meta(dt, 0x2f, QByteArray()); }
+
+    const QByteArray& data() const { return m_data; }
+
+private:
+    void varLen(quint32 value)
+    {
+        quint8 buf[5];
+        int n = 0;
+        buf[n++] = value & 0x7f;
+        while ((value >>= 7) > 0)
+            buf[n++] = (value & 0x7f) | 0x80;
+        while (n > 0)
+            m_data.append(char(buf[--n]));
+    }
+
+    QByteArray m_data;
+    int m_status;
+    bool m_running;
+};
+
+/**
+ * Assembles a Standard MIDI File from track chunks, and optionally chunks
+ * of unknown types, which readers must skip.
+ */
+class SmfBuilder
+{
+public:
+    explicit SmfBuilder(int format = 1, int division = 120) :
+        m_format(format), m_division(division), m_tracks(0) {}
+
+    void addTrack(const SmfTrack& track)
+    {
+        addChunk("MTrk", track.data());
+        m_tracks++;
+    }
+
+    void addChunk(const char *type, const QByteArray& data)
+    {
+        m_body.append(type, 4);
+        append32(m_body, data.size());
+        m_body.append(data);
+    }
+
+    QByteArray build() const
+    {
+        QByteArray smf("MThd", 4);
+        append32(smf, 6);
+        append16(smf, m_format);
+        append16(smf, m_tracks);
+        append16(smf, m_division);
+        smf.append(m_body);
+        return smf;
+    }
+
+    /**
+     * Generates a pseudo random format 1 song: a conductor track with
+     * tempo changes, and note/controller tracks. The same seed always
+     * produces the same bytes.
+     */
+    static QByteArray randomSong(quint32 seed, int tracks, int events,
+                                 int division = 384)
+    {
+        SmfBuilder smf(1, division);
+        SmfTrack conductor;
+        conductor.text(0, 0x03, "Generated");
+        for (int i = 0; i < events / 64 + 1; ++i) {
+            conductor.tempo(i == 0 ? 0 : division * 4, 300000 + next(seed) % 700000);
+        }
+        conductor.endOfTrack();
+        smf.addTrack(conductor);
+        for (int t = 1; t < tracks; ++t) {
+            SmfTrack track;
+            int chan = (t - 1) % 16;
+            track.program(0, chan, next(seed) % 128);
+            for (int i = 0; i < events; ++i) {
+                quint32 r = next(seed);
+                int note = 24 + r % 80;
+                switch ((r >> 8) % 8) {
+                case 0:
+                    track.controller(r >> 12 & 0x3f, chan, 7, r >> 16);
+                    break;
+                case 1:
+                    track.pitchBend(r >> 12 & 0x3f, chan, r >> 16 & 0x3fff);
+                    break;
+                case 2:
+                    track.text(r >> 12 & 0x3f, 0x05, "la ");
+                    break;
+                default:
+                    track.noteOn(r >> 12 & 0x3f, chan, note, 1 + (r >> 16) % 127);
+                    track.noteOff(r >> 20 & 0xff, chan, note);
+                }
+            }
+            track.endOfTrack();
+            smf.addTrack(track);
+        }
+        return smf.build();
+    }
+
+private:
+    static quint32 next(quint32& seed)
+    {
+        seed = seed * 1103515245u + 12345u;
+        return seed >> 1;
+    }
+
+    static void append32(QByteArray& a, quint32 v)
+    {
+        a.append(char(v >> 24));
+        a.append(char(v >> 16));
+        a.append(char(v >> 8));
+        a.append(char(v));
+    }
+
+    static void append16(QByteArray& a, quint16 v)
+    {
+        a.append(char(v >> 8));
+        a.append(char(v));
+    }
+
+    int m_format;
+    int m_division;
+    int m_tracks;
+    QByteArray m_body;
+};
+
+#endif // SMFBUILDER_H
@@ -0,0 +1,124 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "songcache.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <sys/time.h>
+
+using namespace KMid;
+
+/**
+ * Writes a file and sets its modification time, relative to now.
+ */
+static bool writeFile(const QString& name, const QByteArray& data,
+                      int secondsAgo, int usec = 0)
+{
+    QFile file(name);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+        return false;
+    file.close();
+    struct timeval times[2];
+    times[0].tv_sec = times[1].tv_sec = QDateTime::currentDateTime().toTime_t() - secondsAgo;
+    times[0].tv_usec = times[1].tv_usec = usec;
+    return ::utimes(QFile::encodeName(name).constData(), times) == 0;
+}
+
+class SongCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void fileKey();
+    void recentFileKey();
+    void expire();
+};
+
+/**
+ * Changes of a file within the same second, or its replacement by another
+ * file of the same size and time, change its key.
+ */
+void SongCacheTest::fileKey()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString name = QDir(dir.path()).filePath("song.mid");
+    QVERIFY(writeFile(name, QByteArray(100, 'a'), 60, 100000));
+    QByteArray key = SongCache::fileKey(name);
+    QVERIFY(!key.isEmpty());
+    QCOMPARE(SongCache::fileKey(name), key);
+
+    QVERIFY(writeFile(name, QByteArray(100, 'b'), 60, 600000));
+    QByteArray modified = SongCache::fileKey(name);
+    QVERIFY(!modified.isEmpty());
+    QVERIFY(modified != key);
+
+    QString other = QDir(dir.path()).filePath("other.mid");
+    QVERIFY(writeFile(other, QByteArray(100, 'c'), 60, 600000));
+    QVERIFY(QFile::remove(name));
+    QVERIFY(QFile::rename(other, name));
+    QVERIFY(SongCache::fileKey(name) != modified);
+}
+
+/**
+ * A file modified just now gets no key, so its contents are hashed.
+ */
+void SongCacheTest::recentFileKey()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString name = QDir(dir.path()).filePath("song.mid");
+    QVERIFY(writeFile(name, QByteArray(100, 'a'), 0));
+    QVERIFY(SongCache::fileKey(name).isEmpty());
+}
+
+/**
+ * Storing a song beyond the maximum size removes the least recently used
+ * songs, and the temporary files are not counted.
+ */
+void SongCacheTest::expire()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    SongCache cache(dir.path());
+    QCOMPARE(cache.maximumSize(), SongCache::DEFAULT_MAXIMUM_SIZE);
+    cache.setMaximumSize(2500);
+    QVERIFY(writeFile(cache.fileName("a"), QByteArray(1000, 'a'), 40));
+    QVERIFY(writeFile(cache.fileName("b"), QByteArray(1000, 'b'), 10));
+    QVERIFY(writeFile(cache.fileName("c"), QByteArray(1000, 'c'), 30));
+    QVERIFY(writeFile(cache.temporaryFileName("d"), QByteArray(1000, 'd'), 20));
+    QVERIFY(cache.storeFile("d", cache.temporaryFileName("d")));
+    QVERIFY(!QFile::exists(cache.fileName("a")));
+    QVERIFY(QFile::exists(cache.fileName("b")));
+    QVERIFY(!QFile::exists(cache.fileName("c")));
+    QVERIFY(QFile::exists(cache.fileName("d")));
+
+    cache.setMaximumSize(0);
+    QVERIFY(writeFile(cache.fileName("e"), QByteArray(5000, 'e'), 5));
+    cache.expire();
+    QCOMPARE(QDir(dir.path()).entryList(QDir::Files).count(), 3);
+}
+
+QTEST_MAIN(SongCacheTest)
+
+#include "songcachetest.moc"
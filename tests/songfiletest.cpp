@@ -0,0 +1,287 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "song.h"
+#include "songfile.h"
+
+#include <cstddef>
+#include <QBuffer>
+#include <QTemporaryFile>
+#include <QtTest>
+
+using namespace KMid;
+
+class SongFileTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void roundTrip();
+    void indexOf();
+    void corruptHeader_data();
+    void corruptHeader();
+    void damagedEventData();
+    void open();
+
+private:
+    static void buildSong(Song& song, int count);
+    static QByteArray eventData(const EventList& events, int i);
+    QByteArray m_file;
+    Song m_song;
+};
+
+/**
+ * Builds a song with notes, controllers, programs and SysEx messages of
+ * several sizes, and some meta data.
+ */
+void SongFileTest::buildSong(Song& song, int count)
+{
+    quint32 seed = 11;
+    snd_seq_tick_time_t tick = 0;
+    song.setHeader(1, 3, 384);
+    song.setInitialTempo(600000);
+    song.setBarCount(12);
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        quint32 r = seed >> 1;
+        tick += (r >> 4) % 40;
+        int chan = (r >> 8) % 16;
+        switch (r % 6) {
+        case 0: {
+                QByteArray data((r >> 12) % 200 + 2, char(chan));
+                data[0] = char(0xf0);
+                data[data.size() - 1] = char(0xf7);
+                SysExEvent ev(data);
+                ev.scheduleTick(0, tick, false);
+                song.append(ev.getHandle());
+            }
+            break;
+        case 1: {
+                ProgramChangeEvent ev(chan, (r >> 12) % 128);
+                ev.scheduleTick(0, tick, false);
+                song.append(ev.getHandle());
+            }
+            break;
+        case 2: {
+                ControllerEvent ev(chan, (r >> 12) % 120, (r >> 20) % 128);
+                ev.scheduleTick(0, tick, false);
+                song.append(ev.getHandle());
+            }
+            break;
+        default: {
+                NoteOnEvent ev(chan, (r >> 12) % 128, 1 + (r >> 20) % 127);
+                ev.scheduleTick(0, tick, false);
+                song.append(ev.getHandle());
+            }
+            break;
+        }
+    }
+    song.addMetaData(Song::Lyric, "Hel", 10);
+    song.addMetaData(Song::Lyric, "lo", 20);
+    song.addMetaData(Song::TrackName, "Melody", 0);
+    song.updateChaseStates();
+}
+
+QByteArray SongFileTest::eventData(const EventList& events, int i)
+{
+    snd_seq_event_t ev;
+    events.copyEvent(i, &ev);
+    if (!snd_seq_ev_is_variable(&ev))
+        return QByteArray();
+    return QByteArray(static_cast<const char*>(ev.data.ext.ptr), ev.data.ext.len);
+}
+
+void SongFileTest::initTestCase()
+{
+    buildSong(m_song, 3 * Song::CHASE_INTERVAL + 517);
+    QBuffer buffer(&m_file);
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(m_song.save(buffer));
+    QVERIFY(m_file.size() > int(sizeof(SongFileHeader)));
+}
+
+/**
+ * A song written and read back has the same events, variable length
+ * data, chase states and properties.
+ */
+void SongFileTest::roundTrip()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(m_file);
+    file.close();
+    Song song;
+    QVERIFY(song.open(file.fileName()));
+    QVERIFY(song.isMapped());
+    QCOMPARE(song.count(), m_song.count());
+    for (int i = 0; i < song.count(); ++i) {
+        const snd_seq_event_t& a = song.at(i);
+        const snd_seq_event_t& b = m_song.at(i);
+        QCOMPARE(a.type, b.type);
+        QCOMPARE(a.time.tick, b.time.tick);
+        if (snd_seq_ev_is_variable(&a))
+            QCOMPARE(eventData(song, i), eventData(m_song, i));
+        else
+            QVERIFY(memcmp(&a.data, &b.data, sizeof(a.data)) == 0);
+    }
+    for (int i = 0; i <= song.count(); i += Song::CHASE_INTERVAL / 3) {
+        ChaseState a = song.getChaseState(i);
+        ChaseState b = m_song.getChaseState(i);
+        for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            QCOMPARE(a.channel(chan).program, b.channel(chan).program);
+            for (int ctl = 0; ctl < 128; ++ctl)
+                QCOMPARE(a.channel(chan).controller[ctl], b.channel(chan).controller[ctl]);
+        }
+    }
+    QCOMPARE(song.getFormat(), 1);
+    QCOMPARE(song.getTracks(), 3);
+    QCOMPARE(song.getDivision(), 384);
+    QCOMPARE(song.getInitialTempo(), 600000);
+    QCOMPARE(song.getBarCount(), 12);
+    QCOMPARE(song.getText(Song::Lyric), m_song.getText(Song::Lyric));
+    QCOMPARE(song.getText(Song::TrackName), m_song.getText(Song::TrackName));
+}
+
+/**
+ * The two level search of the song file finds the same events as the
+ * search over the events in memory.
+ */
+void SongFileTest::indexOf()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(m_file);
+    file.close();
+    SongFileReader reader;
+    QVERIFY(reader.open(file.fileName()));
+    QCOMPARE(reader.eventCount(), m_song.count());
+    snd_seq_tick_time_t last = m_song.getLastTick();
+    for (snd_seq_tick_time_t tick = 0; tick <= last + 1; ++tick)
+        QCOMPARE(reader.indexOf(tick), m_song.indexOf(tick));
+}
+
+void SongFileTest::corruptHeader_data()
+{
+    QTest::addColumn<int>("offset");
+    QTest::addColumn<quint64>("value");
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("truncate");
+
+    QTest::newRow("magic") << int(offsetof(SongFileHeader, magic)) << quint64(0x46534d4c) << 4 << 0;
+    QTest::newRow("version") << int(offsetof(SongFileHeader, version))
+                             << quint64(SongFileHeader::VERSION + 1) << 4 << 0;
+    QTest::newRow("byte order") << int(offsetof(SongFileHeader, byteOrder)) << quint64(0x04030201) << 4 << 0;
+    QTest::newRow("event size") << int(offsetof(SongFileHeader, eventSize)) << quint64(24) << 4 << 0;
+    QTest::newRow("chase size") << int(offsetof(SongFileHeader, chaseSize)) << quint64(1) << 4 << 0;
+    QTest::newRow("events offset") << int(offsetof(SongFileHeader, eventsOffset)) << quint64(4) << 8 << 0;
+    QTest::newRow("event count") << int(offsetof(SongFileHeader, eventCount))
+                                 << quint64(Q_UINT64_C(0x1000000000)) << 8 << 0;
+    QTest::newRow("data size") << int(offsetof(SongFileHeader, dataSize)) << quint64(1 << 30) << 8 << 0;
+    QTest::newRow("index count") << int(offsetof(SongFileHeader, indexCount)) << quint64(1) << 8 << 0;
+    QTest::newRow("meta offset") << int(offsetof(SongFileHeader, metaOffset))
+                                 << quint64(Q_UINT64_C(0xfffffffffffffff8)) << 8 << 0;
+    QTest::newRow("meta size") << int(offsetof(SongFileHeader, metaSize)) << quint64(4) << 8 << 0;
+    QTest::newRow("truncated") << 0 << quint64(0) << 0 << 16;
+    QTest::newRow("header only") << 0 << quint64(0) << 0 << -int(sizeof(SongFileHeader));
+    QTest::newRow("empty") << 0 << quint64(0) << 0 << -1;
+}
+
+/**
+ * Damaged or foreign song files are rejected when they are opened.
+ */
+void SongFileTest::corruptHeader()
+{
+    QFETCH(int, offset);
+    QFETCH(quint64, value);
+    QFETCH(int, size);
+    QFETCH(int, truncate);
+    QByteArray data = m_file;
+    if (size == 4) {
+        quint32 v = value;
+        memcpy(data.data() + offset, &v, 4);
+    } else if (size == 8) {
+        memcpy(data.data() + offset, &value, 8);
+    }
+    if (truncate > 0)
+        data.chop(truncate);
+    else if (truncate == -1)
+        data.clear();
+    else if (truncate < 0)
+        data.truncate(-truncate);
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(data);
+    file.close();
+    Song song;
+    QVERIFY(!song.open(file.fileName()));
+    QCOMPARE(song.count(), 0);
+}
+
+/**
+ * The data of a variable length event pointing outside of the data
+ * section is ignored instead of read out of bounds.
+ */
+void SongFileTest::damagedEventData()
+{
+    int index = -1;
+    for (int i = 0; i < m_song.count() && index < 0; ++i)
+        if (snd_seq_ev_is_variable(&m_song.at(i)))
+            index = i;
+    QVERIFY(index >= 0);
+    QByteArray data = m_file;
+    SongFileHeader header;
+    memcpy(&header, data.constData(), sizeof(header));
+    snd_seq_event_t *ev = reinterpret_cast<snd_seq_event_t*>(
+            data.data() + header.eventsOffset + index * sizeof(snd_seq_event_t));
+    ev->data.ext.ptr = reinterpret_cast<void*>(quintptr(header.dataSize - 1));
+    ev->data.ext.len = 100;
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(data);
+    file.close();
+    Song song;
+    QVERIFY(song.open(file.fileName()));
+    QCOMPARE(eventData(song, index), QByteArray());
+}
+
+/**
+ * Benchmark of opening a song file and reading all its events.
+ */
+void SongFileTest::open()
+{
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(m_file);
+    file.close();
+    int types = 0;
+    QBENCHMARK {
+        Song song;
+        QVERIFY(song.open(file.fileName()));
+        for (int i = 0; i < song.count(); ++i)
+            types += song.getType(i);
+    }
+    QVERIFY(types > 0);
+}
+
+QTEST_MAIN(SongFileTest)
+
+#include "songfiletest.moc"
@@ -0,0 +1,367 @@
+/*
+    KMid2 MIDI/Karaoke Player
+    Copyright (C) 2009-2010 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "song.h"
+#include "songloader.h"
+
+#include <QTextCodec>
+#include <QtTest>
+
+using namespace KMid;
+
+/**
+ * Generates a sorted list of channel events, with many events sharing
+ * the same tick and some long gaps. The same seed always produces the
+ * same events.
+ */
+static void generateEvents(EventList& events, quint32 seed, int count)
+{
+    snd_seq_tick_time_t tick = 0;
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        quint32 r = seed >> 1;
+        if (r % 4 == 0)
+            tick += (r >> 4) % ((r % 64 == 0) ? 5000 : 50);
+        snd_seq_event_t ev;
+        snd_seq_ev_clear(&ev);
+        ev.type = SND_SEQ_EVENT_NOTEON;
+        ev.time.tick = tick;
+        ev.data.note.channel = (r >> 8) % 16;
+        ev.data.note.note = (r >> 12) % 128;
+        ev.data.note.velocity = 1 + (r >> 20) % 127;
+        events.append(&ev);
+    }
+}
+
+/**
+ * Generates channel messages changing the chased state: programs, bank
+ * selects, controllers, registered and non registered parameters,
+ * controller resets, pitch bend and channel pressure.
+ */
+static void generateChannelEvents(EventList& events, quint32 seed, int count)
+{
+    static const int controllers[] = {
+        MIDI_CTL_MSB_BANK, MIDI_CTL_LSB_BANK, MIDI_CTL_MSB_MODWHEEL,
+        MIDI_CTL_MSB_MAIN_VOLUME, MIDI_CTL_MSB_PAN, MIDI_CTL_SUSTAIN,
+        MIDI_CTL_RESET_CONTROLLERS, MIDI_CTL_REGIST_PARM_NUM_MSB,
+        MIDI_CTL_REGIST_PARM_NUM_LSB, MIDI_CTL_NONREG_PARM_NUM_MSB,
+        MIDI_CTL_NONREG_PARM_NUM_LSB, MIDI_CTL_MSB_DATA_ENTRY,
+        MIDI_CTL_LSB_DATA_ENTRY
+    };
+    static const int ncontrollers = sizeof(controllers) / sizeof(int);
+    for (int i = 0; i < count; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        quint32 r = seed >> 1;
+        snd_seq_event_t ev;
+        snd_seq_ev_clear(&ev);
+        ev.time.tick = i;
+        ev.data.control.channel = (r >> 4) % 4;
+        switch (r % 8) {
+        case 0:
+            ev.type = SND_SEQ_EVENT_PGMCHANGE;
+            ev.data.control.value = (r >> 8) % 128;
+            break;
+        case 1:
+            ev.type = SND_SEQ_EVENT_PITCHBEND;
+            ev.data.control.value = int((r >> 8) % 16384) - 8192;
+            break;
+        case 2:
+            ev.type = SND_SEQ_EVENT_CHANPRESS;
+            ev.data.control.value = (r >> 8) % 128;
+            break;
+        case 3:
+            ev.type = SND_SEQ_EVENT_NOTEON;
+            ev.data.note.note = (r >> 8) % 128;
+            ev.data.note.velocity = 100;
+            break;
+        default:
+            ev.type = SND_SEQ_EVENT_CONTROLLER;
+            ev.data.control.param = controllers[(r >> 8) % ncontrollers];
+            // small parameter numbers select the chased RPNs
+            ev.data.control.value = (r >> 16) % ((r & 0x1000) ? 128 : 6);
+            break;
+        }
+        events.append(&ev);
+    }
+}
+
+static bool sameChannel(const ChaseState::Channel& a, const ChaseState::Channel& b)
+{
+    if (a.program != b.program || a.pressure != b.pressure ||
+        a.pitchBend != b.pitchBend || a.nrpnSelected != b.nrpnSelected)
+        return false;
+    for (int ctl = 0; ctl < 128; ++ctl)
+        if (a.controller[ctl] != b.controller[ctl])
+            return false;
+    for (int i = 0; i < ChaseState::RPN_COUNT; ++i)
+        if (a.rpn[i][0] != b.rpn[i][0] || a.rpn[i][1] != b.rpn[i][1])
+            return false;
+    return true;
+}
+
+static int linearIndexOf(const EventList& events, snd_seq_tick_time_t tick)
+{
+    int i = 0;
+    while (i < events.count() && events.getTick(i) < tick)
+        ++i;
+    return i;
+}
+
+class SongTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void indexOf_data();
+    void indexOf();
+    void seek_data();
+    void seek();
+    void chaseStateAfterSeek();
+    void chaseStateEvents();
+    void textTypes();
+    void ticksWithin();
+    void lyricsMetaData_data();
+    void lyricsMetaData();
+};
+
+void SongTest::indexOf_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("empty") << 0;
+    QTest::newRow("one") << 1;
+    QTest::newRow("small") << 17;
+    QTest::newRow("large") << 5000;
+}
+
+/**
+ * The binary search finds the same event as a linear scan, around the
+ * tick of every event and past the end of the song.
+ */
+void SongTest::indexOf()
+{
+    QFETCH(int, count);
+    EventList events;
+    generateEvents(events, count + 1, count);
+    QCOMPARE(events.count(), count);
+    QCOMPARE(events.indexOf(0), 0);
+    for (int i = 0; i < count; ++i) {
+        snd_seq_tick_time_t tick = events.getTick(i);
+        if (tick > 0)
+            QCOMPARE(events.indexOf(tick - 1), linearIndexOf(events, tick - 1));
+        QCOMPARE(events.indexOf(tick), linearIndexOf(events, tick));
+        QCOMPARE(events.indexOf(tick + 1), linearIndexOf(events, tick + 1));
+    }
+    if (count > 0)
+        QCOMPARE(events.indexOf(events.getLastTick() + 2), count);
+}
+
+void SongTest::seek_data()
+{
+    QTest::addColumn<bool>("binary");
+    QTest::newRow("linear") << false;
+    QTest::newRow("binary") << true;
+}
+
+/**
+ * Benchmark of seeking to a thousand positions of a large song.
+ */
+void SongTest::seek()
+{
+    QFETCH(bool, binary);
+    EventList events;
+    generateEvents(events, 1, 50000);
+    snd_seq_tick_time_t last = events.getLastTick();
+    qint64 found = 0;
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            snd_seq_tick_time_t tick = quint64(last) * i / 1000;
+            found += binary ? events.indexOf(tick) : linearIndexOf(events, tick);
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+/**
+ * The state found from the nearest snapshot is the same as the state
+ * computed from the beginning of the song.
+ */
+void SongTest::chaseStateAfterSeek()
+{
+    const int count = 3 * Song::CHASE_INTERVAL + 100;
+    Song song;
+    generateChannelEvents(song, 5, count);
+    song.updateChaseStates();
+    ChaseState linear;
+    for (int index = 0; index <= count; ++index) {
+        if (index % 97 == 0 || index % Song::CHASE_INTERVAL <= 1 || index == count) {
+            ChaseState state = song.getChaseState(index);
+            for (int chan = 0; chan < MIDI_CHANNELS; ++chan)
+                QVERIFY2(sameChannel(state.channel(chan), linear.channel(chan)),
+                         qPrintable(QString("index %1 channel %2").arg(index).arg(chan)));
+        }
+        if (index < count)
+            linear.update(song.at(index));
+    }
+}
+
+/**
+ * Replaying the events of a chase state restores the state of the
+ * channels: programs, controllers, registered parameters, pitch bend
+ * and pressure.
+ */
+void SongTest::chaseStateEvents()
+{
+    Song song;
+    generateChannelEvents(song, 9, 2000);
+    song.updateChaseStates();
+    for (int index = 0; index <= song.count(); index += 211) {
+        ChaseState state = song.getChaseState(index);
+        EventList events;
+        state.getEvents(events);
+        ChaseState replayed;
+        for (int i = 0; i < events.count(); ++i)
+            replayed.update(events.at(i));
+        for (int chan = 0; chan < MIDI_CHANNELS; ++chan) {
+            const ChaseState::Channel& a = state.channel(chan);
+            const ChaseState::Channel& b = replayed.channel(chan);
+            QCOMPARE(b.program, a.program);
+            QCOMPARE(b.pitchBend, a.pitchBend);
+            QCOMPARE(b.pressure, qint8(a.pressure > 0 ? a.pressure : -1));
+            // the parameter kind only matters while a parameter is selected
+            if (a.controller[MIDI_CTL_REGIST_PARM_NUM_MSB] >= 0 ||
+                a.controller[MIDI_CTL_REGIST_PARM_NUM_LSB] >= 0 ||
+                a.controller[MIDI_CTL_NONREG_PARM_NUM_MSB] >= 0 ||
+                a.controller[MIDI_CTL_NONREG_PARM_NUM_LSB] >= 0)
+                QCOMPARE(b.nrpnSelected, a.nrpnSelected);
+            for (int ctl = 0; ctl < MIDI_CTL_ALL_SOUNDS_OFF; ++ctl) {
+                if (ctl == MIDI_CTL_REGIST_PARM_NUM_MSB || ctl == MIDI_CTL_REGIST_PARM_NUM_LSB ||
+                    ctl == MIDI_CTL_NONREG_PARM_NUM_MSB || ctl == MIDI_CTL_NONREG_PARM_NUM_LSB)
+                    continue;
+                QCOMPARE(b.controller[ctl], a.controller[ctl]);
+            }
+            for (int i = 0; i < ChaseState::RPN_COUNT; ++i) {
+                QCOMPARE(b.rpn[i][0], a.rpn[i][0]);
+                QCOMPARE(b.rpn[i][1], a.rpn[i][1]);
+            }
+        }
+    }
+}
+
+static QByteArray properties(const Song& song)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    song.writeProperties(stream);
+    return data;
+}
+
+/**
+ * Decoding the lyrics and detecting their encoding does not add empty
+ * text types to the song, which would be stored with its properties.
+ */
+void SongTest::textTypes()
+{
+    Song song;
+    song.setHeader(0, 1, 120);
+    QByteArray empty = properties(song);
+    song.setTextCodec(QTextCodec::codecForName("UTF-8"));
+    song.detectTextEncoding();
+    QCOMPARE(properties(song), empty);
+    QVERIFY(song.getLyricsText().isEmpty());
+
+    song.addMetaData(Song::Lyric, "Hel", 10);
+    song.addMetaData(Song::Lyric, "lo", 20);
+    song.detectTextEncoding();
+    QByteArray lyrics = properties(song);
+    song.setTextCodec(QTextCodec::codecForName("ISO-8859-1"));
+    song.detectTextEncoding();
+    QCOMPARE(song.getLyricsText(), QString("Hello"));
+    QCOMPARE(properties(song), lyrics);
+
+    Song copy;
+    QDataStream stream(lyrics);
+    QVERIFY(copy.readProperties(stream));
+    QCOMPARE(properties(copy), lyrics);
+}
+
+/**
+ * The batch window in ticks lasts no longer than the given time at the
+ * fastest tempo of the song, or with the fixed SMPTE tick duration.
+ */
+void SongTest::ticksWithin()
+{
+    Song song;
+    song.setHeader(1, 2, 384);
+    song.setInitialTempo(500000);
+    QCOMPARE(song.ticksWithin(0), 0u);
+    QCOMPARE(song.ticksWithin(20), 15u);
+    QCOMPARE(song.ticksWithin(0.01), 1u);
+
+    QSmfTempoMap tempoMap;
+    tempoMap.setDivision(384);
+    tempoMap.addTempo(600000, 0);
+    tempoMap.addTempo(250000, 1000);
+    tempoMap.addTempo(800000, 2000);
+    song.setTempoMap(tempoMap);
+    song.setInitialTempo(600000);
+    QCOMPARE(song.ticksWithin(20), 30u);
+
+    // 25 frames per second, 40 ticks per frame
+    song.setHeader(1, 2, 0xe728);
+    QCOMPARE(song.ticksWithin(20), 20u);
+    QCOMPARE(song.ticksWithin(500), 500u);
+}
+
+void SongTest::lyricsMetaData_data()
+{
+    QTest::addColumn<bool>("cold");
+    QTest::newRow("cold cache") << true;
+    QTest::newRow("warm cache") << false;
+}
+
+/**
+ * Benchmark of the lyrics of a karaoke file, as returned by
+ * metaData("SMF_LYRICS"), decoded again after every change of the text
+ * codec or taken from the cache of decoded texts.
+ */
+void SongTest::lyricsMetaData()
+{
+    QFETCH(bool, cold);
+    SongLoader loader(0, 0, 0);
+    QVERIFY(loader.loadFile("twinkle.kar", KMID_EXAMPLES_DIR "/twinkle.kar"));
+    Song song;
+    loader.takeSong(song);
+    QTextCodec *codec = QTextCodec::codecForName("ISO-8859-1");
+    song.setTextCodec(codec);
+    const int count = song.getText(Song::Lyric).count();
+    QVERIFY(count > 0);
+    int total = 0;
+    int calls = 0;
+    QBENCHMARK {
+        if (cold)
+            song.setTextCodec(codec);
+        total += song.getText(Song::Lyric).count();
+        ++calls;
+    }
+    QCOMPARE(total, count * calls);
+}
+
+QTEST_MAIN(SongTest)
+
+#include "songtest.moc"